@@ -0,0 +1,55 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+  Annotation API of Afterompt. Applications mark their phases and record
+  counters in the timeline of the OpenMP events of the calling thread. Link
+  with -lafterompt-annotate, whose no-op stubs are replaced by the library
+  when it is preloaded.
+*/
+
+#ifndef AFTEROMPT_ANNOTATE_H
+#define AFTEROMPT_ANNOTATE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Register a label for phases and counters and return its id. The same name
+  always gets the same id. Returns 0 if the tool is not loaded. Registration
+  takes a lock, so labels should be registered once, e.g. at startup.
+*/
+uint32_t afterompt_label(const char* name);
+
+/* Begin a phase of the calling thread, phases may be nested */
+void afterompt_phase_begin(uint32_t label);
+
+/* End the innermost phase of the calling thread */
+void afterompt_phase_end(void);
+
+/* Record the value of a counter in the timeline of the calling thread */
+void afterompt_counter(uint32_t label, int64_t value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
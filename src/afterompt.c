@@ -23,21 +23,29 @@
 #include <pthread.h>
 #include <sched.h>
 #include <stdio.h>
-
-#include <aftermath/core/on_disk_write_to_buffer.h>
+#include <unistd.h>
 
 #include <aftermath/trace/tsc.h>
 
+#include "compensate.h"
+#include "control.h"
+#include "filter.h"
+#include "governor.h"
+#include "lockprof.h"
+#include "profile.h"
 #include "trace.h"
+#include "writer.h"
 
+#include "afterompt-annotate.h"
 #include "afterompt.h"
 
-/* Time reference */
-static struct am_timestamp_reference am_ompt_tsref;
-
 /* Pthread key to access thread tracing data */
 static pthread_key_t am_thread_data_key;
 
+/* Set while the key is valid, since the annotation API may be called before
+   the tool is initialized and after it is finalized */
+static int am_thread_data_key_valid;
+
 ompt_set_callback_t am_set_callback;
 
 ompt_start_tool_result_t* ompt_start_tool(unsigned int omp_version,
@@ -91,12 +99,19 @@ int ompt_initialize(ompt_function_lookup_t lookup, int num, ompt_data_t* data) {
 
   REGISTER_CALLBACK(thread_begin);
   REGISTER_CALLBACK(thread_end);
+  REGISTER_CALLBACK(control_tool);
 
 #ifdef TRACE_LOOPS
 #ifdef ALLOW_EXPERIMENTAL
   REGISTER_CALLBACK(loop_begin);
   REGISTER_CALLBACK(loop_end);
   REGISTER_CALLBACK(loop_chunk);
+#elif defined(TRACE_DISPATCH_LOOPS)
+  REGISTER_CALLBACK(dispatch);
+#ifndef TRACE_OTHERS
+  /* Loops begin and end with their work regions */
+  REGISTER_CALLBACK(work);
+#endif
 #endif
 #endif
 
@@ -128,45 +143,171 @@ int ompt_initialize(ompt_function_lookup_t lookup, int num, ompt_data_t* data) {
 
   am_ompt_init_trace();
 
+  if (am_ompt_lockprof_init()) {
+    fprintf(stderr, "Afterompt: Failed to set up lock profiling.\n"
+                    "           Continuing....\n");
+  }
+
+  if (am_ompt_taskprof_init()) {
+    fprintf(stderr, "Afterompt: Failed to set up task profiling.\n"
+                    "           Continuing....\n");
+  }
+
+  if (am_ompt_profile_init()) {
+    fprintf(stderr, "Afterompt: Failed to set up construct profiling.\n"
+                    "           Continuing....\n");
+  }
+
+  if (am_ompt_governor_init()) {
+    fprintf(stderr, "Afterompt: Failed to set up the overhead governor.\n"
+                    "           Continuing....\n");
+  } else if (am_ompt_governor_enabled) {
+    am_ompt_use_event_type(AM_OMPT_EVENT_GOVERNOR);
+  }
+
+  if (am_ompt_sampling_init(lookup)) {
+    fprintf(stderr, "Afterompt: Failed to set up sampling.\n"
+                    "           Continuing....\n");
+  } else if (am_ompt_sampling_enabled) {
+    am_ompt_use_event_type(AM_OMPT_EVENT_SAMPLE);
+  }
+
+  if (am_ompt_telemetry_init()) {
+    fprintf(stderr, "Afterompt: Failed to set up telemetry.\n"
+                    "           Continuing....\n");
+  }
+
+  if (am_ompt_occupancy_init()) {
+    fprintf(stderr, "Afterompt: Failed to set up occupancy bins.\n"
+                    "           Continuing....\n");
+  } else if (am_ompt_occupancy_enabled) {
+    am_ompt_use_event_type(AM_OMPT_EVENT_OCCUPANCY);
+  }
+
   if (pthread_key_create(&am_thread_data_key, NULL)) {
     fprintf(stderr, "Afterompt: Failed to create thread data key.\n");
     /* Zero means failure */
     return 0;
   }
 
+  __atomic_store_n(&am_thread_data_key_valid, 1, __ATOMIC_RELEASE);
+
+  /* Calibrate before tracing control may pause tracing */
+  if (am_ompt_compensate_init(am_thread_data_key)) {
+    fprintf(stderr, "Afterompt: Failed to calibrate overhead compensation.\n"
+                    "           Continuing....\n");
+  }
+
+  /* After calibration, which runs the callbacks without code locations */
+  if (am_ompt_filter_init()) {
+    fprintf(stderr, "Afterompt: Failed to set up the code filter.\n"
+                    "           Continuing....\n");
+  }
+
+  if (am_ompt_control_init()) {
+    fprintf(stderr, "Afterompt: Failed to set up tracing control.\n"
+                    "           Continuing....\n");
+  }
+
   /* In this context non-zero means success */
   return 1;
 }
 
 void ompt_finalize(ompt_data_t* data) {
+  int status;
+
+  __atomic_store_n(&am_thread_data_key_valid, 0, __ATOMIC_RELEASE);
+
   if (pthread_key_delete(am_thread_data_key)) {
     fprintf(stderr, "Afterompt: Failed to delete thread data key.\n"
                     "           Continuing....\n");
   }
 
   am_ompt_exit_trace();
+  am_ompt_lockprof_report();
+  am_ompt_taskprof_report();
+  am_ompt_telemetry_exit();
+
+  /* Finalization runs while the process exits, so the exit status can only
+     be replaced by leaving immediately */
+  if ((status = am_ompt_profile_report())) {
+    fflush(NULL);
+    _exit(status);
+  }
+}
+
+/* Telemetry state of a thread for each kind of state on the stack */
+static const enum am_ompt_telemetry_state
+    am_ompt_telemetry_state_by_kind[AM_OMPT_NUM_STATE_KINDS] = {
+        [AM_OMPT_STATE_THREAD] = AM_OMPT_TELEMETRY_IDLE,
+        [AM_OMPT_STATE_PARALLEL] = AM_OMPT_TELEMETRY_WORK,
+        [AM_OMPT_STATE_IMPLICIT_TASK] = AM_OMPT_TELEMETRY_WORK,
+        [AM_OMPT_STATE_SYNC_REGION_WAIT] = AM_OMPT_TELEMETRY_BARRIER,
+        [AM_OMPT_STATE_WORK] = AM_OMPT_TELEMETRY_WORK,
+        [AM_OMPT_STATE_MASTER] = AM_OMPT_TELEMETRY_WORK,
+        [AM_OMPT_STATE_SYNC_REGION] = AM_OMPT_TELEMETRY_WORK,
+        [AM_OMPT_STATE_NEST_LOCK] = AM_OMPT_TELEMETRY_WORK,
+        [AM_OMPT_STATE_LOOP] = AM_OMPT_TELEMETRY_WORK};
+
+/* Publish the state at the top of the state stack to the telemetry slot */
+static inline void am_ompt_telemetry_sync(struct am_ompt_thread_data* td) {
+  enum am_ompt_telemetry_state state = AM_OMPT_TELEMETRY_IDLE;
+
+  if (td->state_stack.top > 0) {
+    state = am_ompt_telemetry_state_by_kind
+        [td->state_stack.stack[td->state_stack.top - 1].kind];
+  }
+
+  /* Work inside an explicit task is accounted as task execution */
+  if (state == AM_OMPT_TELEMETRY_WORK && td->in_explicit_task)
+    state = AM_OMPT_TELEMETRY_TASK;
+
+  am_ompt_telemetry_set_state(td->telemetry, state, am_ompt_now());
 }
 
+/* Occupancy state of a thread for each kind of state on the stack */
+static const enum am_ompt_occupancy_state
+    am_ompt_occupancy_state_by_kind[AM_OMPT_NUM_STATE_KINDS] = {
+        [AM_OMPT_STATE_THREAD] = AM_OMPT_OCCUPANCY_IDLE,
+        [AM_OMPT_STATE_PARALLEL] = AM_OMPT_OCCUPANCY_PARALLEL,
+        [AM_OMPT_STATE_IMPLICIT_TASK] = AM_OMPT_OCCUPANCY_IMPLICIT_TASK,
+        [AM_OMPT_STATE_SYNC_REGION_WAIT] = AM_OMPT_OCCUPANCY_SYNC_REGION_WAIT,
+        [AM_OMPT_STATE_WORK] = AM_OMPT_OCCUPANCY_WORK,
+        [AM_OMPT_STATE_MASTER] = AM_OMPT_OCCUPANCY_MASTER,
+        [AM_OMPT_STATE_SYNC_REGION] = AM_OMPT_OCCUPANCY_SYNC_REGION,
+        [AM_OMPT_STATE_NEST_LOCK] = AM_OMPT_OCCUPANCY_NEST_LOCK,
+        [AM_OMPT_STATE_LOOP] = AM_OMPT_OCCUPANCY_LOOP};
+
 /*
-  Returns the current timestamp normalized to the reference. If the result
-  would be negative, the process is aborted.
+  Switch the occupancy bins to the state at the top of the state stack.
+  States entered before the explicit task executed now are accounted as
+  execution of the task. Bins only cover the traced time, so nothing is done
+  while tracing is paused, unless only the bins are recorded.
 */
-static inline am_timestamp_t am_ompt_now(void) {
-  am_timestamp_t now;
+static inline void am_ompt_occupancy_sync(struct am_ompt_thread_data* td) {
+  enum am_ompt_occupancy_state state = AM_OMPT_OCCUPANCY_IDLE;
+  uint32_t top = td->state_stack.top;
 
-  if (am_timestamp_reference_now(&am_ompt_tsref, &now)) {
-    fprintf(
-        stderr,
-        "Afterompt: Local timestamp normalized to reference is negative.\n");
-    // TODO: Dying may be too radical.
-    exit(1);
+  if (!am_ompt_tracing_enabled() && !am_ompt_occupancy_only) return;
+
+  if (top > 0) {
+    state =
+        am_ompt_occupancy_state_by_kind[td->state_stack.stack[top - 1].kind];
   }
 
-  return now;
+  if (td->in_explicit_task && top <= td->occupancy->task_depth)
+    state = AM_OMPT_OCCUPANCY_TASK;
+
+  if (am_ompt_occupancy_resume(td->occupancy, td->event_collection) ||
+      am_ompt_occupancy_set_state(td->occupancy, td->event_collection, state,
+                                  am_ompt_now())) {
+    fprintf(stderr, "Afterompt: Could not write occupancy bins.\n");
+  }
 }
 
 /* Push state on the state stack */
 static inline void am_ompt_push_state(struct am_ompt_thread_data* td,
+                                      enum am_ompt_state_kind kind,
                                       am_timestamp_t tsc,
                                       union am_ompt_stack_item_data data) {
   if (td->state_stack.top >= AM_OMPT_DEFAULT_MAX_STATE_STACK_ENTRIES) {
@@ -175,10 +316,23 @@ static inline void am_ompt_push_state(struct am_ompt_thread_data* td,
     exit(1);
   }
 
+  /* Only the tail of the begin callback lies within the interval, which is
+     compensated separately */
+  td->tool_time += am_ompt_tool_cost.begin[kind];
+
   td->state_stack.stack[td->state_stack.top].tsc = tsc;
+  td->state_stack.stack[td->state_stack.top].tool_time = td->tool_time;
+  td->state_stack.stack[td->state_stack.top].kind = kind;
   td->state_stack.stack[td->state_stack.top].data = data;
 
   td->state_stack.top++;
+
+  /* Intervals pushed while tracing is paused have no timestamp */
+  if (tsc) am_ompt_sample_core(td, tsc);
+
+  if (td->telemetry) am_ompt_telemetry_sync(td);
+
+  if (td->occupancy) am_ompt_occupancy_sync(td);
 }
 
 /* Pop state from the state stack */
@@ -192,13 +346,59 @@ static inline struct am_ompt_stack_item am_ompt_pop_state(
 
   td->state_stack.top--;
 
-  struct am_ompt_stack_item result = {
-      td->state_stack.stack[td->state_stack.top].tsc,
-      td->state_stack.stack[td->state_stack.top].data};
+  struct am_ompt_stack_item result = td->state_stack.stack[td->state_stack.top];
+
+  if (td->telemetry) am_ompt_telemetry_sync(td);
+
+  if (td->occupancy) am_ompt_occupancy_sync(td);
 
   return result;
 }
 
+/*
+  Returns the timestamp for the beginning of an interval. While tracing is
+  paused no timestamp is taken and zero is returned instead, so that the
+  interval can be clipped to the time tracing was resumed if it ends later.
+*/
+static inline am_timestamp_t am_ompt_begin_tsc(void) {
+  return am_ompt_tracing_enabled() ? am_ompt_now() : 0;
+}
+
+/*
+  Computes the interval for a state popped from the stack. Intervals
+  spanning a pause boundary are clipped to the traced time, so that nesting
+  of the states on the stack is preserved in the trace. The calibrated tool
+  time at both ends of the interval is removed and the tool time of the
+  callbacks nested in the interval is left in the tool_time of the state.
+  Returns zero if the interval was never traced and should not be written.
+*/
+static inline int am_ompt_end_interval(struct am_ompt_thread_data* td,
+                                       struct am_ompt_stack_item* state,
+                                       struct am_dsk_interval* interval) {
+  enum am_ompt_state_kind kind = state->kind;
+
+  /* The entry of this callback was already accounted */
+  state->tool_time =
+      td->tool_time - state->tool_time - am_ompt_tool_cost.callback;
+  td->tool_time += am_ompt_tool_cost.end[kind];
+
+  if (am_ompt_tracing_enabled()) {
+    interval->start =
+        state->tsc ? state->tsc + am_ompt_tool_cost.begin_tail[kind]
+                   : __atomic_load_n(&am_ompt_resume_tsc, __ATOMIC_RELAXED);
+    interval->end = am_ompt_now() - am_ompt_tool_cost.end_head[kind];
+  } else {
+    if (!state->tsc) return 0;
+
+    interval->start = state->tsc + am_ompt_tool_cost.begin_tail[kind];
+    interval->end = __atomic_load_n(&am_ompt_pause_tsc, __ATOMIC_RELAXED);
+  }
+
+  if (interval->end < interval->start) interval->end = interval->start;
+
+  return 1;
+}
+
 static inline struct am_ompt_thread_data* am_get_thread_data() {
   struct am_ompt_thread_data* td;
 
@@ -208,9 +408,87 @@ static inline struct am_ompt_thread_data* am_get_thread_data() {
     exit(1);
   }
 
+  /* Every callback except thread begin looks up the thread data once */
+  td->tool_time += am_ompt_tool_cost.callback;
+
+  /* Samples taken since the last callback precede its events */
+  if (td->sampler &&
+      am_ompt_sampling_drain(td->sampler, td->event_collection)) {
+    fprintf(stderr, "Afterompt: Could not write samples.\n");
+    // TODO: Dying may be too radical.
+    exit(1);
+  }
+
   return td;
 }
 
+/* Leave a point event callback early while tracing is paused */
+#define RETURN_IF_PAUSED                  \
+  if (!am_ompt_tracing_enabled()) return;
+
+/*
+  Leave a callback early if the governor aggregates the events of the given
+  type at the code location, instead of writing them in full
+*/
+#define RETURN_IF_AGGREGATED(td, NAME, codeptr_ra, start, end)              \
+  if ((td)->governor &&                                                     \
+      !am_ompt_governor_admit((td)->governor, (td)->event_collection,       \
+                              (uint64_t)(codeptr_ra), AM_OMPT_EVENT_##NAME, \
+                              start, end))                                  \
+    return;
+
+/* Add an interval to the construct profile, including aggregated ones */
+#define PROFILE_INTERVAL(td, KIND, codeptr_ra, interval)          \
+  if ((td)->profile) {                                            \
+    am_ompt_profile_record((td)->profile, AM_OMPT_PROFILE_##KIND, \
+                           (uint64_t)(codeptr_ra),                \
+                           (interval).end - (interval).start);    \
+  }
+
+/*
+  Leave a callback early on a thread that is not traced. Unlike filtered-out
+  code this leaves the data of parallel regions and tasks untouched, so
+  that other threads trace them.
+*/
+#define RETURN_IF_UNTRACED(td) \
+  if (__builtin_expect((td)->untraced, 0)) return;
+
+/* Leave a point event callback early inside filtered-out code */
+#define RETURN_IF_FILTERED(td) \
+  if ((td)->filtered) return;
+
+/*
+  Leave a scoped callback early inside filtered-out code, counting the scopes
+  so that the end of the filtered-out region is found
+*/
+#define BEGIN_IF_FILTERED(td) \
+  if ((td)->filtered) {       \
+    (td)->filtered++;         \
+    return;                   \
+  }
+
+#define END_IF_FILTERED(td) \
+  if ((td)->filtered) {     \
+    (td)->filtered--;       \
+    return;                 \
+  }
+
+/*
+  Returns 1 and opens a filtered-out scope if a region beginning at the code
+  location is not traced, either by itself or since it is nested in another
+  filtered-out region
+*/
+static inline int am_ompt_filter_out(struct am_ompt_thread_data* td,
+                                     const void* codeptr_ra) {
+  if (td->filtered ||
+      (am_ompt_filter_enabled && !am_ompt_filter_admit((uint64_t)codeptr_ra))) {
+    td->filtered++;
+    return 1;
+  }
+
+  return 0;
+}
+
 #define CHECK_WRITE(func_call)                                           \
   if (func_call) {                                                       \
     fprintf(stderr,                                                      \
@@ -221,20 +499,37 @@ static inline struct am_ompt_thread_data* am_get_thread_data() {
     exit(1);                                                             \
   }
 
+/*
+  Write the tool time of the callbacks nested in an interval, if any, right
+  after the interval itself
+*/
+#define CHECK_WRITE_TOOL_TIME(c, NAME, state, interval)                      \
+  if ((state).tool_time) {                                                   \
+    CHECK_WRITE(am_ompt_write_tool_time(&(c)->data, (c)->id, (interval).end, \
+                                        AM_OMPT_TYPE_ID_##NAME,              \
+                                        (state).tool_time))                  \
+  }
+
 void am_callback_thread_begin(ompt_thread_t type, ompt_data_t* data) {
   struct am_ompt_thread_data* td;
+  int traced = am_ompt_filter_select_thread(type == ompt_thread_initial);
 
-  if (!(td = am_ompt_create_thread_data(pthread_self()))) {
+  if (!(td = am_ompt_create_thread_data(pthread_self(), traced))) {
     fprintf(stderr, "Afterompt: Could not create thread data\n");
     // TODO: Dying may be too radical.
     exit(1);
   }
 
+  if (!traced) {
+    pthread_setspecific(am_thread_data_key, td);
+    return;
+  }
+
   // TODO: Use initialization list.
   union am_ompt_stack_item_data type_data;
   type_data.thread_type = type;
 
-  am_ompt_push_state(td, am_ompt_now(), type_data);
+  am_ompt_push_state(td, AM_OMPT_STATE_THREAD, am_ompt_now(), type_data);
 
   pthread_setspecific(am_thread_data_key, td);
 }
@@ -243,17 +538,61 @@ void am_callback_thread_end(ompt_data_t* data) {
   struct am_ompt_thread_data* td = am_get_thread_data();
   struct am_buffered_event_collection* c = td->event_collection;
 
+  if (!c) {
+    am_ompt_destroy_thread_data(td);
+    return;
+  }
+
   struct am_ompt_stack_item state = am_ompt_pop_state(td);
 
   struct am_dsk_interval interval = {state.tsc, am_ompt_now()};
 
-  struct am_dsk_ompt_thread t = {c->id, interval, state.data.thread_type};
+  if (td->governor) {
+    CHECK_WRITE(am_ompt_governor_flush(td->governor, c, interval.end))
+  }
+
+  if (td->sampler) CHECK_WRITE(am_ompt_sampling_drain(td->sampler, c))
+
+  if (td->occupancy) {
+    CHECK_WRITE(am_ompt_occupancy_flush(td->occupancy, c, interval.end))
+  }
 
-  CHECK_WRITE(am_dsk_ompt_thread_write_to_buffer_defid(&c->data, &t))
+  CHECK_WRITE(am_ompt_write_thread(&c->data, c->id, interval,
+                                   state.data.thread_type))
+
+  if (td->telemetry) {
+    am_ompt_telemetry_set_state(td->telemetry, AM_OMPT_TELEMETRY_EXITED,
+                                interval.end);
+  }
 
   am_ompt_destroy_thread_data(td);
 }
 
+int am_callback_control_tool(uint64_t command, uint64_t modifier, void* arg,
+                             const void* codeptr_ra) {
+  switch (command) {
+    case omp_control_tool_start:
+      am_ompt_resume_tracing();
+      break;
+    case omp_control_tool_pause:
+      am_ompt_pause_tracing();
+      break;
+    case omp_control_tool_flush:
+      if (am_ompt_flush_trace()) {
+        fprintf(stderr, "Afterompt: Could not flush the trace.\n");
+        return omp_control_tool_ignored;
+      }
+      break;
+    case omp_control_tool_end:
+      am_ompt_end_tracing();
+      break;
+    default:
+      return omp_control_tool_ignored;
+  }
+
+  return omp_control_tool_success;
+}
+
 void am_callback_parallel_begin(ompt_data_t* task_data,
                                 const ompt_frame_t* task_frame,
                                 ompt_data_t* parallel_data,
@@ -261,10 +600,21 @@ void am_callback_parallel_begin(ompt_data_t* task_data,
                                 const void* codeptr_ra) {
   // TODO: task_frame and codeptr_ra data are not captured by the callback.
   // TODO: Assign id to the parallel region and associated task.
+  struct am_ompt_thread_data* td = am_get_thread_data();
+
+  RETURN_IF_UNTRACED(td)
+
+  /* Workers of the team find out from the parallel data */
+  if (am_ompt_filter_out(td, codeptr_ra)) {
+    parallel_data->value = AM_OMPT_FILTERED_PARALLEL;
+    return;
+  }
+
   // TODO: Use initialization list.
   union am_ompt_stack_item_data parallelism_data;
   parallelism_data.requested_parallelism = requested_parallelism;
-  am_ompt_push_state(am_get_thread_data(), am_ompt_now(), parallelism_data);
+  am_ompt_push_state(td, AM_OMPT_STATE_PARALLEL, am_ompt_begin_tsc(),
+                     parallelism_data);
 }
 
 void am_callback_parallel_end(ompt_data_t* parallel_data,
@@ -274,14 +624,24 @@ void am_callback_parallel_end(ompt_data_t* parallel_data,
   struct am_ompt_thread_data* td = am_get_thread_data();
   struct am_buffered_event_collection* c = td->event_collection;
 
+  RETURN_IF_UNTRACED(td)
+
+  END_IF_FILTERED(td)
+
   struct am_ompt_stack_item state = am_ompt_pop_state(td);
 
-  struct am_dsk_interval interval = {state.tsc, am_ompt_now()};
+  struct am_dsk_interval interval;
+
+  if (!am_ompt_end_interval(td, &state, &interval)) return;
 
-  struct am_dsk_ompt_parallel p = {c->id, interval,
-                                     state.data.requested_parallelism, flags};
+  PROFILE_INTERVAL(td, PARALLEL, codeptr_ra, interval)
 
-  CHECK_WRITE(am_dsk_ompt_parallel_write_to_buffer_defid(&c->data, &p))
+  RETURN_IF_AGGREGATED(td, PARALLEL, codeptr_ra, interval.start, interval.end)
+
+  CHECK_WRITE(am_ompt_write_parallel(&c->data, c->id, interval,
+                                     state.data.requested_parallelism, flags))
+
+  CHECK_WRITE_TOOL_TIME(c, PARALLEL, state, interval)
 }
 
 void am_callback_task_create(ompt_data_t* task_data,
@@ -292,28 +652,92 @@ void am_callback_task_create(ompt_data_t* task_data,
 
   struct am_buffered_event_collection* c = tdata->event_collection;
 
-  new_task_data->value = (tdata->tid << 32) | (tdata->unique_counter++);
+  /* Tasks created by threads that are not traced are traced when a traced
+     thread executes them, so they get an id as well */
+  if (__builtin_expect(tdata->untraced, 0)) {
+    new_task_data->value = am_ompt_new_id(tdata);
+    return;
+  }
+
+  /* Filtered-out tasks are marked by their id, since they may be executed by
+     any thread */
+  if (tdata->filtered || (am_ompt_filter_enabled &&
+                          !am_ompt_filter_admit((uint64_t)codeptr_ra))) {
+    new_task_data->value = AM_OMPT_FILTERED_TASK;
+    return;
+  }
+
+  new_task_data->value = am_ompt_new_id(tdata);
+
+  /* Task ids are assigned even while paused, so that tasks created during a
+     pause can be identified when they are scheduled after tracing resumes */
+  RETURN_IF_PAUSED
 
   uint64_t current_task_id = (task_data == NULL) ? 0 : task_data->value;
+  am_timestamp_t now = am_ompt_now();
 
-  struct am_dsk_ompt_task_create tc = {
-      c->id, am_ompt_now(),   current_task_id,    new_task_data->value,
-      flags, has_dependences, (uint64_t)codeptr_ra};
+  if (tdata->tasks) {
+    am_ompt_taskprof_created(tdata->tasks, new_task_data->value, codeptr_ra,
+                             am_ompt_getcpu(), now);
+  }
 
-  CHECK_WRITE(am_dsk_ompt_task_create_write_to_buffer_defid(&c->data, &tc))
+  CHECK_WRITE(am_ompt_write_task_create(&c->data, c->id, now, current_task_id,
+                                        new_task_data->value, flags,
+                                        has_dependences, (uint64_t)codeptr_ra))
 }
 
 void am_callback_task_schedule(ompt_data_t* prior_task_data,
                                ompt_task_status_t prior_task_status,
                                ompt_data_t* next_task_data) {
-  struct am_buffered_event_collection* c =
-      am_get_thread_data()->event_collection;
+  struct am_ompt_thread_data* td = am_get_thread_data();
+  int prior_filtered = am_ompt_filter_task(prior_task_data->value);
+
+  RETURN_IF_UNTRACED(td)
+
+  /* A filtered-out task counts as a scope opened in filtered-out code */
+  td->filtered += am_ompt_filter_task(next_task_data->value) - prior_filtered;
+
+  /* Only explicit tasks have a non-zero id assigned on creation */
+  if (td->sampler) td->task_id = next_task_data->value;
+
+  if (td->telemetry || td->occupancy)
+    td->in_explicit_task = (next_task_data->value != 0);
+
+  if (td->telemetry) am_ompt_telemetry_sync(td);
+
+  if (td->occupancy) {
+    td->occupancy->task_depth = td->state_stack.top;
+    am_ompt_occupancy_sync(td);
+  }
 
-  struct am_dsk_ompt_task_schedule ts = {
-      c->id, am_ompt_now(), prior_task_data->value, next_task_data->value,
-      prior_task_status};
+  RETURN_IF_PAUSED
 
-  CHECK_WRITE(am_dsk_ompt_task_schedule_write_to_buffer_defid(&c->data, &ts))
+  if (td->filtered || prior_filtered) return;
+
+  struct am_buffered_event_collection* c = td->event_collection;
+  am_timestamp_t now = am_ompt_now();
+
+  am_ompt_sample_core(td, now);
+
+  uint64_t codeptr_ra = 0;
+
+  if (td->tasks && next_task_data->value) {
+    codeptr_ra = am_ompt_taskprof_scheduled(td->tasks, next_task_data->value,
+                                            td->core, now);
+  }
+
+  if (td->profile) {
+    am_ompt_profile_schedule(td->profile, prior_task_data->value,
+                             prior_task_status == ompt_task_complete ||
+                                 prior_task_status == ompt_task_cancel ||
+                                 prior_task_status == ompt_task_detach,
+                             next_task_data->value, codeptr_ra, now);
+  }
+
+  CHECK_WRITE(am_ompt_write_task_schedule(&c->data, c->id, now,
+                                          prior_task_data->value,
+                                          next_task_data->value,
+                                          prior_task_status))
 }
 
 void am_callback_implicit_task(ompt_scope_endpoint_t endpoint,
@@ -327,20 +751,34 @@ void am_callback_implicit_task(ompt_scope_endpoint_t endpoint,
   struct am_ompt_thread_data* td = am_get_thread_data();
   struct am_buffered_event_collection* c = td->event_collection;
 
+  RETURN_IF_UNTRACED(td)
+
   if (endpoint == ompt_scope_begin) {
+    if (td->filtered || (parallel_data && parallel_data->value ==
+                                              AM_OMPT_FILTERED_PARALLEL)) {
+      td->filtered++;
+      return;
+    }
+
     // TODO: Use initialization list.
     union am_ompt_stack_item_data parallelism_data;
     parallelism_data.actual_parallelism = actual_parallelism;
-    am_ompt_push_state(td, am_ompt_now(), parallelism_data);
+    am_ompt_push_state(td, AM_OMPT_STATE_IMPLICIT_TASK, am_ompt_begin_tsc(),
+                       parallelism_data);
   } else {
+    END_IF_FILTERED(td)
+
     struct am_ompt_stack_item state = am_ompt_pop_state(td);
 
-    struct am_dsk_interval interval = {state.tsc, am_ompt_now()};
+    struct am_dsk_interval interval;
+
+    if (!am_ompt_end_interval(td, &state, &interval)) return;
 
-    struct am_dsk_ompt_implicit_task it = {
-        c->id, interval, state.data.actual_parallelism, flags};
+    CHECK_WRITE(am_ompt_write_implicit_task(&c->data, c->id, interval,
+                                            state.data.actual_parallelism,
+                                            flags))
 
-    CHECK_WRITE(am_dsk_ompt_implicit_task_write_to_buffer_defid(&c->data, &it))
+    CHECK_WRITE_TOOL_TIME(c, IMPLICIT_TASK, state, interval)
   }
 }
 
@@ -355,57 +793,166 @@ void am_callback_sync_region_wait(ompt_sync_region_t kind,
   struct am_ompt_thread_data* td = am_get_thread_data();
   struct am_buffered_event_collection* c = td->event_collection;
 
+  RETURN_IF_UNTRACED(td)
+
   if (endpoint == ompt_scope_begin) {
+    BEGIN_IF_FILTERED(td)
+
     // TODO: Use initialization list.
     union am_ompt_stack_item_data empty_data;
-    am_ompt_push_state(td, am_ompt_now(), empty_data);
+    am_ompt_push_state(td, AM_OMPT_STATE_SYNC_REGION_WAIT, am_ompt_begin_tsc(),
+                       empty_data);
   } else {
+    END_IF_FILTERED(td)
+
     struct am_ompt_stack_item state = am_ompt_pop_state(td);
 
-    struct am_dsk_interval interval = {state.tsc, am_ompt_now()};
+    struct am_dsk_interval interval;
 
-    struct am_dsk_ompt_sync_region_wait srw = {c->id, interval, kind};
+    if (!am_ompt_end_interval(td, &state, &interval)) return;
 
-    CHECK_WRITE(am_dsk_ompt_sync_region_wait_write_to_buffer_defid(&c->data, &srw))
+    PROFILE_INTERVAL(td, SYNC_WAIT, codeptr_ra, interval)
+
+    RETURN_IF_AGGREGATED(td, SYNC_REGION_WAIT, codeptr_ra, interval.start,
+                         interval.end)
+
+    CHECK_WRITE(am_ompt_write_sync_region_wait(&c->data, c->id, interval, kind))
+
+    CHECK_WRITE_TOOL_TIME(c, SYNC_REGION_WAIT, state, interval)
   }
 }
 
 void am_callback_mutex_released(ompt_mutex_t kind, ompt_wait_id_t wait_id,
                                 const void* codeptr_ra) {
   // TODO: codeptr_ra data is not captured by the callback.
-  struct am_buffered_event_collection* c =
-      am_get_thread_data()->event_collection;
+  RETURN_IF_PAUSED
 
-  struct am_dsk_ompt_mutex_released mr = {c->id, am_ompt_now(), wait_id,
-                                            kind};
+  struct am_ompt_thread_data* td = am_get_thread_data();
+  struct am_buffered_event_collection* c = td->event_collection;
 
-  CHECK_WRITE(am_dsk_ompt_mutex_released_write_to_buffer_defid(&c->data, &mr))
+  RETURN_IF_UNTRACED(td)
+
+  am_timestamp_t now = am_ompt_now();
+
+  RETURN_IF_FILTERED(td)
+
+  if (td->locks && !am_ompt_lockprof_released(td->locks, wait_id, now)) return;
+
+  CHECK_WRITE(am_ompt_write_mutex_released(&c->data, c->id, now, wait_id, kind))
 }
 
 void am_callback_dependences(ompt_data_t* task_data,
                              const ompt_dependence_t* deps, int ndeps) {
   // TODO: Capture task id as well for this event.
-  struct am_buffered_event_collection* c =
-      am_get_thread_data()->event_collection;
+  RETURN_IF_PAUSED
+
+  struct am_ompt_thread_data* td = am_get_thread_data();
+  struct am_buffered_event_collection* c = td->event_collection;
+
+  RETURN_IF_UNTRACED(td)
+
+  RETURN_IF_FILTERED(td)
+
+  if (am_ompt_filter_task(task_data->value)) return;
 
   // TODO: We could collect more information here by traversing the deps
   //       list to get the storage location of dependences.
-  struct am_dsk_ompt_dependences d = {c->id, am_ompt_now(), ndeps};
-
-  CHECK_WRITE(am_dsk_ompt_dependences_write_to_buffer_defid(&c->data, &d))
+  CHECK_WRITE(am_ompt_write_dependences(&c->data, c->id, am_ompt_now(), ndeps))
 }
 
 void am_callback_task_dependence(ompt_data_t* src_task_data,
                                  ompt_data_t* sink_task_data) {
-  struct am_buffered_event_collection* c =
-      am_get_thread_data()->event_collection;
+  RETURN_IF_PAUSED
+
+  struct am_ompt_thread_data* td = am_get_thread_data();
+  struct am_buffered_event_collection* c = td->event_collection;
+
+  RETURN_IF_UNTRACED(td)
+
+  RETURN_IF_FILTERED(td)
+
+  if (am_ompt_filter_task(src_task_data->value) ||
+      am_ompt_filter_task(sink_task_data->value))
+    return;
+
+  CHECK_WRITE(am_ompt_write_task_dependence(&c->data, c->id, am_ompt_now(),
+                                            src_task_data->value,
+                                            sink_task_data->value))
+}
+
+/* Push a loop on the state stack */
+static inline void am_ompt_begin_loop(struct am_ompt_thread_data* td,
+                                      uint64_t instance_id, int flags,
+                                      int64_t lower_bound, int64_t upper_bound,
+                                      int64_t increment, int num_workers,
+                                      const void* codeptr_ra) {
+  union am_ompt_stack_item_data loop_info;
 
-  struct am_dsk_ompt_task_dependence td = {
-      c->id, am_ompt_now(), src_task_data->value, sink_task_data->value};
+  loop_info.loop_info.instance_id = instance_id;
+  loop_info.loop_info.flags = flags;
+  loop_info.loop_info.lower_bound = lower_bound;
+  loop_info.loop_info.upper_bound = upper_bound;
+  loop_info.loop_info.increment = increment;
+  loop_info.loop_info.num_workers = num_workers;
+  loop_info.loop_info.codeptr_ra = (uint64_t)codeptr_ra;
 
-  CHECK_WRITE(am_dsk_ompt_task_dependence_write_to_buffer_defid(&c->data, &td))
+  am_ompt_push_state(td, AM_OMPT_STATE_LOOP, am_ompt_begin_tsc(), loop_info);
 }
 
+/* Pop the loop at the top of the state stack and write it */
+static inline void am_ompt_end_loop(struct am_ompt_thread_data* td) {
+  struct am_buffered_event_collection* c = td->event_collection;
+
+  struct am_ompt_stack_item state = am_ompt_pop_state(td);
+  struct am_ompt_loop_info loop_info = state.data.loop_info;
+
+  struct am_dsk_interval interval;
+
+  if (!am_ompt_end_interval(td, &state, &interval)) return;
+
+  CHECK_WRITE(am_ompt_write_loop(&c->data, c->id, interval,
+                                 loop_info.instance_id, loop_info.flags,
+                                 loop_info.lower_bound, loop_info.upper_bound,
+                                 loop_info.increment, loop_info.num_workers,
+                                 loop_info.codeptr_ra))
+
+  CHECK_WRITE_TOOL_TIME(c, LOOP, state, interval)
+
+  /* We need a marker in the trace to close the last period in the loop. Not
+     sure it is the best solution, so probably it needs to be revisited. */
+  // TODO: Revisit this later.
+  CHECK_WRITE(am_ompt_write_loop_chunk(&c->data, c->id, interval.end,
+                                       loop_info.instance_id, 0, 0, 1))
+}
+
+#ifdef TRACE_DISPATCH_LOOPS
+/* Kinds of work of worksharing loops */
+static inline int am_ompt_is_loop_work(ompt_work_t wstype) {
+  switch (wstype) {
+    case ompt_work_loop:
+#ifdef HAVE_OMPT_WORK_LOOP_SCHEDULES
+    case ompt_work_loop_static:
+    case ompt_work_loop_dynamic:
+    case ompt_work_loop_guided:
+    case ompt_work_loop_other:
+#endif
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/* Threads in the team of the innermost implicit task, zero if unknown */
+static inline int am_ompt_team_size(struct am_ompt_thread_data* td) {
+  for (uint32_t i = td->state_stack.top; i-- > 0;) {
+    if (td->state_stack.stack[i].kind == AM_OMPT_STATE_IMPLICIT_TASK)
+      return td->state_stack.stack[i].data.actual_parallelism;
+  }
+
+  return 0;
+}
+#endif
+
 void am_callback_work(ompt_work_t wstype, ompt_scope_endpoint_t endpoint,
                       ompt_data_t* parallel_data, ompt_data_t* task_data,
                       uint64_t count, const void* codeptr_ra) {
@@ -416,19 +963,45 @@ void am_callback_work(ompt_work_t wstype, ompt_scope_endpoint_t endpoint,
   struct am_ompt_thread_data* td = am_get_thread_data();
   struct am_buffered_event_collection* c = td->event_collection;
 
+  RETURN_IF_UNTRACED(td)
+
   if (endpoint == ompt_scope_begin) {
+    if (am_ompt_filter_out(td, codeptr_ra)) return;
+
     // TODO: Use initialization list.
     union am_ompt_stack_item_data count_data;
     count_data.count = count;
-    am_ompt_push_state(td, am_ompt_now(), count_data);
+    am_ompt_push_state(td, AM_OMPT_STATE_WORK, am_ompt_begin_tsc(), count_data);
+
+#ifdef TRACE_DISPATCH_LOOPS
+    /* Compilers pass the runtime the logical iterations of the loop, from
+       zero to count - 1, so chunks are reported in this space as well */
+    if (am_ompt_is_loop_work(wstype)) {
+      am_ompt_begin_loop(td, am_ompt_new_id(td), wstype, 0, (int64_t)count - 1,
+                         1, am_ompt_team_size(td), codeptr_ra);
+    }
+#endif
   } else {
+    END_IF_FILTERED(td)
+
+#ifdef TRACE_DISPATCH_LOOPS
+    if (am_ompt_is_loop_work(wstype)) am_ompt_end_loop(td);
+#endif
+
     struct am_ompt_stack_item state = am_ompt_pop_state(td);
 
-    struct am_dsk_interval interval = {state.tsc, am_ompt_now()};
+    struct am_dsk_interval interval;
+
+    if (!am_ompt_end_interval(td, &state, &interval)) return;
+
+    PROFILE_INTERVAL(td, WORK, codeptr_ra, interval)
+
+    RETURN_IF_AGGREGATED(td, WORK, codeptr_ra, interval.start, interval.end)
 
-    struct am_dsk_ompt_work w = {c->id, interval, wstype, state.data.count};
+    CHECK_WRITE(am_ompt_write_work(&c->data, c->id, interval, wstype,
+                                   state.data.count))
 
-    CHECK_WRITE(am_dsk_ompt_work_write_to_buffer_defid(&c->data, &w))
+    CHECK_WRITE_TOOL_TIME(c, WORK, state, interval)
   }
 }
 
@@ -441,18 +1014,29 @@ void am_callback_master(ompt_scope_endpoint_t endpoint,
   struct am_ompt_thread_data* td = am_get_thread_data();
   struct am_buffered_event_collection* c = td->event_collection;
 
+  RETURN_IF_UNTRACED(td)
+
   if (endpoint == ompt_scope_begin) {
+    BEGIN_IF_FILTERED(td)
+
     // TODO: Use initialization list.
     union am_ompt_stack_item_data empty_data;
-    am_ompt_push_state(td, am_ompt_now(), empty_data);
+    am_ompt_push_state(td, AM_OMPT_STATE_MASTER, am_ompt_begin_tsc(),
+                       empty_data);
   } else {
+    END_IF_FILTERED(td)
+
     struct am_ompt_stack_item state = am_ompt_pop_state(td);
 
-    struct am_dsk_interval interval = {state.tsc, am_ompt_now()};
+    struct am_dsk_interval interval;
+
+    if (!am_ompt_end_interval(td, &state, &interval)) return;
+
+    RETURN_IF_AGGREGATED(td, MASTER, codeptr_ra, interval.start, interval.end)
 
-    struct am_dsk_ompt_master m = {c->id, interval};
+    CHECK_WRITE(am_ompt_write_master(&c->data, c->id, interval))
 
-    CHECK_WRITE(am_dsk_ompt_master_write_to_buffer_defid(&c->data, &m))
+    CHECK_WRITE_TOOL_TIME(c, MASTER, state, interval)
   }
 }
 
@@ -465,66 +1049,144 @@ void am_callback_sync_region(ompt_sync_region_t kind,
   struct am_ompt_thread_data* td = am_get_thread_data();
   struct am_buffered_event_collection* c = td->event_collection;
 
+  RETURN_IF_UNTRACED(td)
+
   if (endpoint == ompt_scope_begin) {
+    BEGIN_IF_FILTERED(td)
+
     // TODO: Use initialization list.
     union am_ompt_stack_item_data empty_data;
-    am_ompt_push_state(td, am_ompt_now(), empty_data);
+    am_ompt_push_state(td, AM_OMPT_STATE_SYNC_REGION, am_ompt_begin_tsc(),
+                       empty_data);
   } else {
+    END_IF_FILTERED(td)
+
     struct am_ompt_stack_item state = am_ompt_pop_state(td);
 
-    struct am_dsk_interval interval = {state.tsc, am_ompt_now()};
+    struct am_dsk_interval interval;
+
+    if (!am_ompt_end_interval(td, &state, &interval)) return;
+
+    RETURN_IF_AGGREGATED(td, SYNC_REGION, codeptr_ra, interval.start,
+                         interval.end)
 
-    struct am_dsk_ompt_sync_region sr = {c->id, interval, kind};
+    CHECK_WRITE(am_ompt_write_sync_region(&c->data, c->id, interval, kind))
 
-    CHECK_WRITE(am_dsk_ompt_sync_region_write_to_buffer_defid(&c->data, &sr))
+    CHECK_WRITE_TOOL_TIME(c, SYNC_REGION, state, interval)
   }
 }
 
 void am_callback_lock_init(ompt_mutex_t kind, ompt_wait_id_t wait_id,
                            const void* codeptr_ra) {
   // TODO: codeptr_ra data is not captured by the callback.
-  struct am_buffered_event_collection* c =
-      am_get_thread_data()->event_collection;
+  RETURN_IF_PAUSED
+
+  struct am_ompt_thread_data* td = am_get_thread_data();
+  struct am_buffered_event_collection* c = td->event_collection;
+
+  RETURN_IF_UNTRACED(td)
+
+  am_timestamp_t now = am_ompt_now();
 
-  struct am_dsk_ompt_lock_init li = {c->id, am_ompt_now(), wait_id, kind};
+  RETURN_IF_FILTERED(td)
 
-  CHECK_WRITE(am_dsk_ompt_lock_init_write_to_buffer_defid(&c->data, &li))
+  RETURN_IF_AGGREGATED(td, LOCK_INIT, codeptr_ra, now, now)
+
+  CHECK_WRITE(am_ompt_write_lock_init(&c->data, c->id, now, wait_id, kind))
 }
 
 void am_callback_lock_destroy(ompt_mutex_t kind, ompt_wait_id_t wait_id,
                               const void* codeptr_ra) {
   // TODO: codeptr_ra data is not captured by the callback.
-  struct am_buffered_event_collection* c =
-      am_get_thread_data()->event_collection;
+  RETURN_IF_PAUSED
+
+  struct am_ompt_thread_data* td = am_get_thread_data();
+  struct am_buffered_event_collection* c = td->event_collection;
+
+  RETURN_IF_UNTRACED(td)
+
+  am_timestamp_t now = am_ompt_now();
 
-  struct am_dsk_ompt_lock_destroy ld = {c->id, am_ompt_now(), wait_id, kind};
+  RETURN_IF_FILTERED(td)
 
-  CHECK_WRITE(am_dsk_ompt_lock_destroy_write_to_buffer_defid(&c->data, &ld))
+  RETURN_IF_AGGREGATED(td, LOCK_DESTROY, codeptr_ra, now, now)
+
+  CHECK_WRITE(
+      am_ompt_write_lock_destroy(&c->data, c->id, now, wait_id, kind))
 }
 
 void am_callback_mutex_acquire(ompt_mutex_t kind, unsigned int hint,
                                unsigned int impl, ompt_wait_id_t wait_id,
                                const void* codeptr_pa) {
   // TODO: codeptr_ra data is not captured by the callback.
-  struct am_buffered_event_collection* c =
-      am_get_thread_data()->event_collection;
+  struct am_ompt_thread_data* td = am_get_thread_data();
+
+  RETURN_IF_UNTRACED(td)
+
+  /* Live telemetry is updated while paused as well, otherwise no timestamp
+     is needed then */
+  if (!td->telemetry && !am_ompt_tracing_enabled()) return;
+
+  am_timestamp_t now = am_ompt_now();
 
-  struct am_dsk_ompt_mutex_acquire ma = {c->id, am_ompt_now(), wait_id,
-                                           kind,  hint,          impl};
+  if (td->telemetry)
+    am_ompt_telemetry_set_state(td->telemetry, AM_OMPT_TELEMETRY_LOCK, now);
 
-  CHECK_WRITE(am_dsk_ompt_mutex_acquire_write_to_buffer_defid(&c->data, &ma))
+  RETURN_IF_PAUSED
+
+  RETURN_IF_FILTERED(td)
+
+  struct am_buffered_event_collection* c = td->event_collection;
+
+  if (td->profile)
+    am_ompt_profile_acquire(td->profile, wait_id, codeptr_pa, now);
+
+  if (td->locks) {
+    am_ompt_lockprof_acquire(td->locks, kind, hint, impl, wait_id, codeptr_pa,
+                             now);
+
+    /* Written on acquisition, once it is known if the lock was contended */
+    if (am_ompt_lockprof_skip_uncontended) return;
+  }
+
+  CHECK_WRITE(am_ompt_write_mutex_acquire(&c->data, c->id, now, wait_id, kind,
+                                          hint, impl))
 }
 
 void am_callback_mutex_acquired(ompt_mutex_t kind, ompt_wait_id_t wait_id,
                                 const void* codeptr_ra) {
   // TODO: codeptr_ra data is not captured by the callback.
-  struct am_buffered_event_collection* c =
-      am_get_thread_data()->event_collection;
+  struct am_ompt_thread_data* td = am_get_thread_data();
+
+  RETURN_IF_UNTRACED(td)
 
-  struct am_dsk_ompt_mutex_acquired ma = {c->id, am_ompt_now(), wait_id,
-                                            kind};
+  if (td->telemetry) am_ompt_telemetry_sync(td);
 
-  CHECK_WRITE(am_dsk_ompt_mutex_acquired_write_to_buffer_defid(&c->data, &ma))
+  RETURN_IF_PAUSED
+
+  RETURN_IF_FILTERED(td)
+
+  struct am_buffered_event_collection* c = td->event_collection;
+  am_timestamp_t now = am_ompt_now();
+
+  if (td->profile) am_ompt_profile_acquired(td->profile, wait_id, now);
+
+  if (td->locks) {
+    struct am_ompt_lock_data* ld = td->locks;
+    am_timestamp_t acquire_tsc = ld->acquire_tsc;
+    uint32_t hint = ld->acquire_hint;
+    uint32_t impl = ld->acquire_impl;
+
+    if (!am_ompt_lockprof_acquired(ld, wait_id, now)) return;
+
+    /* Write the acquire event deferred by am_callback_mutex_acquire */
+    if (am_ompt_lockprof_skip_uncontended && acquire_tsc <= now) {
+      CHECK_WRITE(am_ompt_write_mutex_acquire(&c->data, c->id, acquire_tsc,
+                                              wait_id, kind, hint, impl))
+    }
+  }
+
+  CHECK_WRITE(am_ompt_write_mutex_acquired(&c->data, c->id, now, wait_id, kind))
 }
 
 void am_callback_nest_lock(ompt_scope_endpoint_t endpoint,
@@ -533,41 +1195,66 @@ void am_callback_nest_lock(ompt_scope_endpoint_t endpoint,
   struct am_ompt_thread_data* td = am_get_thread_data();
   struct am_buffered_event_collection* c = td->event_collection;
 
+  RETURN_IF_UNTRACED(td)
+
   if (endpoint == ompt_scope_begin) {
+    BEGIN_IF_FILTERED(td)
+
     // TODO: Use initialization list.
     union am_ompt_stack_item_data empty_data;
-    am_ompt_push_state(td, am_ompt_now(), empty_data);
+    am_ompt_push_state(td, AM_OMPT_STATE_NEST_LOCK, am_ompt_begin_tsc(),
+                       empty_data);
   } else {
+    END_IF_FILTERED(td)
+
     struct am_ompt_stack_item state = am_ompt_pop_state(td);
 
-    struct am_dsk_interval interval = {state.tsc, am_ompt_now()};
+    struct am_dsk_interval interval;
+
+    if (!am_ompt_end_interval(td, &state, &interval)) return;
 
-    struct am_dsk_ompt_nest_lock nl = {c->id, interval, wait_id};
+    CHECK_WRITE(am_ompt_write_nest_lock(&c->data, c->id, interval, wait_id))
 
-    CHECK_WRITE(am_dsk_ompt_nest_lock_write_to_buffer_defid(&c->data, &nl))
+    CHECK_WRITE_TOOL_TIME(c, NEST_LOCK, state, interval)
   }
 }
 
 void am_callback_flush(ompt_data_t* thread_data, const void* codeptr_ra) {
   // TODO: codeptr_ra data is not captured by the callback
-  struct am_buffered_event_collection* c =
-      am_get_thread_data()->event_collection;
+  RETURN_IF_PAUSED
+
+  struct am_ompt_thread_data* td = am_get_thread_data();
+  struct am_buffered_event_collection* c = td->event_collection;
+
+  RETURN_IF_UNTRACED(td)
 
-  struct am_dsk_ompt_flush f = {c->id, am_ompt_now()};
+  am_timestamp_t now = am_ompt_now();
 
-  CHECK_WRITE(am_dsk_ompt_flush_write_to_buffer_defid(&c->data, &f))
+  RETURN_IF_FILTERED(td)
+
+  RETURN_IF_AGGREGATED(td, FLUSH, codeptr_ra, now, now)
+
+  CHECK_WRITE(am_ompt_write_flush(&c->data, c->id, now))
 }
 
 void am_callback_cancel(ompt_data_t* task_data, int flags,
                         const void* codeptr_ra) {
   // TODO: codeptr_ra data is not captured by the callback
   // TODO: Task id can be captured to relate cancel event with the task
-  struct am_buffered_event_collection* c =
-      am_get_thread_data()->event_collection;
+  RETURN_IF_PAUSED
+
+  struct am_ompt_thread_data* td = am_get_thread_data();
+  struct am_buffered_event_collection* c = td->event_collection;
 
-  struct am_dsk_ompt_cancel cc = {c->id, am_ompt_now(), flags};
+  RETURN_IF_UNTRACED(td)
 
-  CHECK_WRITE(am_dsk_ompt_cancel_write_to_buffer_defid(&c->data, &cc))
+  am_timestamp_t now = am_ompt_now();
+
+  RETURN_IF_FILTERED(td)
+
+  RETURN_IF_AGGREGATED(td, CANCEL, codeptr_ra, now, now)
+
+  CHECK_WRITE(am_ompt_write_cancel(&c->data, c->id, now, flags))
 }
 
 void am_callback_loop_begin(ompt_data_t* parallel_data, ompt_data_t* task_data,
@@ -576,62 +1263,133 @@ void am_callback_loop_begin(ompt_data_t* parallel_data, ompt_data_t* task_data,
                             void* codeptr_ra) {
   struct am_ompt_thread_data* tdata = am_get_thread_data();
 
-  task_data->value = (tdata->tid << 32) | (tdata->unique_counter++);
+  RETURN_IF_UNTRACED(tdata)
 
-  union am_ompt_stack_item_data loop_info;
+  task_data->value = am_ompt_new_id(tdata);
 
-  loop_info.loop_info.flags = flags;
-  loop_info.loop_info.lower_bound = lower_bound;
-  loop_info.loop_info.upper_bound = upper_bound;
-  loop_info.loop_info.increment = increment;
-  loop_info.loop_info.num_workers = num_workers;
-  loop_info.loop_info.codeptr_ra = (uint64_t)codeptr_ra;
+  if (am_ompt_filter_out(tdata, codeptr_ra)) return;
 
-  am_ompt_push_state(am_get_thread_data(), am_ompt_now(), loop_info);
+  am_ompt_begin_loop(tdata, task_data->value, flags, lower_bound, upper_bound,
+                     increment, num_workers, codeptr_ra);
 }
 
 void am_callback_loop_end(ompt_data_t* parallel_data, ompt_data_t* task_data) {
   struct am_ompt_thread_data* td = am_get_thread_data();
-  struct am_buffered_event_collection* c = td->event_collection;
 
-  struct am_ompt_stack_item state = am_ompt_pop_state(td);
-  struct am_ompt_loop_info loop_info = state.data.loop_info;
-
-  struct am_dsk_interval interval = {state.tsc, am_ompt_now()};
-
-  struct am_dsk_ompt_loop l = {c->id,
-                                 interval,
-                                 task_data->value,
-                                 loop_info.flags,
-                                 loop_info.lower_bound,
-                                 loop_info.upper_bound,
-                                 loop_info.increment,
-                                 loop_info.num_workers,
-                                 loop_info.codeptr_ra};
+  RETURN_IF_UNTRACED(td)
 
-  CHECK_WRITE(am_dsk_ompt_loop_write_to_buffer_defid(&c->data, &l))
+  END_IF_FILTERED(td)
 
-  /* We need a marker in the trace to close the last period in the loop. Not
-     sure it is the best solution, so probably it needs to be revisited. */
-  // TODO: Revisit this later.
-  struct am_dsk_ompt_loop_chunk lc = {c->id, am_ompt_now(), task_data->value,
-                                        0, 0, 1};
-
-  CHECK_WRITE(am_dsk_ompt_loop_chunk_write_to_buffer_defid(&c->data, &lc))
+  am_ompt_end_loop(td);
 }
 
 void am_callback_loop_chunk(ompt_data_t* parallel_data, ompt_data_t* task_data,
                             int64_t lower_bound, int64_t upper_bound) {
-  struct am_buffered_event_collection* c =
-      am_get_thread_data()->event_collection;
+  RETURN_IF_PAUSED
+
+  struct am_ompt_thread_data* td = am_get_thread_data();
+  struct am_buffered_event_collection* c = td->event_collection;
+
+  RETURN_IF_UNTRACED(td)
+
+  RETURN_IF_FILTERED(td)
 
   /* Zero indicates that it is not the end of the last period. This should be
      treated as a small hack, since maybe there is a better solution. */
   // TODO: Revisit this later.
-  struct am_dsk_ompt_loop_chunk lc = {c->id, am_ompt_now(), task_data->value,
-                                        lower_bound, upper_bound, 0};
+  CHECK_WRITE(am_ompt_write_loop_chunk(&c->data, c->id, am_ompt_now(),
+                                       task_data->value, lower_bound,
+                                       upper_bound, 0))
+}
+
+#ifdef TRACE_DISPATCH_LOOPS
+void am_callback_dispatch(ompt_data_t* parallel_data, ompt_data_t* task_data,
+                          ompt_dispatch_t kind, ompt_data_t instance) {
+  RETURN_IF_PAUSED
+
+  struct am_ompt_thread_data* td = am_get_thread_data();
+  struct am_buffered_event_collection* c = td->event_collection;
+
+  struct am_ompt_stack_item* loop;
+  const ompt_dispatch_chunk_t* chunk;
+  int64_t lower_bound, upper_bound;
+
+  RETURN_IF_UNTRACED(td)
+
+  RETURN_IF_FILTERED(td)
+
+  /* Sections and taskloop chunks do not belong to a loop on the stack */
+  if (!td->state_stack.top) return;
+
+  loop = &td->state_stack.stack[td->state_stack.top - 1];
+
+  if (loop->kind != AM_OMPT_STATE_LOOP) return;
+
+  switch (kind) {
+    case ompt_dispatch_ws_loop_chunk:
+      chunk = instance.ptr;
+      lower_bound = chunk->start;
+      upper_bound = chunk->start + chunk->iterations - 1;
+      break;
+    case ompt_dispatch_iteration:
+      lower_bound = upper_bound = instance.value;
+      break;
+    default:
+      return;
+  }
+
+  CHECK_WRITE(am_ompt_write_loop_chunk(&c->data, c->id, am_ompt_now(),
+                                       loop->data.loop_info.instance_id,
+                                       lower_bound, upper_bound, 0))
+}
+#endif
+
+/*
+  Thread data for the annotation API, NULL if the tool is not initialized or
+  the calling thread is not known to the OpenMP runtime or not traced
+*/
+static inline struct am_ompt_thread_data* am_ompt_annotation_thread_data() {
+  struct am_ompt_thread_data* td;
+
+  if (!__atomic_load_n(&am_thread_data_key_valid, __ATOMIC_ACQUIRE))
+    return NULL;
+
+  /* Threads that are not traced have no event collection */
+  if (!(td = pthread_getspecific(am_thread_data_key)) || !td->event_collection)
+    return NULL;
+
+  return td;
+}
+
+uint32_t afterompt_label(const char* name) {
+  return am_ompt_annotate_label(name);
+}
+
+void afterompt_phase_begin(uint32_t label) {
+  struct am_ompt_thread_data* td = am_ompt_annotation_thread_data();
+
+  if (!td) return;
+
+  am_ompt_annotate_phase_begin(&td->phases, label, am_ompt_begin_tsc());
+}
+
+void afterompt_phase_end(void) {
+  struct am_ompt_thread_data* td = am_ompt_annotation_thread_data();
+
+  if (!td) return;
+
+  CHECK_WRITE(am_ompt_annotate_phase_end(&td->phases, td->event_collection))
+}
+
+void afterompt_counter(uint32_t label, int64_t value) {
+  struct am_ompt_thread_data* td = am_ompt_annotation_thread_data();
+
+  RETURN_IF_PAUSED
+
+  if (!td) return;
 
-  CHECK_WRITE(am_dsk_ompt_loop_chunk_write_to_buffer_defid(&c->data, &lc))
+  CHECK_WRITE(am_ompt_annotate_counter(td->event_collection, label,
+                                       am_ompt_now(), value))
 }
 
 #pragma clang pop
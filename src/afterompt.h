@@ -19,6 +19,13 @@
 #include <omp.h>
 #include <ompt.h>
 
+/* Loops are traced with the experimental callbacks if they are allowed and
+   otherwise with the dispatch callback, if the runtime reports chunks */
+#if defined(TRACE_LOOPS) && !defined(ALLOW_EXPERIMENTAL) && \
+    defined(HAVE_OMPT_DISPATCH_CHUNK)
+#define TRACE_DISPATCH_LOOPS
+#endif
+
 /* All function signatures as defined in OpenMP API Specification 5.0 */
 
 /* Tool setup */
@@ -36,6 +43,9 @@ void am_callback_thread_begin(ompt_thread_t type, ompt_data_t* data);
 
 void am_callback_thread_end(ompt_data_t* data);
 
+int am_callback_control_tool(uint64_t command, uint64_t modifier, void* arg,
+                             const void* codeptr_ra);
+
 void am_callback_parallel_begin(ompt_data_t* task_data,
                                 const ompt_frame_t* task_frame,
                                 ompt_data_t* parallel_data,
@@ -120,3 +130,8 @@ void am_callback_loop_end(ompt_data_t* parallel_data, ompt_data_t* task_data);
 void am_callback_loop_chunk(ompt_data_t* parallel_data, ompt_data_t* task_data,
                             int64_t lower_bound, int64_t upper_bound);
 
+#ifdef TRACE_DISPATCH_LOOPS
+void am_callback_dispatch(ompt_data_t* parallel_data, ompt_data_t* task_data,
+                          ompt_dispatch_t kind, ompt_data_t instance);
+#endif
+
@@ -0,0 +1,141 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aftermath/trace/on_disk_structs.h>
+#include <aftermath/trace/on_disk_write_to_buffer.h>
+
+#include "annotate.h"
+#include "control.h"
+#include "trace.h"
+#include "writer.h"
+
+/* Interned labels, the label with id i is at i - AM_OMPT_FIRST_LABEL_ID */
+static char** am_ompt_labels;
+static uint32_t am_ompt_num_labels;
+static uint32_t am_ompt_max_labels;
+
+static pthread_mutex_t am_ompt_labels_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint32_t am_ompt_annotate_label(const char* name) {
+  char** labels;
+  uint32_t max_labels;
+  uint32_t id = 0;
+
+  if (!name || pthread_mutex_lock(&am_ompt_labels_lock)) return 0;
+
+  for (uint32_t i = 0; i < am_ompt_num_labels; i++) {
+    if (!strcmp(am_ompt_labels[i], name)) {
+      id = AM_OMPT_FIRST_LABEL_ID + i;
+      goto out_unlock;
+    }
+  }
+
+  if (am_ompt_num_labels == am_ompt_max_labels) {
+    max_labels = am_ompt_max_labels ? 2 * am_ompt_max_labels : 16;
+
+    if (!(labels = realloc(am_ompt_labels, max_labels * sizeof(*labels))))
+      goto out_unlock;
+
+    am_ompt_labels = labels;
+    am_ompt_max_labels = max_labels;
+  }
+
+  if (!(am_ompt_labels[am_ompt_num_labels] = strdup(name))) goto out_unlock;
+
+  id = AM_OMPT_FIRST_LABEL_ID + am_ompt_num_labels++;
+
+out_unlock:
+  pthread_mutex_unlock(&am_ompt_labels_lock);
+
+  return id;
+}
+
+int am_ompt_annotate_write_labels(struct am_write_buffer* b) {
+  struct am_dsk_counter_description dsk_cd;
+  int ret = 0;
+
+  if (pthread_mutex_lock(&am_ompt_labels_lock)) return 1;
+
+  for (uint32_t i = 0; i < am_ompt_num_labels; i++) {
+    dsk_cd.counter_id = AM_OMPT_FIRST_LABEL_ID + i;
+    dsk_cd.name.str = am_ompt_labels[i];
+    dsk_cd.name.len = strlen(dsk_cd.name.str);
+
+    if (am_dsk_counter_description_write_to_buffer_defid(b, &dsk_cd)) {
+      ret = 1;
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&am_ompt_labels_lock);
+
+  return ret;
+}
+
+int am_ompt_annotate_counter(struct am_buffered_event_collection* c,
+                             uint32_t label, am_timestamp_t now,
+                             int64_t value) {
+  return am_ompt_write_counter(&c->data, c->id, label, now, value);
+}
+
+void am_ompt_annotate_phase_begin(struct am_ompt_phases* p, uint32_t label,
+                                  am_timestamp_t tsc) {
+  if (p->depth < AM_OMPT_MAX_PHASE_DEPTH) {
+    p->stack[p->depth].tsc = tsc;
+    p->stack[p->depth].label = label;
+  }
+
+  p->depth++;
+}
+
+int am_ompt_annotate_phase_end(struct am_ompt_phases* p,
+                               struct am_buffered_event_collection* c) {
+  struct am_ompt_phase* phase;
+  struct am_dsk_interval interval;
+
+  /* Unbalanced ends are ignored */
+  if (!p->depth) return 0;
+
+  if (--p->depth >= AM_OMPT_MAX_PHASE_DEPTH) return 0;
+
+  phase = &p->stack[p->depth];
+
+  /* Clipped to the traced time as the states of the state stack */
+  if (am_ompt_tracing_enabled()) {
+    interval.start =
+        phase->tsc ? phase->tsc
+                   : __atomic_load_n(&am_ompt_resume_tsc, __ATOMIC_RELAXED);
+    interval.end = am_ompt_now();
+  } else {
+    if (!phase->tsc) return 0;
+
+    interval.start = phase->tsc;
+    interval.end = __atomic_load_n(&am_ompt_pause_tsc, __ATOMIC_RELAXED);
+  }
+
+  if (interval.end < interval.start) interval.end = interval.start;
+
+  am_ompt_use_event_type(AM_OMPT_EVENT_PHASE);
+
+  return am_ompt_write_phase(&c->data, c->id, interval, phase->label,
+                             p->depth);
+}
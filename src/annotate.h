@@ -0,0 +1,80 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef AM_OMPT_ANNOTATE_H
+#define AM_OMPT_ANNOTATE_H
+
+#include <stdint.h>
+
+#include <aftermath/trace/buffered_event_collection.h>
+#include <aftermath/trace/timestamp.h>
+#include <aftermath/trace/write_buffer.h>
+
+#define AM_OMPT_MAX_PHASE_DEPTH 16
+
+/* Id of the first label, the ids before are taken by the tool's counters */
+#define AM_OMPT_FIRST_LABEL_ID 1
+
+/* Phase begun by the application and not ended yet */
+struct am_ompt_phase {
+  /* Zero if the phase began while tracing was paused */
+  am_timestamp_t tsc;
+  uint32_t label;
+};
+
+/* Per-thread stack of open phases */
+struct am_ompt_phases {
+  struct am_ompt_phase stack[AM_OMPT_MAX_PHASE_DEPTH];
+  /* Number of open phases, including those nested too deep to be recorded */
+  uint32_t depth;
+};
+
+/*
+  Intern a label, so that the same name always gets the same id. Returns the
+  id or 0 on error. Takes a lock, so labels should be registered once.
+*/
+uint32_t am_ompt_annotate_label(const char* name);
+
+/*
+  Write a counter description for each label to the trace buffer, so that
+  counters and phases can be named. Returns 0 on success.
+*/
+int am_ompt_annotate_write_labels(struct am_write_buffer* b);
+
+/*
+  Write the value of the counter with the given label to the event collection.
+  Returns 0 on success.
+*/
+int am_ompt_annotate_counter(struct am_buffered_event_collection* c,
+                             uint32_t label, am_timestamp_t now, int64_t value);
+
+/*
+  Open a phase with the given label at the given time, zero if tracing is
+  paused.
+*/
+void am_ompt_annotate_phase_begin(struct am_ompt_phases* p, uint32_t label,
+                                  am_timestamp_t tsc);
+
+/*
+  Close the innermost open phase and write it to the event collection,
+  clipped to the time tracing was active. Returns 0 on success.
+*/
+int am_ompt_annotate_phase_end(struct am_ompt_phases* p,
+                               struct am_buffered_event_collection* c);
+
+#endif
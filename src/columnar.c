@@ -0,0 +1,410 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aftermath/trace/buffered_event_collection.h>
+
+#include "columnar.h"
+#include "writer.h"
+
+/* Column of an event type */
+struct am_ompt_columnar_field {
+  const char* name;
+  enum am_ompt_columnar_type type;
+  enum am_ompt_columnar_encoding encoding;
+};
+
+#define AM_OMPT_COLUMNAR_TYPE_uint8_t AM_OMPT_COLUMNAR_UINT8
+#define AM_OMPT_COLUMNAR_TYPE_int32_t AM_OMPT_COLUMNAR_INT32
+#define AM_OMPT_COLUMNAR_TYPE_uint32_t AM_OMPT_COLUMNAR_UINT32
+#define AM_OMPT_COLUMNAR_TYPE_int64_t AM_OMPT_COLUMNAR_INT64
+#define AM_OMPT_COLUMNAR_TYPE_uint64_t AM_OMPT_COLUMNAR_UINT64
+
+#define AM_OMPT_COLUMNAR_TIME(name)                        \
+  {name, AM_OMPT_COLUMNAR_UINT64, AM_OMPT_COLUMNAR_DELTA},
+
+#define AM_OMPT_COLUMNAR_PREFIX_INTERVAL                      \
+  AM_OMPT_COLUMNAR_TIME("start") AM_OMPT_COLUMNAR_TIME("end")
+#define AM_OMPT_COLUMNAR_PREFIX_POINT AM_OMPT_COLUMNAR_TIME("time")
+
+#define AM_OMPT_COLUMNAR_FIELD(type, name)                       \
+  {#name, AM_OMPT_COLUMNAR_TYPE_##type, AM_OMPT_COLUMNAR_PLAIN},
+
+/* Columns of each event type in frame order */
+#define AM_OMPT_COLUMNAR_FIELDS(name, NAME, kind)               \
+  static const struct am_ompt_columnar_field                    \
+      am_ompt_columnar_fields_##name[] = {                      \
+          AM_OMPT_COLUMNAR_PREFIX_##kind AM_OMPT_FIELDS_##name( \
+              AM_OMPT_COLUMNAR_FIELD)};
+AM_OMPT_EVENTS(AM_OMPT_COLUMNAR_FIELDS)
+#undef AM_OMPT_COLUMNAR_FIELDS
+
+struct am_ompt_columnar_schema {
+  const char* name;
+  const struct am_ompt_columnar_field* fields;
+  uint32_t num_fields;
+  uint32_t frame_size;
+};
+
+static const struct am_ompt_columnar_schema
+    am_ompt_columnar_schemas[AM_OMPT_NUM_EVENTS] = {
+#define AM_OMPT_COLUMNAR_SCHEMA(name, NAME, kind)      \
+  {#name, am_ompt_columnar_fields_##name,              \
+   sizeof(am_ompt_columnar_fields_##name) /            \
+       sizeof(am_ompt_columnar_fields_##name[0]),      \
+   sizeof(uint32_t) + AM_OMPT_EVENT_SIZE(name, kind)},
+        AM_OMPT_EVENTS(AM_OMPT_COLUMNAR_SCHEMA)
+#undef AM_OMPT_COLUMNAR_SCHEMA
+};
+
+static const uint32_t am_ompt_columnar_widths[] = {
+    [AM_OMPT_COLUMNAR_UINT8] = sizeof(uint8_t),
+    [AM_OMPT_COLUMNAR_INT32] = sizeof(int32_t),
+    [AM_OMPT_COLUMNAR_UINT32] = sizeof(uint32_t),
+    [AM_OMPT_COLUMNAR_INT64] = sizeof(int64_t),
+    [AM_OMPT_COLUMNAR_UINT64] = sizeof(uint64_t)};
+
+/* Offset of the first column in a frame, after type and collection id */
+#define AM_OMPT_COLUMNAR_FIELDS_OFFSET (2 * sizeof(uint32_t))
+
+/*
+  Get the size of the frame at pos and its event type, AM_OMPT_NUM_EVENTS
+  for the counter events of core migrations. Returns 0 at the end of the
+  buffer.
+*/
+static size_t am_ompt_columnar_frame(const uint8_t* data, size_t used,
+                                     size_t pos, uint32_t* type) {
+  uint32_t type_id;
+  size_t size;
+
+  if (used - pos < sizeof(type_id)) return 0;
+
+  memcpy(&type_id, &data[pos], sizeof(type_id));
+
+  if (type_id >= AM_OMPT_TYPE_ID_BASE &&
+      type_id < AM_OMPT_TYPE_ID_BASE + AM_OMPT_NUM_EVENTS) {
+    *type = type_id - AM_OMPT_TYPE_ID_BASE;
+    size = am_ompt_columnar_schemas[*type].frame_size;
+  } else {
+    *type = AM_OMPT_NUM_EVENTS;
+    size = AM_OMPT_COUNTER_FRAME_SIZE;
+  }
+
+  return used - pos < size ? 0 : size;
+}
+
+/* Load a value of a column from a frame, widened to 64 bits */
+static uint64_t am_ompt_columnar_load(const uint8_t* p,
+                                      enum am_ompt_columnar_type type) {
+  uint8_t u8;
+  int32_t i32;
+  uint32_t u32;
+  uint64_t u64;
+
+  switch (type) {
+    case AM_OMPT_COLUMNAR_UINT8:
+      memcpy(&u8, p, sizeof(u8));
+      return u8;
+    case AM_OMPT_COLUMNAR_INT32:
+      memcpy(&i32, p, sizeof(i32));
+      return (uint64_t)(int64_t)i32;
+    case AM_OMPT_COLUMNAR_UINT32:
+      memcpy(&u32, p, sizeof(u32));
+      return u32;
+    default:
+      memcpy(&u64, p, sizeof(u64));
+      return u64;
+  }
+}
+
+static inline int am_ompt_columnar_less(uint64_t a, uint64_t b,
+                                        enum am_ompt_columnar_type type) {
+  if (type == AM_OMPT_COLUMNAR_INT32 || type == AM_OMPT_COLUMNAR_INT64)
+    return (int64_t)a < (int64_t)b;
+
+  return a < b;
+}
+
+/* Pad the file with zeros to a multiple of 8 bytes */
+static int am_ompt_columnar_align(FILE* fp, uint64_t* offset) {
+  static const uint8_t zeros[8];
+  size_t n = (8 - *offset % 8) % 8;
+
+  if (n && fwrite(zeros, 1, n, fp) != n) return 1;
+
+  *offset += n;
+
+  return 0;
+}
+
+/* Number of blocks of the statistics of a column of n events */
+static inline uint64_t am_ompt_columnar_num_blocks(uint64_t n) {
+  return (n + AM_OMPT_COLUMNAR_BLOCK_ROWS - 1) / AM_OMPT_COLUMNAR_BLOCK_ROWS;
+}
+
+/* Size of the data and the statistics of a column of n events, both padded
+   to a multiple of 8 bytes */
+static inline uint64_t am_ompt_columnar_size(
+    const struct am_ompt_columnar_field* f, uint64_t n) {
+  uint32_t width = f->encoding == AM_OMPT_COLUMNAR_DELTA
+                       ? sizeof(int64_t)
+                       : am_ompt_columnar_widths[f->type];
+
+  return (n * width + 7) / 8 * 8 +
+         am_ompt_columnar_num_blocks(n) * 2 * sizeof(uint64_t);
+}
+
+/*
+  Write the data and the statistics of a column from the frames at the given
+  offsets in the buffer of an event collection, one block at a time
+*/
+static int am_ompt_columnar_write_column(FILE* fp, uint64_t* offset,
+                                         const uint8_t* data,
+                                         const size_t* frames, uint64_t n,
+                                         const struct am_ompt_columnar_field* f,
+                                         size_t field_offset, uint8_t* block,
+                                         uint64_t* stats) {
+  uint32_t width = am_ompt_columnar_widths[f->type];
+  uint32_t stride =
+      f->encoding == AM_OMPT_COLUMNAR_DELTA ? sizeof(int64_t) : width;
+  uint64_t prev = 0, v, b;
+  int64_t delta;
+  size_t k;
+
+  for (uint64_t i = 0; i < n; i += k) {
+    b = i / AM_OMPT_COLUMNAR_BLOCK_ROWS;
+
+    for (k = 0; k < AM_OMPT_COLUMNAR_BLOCK_ROWS && i + k < n; k++) {
+      const uint8_t* p = &data[frames[i + k] + field_offset];
+
+      v = am_ompt_columnar_load(p, f->type);
+
+      if (!k || am_ompt_columnar_less(v, stats[2 * b], f->type))
+        stats[2 * b] = v;
+
+      if (!k || am_ompt_columnar_less(stats[2 * b + 1], v, f->type))
+        stats[2 * b + 1] = v;
+
+      if (f->encoding == AM_OMPT_COLUMNAR_DELTA) {
+        delta = (int64_t)(v - prev);
+        memcpy(&block[k * stride], &delta, sizeof(delta));
+        prev = v;
+      } else {
+        memcpy(&block[k * width], p, width);
+      }
+    }
+
+    if (fwrite(block, stride, k, fp) != k) return 1;
+
+    *offset += k * stride;
+  }
+
+  if (am_ompt_columnar_align(fp, offset)) return 1;
+
+  b = am_ompt_columnar_num_blocks(n);
+
+  if (fwrite(stats, 2 * sizeof(uint64_t), b, fp) != b) return 1;
+
+  *offset += b * 2 * sizeof(uint64_t);
+
+  return 0;
+}
+
+/* Write the tables of an event collection, in the order of the event types.
+   counts holds the number of events of each type. */
+static int am_ompt_columnar_write_collection(
+    FILE* fp, uint64_t* offset, const struct am_buffered_event_collection* c,
+    const uint64_t* counts, uint8_t* block) {
+  const struct am_ompt_columnar_schema* s;
+  size_t* frames = NULL;
+  uint64_t* stats = NULL;
+  size_t starts[AM_OMPT_NUM_EVENTS + 1];
+  size_t fill[AM_OMPT_NUM_EVENTS];
+  size_t pos = 0, size, field_offset, max_blocks = 0;
+  uint32_t type;
+  int ret = 1;
+
+  starts[0] = 0;
+
+  for (uint32_t t = 0; t < AM_OMPT_NUM_EVENTS; t++) {
+    starts[t + 1] = starts[t] + counts[t];
+    fill[t] = starts[t];
+
+    if (am_ompt_columnar_num_blocks(counts[t]) > max_blocks)
+      max_blocks = am_ompt_columnar_num_blocks(counts[t]);
+  }
+
+  if (!starts[AM_OMPT_NUM_EVENTS]) return 0;
+
+  /* Offsets of the frames of each type, grouped by type */
+  if (!(frames = malloc(starts[AM_OMPT_NUM_EVENTS] * sizeof(*frames))) ||
+      !(stats = malloc(max_blocks * 2 * sizeof(*stats))))
+    goto out;
+
+  while ((size = am_ompt_columnar_frame(c->data.data, c->data.used, pos,
+                                        &type))) {
+    if (type < AM_OMPT_NUM_EVENTS) frames[fill[type]++] = pos;
+
+    pos += size;
+  }
+
+  for (type = 0; type < AM_OMPT_NUM_EVENTS; type++) {
+    if (!counts[type]) continue;
+
+    s = &am_ompt_columnar_schemas[type];
+    field_offset = AM_OMPT_COLUMNAR_FIELDS_OFFSET;
+
+    for (uint32_t i = 0; i < s->num_fields; i++) {
+      if (am_ompt_columnar_write_column(
+              fp, offset, c->data.data, &frames[starts[type]], counts[type],
+              &s->fields[i], field_offset, block, stats))
+        goto out;
+
+      field_offset += am_ompt_columnar_widths[s->fields[i].type];
+    }
+  }
+
+  ret = 0;
+
+out:
+  free(stats);
+  free(frames);
+
+  return ret;
+}
+
+int am_ompt_columnar_write(const char* trace_file,
+                           struct am_buffered_event_collection** collections,
+                           size_t num) {
+  struct am_ompt_columnar_header header = {0};
+  struct am_ompt_columnar_table table = {0};
+  struct am_ompt_columnar_column column = {0};
+  const struct am_ompt_columnar_schema* s;
+  uint64_t *counts, offset, data_offset;
+  uint8_t* block = NULL;
+  char path[4096];
+  size_t pos, size;
+  uint32_t type;
+  FILE* fp;
+
+  snprintf(path, sizeof(path), "%s.columns", trace_file);
+
+  if (!(counts = calloc(num * AM_OMPT_NUM_EVENTS + 1, sizeof(*counts))))
+    goto out_err;
+
+  if (!(block = malloc(AM_OMPT_COLUMNAR_BLOCK_ROWS * sizeof(uint64_t))))
+    goto out_err_free;
+
+  header.magic = AM_OMPT_COLUMNAR_MAGIC;
+  header.version = AM_OMPT_COLUMNAR_VERSION;
+  header.block_rows = AM_OMPT_COLUMNAR_BLOCK_ROWS;
+
+  for (size_t i = 0; i < num; i++) {
+    const struct am_buffered_event_collection* c = collections[i];
+
+    for (pos = 0; (size = am_ompt_columnar_frame(c->data.data, c->data.used,
+                                                 pos, &type));
+         pos += size) {
+      if (type < AM_OMPT_NUM_EVENTS) counts[i * AM_OMPT_NUM_EVENTS + type]++;
+    }
+
+    for (type = 0; type < AM_OMPT_NUM_EVENTS; type++) {
+      if (!counts[i * AM_OMPT_NUM_EVENTS + type]) continue;
+
+      header.num_tables++;
+      header.num_columns += am_ompt_columnar_schemas[type].num_fields;
+    }
+  }
+
+  if (!(fp = fopen(path, "wb"))) goto out_err_free;
+
+  if (fwrite(&header, sizeof(header), 1, fp) != 1) goto out_err_close;
+
+  for (size_t i = 0; i < num; i++) {
+    for (type = 0; type < AM_OMPT_NUM_EVENTS; type++) {
+      if (!(table.num_rows = counts[i * AM_OMPT_NUM_EVENTS + type])) continue;
+
+      s = &am_ompt_columnar_schemas[type];
+      strncpy(table.name, s->name, sizeof(table.name) - 1);
+      table.collection_id = collections[i]->id;
+      table.num_columns = s->num_fields;
+
+      if (fwrite(&table, sizeof(table), 1, fp) != 1) goto out_err_close;
+
+      table.first_column += s->num_fields;
+    }
+  }
+
+  /* Columns are laid out in the order of the tables */
+  data_offset = sizeof(header) + header.num_tables * sizeof(table) +
+                header.num_columns * sizeof(column);
+  data_offset = (data_offset + 7) / 8 * 8;
+
+  for (size_t i = 0; i < num; i++) {
+    for (type = 0; type < AM_OMPT_NUM_EVENTS; type++) {
+      uint64_t n = counts[i * AM_OMPT_NUM_EVENTS + type];
+
+      if (!n) continue;
+
+      s = &am_ompt_columnar_schemas[type];
+
+      for (uint32_t f = 0; f < s->num_fields; f++) {
+        strncpy(column.name, s->fields[f].name, sizeof(column.name) - 1);
+        column.type = s->fields[f].type;
+        column.encoding = s->fields[f].encoding;
+        column.data_offset = data_offset;
+        column.stats_offset =
+            data_offset + am_ompt_columnar_size(&s->fields[f], n) -
+            am_ompt_columnar_num_blocks(n) * 2 * sizeof(uint64_t);
+        data_offset += am_ompt_columnar_size(&s->fields[f], n);
+
+        if (fwrite(&column, sizeof(column), 1, fp) != 1) goto out_err_close;
+      }
+    }
+  }
+
+  offset = sizeof(header) + header.num_tables * sizeof(table) +
+           header.num_columns * sizeof(column);
+
+  if (am_ompt_columnar_align(fp, &offset)) goto out_err_close;
+
+  for (size_t i = 0; i < num; i++) {
+    if (am_ompt_columnar_write_collection(fp, &offset, collections[i],
+                                          &counts[i * AM_OMPT_NUM_EVENTS],
+                                          block))
+      goto out_err_close;
+  }
+
+  if (fclose(fp)) goto out_err_free;
+
+  free(block);
+  free(counts);
+
+  return 0;
+
+out_err_close:
+  fclose(fp);
+out_err_free:
+  free(block);
+  free(counts);
+out_err:
+  return 1;
+}
@@ -0,0 +1,107 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef AM_OMPT_COLUMNAR_H
+#define AM_OMPT_COLUMNAR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+  Columnar copy of the events of a trace, written to <trace>.columns on exit
+  if AFTEROMPT_COLUMNAR is set. The file consists of a header, the tables,
+  the columns of all tables and the data of the columns, the first three as
+  arrays of the structures below in native byte order. The structures have
+  no padding.
+
+  A table holds the events of one type recorded by one event collection, in
+  the order in which they were recorded. Its columns are start and end for
+  intervals or time for other events, followed by the fields of the event in
+  the order of AM_OMPT_FIELDS_<name>. The data of a column is an array with
+  one element per event, followed by the statistics of the column. Both
+  start at a multiple of 8 bytes from the beginning of the file.
+
+  Time columns are delta encoded: each element is the difference to the
+  previous time of the column as int64_t, the first one the time itself.
+  Other columns are plain arrays of their type.
+
+  The statistics hold the minimum and maximum of the decoded values of the
+  column for each block of block_rows events, as int64_t for signed types and
+  uint64_t otherwise, so that scans can skip blocks.
+*/
+#define AM_OMPT_COLUMNAR_MAGIC 0x4c434f41
+#define AM_OMPT_COLUMNAR_VERSION 1
+
+/* Events per block of the column statistics */
+#define AM_OMPT_COLUMNAR_BLOCK_ROWS 4096
+
+/* Size of the names of tables and columns, including the terminating zero */
+#define AM_OMPT_COLUMNAR_MAX_NAME 32
+
+enum am_ompt_columnar_type {
+  AM_OMPT_COLUMNAR_UINT8 = 0,
+  AM_OMPT_COLUMNAR_INT32,
+  AM_OMPT_COLUMNAR_UINT32,
+  AM_OMPT_COLUMNAR_INT64,
+  AM_OMPT_COLUMNAR_UINT64
+};
+
+enum am_ompt_columnar_encoding {
+  AM_OMPT_COLUMNAR_PLAIN = 0,
+  /* Differences to the previous element as int64_t */
+  AM_OMPT_COLUMNAR_DELTA
+};
+
+struct am_ompt_columnar_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_tables;
+  uint32_t num_columns;
+  uint32_t block_rows;
+  uint32_t reserved;
+};
+
+struct am_ompt_columnar_table {
+  /* Name of the event type, e.g. "loop_chunk" */
+  char name[AM_OMPT_COLUMNAR_MAX_NAME];
+  uint32_t collection_id;
+  /* Index of the first column of the table in the columns */
+  uint32_t first_column;
+  uint32_t num_columns;
+  uint32_t reserved;
+  uint64_t num_rows;
+};
+
+struct am_ompt_columnar_column {
+  char name[AM_OMPT_COLUMNAR_MAX_NAME];
+  uint32_t type;
+  uint32_t encoding;
+  /* File offsets of the data and of the statistics */
+  uint64_t data_offset;
+  uint64_t stats_offset;
+};
+
+struct am_buffered_event_collection;
+
+/* Write the events of the event collections to <trace_file>.columns.
+   Returns 0 on success. */
+int am_ompt_columnar_write(const char* trace_file,
+                           struct am_buffered_event_collection** collections,
+                           size_t num);
+
+#endif
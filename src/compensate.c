@@ -0,0 +1,272 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "afterompt.h"
+#include "compensate.h"
+#include "writer.h"
+
+struct am_ompt_tool_cost am_ompt_tool_cost;
+
+static size_t am_ompt_calibration_rounds = AM_OMPT_DEFAULT_CALIBRATION_ROUNDS;
+
+/* Type id of the interval written at the end of each kind of state, zero for
+   kinds that are not calibrated */
+static const uint32_t am_ompt_compensate_type_ids[AM_OMPT_NUM_STATE_KINDS] = {
+    [AM_OMPT_STATE_PARALLEL] = AM_OMPT_TYPE_ID_PARALLEL,
+    [AM_OMPT_STATE_IMPLICIT_TASK] = AM_OMPT_TYPE_ID_IMPLICIT_TASK,
+    [AM_OMPT_STATE_SYNC_REGION_WAIT] = AM_OMPT_TYPE_ID_SYNC_REGION_WAIT,
+    [AM_OMPT_STATE_WORK] = AM_OMPT_TYPE_ID_WORK,
+    [AM_OMPT_STATE_MASTER] = AM_OMPT_TYPE_ID_MASTER,
+    [AM_OMPT_STATE_SYNC_REGION] = AM_OMPT_TYPE_ID_SYNC_REGION,
+    [AM_OMPT_STATE_NEST_LOCK] = AM_OMPT_TYPE_ID_NEST_LOCK,
+    [AM_OMPT_STATE_LOOP] = AM_OMPT_TYPE_ID_LOOP};
+
+/* Invoke the begin or end callback of a kind of state with dummy arguments */
+static void am_ompt_compensate_invoke(enum am_ompt_state_kind kind,
+                                      ompt_scope_endpoint_t endpoint) {
+  static ompt_data_t data;
+
+  switch (kind) {
+    case AM_OMPT_STATE_PARALLEL:
+      if (endpoint == ompt_scope_begin)
+        am_callback_parallel_begin(&data, NULL, &data, 1, 0, NULL);
+      else
+        am_callback_parallel_end(&data, &data, 0, NULL);
+      break;
+    case AM_OMPT_STATE_IMPLICIT_TASK:
+      am_callback_implicit_task(endpoint, &data, data, 1, 0, 0);
+      break;
+    case AM_OMPT_STATE_SYNC_REGION_WAIT:
+      am_callback_sync_region_wait(ompt_sync_region_barrier, endpoint, &data,
+                                   &data, NULL);
+      break;
+    case AM_OMPT_STATE_WORK:
+      /* Not a loop, which would also begin a loop traced with dispatch */
+      am_callback_work(ompt_work_sections, endpoint, &data, &data, 1, NULL);
+      break;
+    case AM_OMPT_STATE_MASTER:
+      am_callback_master(endpoint, &data, &data, NULL);
+      break;
+    case AM_OMPT_STATE_SYNC_REGION:
+      am_callback_sync_region(ompt_sync_region_barrier, endpoint, &data, &data,
+                              NULL);
+      break;
+    case AM_OMPT_STATE_NEST_LOCK:
+      am_callback_nest_lock(endpoint, 0, NULL);
+      break;
+    case AM_OMPT_STATE_LOOP:
+      if (endpoint == ompt_scope_begin)
+        am_callback_loop_begin(&data, &data, 0, 0, 0, 1, 1, NULL);
+      else
+        am_callback_loop_end(&data, &data);
+      break;
+    default:
+      break;
+  }
+}
+
+/* Time between two timestamps without the cost of taking a timestamp */
+static inline am_timestamp_t am_ompt_compensate_delta(am_timestamp_t from,
+                                                      am_timestamp_t to,
+                                                      am_timestamp_t timer) {
+  return (to > from + timer) ? to - from - timer : 0;
+}
+
+/* Discard everything the previous round left in the scratch thread data */
+static void am_ompt_compensate_reset(struct am_ompt_thread_data* td) {
+  td->event_collection->data.used = 0;
+  td->state_stack.top = 0;
+  td->num_placements = 1;
+  td->core = am_ompt_getcpu();
+}
+
+/* Minimal time between two consecutive timestamps */
+static am_timestamp_t am_ompt_calibrate_timer(void) {
+  am_timestamp_t min = UINT64_MAX;
+
+  for (size_t i = 0; i < am_ompt_calibration_rounds; i++) {
+    am_timestamp_t t0 = am_ompt_now();
+    am_timestamp_t t1 = am_ompt_now();
+
+    if (t1 - t0 < min) min = t1 - t0;
+  }
+
+  return min;
+}
+
+/* Minimal cost of a callback writing a single point event */
+static am_timestamp_t am_ompt_calibrate_callback(
+    struct am_ompt_thread_data* td, am_timestamp_t timer) {
+  am_timestamp_t min = UINT64_MAX;
+
+  for (size_t i = 0; i < am_ompt_calibration_rounds; i++) {
+    am_ompt_compensate_reset(td);
+
+    am_timestamp_t t0 = am_ompt_now();
+    am_callback_flush(NULL, NULL);
+    am_timestamp_t t1 = am_ompt_now();
+
+    am_timestamp_t d = am_ompt_compensate_delta(t0, t1, timer);
+
+    if (d < min) min = d;
+  }
+
+  return min;
+}
+
+/*
+  Measure the minimal cost of the begin and end callbacks of a kind of state
+  and the minimal tool time recorded within an empty interval of the kind.
+  Minima are used so that the compensation never exceeds the actual cost and
+  compensated intervals still nest. Returns 0 on success.
+*/
+static int am_ompt_calibrate_state(struct am_ompt_thread_data* td,
+                                   enum am_ompt_state_kind kind,
+                                   am_timestamp_t timer,
+                                   struct am_ompt_tool_cost* cost) {
+  struct am_write_buffer* b = &td->event_collection->data;
+  am_timestamp_t begin = UINT64_MAX, end = UINT64_MAX;
+  am_timestamp_t tail = UINT64_MAX, head = UINT64_MAX;
+  uint32_t type_id;
+  uint64_t start_tsc, end_tsc;
+
+  for (size_t i = 0; i < am_ompt_calibration_rounds; i++) {
+    am_ompt_compensate_reset(td);
+
+    am_timestamp_t t0 = am_ompt_now();
+    am_ompt_compensate_invoke(kind, ompt_scope_begin);
+    am_timestamp_t t1 = am_ompt_now();
+    am_timestamp_t t2 = am_ompt_now();
+    am_ompt_compensate_invoke(kind, ompt_scope_end);
+    am_timestamp_t t3 = am_ompt_now();
+
+    if (b->used < AM_OMPT_TIME_OFFSET_INTERVAL + sizeof(uint64_t)) continue;
+
+    /* Rounds in which the thread migrated start with a counter event */
+    memcpy(&type_id, b->data, sizeof(type_id));
+
+    if (type_id != am_ompt_compensate_type_ids[kind]) continue;
+
+    memcpy(&start_tsc, &b->data[AM_OMPT_TIME_OFFSET_POINT], sizeof(uint64_t));
+    memcpy(&end_tsc, &b->data[AM_OMPT_TIME_OFFSET_INTERVAL], sizeof(uint64_t));
+
+    am_timestamp_t d;
+
+    if ((d = am_ompt_compensate_delta(t0, t1, timer)) < begin) begin = d;
+    if ((d = am_ompt_compensate_delta(t2, t3, timer)) < end) end = d;
+    if ((d = am_ompt_compensate_delta(start_tsc, t1, timer)) < tail) tail = d;
+    if ((d = am_ompt_compensate_delta(t2, end_tsc, timer)) < head) head = d;
+  }
+
+  if (begin == UINT64_MAX) return 1;
+
+  /* The cost of entering a callback is accounted separately */
+  cost->begin[kind] = begin > cost->callback ? begin - cost->callback : 0;
+  cost->end[kind] = end > cost->callback ? end - cost->callback : 0;
+  cost->begin_tail[kind] = tail;
+  cost->end_head[kind] = head;
+
+  return 0;
+}
+
+/* Measure the costs of all callbacks with the scratch thread data */
+static int am_ompt_calibrate(struct am_ompt_thread_data* td,
+                             struct am_ompt_tool_cost* cost) {
+  am_timestamp_t timer = am_ompt_calibrate_timer();
+
+  cost->callback = am_ompt_calibrate_callback(td, timer);
+
+  for (int kind = 0; kind < AM_OMPT_NUM_STATE_KINDS; kind++) {
+    if (!am_ompt_compensate_type_ids[kind]) continue;
+
+    if (am_ompt_calibrate_state(td, kind, timer, cost)) {
+      fprintf(stderr, "Afterompt: Could not calibrate state kind %d.\n", kind);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int am_ompt_compensate_init(pthread_key_t key) {
+  struct am_ompt_tool_cost cost = {0};
+  struct am_ompt_stack_item stack[AM_OMPT_DEFAULT_MAX_STATE_STACK_ENTRIES];
+  struct am_buffered_event_collection c;
+  struct am_ompt_thread_data td;
+  const char* value;
+  int enabled = 0;
+  int ret = 1;
+
+  if ((value = getenv("AFTEROMPT_COMPENSATE"))) sscanf(value, "%d", &enabled);
+
+  if ((value = getenv("AFTEROMPT_CALIBRATION_ROUNDS")))
+    sscanf(value, "%lu", &am_ompt_calibration_rounds);
+
+  if (!enabled || !am_ompt_calibration_rounds) return 0;
+
+  memset(&td, 0, sizeof(td));
+
+  if (am_buffered_event_collection_init(&c, 0,
+                                        AM_OMPT_CALIBRATION_BUFFER_SIZE)) {
+    fprintf(stderr, "Afterompt: Could not initialize calibration buffer.\n");
+    goto out_err;
+  }
+
+  td.max_placements = AM_OMPT_DEFAULT_MAX_PLACEMENTS;
+
+  if (!(td.placements = malloc(sizeof(*td.placements) * td.max_placements))) {
+    fprintf(stderr, "Afterompt: Could not allocate memory for placements\n");
+    goto out_err_destroy;
+  }
+
+  td.event_collection = &c;
+  td.state_stack.stack = stack;
+  td.tid = pthread_self();
+  td.placements[0].start = am_ompt_now();
+  td.placements[0].core = am_ompt_getcpu();
+
+  if (pthread_setspecific(key, &td)) {
+    fprintf(stderr, "Afterompt: Could not set calibration thread data.\n");
+    goto out_err_free;
+  }
+
+  ret = am_ompt_calibrate(&td, &cost);
+
+  pthread_setspecific(key, NULL);
+
+  if (!ret) {
+    am_ompt_tool_cost = cost;
+    am_ompt_use_event_type(AM_OMPT_EVENT_TOOL_TIME);
+
+    fprintf(stderr,
+            "Afterompt: Compensating a callback cost of %lu timestamp "
+            "units.\n",
+            cost.callback);
+  }
+
+out_err_free:
+  free(td.placements);
+out_err_destroy:
+  am_buffered_event_collection_destroy(&c);
+out_err:
+  return ret;
+}
@@ -0,0 +1,63 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef AM_OMPT_COMPENSATE_H
+#define AM_OMPT_COMPENSATE_H
+
+#include <pthread.h>
+
+#include <aftermath/trace/timestamp.h>
+
+#include "trace.h"
+
+/* Number of begin/end pairs timed per callback kind during calibration */
+#define AM_OMPT_DEFAULT_CALIBRATION_ROUNDS 1000
+
+/* Size of the scratch buffer the calibration callbacks write to */
+#define AM_OMPT_CALIBRATION_BUFFER_SIZE 4096
+
+/*
+  Calibrated cost of the tool in trace timestamp units. All costs are zero if
+  compensation is disabled, so that they can be applied unconditionally.
+*/
+struct am_ompt_tool_cost {
+  /* Cost of a callback that writes a single point event */
+  am_timestamp_t callback;
+  /* Cost of the begin and end callbacks of each kind of state beyond the
+     cost of a point event callback */
+  am_timestamp_t begin[AM_OMPT_NUM_STATE_KINDS];
+  am_timestamp_t end[AM_OMPT_NUM_STATE_KINDS];
+  /* Tool time recorded at the beginning and the end of an interval of each
+     kind of state: from the start timestamp until the begin callback returns
+     and from entering the end callback until the end timestamp */
+  am_timestamp_t begin_tail[AM_OMPT_NUM_STATE_KINDS];
+  am_timestamp_t end_head[AM_OMPT_NUM_STATE_KINDS];
+};
+
+extern struct am_ompt_tool_cost am_ompt_tool_cost;
+
+/*
+  Read the compensation settings from the environment and, if compensation
+  is enabled, measure the cost of the callbacks by invoking them on the
+  calling thread with scratch thread data. The thread data key is set
+  to the scratch data during calibration and reset afterwards. Returns 0 on
+  success.
+*/
+int am_ompt_compensate_init(pthread_key_t key);
+
+#endif
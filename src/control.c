@@ -0,0 +1,200 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "control.h"
+#include "trace.h"
+
+int am_ompt_tracing = 1;
+
+am_timestamp_t am_ompt_pause_tsc;
+
+am_timestamp_t am_ompt_resume_tsc;
+
+/* Set once tracing has been ended, so it cannot be resumed anymore */
+static int am_ompt_tracing_ended;
+
+/* Delay before tracing starts and duration of tracing in seconds */
+static double am_ompt_start_delay;
+static double am_ompt_duration;
+
+/* Set while tracing is paused only by the start delay. Any explicit pause or
+   resume clears it, so that the end of the delay does not override it. */
+static int am_ompt_delayed_start;
+
+/* Set while the duration timer waits for tracing to be resumed for the first
+   time, which posts the semaphore */
+static int am_ompt_wait_resume;
+static sem_t am_ompt_first_resume;
+
+void am_ompt_pause_tracing() {
+  __atomic_store_n(&am_ompt_delayed_start, 0, __ATOMIC_RELEASE);
+
+  if (!__atomic_load_n(&am_ompt_tracing, __ATOMIC_ACQUIRE)) return;
+
+  __atomic_store_n(&am_ompt_pause_tsc, am_ompt_now(), __ATOMIC_RELAXED);
+  __atomic_store_n(&am_ompt_tracing, 0, __ATOMIC_RELEASE);
+}
+
+void am_ompt_resume_tracing() {
+  __atomic_store_n(&am_ompt_delayed_start, 0, __ATOMIC_RELEASE);
+
+  if (__atomic_load_n(&am_ompt_tracing_ended, __ATOMIC_ACQUIRE) ||
+      __atomic_load_n(&am_ompt_tracing, __ATOMIC_ACQUIRE))
+    return;
+
+  __atomic_store_n(&am_ompt_resume_tsc, am_ompt_now(), __ATOMIC_RELAXED);
+  __atomic_store_n(&am_ompt_tracing, 1, __ATOMIC_RELEASE);
+
+  /* sem_post is async-signal-safe */
+  if (__atomic_exchange_n(&am_ompt_wait_resume, 0, __ATOMIC_ACQ_REL))
+    sem_post(&am_ompt_first_resume);
+}
+
+void am_ompt_end_tracing() {
+  __atomic_store_n(&am_ompt_tracing_ended, 1, __ATOMIC_RELEASE);
+  am_ompt_pause_tracing();
+}
+
+/* Toggles tracing on each delivery of the control signal */
+static void am_ompt_control_signal_handler(int signum) {
+  if (__atomic_load_n(&am_ompt_tracing, __ATOMIC_ACQUIRE))
+    am_ompt_pause_tracing();
+  else
+    am_ompt_resume_tracing();
+}
+
+static void am_ompt_sleep(double seconds) {
+  struct timespec ts;
+
+  ts.tv_sec = (time_t)seconds;
+  ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+
+  while (nanosleep(&ts, &ts) && errno == EINTR)
+    ;
+}
+
+/* Helper thread starting and stopping tracing after the given times. It is
+   not an OpenMP thread, so it never triggers any callbacks. The duration
+   counts from the first time tracing is active. */
+static void* am_ompt_control_timer(void* arg) {
+  int paused = (int)(intptr_t)arg;
+
+  if (am_ompt_start_delay > 0) {
+    am_ompt_sleep(am_ompt_start_delay);
+
+    if (__atomic_exchange_n(&am_ompt_delayed_start, 0, __ATOMIC_ACQ_REL))
+      am_ompt_resume_tracing();
+  }
+
+  if (am_ompt_duration > 0) {
+    if (paused) {
+      while (sem_wait(&am_ompt_first_resume) && errno == EINTR)
+        ;
+    }
+
+    am_ompt_sleep(am_ompt_duration);
+    am_ompt_end_tracing();
+  }
+
+  return NULL;
+}
+
+int am_ompt_control_init() {
+  const char* value;
+  int signum = 0;
+  int paused = 0;
+
+  if ((value = getenv("AFTEROMPT_START_PAUSED"))) sscanf(value, "%d", &paused);
+
+  if ((value = getenv("AFTEROMPT_START_DELAY")))
+    sscanf(value, "%lf", &am_ompt_start_delay);
+
+  if ((value = getenv("AFTEROMPT_DURATION")))
+    sscanf(value, "%lf", &am_ompt_duration);
+
+  if ((value = getenv("AFTEROMPT_CONTROL_SIGNAL")))
+    sscanf(value, "%d", &signum);
+
+  /* No events besides the bins, tracing cannot be started */
+  if (am_ompt_occupancy_only) {
+    am_ompt_end_tracing();
+    return 0;
+  }
+
+  if (paused || am_ompt_start_delay > 0) am_ompt_pause_tracing();
+
+  /* With AFTEROMPT_START_PAUSED tracing is not started by the delay */
+  if (!paused && am_ompt_start_delay > 0) {
+    __atomic_store_n(&am_ompt_delayed_start, 1, __ATOMIC_RELEASE);
+    paused = 1;
+  }
+
+  if (paused && am_ompt_duration > 0) {
+    if (sem_init(&am_ompt_first_resume, 0, 0)) {
+      fprintf(stderr, "Afterompt: Could not create semaphore.\n");
+      return 1;
+    }
+
+    __atomic_store_n(&am_ompt_wait_resume, 1, __ATOMIC_RELEASE);
+  }
+
+  if (signum > 0) {
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = am_ompt_control_signal_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+
+    if (sigaction(signum, &sa, NULL)) {
+      fprintf(stderr,
+              "Afterompt: Could not install handler for control signal %d.\n",
+              signum);
+      return 1;
+    }
+  }
+
+  if (am_ompt_start_delay > 0 || am_ompt_duration > 0) {
+    pthread_t timer;
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    if (pthread_create(&timer, &attr, am_ompt_control_timer,
+                       (void*)(intptr_t)paused)) {
+      fprintf(stderr, "Afterompt: Could not create control timer thread.\n");
+      pthread_attr_destroy(&attr);
+      return 1;
+    }
+
+    pthread_attr_destroy(&attr);
+  }
+
+  return 0;
+}
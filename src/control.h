@@ -0,0 +1,65 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef AM_OMPT_CONTROL_H
+#define AM_OMPT_CONTROL_H
+
+#include <aftermath/trace/timestamp.h>
+
+/* Non-zero while events are recorded */
+extern int am_ompt_tracing;
+
+/* Time tracing was last paused */
+extern am_timestamp_t am_ompt_pause_tsc;
+
+/* Time tracing was last resumed */
+extern am_timestamp_t am_ompt_resume_tsc;
+
+/*
+  Returns non-zero if events should be recorded. This is checked at the
+  beginning of every callback, so it is kept to a single relaxed load.
+*/
+static inline int am_ompt_tracing_enabled(void) {
+  return __builtin_expect(__atomic_load_n(&am_ompt_tracing, __ATOMIC_RELAXED),
+                          1);
+}
+
+/*
+  Read control settings from the environment, install the control signal
+  handler and start the timer for delayed start and limited duration. Has
+  to be called after the time reference is initialized.
+*/
+int am_ompt_control_init();
+
+/*
+  Stop recording events. Safe to call from a signal handler.
+*/
+void am_ompt_pause_tracing();
+
+/*
+  Start recording events again, unless tracing has been ended. Safe to call
+  from a signal handler.
+*/
+void am_ompt_resume_tracing();
+
+/*
+  Stop recording events for the rest of the execution.
+*/
+void am_ompt_end_tracing();
+
+#endif
@@ -0,0 +1,202 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef AM_OMPT_EVENTS_H
+#define AM_OMPT_EVENTS_H
+
+#include <stdint.h>
+
+/* Events written by Afterompt, as (name, NAME, kind) entries. The on-disk
+   frame of each event is its type id, the id of the event collection, the
+   interval (kind INTERVAL) or the timestamp (kind POINT) and the fields listed
+   in AM_OMPT_FIELDS_<name>. Frame type names are "am::ompt::<name>". */
+#define AM_OMPT_EVENTS(X)                         \
+  X(thread, THREAD, INTERVAL)                     \
+  X(parallel, PARALLEL, INTERVAL)                 \
+  X(task_create, TASK_CREATE, POINT)              \
+  X(task_schedule, TASK_SCHEDULE, POINT)          \
+  X(implicit_task, IMPLICIT_TASK, INTERVAL)       \
+  X(sync_region_wait, SYNC_REGION_WAIT, INTERVAL) \
+  X(mutex_released, MUTEX_RELEASED, POINT)        \
+  X(dependences, DEPENDENCES, POINT)              \
+  X(task_dependence, TASK_DEPENDENCE, POINT)      \
+  X(work, WORK, INTERVAL)                         \
+  X(master, MASTER, INTERVAL)                     \
+  X(sync_region, SYNC_REGION, INTERVAL)           \
+  X(lock_init, LOCK_INIT, POINT)                  \
+  X(lock_destroy, LOCK_DESTROY, POINT)            \
+  X(mutex_acquire, MUTEX_ACQUIRE, POINT)          \
+  X(mutex_acquired, MUTEX_ACQUIRED, POINT)        \
+  X(nest_lock, NEST_LOCK, INTERVAL)               \
+  X(flush, FLUSH, POINT)                          \
+  X(cancel, CANCEL, POINT)                        \
+  X(loop, LOOP, INTERVAL)                         \
+  X(loop_chunk, LOOP_CHUNK, POINT)                \
+  X(governor, GOVERNOR, POINT)                    \
+  X(tool_time, TOOL_TIME, POINT)                  \
+  X(sample, SAMPLE, POINT)                        \
+  X(occupancy, OCCUPANCY, POINT)                  \
+  X(phase, PHASE, INTERVAL)
+
+/* Fields of each event in on-disk order, as (type, name) entries */
+#define AM_OMPT_FIELDS_thread(F) F(int32_t, thread_type)
+
+#define AM_OMPT_FIELDS_parallel(F)                     \
+  F(uint32_t, requested_parallelism) F(int32_t, flags)
+
+#define AM_OMPT_FIELDS_task_create(F)                                     \
+  F(uint64_t, current_task_id) F(uint64_t, new_task_id) F(int32_t, flags) \
+  F(int32_t, has_dependences) F(uint64_t, codeptr_ra)
+
+#define AM_OMPT_FIELDS_task_schedule(F)                \
+  F(uint64_t, prior_task_id) F(uint64_t, next_task_id) \
+  F(int32_t, prior_task_status)
+
+#define AM_OMPT_FIELDS_implicit_task(F)             \
+  F(uint32_t, actual_parallelism) F(int32_t, flags)
+
+#define AM_OMPT_FIELDS_sync_region_wait(F) F(int32_t, kind)
+
+#define AM_OMPT_FIELDS_mutex_released(F) F(uint64_t, wait_id) F(int32_t, kind)
+
+#define AM_OMPT_FIELDS_dependences(F) F(int32_t, ndeps)
+
+#define AM_OMPT_FIELDS_task_dependence(F)            \
+  F(uint64_t, src_task_id) F(uint64_t, sink_task_id)
+
+#define AM_OMPT_FIELDS_work(F) F(int32_t, wstype) F(uint64_t, count)
+
+#define AM_OMPT_FIELDS_master(F)
+
+#define AM_OMPT_FIELDS_sync_region(F) F(int32_t, kind)
+
+#define AM_OMPT_FIELDS_lock_init(F) F(uint64_t, wait_id) F(int32_t, kind)
+
+#define AM_OMPT_FIELDS_lock_destroy(F) F(uint64_t, wait_id) F(int32_t, kind)
+
+#define AM_OMPT_FIELDS_mutex_acquire(F)                   \
+  F(uint64_t, wait_id) F(int32_t, kind) F(uint32_t, hint) \
+  F(uint32_t, impl)
+
+#define AM_OMPT_FIELDS_mutex_acquired(F) F(uint64_t, wait_id) F(int32_t, kind)
+
+#define AM_OMPT_FIELDS_nest_lock(F) F(uint64_t, wait_id)
+
+#define AM_OMPT_FIELDS_flush(F)
+
+#define AM_OMPT_FIELDS_cancel(F) F(int32_t, flags)
+
+#define AM_OMPT_FIELDS_loop(F)                                          \
+  F(uint64_t, instance_id) F(int32_t, flags) F(int64_t, lower_bound)    \
+  F(int64_t, upper_bound) F(int64_t, increment) F(int32_t, num_workers) \
+  F(uint64_t, codeptr_ra)
+
+#define AM_OMPT_FIELDS_loop_chunk(F)               \
+  F(uint64_t, instance_id) F(int64_t, lower_bound) \
+  F(int64_t, upper_bound) F(uint8_t, is_last)
+
+/* Transition of the events of type type_id at codeptr_ra to another mode.
+   When returning to full mode, count and duration summarize the events that
+   were aggregated since the last transition. */
+#define AM_OMPT_FIELDS_governor(F)                              \
+  F(uint64_t, codeptr_ra) F(uint32_t, type_id) F(int32_t, mode) \
+  F(uint64_t, count) F(uint64_t, duration)
+
+/* Calibrated time spent in the callbacks of the tool during the interval of
+   type type_id that ends at the same time. Written right after the interval
+   if tracing overhead is compensated and the interval had nested callbacks. */
+#define AM_OMPT_FIELDS_tool_time(F) F(uint32_t, type_id) F(uint64_t, duration)
+
+/* Program counter sampled while the thread was in the innermost state of the
+   given kind (-1 if none) and OpenMP state omp_state (-1 if unknown). The
+   task id is the explicit task executed at the time, codeptr_ra is set for
+   loop states. */
+#define AM_OMPT_FIELDS_sample(F)                                              \
+  F(uint64_t, pc) F(int32_t, kind) F(int32_t, omp_state) F(uint64_t, task_id) \
+  F(uint64_t, codeptr_ra)
+
+/* Time spent in the given state (enum am_ompt_occupancy_state in
+   occupancy.h) during the bin that starts at the time of the event and spans
+   width timestamp units, and the number of times the state was entered in
+   the bin. Written when the bin is over, for each state with time or
+   entries. */
+#define AM_OMPT_FIELDS_occupancy(F)                        \
+  F(uint64_t, width) F(uint32_t, state) F(uint32_t, count) \
+  F(uint64_t, duration)
+
+/* Phase of the application marked with the annotation API. The label is
+   the id of a counter description holding its name and depth is the number
+   of enclosing phases of the thread. */
+#define AM_OMPT_FIELDS_phase(F) F(uint32_t, label) F(uint32_t, depth)
+
+/* Size of the common part of the frame after the type id */
+#define AM_OMPT_PREFIX_SIZE_INTERVAL (sizeof(uint32_t) + 2 * sizeof(uint64_t))
+#define AM_OMPT_PREFIX_SIZE_POINT (sizeof(uint32_t) + sizeof(uint64_t))
+
+#define AM_OMPT_FIELD_SIZE(type, name) +sizeof(type)
+
+/* Size of the frame of an event without its type id */
+#define AM_OMPT_EVENT_SIZE(name, kind)                                   \
+  (AM_OMPT_PREFIX_SIZE_##kind AM_OMPT_FIELDS_##name(AM_OMPT_FIELD_SIZE))
+
+/* Offset of the time at which an event was recorded, i.e. the end of
+   intervals, in its frame including the type id */
+#define AM_OMPT_TIME_OFFSET_INTERVAL (2 * sizeof(uint32_t) + sizeof(uint64_t))
+#define AM_OMPT_TIME_OFFSET_POINT (2 * sizeof(uint32_t))
+
+/* Size and time offset of counter event frames: type id, collection id,
+   counter id, time and value */
+#define AM_OMPT_COUNTER_FRAME_SIZE (3 * sizeof(uint32_t) + 2 * sizeof(uint64_t))
+#define AM_OMPT_COUNTER_TIME_OFFSET (3 * sizeof(uint32_t))
+
+/*
+  Optional indexes appended after the frames of a trace. Each index is
+  followed by a footer with the file offset of its first entry (uint64_t),
+  the number of entries (uint64_t), the size of an entry (uint32_t) and the
+  magic number of the index (uint32_t). Readers find the last index from the
+  end of the file and each preceding one from the footer right before the
+  first entry of the next.
+
+  The time index consists of one entry per event in order of the recording
+  time across all collections, with the entries of equal time of a collection
+  in the order of their frames: the time (uint64_t), the id of the
+  event collection (uint32_t) and the file offset of the frame (uint64_t).
+*/
+#define AM_OMPT_INDEX_MAGIC 0x49544f41
+#define AM_OMPT_INDEX_ENTRY_SIZE (2 * sizeof(uint64_t) + sizeof(uint32_t))
+#define AM_OMPT_INDEX_FOOTER_SIZE (2 * sizeof(uint64_t) + 2 * sizeof(uint32_t))
+
+/*
+  The seek index holds sparse entries per event collection, ordered by the id
+  of the collection and by time: the latest recording time of the frames of
+  the collection up to the entry (uint64_t), the file offset of the frame
+  (uint64_t), the id of the event collection (uint32_t) and the number of
+  states open at that time (uint32_t), whose intervals follow the frame.
+*/
+#define AM_OMPT_SEEK_INDEX_MAGIC 0x4b534f41
+#define AM_OMPT_SEEK_INDEX_ENTRY_SIZE \
+  (2 * sizeof(uint64_t) + 2 * sizeof(uint32_t))
+
+enum am_ompt_event_type {
+#define AM_OMPT_EVENT_ENUM(name, NAME, kind) AM_OMPT_EVENT_##NAME,
+  AM_OMPT_EVENTS(AM_OMPT_EVENT_ENUM)
+#undef AM_OMPT_EVENT_ENUM
+  AM_OMPT_NUM_EVENTS
+};
+
+#endif
@@ -0,0 +1,416 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <link.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter.h"
+
+int am_ompt_filter_enabled = 0;
+
+int am_ompt_filter_threads = 0;
+
+/* Traced threads are those whose number is a multiple of the stride, below
+   the first, or in one of the ranges of numbers */
+static uint32_t am_ompt_filter_thread_stride;
+static uint32_t am_ompt_filter_thread_first;
+static struct am_ompt_filter_table am_ompt_filter_thread_numbers;
+
+/* Number of the last thread that began, the initial thread is 0 */
+static uint32_t am_ompt_filter_last_thread;
+
+/* Set if only included ranges are traced */
+static int am_ompt_filter_inclusive;
+
+static struct am_ompt_filter_table am_ompt_filter_include;
+static struct am_ompt_filter_table am_ompt_filter_exclude;
+
+/* File mapped into the address space, from /proc/self/maps */
+struct am_ompt_filter_mapping {
+  uint64_t start;
+  uint64_t end;
+  /* Lowest address the file is mapped at, i.e. its load base */
+  uint64_t base;
+  int executable;
+  char* path;
+};
+
+/* Mapped files of the process */
+struct am_ompt_filter_maps {
+  struct am_ompt_filter_mapping* mappings;
+  size_t num_mappings;
+  size_t max_mappings;
+};
+
+static int am_ompt_filter_add(struct am_ompt_filter_table* t, uint64_t start,
+                              uint64_t end) {
+  struct am_ompt_filter_range* ranges;
+  size_t max_ranges;
+
+  if (start >= end) return 0;
+
+  if (t->num_ranges == t->max_ranges) {
+    max_ranges = t->max_ranges ? 2 * t->max_ranges
+                               : AM_OMPT_DEFAULT_FILTER_RANGES;
+
+    if (!(ranges = realloc(t->ranges, max_ranges * sizeof(*ranges)))) return 1;
+
+    t->ranges = ranges;
+    t->max_ranges = max_ranges;
+  }
+
+  t->ranges[t->num_ranges].start = start;
+  t->ranges[t->num_ranges].end = end;
+  t->num_ranges++;
+
+  return 0;
+}
+
+static int am_ompt_filter_compare(const void* a, const void* b) {
+  const struct am_ompt_filter_range* ra = a;
+  const struct am_ompt_filter_range* rb = b;
+
+  return (ra->start > rb->start) - (ra->start < rb->start);
+}
+
+/* Sort the ranges and merge the overlapping ones */
+static void am_ompt_filter_sort(struct am_ompt_filter_table* t) {
+  size_t n = 0;
+
+  if (!t->num_ranges) return;
+
+  qsort(t->ranges, t->num_ranges, sizeof(*t->ranges), am_ompt_filter_compare);
+
+  for (size_t i = 1; i < t->num_ranges; i++) {
+    if (t->ranges[i].start <= t->ranges[n].end) {
+      if (t->ranges[i].end > t->ranges[n].end)
+        t->ranges[n].end = t->ranges[i].end;
+    } else {
+      t->ranges[++n] = t->ranges[i];
+    }
+  }
+
+  t->num_ranges = n + 1;
+}
+
+/* Returns 1 if the address is in one of the ranges */
+static int am_ompt_filter_find(const struct am_ompt_filter_table* t,
+                               uint64_t addr) {
+  size_t lo = 0;
+  size_t hi = t->num_ranges;
+
+  /* Find the first range starting after the address */
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+
+    if (t->ranges[mid].start <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo > 0 && addr < t->ranges[lo - 1].end;
+}
+
+int am_ompt_filter_admit(uint64_t codeptr_ra) {
+  if (am_ompt_filter_find(&am_ompt_filter_exclude, codeptr_ra)) return 0;
+
+  return !am_ompt_filter_inclusive ||
+         am_ompt_filter_find(&am_ompt_filter_include, codeptr_ra);
+}
+
+static void am_ompt_filter_free_maps(struct am_ompt_filter_maps* m) {
+  for (size_t i = 0; i < m->num_mappings; i++) free(m->mappings[i].path);
+
+  free(m->mappings);
+}
+
+/* Read the file mappings of the process */
+static int am_ompt_filter_read_maps(struct am_ompt_filter_maps* m) {
+  struct am_ompt_filter_mapping* mappings;
+  struct am_ompt_filter_mapping* mapping;
+  char line[4096];
+  char perms[5];
+  uint64_t start, end, offset;
+  size_t max_mappings;
+  FILE* fp;
+  int n;
+
+  m->mappings = NULL;
+  m->num_mappings = 0;
+  m->max_mappings = 0;
+
+  if (!(fp = fopen("/proc/self/maps", "r"))) return 1;
+
+  while (fgets(line, sizeof(line), fp)) {
+    if (sscanf(line, "%lx-%lx %4s %lx %*s %*s %n", &start, &end, perms,
+               &offset, &n) != 4 ||
+        line[n] != '/')
+      continue;
+
+    line[strcspn(line, "\n")] = '\0';
+
+    if (m->num_mappings == m->max_mappings) {
+      max_mappings = m->max_mappings ? 2 * m->max_mappings
+                                     : AM_OMPT_DEFAULT_FILTER_MAPPINGS;
+
+      if (!(mappings = realloc(m->mappings, max_mappings * sizeof(*mappings))))
+        goto out_err;
+
+      m->mappings = mappings;
+      m->max_mappings = max_mappings;
+    }
+
+    mapping = &m->mappings[m->num_mappings];
+
+    if (!(mapping->path = strdup(&line[n]))) goto out_err;
+
+    mapping->start = start;
+    mapping->end = end;
+    mapping->base = start;
+    mapping->executable = (perms[2] == 'x');
+
+    /* Mappings are sorted by address, so the first one of a file is its
+       load base */
+    for (size_t i = 0; i < m->num_mappings; i++) {
+      if (!strcmp(m->mappings[i].path, mapping->path)) {
+        mapping->base = m->mappings[i].base;
+        break;
+      }
+    }
+
+    m->num_mappings++;
+  }
+
+  fclose(fp);
+
+  return 0;
+
+out_err:
+  fclose(fp);
+  am_ompt_filter_free_maps(m);
+  return 1;
+}
+
+static const char* am_ompt_filter_basename(const char* path) {
+  const char* name = strrchr(path, '/');
+
+  return name ? name + 1 : path;
+}
+
+/*
+  Add the code ranges of a single entry to the table. Returns the number of
+  ranges added or -1 on error.
+*/
+static int am_ompt_filter_resolve(struct am_ompt_filter_table* t,
+                                  const char* entry,
+                                  const struct am_ompt_filter_maps* m) {
+  const struct am_ompt_filter_mapping* mapping;
+  const ElfW(Sym) * sym;
+  const char* offsets;
+  uint64_t start, end;
+  size_t len;
+  Dl_info info;
+  void* addr;
+  int num = 0;
+  int n;
+
+  /* Absolute address range */
+  if (sscanf(entry, "%li-%li%n", &start, &end, &n) == 2 && !entry[n])
+    return am_ompt_filter_add(t, start, end) ? -1 : 1;
+
+  /* Range of offsets in a module, as in the construct profile */
+  if ((offsets = strchr(entry, '+'))) {
+    if (sscanf(offsets + 1, "%li-%li%n", &start, &end, &n) != 2 ||
+        offsets[n + 1])
+      return 0;
+
+    len = offsets - entry;
+
+    for (size_t i = 0; i < m->num_mappings; i++) {
+      mapping = &m->mappings[i];
+
+      /* Only the first mapping of each file */
+      if (mapping->start != mapping->base ||
+          strlen(am_ompt_filter_basename(mapping->path)) != len ||
+          strncmp(am_ompt_filter_basename(mapping->path), entry, len))
+        continue;
+
+      if (am_ompt_filter_add(t, mapping->base + start, mapping->base + end))
+        return -1;
+
+      num++;
+    }
+
+    return num;
+  }
+
+  /* Function exported by a loaded module */
+  if ((addr = dlsym(RTLD_DEFAULT, entry))) {
+    if (!dladdr1(addr, &info, (void**)&sym, RTLD_DL_SYMENT) || !sym ||
+        !sym->st_size)
+      return 0;
+
+    return am_ompt_filter_add(t, (uint64_t)addr, (uint64_t)addr + sym->st_size)
+               ? -1
+               : 1;
+  }
+
+  /* Code of the modules whose file name begins with the entry */
+  len = strlen(entry);
+
+  for (size_t i = 0; i < m->num_mappings; i++) {
+    mapping = &m->mappings[i];
+
+    if (!mapping->executable ||
+        strncmp(am_ompt_filter_basename(mapping->path), entry, len))
+      continue;
+
+    if (am_ompt_filter_add(t, mapping->start, mapping->end)) return -1;
+
+    num++;
+  }
+
+  return num;
+}
+
+/* Resolve a comma separated list of entries into the table */
+static int am_ompt_filter_parse(struct am_ompt_filter_table* t,
+                                const char* value,
+                                const struct am_ompt_filter_maps* m) {
+  char *list, *entry, *saveptr;
+  int num;
+
+  if (!(list = strdup(value))) return 1;
+
+  for (entry = strtok_r(list, ",", &saveptr); entry;
+       entry = strtok_r(NULL, ",", &saveptr)) {
+    if ((num = am_ompt_filter_resolve(t, entry, m)) < 0) goto out_err;
+
+    if (!num) {
+      fprintf(stderr, "Afterompt: Filter entry %s matches no code.\n"
+                      "           Continuing....\n",
+              entry);
+    }
+  }
+
+  free(list);
+
+  am_ompt_filter_sort(t);
+
+  return 0;
+
+out_err:
+  free(list);
+  return 1;
+}
+
+/* Read the threads to trace, a stride, a number of threads or a list */
+static int am_ompt_filter_init_threads() {
+  struct am_ompt_filter_table* t = &am_ompt_filter_thread_numbers;
+  char *list, *entry, *saveptr;
+  const char* value;
+  uint32_t first, last;
+  int n;
+
+  if (!(value = getenv("AFTEROMPT_THREADS"))) return 0;
+
+  if (sscanf(value, "stride:%u", &am_ompt_filter_thread_stride) == 1) {
+    if (!am_ompt_filter_thread_stride) return 1;
+  } else if (sscanf(value, "first:%u", &am_ompt_filter_thread_first) != 1) {
+    if (!(list = strdup(value))) return 1;
+
+    for (entry = strtok_r(list, ",", &saveptr); entry;
+         entry = strtok_r(NULL, ",", &saveptr)) {
+      if (sscanf(entry, "%u-%u%n", &first, &last, &n) != 2 || entry[n]) {
+        if (sscanf(entry, "%u%n", &first, &n) != 1 || entry[n]) {
+          fprintf(stderr, "Afterompt: Invalid thread number %s.\n", entry);
+          goto out_err;
+        }
+
+        last = first;
+      }
+
+      if (am_ompt_filter_add(t, first, (uint64_t)last + 1)) goto out_err;
+    }
+
+    free(list);
+
+    am_ompt_filter_sort(t);
+  }
+
+  am_ompt_filter_threads = 1;
+
+  return 0;
+
+out_err:
+  free(list);
+  return 1;
+}
+
+int am_ompt_filter_select_thread(int initial) {
+  uint32_t number;
+
+  if (!am_ompt_filter_threads || initial) return 1;
+
+  number = __atomic_add_fetch(&am_ompt_filter_last_thread, 1, __ATOMIC_RELAXED);
+
+  if (am_ompt_filter_thread_stride)
+    return number % am_ompt_filter_thread_stride == 0;
+
+  if (am_ompt_filter_thread_first) return number < am_ompt_filter_thread_first;
+
+  return am_ompt_filter_find(&am_ompt_filter_thread_numbers, number);
+}
+
+/* Read the code regions to trace */
+static int am_ompt_filter_init_code() {
+  struct am_ompt_filter_maps maps;
+  const char* include = getenv("AFTEROMPT_FILTER_INCLUDE");
+  const char* exclude = getenv("AFTEROMPT_FILTER_EXCLUDE");
+
+  if (!include && !exclude) return 0;
+
+  if (am_ompt_filter_read_maps(&maps)) goto out_err;
+
+  if (include && am_ompt_filter_parse(&am_ompt_filter_include, include, &maps))
+    goto out_err_free_maps;
+
+  if (exclude && am_ompt_filter_parse(&am_ompt_filter_exclude, exclude, &maps))
+    goto out_err_free_maps;
+
+  am_ompt_filter_free_maps(&maps);
+
+  am_ompt_filter_inclusive = (include != NULL);
+  am_ompt_filter_enabled = 1;
+
+  return 0;
+
+out_err_free_maps:
+  am_ompt_filter_free_maps(&maps);
+out_err:
+  return 1;
+}
+
+int am_ompt_filter_init() {
+  return am_ompt_filter_init_threads() | am_ompt_filter_init_code();
+}
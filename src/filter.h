@@ -0,0 +1,80 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef AM_OMPT_FILTER_H
+#define AM_OMPT_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define AM_OMPT_DEFAULT_FILTER_RANGES 16
+#define AM_OMPT_DEFAULT_FILTER_MAPPINGS 256
+
+/* Value of the parallel data of a filtered-out parallel region */
+#define AM_OMPT_FILTERED_PARALLEL 1
+
+/* Id of filtered-out explicit tasks, which is never assigned to traced tasks
+   (see am_ompt_new_id) */
+#define AM_OMPT_FILTERED_TASK UINT64_MAX
+
+/* Range of code addresses, the end is excluded */
+struct am_ompt_filter_range {
+  uint64_t start;
+  uint64_t end;
+};
+
+/* Sorted and disjoint ranges of code addresses */
+struct am_ompt_filter_table {
+  struct am_ompt_filter_range* ranges;
+  size_t num_ranges;
+  size_t max_ranges;
+};
+
+/* Set if regions are filtered by their code location */
+extern int am_ompt_filter_enabled;
+
+/* Set if only some threads are traced */
+extern int am_ompt_filter_threads;
+
+/*
+  Read the filter from AFTEROMPT_FILTER_INCLUDE and AFTEROMPT_FILTER_EXCLUDE
+  and resolve it against the modules loaded now. Both are comma separated
+  lists of symbols, modules and address ranges. The threads to trace are
+  read from AFTEROMPT_THREADS.
+*/
+int am_ompt_filter_init();
+
+/*
+  Number a new thread in the order threads begin and return 1 if it is
+  traced. The initial thread is always traced, since the parallel regions of
+  the outermost teams are recorded by it.
+*/
+int am_ompt_filter_select_thread(int initial);
+
+/*
+  Returns 1 if a region beginning at the code location is traced, i.e. it is
+  in an included range, if there are any, and not in an excluded one.
+*/
+int am_ompt_filter_admit(uint64_t codeptr_ra);
+
+/* Returns 1 if the task with the given id was filtered out on creation */
+static inline int am_ompt_filter_task(uint64_t task_id) {
+  return am_ompt_filter_enabled && task_id == AM_OMPT_FILTERED_TASK;
+}
+
+#endif
@@ -0,0 +1,249 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "governor.h"
+#include "table.h"
+#include "writer.h"
+
+int am_ompt_governor_enabled;
+
+/* Length of a window in trace timestamp units */
+static uint64_t am_ompt_governor_window = AM_OMPT_DEFAULT_GOVERNOR_WINDOW;
+
+/* Number of full events per window a thread may write */
+static uint64_t am_ompt_governor_budget;
+
+/* Maximal share of the window in percent spent in tracing */
+static double am_ompt_governor_overhead;
+
+/* Estimated cost of an event in trace timestamp units */
+static uint64_t am_ompt_governor_event_cost =
+    AM_OMPT_DEFAULT_GOVERNOR_EVENT_COST;
+
+int am_ompt_governor_init() {
+  const char* value;
+
+  if ((value = getenv("AFTEROMPT_GOVERNOR_WINDOW")))
+    sscanf(value, "%lu", &am_ompt_governor_window);
+
+  if ((value = getenv("AFTEROMPT_GOVERNOR_EVENT_COST")))
+    sscanf(value, "%lu", &am_ompt_governor_event_cost);
+
+  if ((value = getenv("AFTEROMPT_GOVERNOR_OVERHEAD")) &&
+      sscanf(value, "%lf", &am_ompt_governor_overhead) == 1 &&
+      am_ompt_governor_event_cost) {
+    am_ompt_governor_budget = am_ompt_governor_window *
+                              am_ompt_governor_overhead / 100 /
+                              am_ompt_governor_event_cost;
+  }
+
+  /* An explicit budget takes precedence over the overhead estimate */
+  if ((value = getenv("AFTEROMPT_GOVERNOR_BUDGET")))
+    sscanf(value, "%lu", &am_ompt_governor_budget);
+
+  if (!am_ompt_governor_budget || !am_ompt_governor_window) return 0;
+
+  am_ompt_governor_enabled = 1;
+
+  return 0;
+}
+
+/* Key of a construct, with the event type plus one */
+struct am_ompt_governor_key {
+  uint64_t codeptr_ra;
+  uint32_t type;
+};
+
+static inline uint64_t am_ompt_governor_hash(struct am_ompt_governor_key key) {
+  return am_ompt_hash(key.codeptr_ra, key.type);
+}
+
+static inline int am_ompt_governor_used(
+    const struct am_ompt_governor_entry* e) {
+  return e->type != 0;
+}
+
+static inline int am_ompt_governor_match(const struct am_ompt_governor_entry* e,
+                                         struct am_ompt_governor_key key) {
+  return e->codeptr_ra == key.codeptr_ra && e->type == key.type;
+}
+
+static inline struct am_ompt_governor_key am_ompt_governor_key(
+    const struct am_ompt_governor_entry* e) {
+  return (struct am_ompt_governor_key){e->codeptr_ra, e->type};
+}
+
+static inline void am_ompt_governor_fill(struct am_ompt_governor_entry* e,
+                                         struct am_ompt_governor_key key) {
+  e->codeptr_ra = key.codeptr_ra;
+  e->type = key.type;
+}
+
+AM_OMPT_TABLE_DEFINE(am_ompt_governor, struct am_ompt_governor,
+                     struct am_ompt_governor_entry, struct am_ompt_governor_key)
+
+struct am_ompt_governor* am_ompt_governor_create(am_timestamp_t now) {
+  struct am_ompt_governor* g;
+
+  if (!(g = malloc(sizeof(*g)))) return NULL;
+
+  if (!(g->entries = calloc(AM_OMPT_DEFAULT_GOVERNOR_TABLE_SIZE,
+                            sizeof(*g->entries)))) {
+    free(g);
+    return NULL;
+  }
+
+  g->capacity = AM_OMPT_DEFAULT_GOVERNOR_TABLE_SIZE;
+  g->size = 0;
+  g->window_start = now;
+  g->window_end = now + am_ompt_governor_window;
+
+  return g;
+}
+
+void am_ompt_governor_destroy(struct am_ompt_governor* g) {
+  if (!g) return;
+
+  free(g->entries);
+  free(g);
+}
+
+/* Record the transition of a construct to another mode. The transition to
+   full mode carries the number and duration of the aggregated events. */
+static int am_ompt_governor_switch(struct am_buffered_event_collection* c,
+                                   struct am_ompt_governor_entry* e,
+                                   int32_t mode, am_timestamp_t now) {
+  if (am_ompt_write_governor(&c->data, c->id, now, e->codeptr_ra,
+                             AM_OMPT_TYPE_ID_BASE + e->type - 1, mode,
+                             e->count, e->duration))
+    return 1;
+
+  e->mode = mode;
+  e->count = 0;
+  e->duration = 0;
+
+  return 0;
+}
+
+int am_ompt_governor_flush(struct am_ompt_governor* g,
+                           struct am_buffered_event_collection* c,
+                           am_timestamp_t now) {
+  for (size_t i = 0; i < g->capacity; i++) {
+    struct am_ompt_governor_entry* e = &g->entries[i];
+
+    if (e->type && e->mode == AM_OMPT_GOVERNOR_AGGREGATED &&
+        am_ompt_governor_switch(c, e, AM_OMPT_GOVERNOR_FULL, now))
+      return 1;
+  }
+
+  return 0;
+}
+
+/*
+  Adjust the modes at the end of a window. If the full events of the window
+  exceed the budget, the constructs with the most events are aggregated until
+  the rest fits. Aggregated constructs return to full mode once their events
+  fit into half of the remaining budget, so that constructs near the budget
+  do not switch back and forth on every window.
+*/
+static int am_ompt_governor_rollover(struct am_ompt_governor* g,
+                                     struct am_buffered_event_collection* c,
+                                     am_timestamp_t now) {
+  struct am_ompt_governor_entry *e, *max;
+  uint64_t full = 0;
+  uint64_t budget;
+
+  /* Windows without events are merged with the current one, so the budget
+     scales with the time since the last window ended */
+  budget = am_ompt_governor_budget * (double)(now - g->window_start) /
+           am_ompt_governor_window;
+
+  for (size_t i = 0; i < g->capacity; i++) {
+    e = &g->entries[i];
+
+    if (e->type && e->mode == AM_OMPT_GOVERNOR_FULL) full += e->window_events;
+  }
+
+  while (full > budget) {
+    max = NULL;
+
+    for (size_t i = 0; i < g->capacity; i++) {
+      e = &g->entries[i];
+
+      if (e->type && e->mode == AM_OMPT_GOVERNOR_FULL && e->window_events &&
+          (!max || e->window_events > max->window_events))
+        max = e;
+    }
+
+    if (!max) break;
+
+    if (am_ompt_governor_switch(c, max, AM_OMPT_GOVERNOR_AGGREGATED, now))
+      return 1;
+
+    full -= max->window_events;
+  }
+
+  for (size_t i = 0; i < g->capacity; i++) {
+    e = &g->entries[i];
+
+    if (!e->type) continue;
+
+    if (e->mode == AM_OMPT_GOVERNOR_AGGREGATED &&
+        2 * (full + e->window_events) <= budget) {
+      if (am_ompt_governor_switch(c, e, AM_OMPT_GOVERNOR_FULL, now)) return 1;
+
+      full += e->window_events;
+    }
+
+    e->window_events = 0;
+  }
+
+  g->window_start = now;
+  g->window_end = now + am_ompt_governor_window;
+
+  return 0;
+}
+
+int am_ompt_governor_admit(struct am_ompt_governor* g,
+                           struct am_buffered_event_collection* c,
+                           uint64_t codeptr_ra, enum am_ompt_event_type type,
+                           am_timestamp_t start, am_timestamp_t end) {
+  struct am_ompt_governor_key key = {codeptr_ra, type + 1};
+  struct am_ompt_governor_entry* e;
+
+  if (end >= g->window_end && am_ompt_governor_rollover(g, c, end)) {
+    fprintf(stderr, "Afterompt: Could not write governor transition.\n");
+    // TODO: Dying may be too radical.
+    exit(1);
+  }
+
+  /* If the table cannot grow, the construct is simply not governed */
+  if (!(e = am_ompt_governor_get(g, key))) return 1;
+
+  e->window_events++;
+
+  if (e->mode == AM_OMPT_GOVERNOR_FULL) return 1;
+
+  e->count++;
+  e->duration += end - start;
+
+  return 0;
+}
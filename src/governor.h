@@ -0,0 +1,99 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef AM_OMPT_GOVERNOR_H
+#define AM_OMPT_GOVERNOR_H
+
+#include <stdint.h>
+
+#include <aftermath/trace/buffered_event_collection.h>
+#include <aftermath/trace/timestamp.h>
+
+#include "events.h"
+
+#define AM_OMPT_DEFAULT_GOVERNOR_TABLE_SIZE 64
+#define AM_OMPT_DEFAULT_GOVERNOR_WINDOW 1000000
+#define AM_OMPT_DEFAULT_GOVERNOR_EVENT_COST 200
+
+/* Detail at which the events of a construct are recorded */
+enum am_ompt_governor_mode {
+  /* Every event is written to the trace */
+  AM_OMPT_GOVERNOR_FULL = 0,
+  /* Events are only counted and summarized on the next transition */
+  AM_OMPT_GOVERNOR_AGGREGATED = 1
+};
+
+/* Events of a single type at a single code location */
+struct am_ompt_governor_entry {
+  uint64_t codeptr_ra;
+  /* Event type plus one, zero for empty hash table entries */
+  uint32_t type;
+  int32_t mode;
+  /* Events in the current window, including aggregated ones */
+  uint64_t window_events;
+  /* Events aggregated since the last transition and their total duration */
+  uint64_t count;
+  uint64_t duration;
+};
+
+/* Per-thread governor state */
+struct am_ompt_governor {
+  /* Open addressing hash table of constructs */
+  struct am_ompt_governor_entry* entries;
+  size_t capacity;
+  size_t size;
+  am_timestamp_t window_start;
+  am_timestamp_t window_end;
+};
+
+/* Set if the governor is enabled */
+extern int am_ompt_governor_enabled;
+
+/*
+  Read the governor settings from the environment. The governor is enabled if
+  AFTEROMPT_GOVERNOR_BUDGET or AFTEROMPT_GOVERNOR_OVERHEAD is set.
+*/
+int am_ompt_governor_init();
+
+/*
+  Allocate the governor state of a new thread. Returns NULL on error.
+*/
+struct am_ompt_governor* am_ompt_governor_create(am_timestamp_t now);
+
+void am_ompt_governor_destroy(struct am_ompt_governor* g);
+
+/*
+  Switch all aggregated constructs back to full mode, writing the summaries
+  of their aggregated events to the event collection. Returns 0 on success.
+*/
+int am_ompt_governor_flush(struct am_ompt_governor* g,
+                           struct am_buffered_event_collection* c,
+                           am_timestamp_t now);
+
+/*
+  Account an event of the given type at a code location that ends at the
+  given time. Transitions of constructs between full and aggregated mode at
+  the end of a window are written to the event collection. Returns 1 if the
+  event should be written in full, 0 if it was aggregated.
+*/
+int am_ompt_governor_admit(struct am_ompt_governor* g,
+                           struct am_buffered_event_collection* c,
+                           uint64_t codeptr_ra, enum am_ompt_event_type type,
+                           am_timestamp_t start, am_timestamp_t end);
+
+#endif
@@ -0,0 +1,379 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ompt.h>
+
+#include "lockprof.h"
+#include "table.h"
+
+int am_ompt_lockprof_enabled;
+
+int am_ompt_lockprof_skip_uncontended;
+
+/* Name of the report file */
+static const char* am_ompt_lockprof_file;
+
+/* Number of locks listed in the report */
+static size_t am_ompt_lockprof_top = AM_OMPT_DEFAULT_LOCK_PROFILE_TOP;
+
+/* Minimal wait time for an acquisition to count as contended */
+static am_timestamp_t am_ompt_lockprof_threshold =
+    AM_OMPT_DEFAULT_LOCK_CONTENTION_THRESHOLD;
+
+/* Tables of all threads, protected by am_ompt_lockprof_lock */
+static struct am_ompt_lock_table* am_ompt_lockprof_tables;
+static pthread_mutex_t am_ompt_lockprof_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Names of ompt_mutex_t values */
+static const char* am_ompt_lockprof_kind_names[] = {
+    "unknown", "lock", "test_lock", "nest_lock", "test_nest_lock",
+    "critical", "atomic", "ordered"};
+
+int am_ompt_lockprof_init() {
+  const char* value;
+
+  if (!(am_ompt_lockprof_file = getenv("AFTEROMPT_LOCK_PROFILE"))) return 0;
+
+  if ((value = getenv("AFTEROMPT_LOCK_PROFILE_TOP")))
+    sscanf(value, "%zu", &am_ompt_lockprof_top);
+
+  if ((value = getenv("AFTEROMPT_LOCK_CONTENTION_THRESHOLD")))
+    sscanf(value, "%lu", &am_ompt_lockprof_threshold);
+
+  if ((value = getenv("AFTEROMPT_LOCK_SKIP_UNCONTENDED")))
+    sscanf(value, "%d", &am_ompt_lockprof_skip_uncontended);
+
+  am_ompt_lockprof_enabled = 1;
+
+  return 0;
+}
+
+static int am_ompt_lock_table_init(struct am_ompt_lock_table* t,
+                                   size_t capacity) {
+  if (!(t->entries = calloc(capacity, sizeof(*t->entries)))) return 1;
+
+  t->capacity = capacity;
+  t->size = 0;
+  t->lost_holds = 0;
+  t->next = NULL;
+
+  return 0;
+}
+
+/* Key of the statistics of a lock */
+struct am_ompt_lock_key {
+  uint64_t wait_id;
+  uint64_t codeptr_ra;
+  int32_t kind;
+};
+
+static inline uint64_t am_ompt_lock_table_hash(struct am_ompt_lock_key key) {
+  return am_ompt_hash(key.codeptr_ra, key.wait_id ^ (uint64_t)key.kind);
+}
+
+static inline int am_ompt_lock_table_used(const struct am_ompt_lock_stats* s) {
+  return s->count != 0;
+}
+
+static inline int am_ompt_lock_table_match(const struct am_ompt_lock_stats* s,
+                                           struct am_ompt_lock_key key) {
+  return s->wait_id == key.wait_id && s->codeptr_ra == key.codeptr_ra &&
+         s->kind == key.kind;
+}
+
+static inline struct am_ompt_lock_key am_ompt_lock_table_key(
+    const struct am_ompt_lock_stats* s) {
+  return (struct am_ompt_lock_key){s->wait_id, s->codeptr_ra, s->kind};
+}
+
+/* New entries have a count of zero until the caller records the lock */
+static inline void am_ompt_lock_table_fill(struct am_ompt_lock_stats* s,
+                                           struct am_ompt_lock_key key) {
+  memset(s, 0, sizeof(*s));
+  s->wait_id = key.wait_id;
+  s->codeptr_ra = key.codeptr_ra;
+  s->kind = key.kind;
+}
+
+AM_OMPT_TABLE_DEFINE(am_ompt_lock_table, struct am_ompt_lock_table,
+                     struct am_ompt_lock_stats, struct am_ompt_lock_key)
+
+static inline unsigned int am_ompt_lockprof_bucket(uint64_t duration) {
+  unsigned int b = duration ? 64 - __builtin_clzll(duration) : 0;
+
+  return b < AM_OMPT_LOCK_HIST_BUCKETS ? b : AM_OMPT_LOCK_HIST_BUCKETS - 1;
+}
+
+struct am_ompt_lock_data* am_ompt_lockprof_create_thread_data() {
+  struct am_ompt_lock_data* ld;
+
+  if (!am_ompt_lockprof_enabled) return NULL;
+
+  if (!(ld = calloc(1, sizeof(*ld)))) {
+    fprintf(stderr, "Afterompt: Could not allocate lock profiling data.\n");
+    goto out_err;
+  }
+
+  if (!(ld->table = malloc(sizeof(*ld->table)))) {
+    fprintf(stderr, "Afterompt: Could not allocate lock table.\n");
+    goto out_err_free;
+  }
+
+  if (am_ompt_lock_table_init(ld->table, AM_OMPT_DEFAULT_LOCK_TABLE_SIZE)) {
+    fprintf(stderr, "Afterompt: Could not allocate lock table entries.\n");
+    goto out_err_free_table;
+  }
+
+  /* No acquisition is pending */
+  ld->acquire_tsc = AM_TIMESTAMP_T_MAX;
+
+  pthread_mutex_lock(&am_ompt_lockprof_lock);
+  ld->table->next = am_ompt_lockprof_tables;
+  am_ompt_lockprof_tables = ld->table;
+  pthread_mutex_unlock(&am_ompt_lockprof_lock);
+
+  return ld;
+
+out_err_free_table:
+  free(ld->table);
+out_err_free:
+  free(ld);
+out_err:
+  return NULL;
+}
+
+void am_ompt_lockprof_destroy_thread_data(struct am_ompt_lock_data* ld) {
+  free(ld);
+}
+
+void am_ompt_lockprof_acquire(struct am_ompt_lock_data* ld, int32_t kind,
+                              uint32_t hint, uint32_t impl, uint64_t wait_id,
+                              const void* codeptr_ra, am_timestamp_t tsc) {
+  ld->acquire_wait_id = wait_id;
+  ld->acquire_codeptr_ra = (uint64_t)codeptr_ra;
+  ld->acquire_kind = kind;
+  ld->acquire_hint = hint;
+  ld->acquire_impl = impl;
+  ld->acquire_tsc = tsc;
+}
+
+int am_ompt_lockprof_acquired(struct am_ompt_lock_data* ld, uint64_t wait_id,
+                              am_timestamp_t tsc) {
+  struct am_ompt_lock_key key = {wait_id, ld->acquire_codeptr_ra,
+                                 ld->acquire_kind};
+  struct am_ompt_lock_stats* s;
+  struct am_ompt_lock_hold* h;
+  uint64_t wait;
+  int contended;
+
+  /* Acquisition without a matching acquire, e.g. started while paused */
+  if (ld->acquire_wait_id != wait_id || ld->acquire_tsc > tsc) return 1;
+
+  wait = tsc - ld->acquire_tsc;
+  contended = wait >= am_ompt_lockprof_threshold;
+
+  if ((s = am_ompt_lock_table_get(ld->table, key))) {
+    s->count++;
+    s->contended += contended;
+    s->hint |= ld->acquire_hint;
+    s->impl = ld->acquire_impl;
+    s->wait_total += wait;
+    s->wait_hist[am_ompt_lockprof_bucket(wait)]++;
+
+    if (wait > s->wait_max) s->wait_max = wait;
+  }
+
+  /* Locks that are never released, e.g. because the release happens while
+     tracing is paused, end up at the bottom and make room for newer ones */
+  if (ld->num_held == AM_OMPT_MAX_HELD_LOCKS) {
+    memmove(&ld->held[0], &ld->held[1],
+            (AM_OMPT_MAX_HELD_LOCKS - 1) * sizeof(ld->held[0]));
+    ld->num_held--;
+    ld->table->lost_holds++;
+  }
+
+  h = &ld->held[ld->num_held++];
+  h->wait_id = wait_id;
+  h->codeptr_ra = ld->acquire_codeptr_ra;
+  h->kind = ld->acquire_kind;
+  h->tsc = tsc;
+  h->contended = contended;
+
+  /* Mark the pending acquisition as consumed */
+  ld->acquire_tsc = AM_TIMESTAMP_T_MAX;
+
+  return contended || !am_ompt_lockprof_skip_uncontended;
+}
+
+int am_ompt_lockprof_released(struct am_ompt_lock_data* ld, uint64_t wait_id,
+                              am_timestamp_t tsc) {
+  struct am_ompt_lock_stats* s;
+  struct am_ompt_lock_hold h;
+  uint64_t hold;
+
+  /* Locks are usually released in reverse order of acquisition */
+  for (uint32_t i = ld->num_held; i > 0; i--) {
+    if (ld->held[i - 1].wait_id != wait_id) continue;
+
+    h = ld->held[i - 1];
+    memmove(&ld->held[i - 1], &ld->held[i],
+            (ld->num_held - i) * sizeof(ld->held[0]));
+    ld->num_held--;
+
+    hold = tsc > h.tsc ? tsc - h.tsc : 0;
+
+    struct am_ompt_lock_key key = {h.wait_id, h.codeptr_ra, h.kind};
+
+    if ((s = am_ompt_lock_table_get(ld->table, key))) {
+      s->hold_total += hold;
+      s->hold_hist[am_ompt_lockprof_bucket(hold)]++;
+
+      if (hold > s->hold_max) s->hold_max = hold;
+    }
+
+    return h.contended || !am_ompt_lockprof_skip_uncontended;
+  }
+
+  return 1;
+}
+
+static int am_ompt_lockprof_compare(const void* a, const void* b) {
+  const struct am_ompt_lock_stats* sa = a;
+  const struct am_ompt_lock_stats* sb = b;
+
+  if (sa->wait_total != sb->wait_total)
+    return sa->wait_total < sb->wait_total ? 1 : -1;
+
+  return (sa->count < sb->count) - (sa->count > sb->count);
+}
+
+static void am_ompt_lockprof_print_hist(FILE* fp, const char* name,
+                                        const uint64_t* hist) {
+  fprintf(fp, "      %s:", name);
+
+  /* Bucket b holds durations in [2^(b-1), 2^b) */
+  for (unsigned int b = 0; b < AM_OMPT_LOCK_HIST_BUCKETS; b++) {
+    if (hist[b]) fprintf(fp, " <2^%u:%lu", b, hist[b]);
+  }
+
+  fprintf(fp, "\n");
+}
+
+void am_ompt_lockprof_report() {
+  struct am_ompt_lock_table merged;
+  struct am_ompt_lock_stats *s, *m;
+  uint64_t lost_holds = 0;
+  size_t n = 0;
+  FILE* fp;
+
+  if (!am_ompt_lockprof_enabled) return;
+
+  if (am_ompt_lock_table_init(&merged, AM_OMPT_DEFAULT_LOCK_TABLE_SIZE)) {
+    fprintf(stderr, "Afterompt: Could not allocate merged lock table.\n");
+    return;
+  }
+
+  pthread_mutex_lock(&am_ompt_lockprof_lock);
+
+  for (struct am_ompt_lock_table* t = am_ompt_lockprof_tables; t;
+       t = t->next) {
+    lost_holds += t->lost_holds;
+
+    for (size_t i = 0; i < t->capacity; i++) {
+      s = &t->entries[i];
+
+      if (!s->count) continue;
+
+      if (!(m = am_ompt_lock_table_get(&merged, am_ompt_lock_table_key(s)))) {
+        fprintf(stderr, "Afterompt: Could not merge lock tables.\n");
+        goto out_unlock;
+      }
+
+      m->count += s->count;
+      m->contended += s->contended;
+      m->wait_total += s->wait_total;
+      m->hold_total += s->hold_total;
+      m->hint |= s->hint;
+
+      if (s->impl) m->impl = s->impl;
+
+      if (s->wait_max > m->wait_max) m->wait_max = s->wait_max;
+      if (s->hold_max > m->hold_max) m->hold_max = s->hold_max;
+
+      for (unsigned int b = 0; b < AM_OMPT_LOCK_HIST_BUCKETS; b++) {
+        m->wait_hist[b] += s->wait_hist[b];
+        m->hold_hist[b] += s->hold_hist[b];
+      }
+    }
+  }
+
+  /* Compact the used entries to the front and sort them by wait time */
+  for (size_t i = 0; i < merged.capacity; i++) {
+    if (merged.entries[i].count) merged.entries[n++] = merged.entries[i];
+  }
+
+  qsort(merged.entries, n, sizeof(*merged.entries), am_ompt_lockprof_compare);
+
+  if (!(fp = fopen(am_ompt_lockprof_file, "w"))) {
+    fprintf(stderr, "Afterompt: Could not open lock profile \"%s\".\n",
+            am_ompt_lockprof_file);
+    goto out_unlock;
+  }
+
+  fprintf(fp,
+          "# AfterOMPT lock profile, times in trace timestamp units\n"
+          "# %zu locks, showing the %zu with the highest total wait time\n",
+          n, n < am_ompt_lockprof_top ? n : am_ompt_lockprof_top);
+
+  if (lost_holds) {
+    fprintf(fp,
+            "# %lu hold times lost, threads held more than %d locks at once\n",
+            lost_holds, AM_OMPT_MAX_HELD_LOCKS);
+  }
+
+  fprintf(fp, "%4s %-14s %18s %18s %6s %6s %10s %10s %14s %12s %14s %12s\n",
+          "rank", "kind", "wait_id", "codeptr_ra", "hint", "impl", "count",
+          "contended", "wait_total", "wait_max", "hold_total", "hold_max");
+
+  for (size_t i = 0; i < n && i < am_ompt_lockprof_top; i++) {
+    s = &merged.entries[i];
+
+    int32_t kind = (s->kind > 0 && s->kind <= ompt_mutex_ordered) ? s->kind : 0;
+
+    fprintf(fp,
+            "%4zu %-14s %#18lx %#18lx %#6x %6u %10lu %10lu %14lu %12lu %14lu "
+            "%12lu\n",
+            i + 1, am_ompt_lockprof_kind_names[kind], s->wait_id,
+            s->codeptr_ra, s->hint, s->impl, s->count, s->contended,
+            s->wait_total, s->wait_max, s->hold_total, s->hold_max);
+
+    am_ompt_lockprof_print_hist(fp, "wait", s->wait_hist);
+    am_ompt_lockprof_print_hist(fp, "hold", s->hold_hist);
+  }
+
+  fclose(fp);
+
+out_unlock:
+  pthread_mutex_unlock(&am_ompt_lockprof_lock);
+  free(merged.entries);
+}
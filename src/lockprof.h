@@ -0,0 +1,144 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef AM_OMPT_LOCKPROF_H
+#define AM_OMPT_LOCKPROF_H
+
+#include <stdint.h>
+
+#include <aftermath/trace/timestamp.h>
+
+/* Number of logarithmic buckets for wait and hold time histograms */
+#define AM_OMPT_LOCK_HIST_BUCKETS 32
+
+/* Maximum number of locks a thread can hold at once to be profiled */
+#define AM_OMPT_MAX_HELD_LOCKS 16
+
+#define AM_OMPT_DEFAULT_LOCK_TABLE_SIZE 64
+#define AM_OMPT_DEFAULT_LOCK_PROFILE_TOP 10
+#define AM_OMPT_DEFAULT_LOCK_CONTENTION_THRESHOLD 1000
+
+/* Statistics of a single lock acquired at a single code location */
+struct am_ompt_lock_stats {
+  uint64_t wait_id;
+  uint64_t codeptr_ra;
+  int32_t kind;
+  /* Zero for empty hash table entries */
+  uint64_t count;
+  uint64_t contended;
+  uint64_t wait_total;
+  uint64_t wait_max;
+  uint64_t hold_total;
+  uint64_t hold_max;
+  /* Synchronization hints of the acquisitions, combined, and the lock
+     implementation the runtime reported last */
+  uint32_t hint;
+  uint32_t impl;
+  uint64_t wait_hist[AM_OMPT_LOCK_HIST_BUCKETS];
+  uint64_t hold_hist[AM_OMPT_LOCK_HIST_BUCKETS];
+};
+
+/* Open addressing hash table of lock statistics */
+struct am_ompt_lock_table {
+  struct am_ompt_lock_stats* entries;
+  size_t capacity;
+  size_t size;
+  /* Locks whose hold time was lost since the thread held too many at once */
+  uint64_t lost_holds;
+  /* Link in the list of all tables, merged at finalize */
+  struct am_ompt_lock_table* next;
+};
+
+/* Lock currently held by a thread */
+struct am_ompt_lock_hold {
+  uint64_t wait_id;
+  uint64_t codeptr_ra;
+  int32_t kind;
+  am_timestamp_t tsc;
+  int contended;
+};
+
+/* Per-thread lock profiling state */
+struct am_ompt_lock_data {
+  struct am_ompt_lock_table* table;
+
+  /* Acquisition the thread is currently waiting for */
+  uint64_t acquire_wait_id;
+  uint64_t acquire_codeptr_ra;
+  int32_t acquire_kind;
+  uint32_t acquire_hint;
+  uint32_t acquire_impl;
+  am_timestamp_t acquire_tsc;
+
+  struct am_ompt_lock_hold held[AM_OMPT_MAX_HELD_LOCKS];
+  uint32_t num_held;
+};
+
+/* Set if lock profiling is enabled */
+extern int am_ompt_lockprof_enabled;
+
+/* Set if point events of uncontended acquisitions are left out */
+extern int am_ompt_lockprof_skip_uncontended;
+
+/*
+  Read lock profiling settings from the environment. Profiling is enabled
+  if AFTEROMPT_LOCK_PROFILE names the report file.
+*/
+int am_ompt_lockprof_init();
+
+/*
+  Allocate the lock profiling state for a new thread. Returns NULL if lock
+  profiling is disabled. The hash table is kept after the thread finishes,
+  so it can be merged at finalize.
+*/
+struct am_ompt_lock_data* am_ompt_lockprof_create_thread_data();
+
+/*
+  Free the per-thread lock profiling state, except for its hash table.
+*/
+void am_ompt_lockprof_destroy_thread_data(struct am_ompt_lock_data* ld);
+
+/*
+  Record the beginning of a wait for a lock.
+*/
+void am_ompt_lockprof_acquire(struct am_ompt_lock_data* ld, int32_t kind,
+                              uint32_t hint, uint32_t impl, uint64_t wait_id,
+                              const void* codeptr_ra, am_timestamp_t tsc);
+
+/*
+  Record the end of a wait for a lock and the beginning of its hold time.
+  Returns zero if the acquisition was uncontended and its point events
+  should be left out of the trace.
+*/
+int am_ompt_lockprof_acquired(struct am_ompt_lock_data* ld, uint64_t wait_id,
+                              am_timestamp_t tsc);
+
+/*
+  Record the release of a lock. Returns zero if the acquisition was
+  uncontended and its release event should be left out of the trace.
+*/
+int am_ompt_lockprof_released(struct am_ompt_lock_data* ld, uint64_t wait_id,
+                              am_timestamp_t tsc);
+
+/*
+  Merge the tables of all threads and write the report of the most
+  contended locks.
+*/
+void am_ompt_lockprof_report();
+
+#endif
@@ -0,0 +1,165 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "control.h"
+#include "occupancy.h"
+#include "writer.h"
+
+int am_ompt_occupancy_enabled = 0;
+
+int am_ompt_occupancy_only = 0;
+
+/* Width of a bin in timestamp units */
+static uint64_t am_ompt_occupancy_width;
+
+int am_ompt_occupancy_init() {
+  const char* value;
+
+  if (!(value = getenv("AFTEROMPT_OCCUPANCY"))) return 0;
+
+  if (sscanf(value, "%lu", &am_ompt_occupancy_width) != 1) return 1;
+
+  am_ompt_occupancy_enabled = (am_ompt_occupancy_width != 0);
+
+  if (am_ompt_occupancy_enabled && (value = getenv("AFTEROMPT_OCCUPANCY_ONLY")))
+    sscanf(value, "%d", &am_ompt_occupancy_only);
+
+  return 0;
+}
+
+struct am_ompt_occupancy* am_ompt_occupancy_create(am_timestamp_t now) {
+  struct am_ompt_occupancy* o;
+
+  if (!(o = calloc(1, sizeof(*o)))) return NULL;
+
+  /* Bins are aligned across threads */
+  o->bin_start = now - now % am_ompt_occupancy_width;
+  o->since = now;
+  o->state = AM_OMPT_OCCUPANCY_IDLE;
+  o->count[AM_OMPT_OCCUPANCY_IDLE] = 1;
+
+  return o;
+}
+
+void am_ompt_occupancy_destroy(struct am_ompt_occupancy* o) { free(o); }
+
+/* Write the states of the current bin with time or entries and clear them */
+static int am_ompt_occupancy_write_bin(struct am_ompt_occupancy* o,
+                                       struct am_buffered_event_collection* c,
+                                       uint64_t width) {
+  for (int s = 0; s < AM_OMPT_NUM_OCCUPANCY_STATES; s++) {
+    if (!o->time[s] && !o->count[s]) continue;
+
+    if (am_ompt_write_occupancy(&c->data, c->id, o->bin_start, width, s,
+                                o->count[s], o->time[s]))
+      return 1;
+  }
+
+  memset(o->time, 0, sizeof(o->time));
+  memset(o->count, 0, sizeof(o->count));
+
+  return 0;
+}
+
+/* Charge the time up to now to the current state, writing the bins that
+   ended before */
+static int am_ompt_occupancy_advance(struct am_ompt_occupancy* o,
+                                     struct am_buffered_event_collection* c,
+                                     am_timestamp_t now) {
+  am_timestamp_t end;
+
+  if (now < o->since) return 0;
+
+  while (now - o->bin_start >= am_ompt_occupancy_width) {
+    end = o->bin_start + am_ompt_occupancy_width;
+    o->time[o->state] += end - o->since;
+
+    if (am_ompt_occupancy_write_bin(o, c, am_ompt_occupancy_width)) return 1;
+
+    o->bin_start = end;
+    o->since = end;
+  }
+
+  o->time[o->state] += now - o->since;
+  o->since = now;
+
+  return 0;
+}
+
+int am_ompt_occupancy_set_state(struct am_ompt_occupancy* o,
+                                struct am_buffered_event_collection* c,
+                                enum am_ompt_occupancy_state state,
+                                am_timestamp_t now) {
+  if (am_ompt_occupancy_advance(o, c, now)) return 1;
+
+  if (state != o->state) {
+    o->state = state;
+    o->count[state]++;
+  }
+
+  return 0;
+}
+
+int am_ompt_occupancy_resume(struct am_ompt_occupancy* o,
+                             struct am_buffered_event_collection* c) {
+  am_timestamp_t pause = __atomic_load_n(&am_ompt_pause_tsc, __ATOMIC_RELAXED);
+  am_timestamp_t resume =
+      __atomic_load_n(&am_ompt_resume_tsc, __ATOMIC_RELAXED);
+
+  if (__builtin_expect(o->since >= resume, 1)) return 0;
+
+  /* The thread may have begun while tracing was paused */
+  if (o->since < pause && am_ompt_occupancy_advance(o, c, pause)) return 1;
+
+  if (resume - o->bin_start >= am_ompt_occupancy_width) {
+    /* The bin is only as wide as the time covered before the pause */
+    if (am_ompt_occupancy_write_bin(o, c, o->since - o->bin_start)) return 1;
+
+    o->bin_start = resume - resume % am_ompt_occupancy_width;
+  }
+
+  o->since = resume;
+
+  return 0;
+}
+
+int am_ompt_occupancy_flush(struct am_ompt_occupancy* o,
+                            struct am_buffered_event_collection* c,
+                            am_timestamp_t now) {
+  /* Bins end with the traced time */
+  if (am_ompt_occupancy_only || am_ompt_tracing_enabled()) {
+    if (am_ompt_occupancy_resume(o, c)) return 1;
+  } else {
+    now = __atomic_load_n(&am_ompt_pause_tsc, __ATOMIC_RELAXED);
+
+    if (now < o->since) now = o->since;
+  }
+
+  if (am_ompt_occupancy_advance(o, c, now)) return 1;
+
+  /* The partial bin is only as wide as the time covered */
+  if (am_ompt_occupancy_write_bin(o, c, now - o->bin_start)) return 1;
+
+  o->bin_start = now;
+
+  return 0;
+}
@@ -0,0 +1,111 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef AM_OMPT_OCCUPANCY_H
+#define AM_OMPT_OCCUPANCY_H
+
+#include <stdint.h>
+
+#include <aftermath/trace/buffered_event_collection.h>
+#include <aftermath/trace/timestamp.h>
+
+/*
+  States of a thread in the occupancy bins, in the order of enum
+  am_ompt_state_kind in trace.h, followed by the execution of explicit tasks.
+  Idle is the time of a thread outside of any other state.
+*/
+enum am_ompt_occupancy_state {
+  AM_OMPT_OCCUPANCY_IDLE = 0,
+  AM_OMPT_OCCUPANCY_PARALLEL,
+  AM_OMPT_OCCUPANCY_IMPLICIT_TASK,
+  AM_OMPT_OCCUPANCY_SYNC_REGION_WAIT,
+  AM_OMPT_OCCUPANCY_WORK,
+  AM_OMPT_OCCUPANCY_MASTER,
+  AM_OMPT_OCCUPANCY_SYNC_REGION,
+  AM_OMPT_OCCUPANCY_NEST_LOCK,
+  AM_OMPT_OCCUPANCY_LOOP,
+  AM_OMPT_OCCUPANCY_TASK,
+  AM_OMPT_NUM_OCCUPANCY_STATES
+};
+
+/* Per-thread time spent in each state during the current bin */
+struct am_ompt_occupancy {
+  am_timestamp_t bin_start;
+  /* Time of the last change of state */
+  am_timestamp_t since;
+  enum am_ompt_occupancy_state state;
+  /* Depth of the state stack when the explicit task executed now was
+     scheduled, states below are accounted as task execution */
+  uint32_t task_depth;
+  uint64_t time[AM_OMPT_NUM_OCCUPANCY_STATES];
+  /* Number of times each state was entered */
+  uint32_t count[AM_OMPT_NUM_OCCUPANCY_STATES];
+};
+
+/* Set if occupancy bins are recorded */
+extern int am_ompt_occupancy_enabled;
+
+/* Set if only the bins are recorded, which then cover the whole execution
+   while tracing of events is ended at initialization */
+extern int am_ompt_occupancy_only;
+
+/*
+  Read the occupancy settings from the environment. Bins are recorded if
+  AFTEROMPT_OCCUPANCY is set to the width of a bin, without any other events
+  if AFTEROMPT_OCCUPANCY_ONLY is set to 1.
+*/
+int am_ompt_occupancy_init();
+
+/*
+  Allocate the occupancy state of a new thread, which is idle from the given
+  time. Returns NULL on error.
+*/
+struct am_ompt_occupancy* am_ompt_occupancy_create(am_timestamp_t now);
+
+void am_ompt_occupancy_destroy(struct am_ompt_occupancy* o);
+
+/*
+  Switch the thread to a new state at the given time. The time since the
+  last switch is charged to the previous state, split at the boundaries of
+  the bins, and the bins that ended before are written to the event
+  collection. Returns 0 on success.
+*/
+int am_ompt_occupancy_set_state(struct am_ompt_occupancy* o,
+                                struct am_buffered_event_collection* c,
+                                enum am_ompt_occupancy_state state,
+                                am_timestamp_t now);
+
+/*
+  Leave the time tracing was last paused out of the bins if the thread has not
+  switched state since tracing was resumed. States are not switched while
+  tracing is paused, so this is called before the first switch afterwards.
+  Earlier pauses without a switch in between are charged to the state.
+  Returns 0 on success.
+*/
+int am_ompt_occupancy_resume(struct am_ompt_occupancy* o,
+                             struct am_buffered_event_collection* c);
+
+/*
+  Write the current bin up to the given time, e.g. when the thread ends, or
+  up to the time tracing was paused. Returns 0 on success.
+*/
+int am_ompt_occupancy_flush(struct am_ompt_occupancy* o,
+                            struct am_buffered_event_collection* c,
+                            am_timestamp_t now);
+
+#endif
@@ -0,0 +1,577 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+#include "table.h"
+
+int am_ompt_profile_enabled;
+
+/* Name of the profile file */
+static const char* am_ompt_profile_file;
+
+/* Name of the baseline profile, NULL if there is none */
+static const char* am_ompt_profile_baseline;
+
+/* Increase of a quantile over the baseline in percent that is a regression */
+static unsigned int am_ompt_profile_threshold =
+    AM_OMPT_DEFAULT_PROFILE_THRESHOLD;
+
+/* Minimal number of instances in both profiles for a comparison */
+static uint64_t am_ompt_profile_min_count = AM_OMPT_DEFAULT_PROFILE_MIN_COUNT;
+
+/* Exit status of the process if a construct regressed */
+static int am_ompt_profile_exit_status = AM_OMPT_DEFAULT_PROFILE_EXIT_STATUS;
+
+/* Exit status of the process if the baseline cannot be compared against */
+static int am_ompt_profile_baseline_exit_status =
+    AM_OMPT_DEFAULT_PROFILE_BASELINE_EXIT_STATUS;
+
+/* Tables of all threads, protected by am_ompt_profile_lock */
+static struct am_ompt_profile_table* am_ompt_profile_tables;
+static pthread_mutex_t am_ompt_profile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Names of the kinds of constructs, as used in profiles */
+static const char* am_ompt_profile_kind_names[AM_OMPT_NUM_PROFILE_KINDS] = {
+    [AM_OMPT_PROFILE_PARALLEL] = "parallel",
+    [AM_OMPT_PROFILE_WORK] = "work",
+    [AM_OMPT_PROFILE_TASK] = "task",
+    [AM_OMPT_PROFILE_SYNC_WAIT] = "sync_wait",
+    [AM_OMPT_PROFILE_LOCK_WAIT] = "lock_wait"};
+
+/* Quantiles in the profile, in percent */
+static const unsigned int am_ompt_profile_quantiles[] = {50, 90, 99};
+
+#define AM_OMPT_PROFILE_NUM_QUANTILES \
+  (sizeof(am_ompt_profile_quantiles) / sizeof(am_ompt_profile_quantiles[0]))
+
+/* Quantiles compared against the baseline, as indexes of
+   am_ompt_profile_quantiles */
+static const unsigned int am_ompt_profile_compared[] = {0, 1};
+
+int am_ompt_profile_init() {
+  const char* value;
+
+  if (!(am_ompt_profile_file = getenv("AFTEROMPT_PROFILE"))) return 0;
+
+  am_ompt_profile_baseline = getenv("AFTEROMPT_PROFILE_BASELINE");
+
+  if ((value = getenv("AFTEROMPT_PROFILE_THRESHOLD")))
+    sscanf(value, "%u", &am_ompt_profile_threshold);
+
+  if ((value = getenv("AFTEROMPT_PROFILE_MIN_COUNT")))
+    sscanf(value, "%lu", &am_ompt_profile_min_count);
+
+  if ((value = getenv("AFTEROMPT_PROFILE_EXIT_STATUS")))
+    sscanf(value, "%d", &am_ompt_profile_exit_status);
+
+  if ((value = getenv("AFTEROMPT_PROFILE_BASELINE_EXIT_STATUS")))
+    sscanf(value, "%d", &am_ompt_profile_baseline_exit_status);
+
+  if (am_ompt_profile_exit_status < 1 || am_ompt_profile_exit_status > 255) {
+    fprintf(stderr,
+            "Afterompt: Exit status for regressions must be between 1 and "
+            "255.\n");
+    return 1;
+  }
+
+  if (am_ompt_profile_baseline_exit_status < 1 ||
+      am_ompt_profile_baseline_exit_status > 255) {
+    fprintf(stderr,
+            "Afterompt: Exit status for baseline errors must be between 1 "
+            "and 255.\n");
+    return 1;
+  }
+
+  am_ompt_profile_enabled = 1;
+
+  return 0;
+}
+
+static int am_ompt_profile_table_init(struct am_ompt_profile_table* t,
+                                      size_t capacity) {
+  if (!(t->entries = calloc(capacity, sizeof(*t->entries)))) return 1;
+
+  t->capacity = capacity;
+  t->size = 0;
+  t->next = NULL;
+
+  return 0;
+}
+
+/* Key of the statistics of a construct */
+struct am_ompt_profile_key {
+  uint64_t codeptr_ra;
+  int32_t kind;
+};
+
+static inline uint64_t am_ompt_profile_table_hash(
+    struct am_ompt_profile_key key) {
+  return am_ompt_hash(key.codeptr_ra, (uint64_t)key.kind);
+}
+
+static inline int am_ompt_profile_table_used(
+    const struct am_ompt_profile_stats* s) {
+  return s->count != 0;
+}
+
+static inline int am_ompt_profile_table_match(
+    const struct am_ompt_profile_stats* s, struct am_ompt_profile_key key) {
+  return s->codeptr_ra == key.codeptr_ra && s->kind == key.kind;
+}
+
+static inline struct am_ompt_profile_key am_ompt_profile_table_key(
+    const struct am_ompt_profile_stats* s) {
+  return (struct am_ompt_profile_key){s->codeptr_ra, s->kind};
+}
+
+/* New entries have a count of zero until the caller records the construct */
+static inline void am_ompt_profile_table_fill(struct am_ompt_profile_stats* s,
+                                              struct am_ompt_profile_key key) {
+  memset(s, 0, sizeof(*s));
+  s->codeptr_ra = key.codeptr_ra;
+  s->kind = key.kind;
+  s->min = UINT64_MAX;
+}
+
+AM_OMPT_TABLE_DEFINE(am_ompt_profile_table, struct am_ompt_profile_table,
+                     struct am_ompt_profile_stats, struct am_ompt_profile_key)
+
+/*
+  Bucket of a duration. Durations below AM_OMPT_PROFILE_SUB_BUCKETS have a
+  bucket each, every following power of two is split into
+  AM_OMPT_PROFILE_SUB_BUCKETS buckets of equal width.
+*/
+static inline unsigned int am_ompt_profile_bucket(uint64_t duration) {
+  unsigned int msb, b;
+
+  if (duration < AM_OMPT_PROFILE_SUB_BUCKETS) return duration;
+
+  msb = 63 - __builtin_clzll(duration);
+  b = ((msb - AM_OMPT_PROFILE_SUB_BUCKET_BITS + 1)
+       << AM_OMPT_PROFILE_SUB_BUCKET_BITS) +
+      ((duration >> (msb - AM_OMPT_PROFILE_SUB_BUCKET_BITS)) &
+       (AM_OMPT_PROFILE_SUB_BUCKETS - 1));
+
+  return b < AM_OMPT_PROFILE_BUCKETS ? b : AM_OMPT_PROFILE_BUCKETS - 1;
+}
+
+/* Smallest duration of a bucket */
+static uint64_t am_ompt_profile_bucket_start(unsigned int b) {
+  unsigned int group = b >> AM_OMPT_PROFILE_SUB_BUCKET_BITS;
+  uint64_t sub = b & (AM_OMPT_PROFILE_SUB_BUCKETS - 1);
+
+  if (!group) return sub;
+
+  return (AM_OMPT_PROFILE_SUB_BUCKETS + sub) << (group - 1);
+}
+
+/* Width of a bucket */
+static uint64_t am_ompt_profile_bucket_width(unsigned int b) {
+  unsigned int group = b >> AM_OMPT_PROFILE_SUB_BUCKET_BITS;
+
+  return group ? 1ULL << (group - 1) : 1;
+}
+
+/*
+  Estimate a quantile from the histogram as the middle of the bucket it
+  falls into, clamped to the observed range
+*/
+static uint64_t am_ompt_profile_quantile(const struct am_ompt_profile_stats* s,
+                                         unsigned int percent) {
+  uint64_t rank = (s->count * percent + 99) / 100;
+  uint64_t seen = 0, value = s->max;
+
+  if (!rank) rank = 1;
+
+  for (unsigned int b = 0; b < AM_OMPT_PROFILE_BUCKETS; b++) {
+    if ((seen += s->hist[b]) < rank) continue;
+
+    value = am_ompt_profile_bucket_start(b) +
+            am_ompt_profile_bucket_width(b) / 2;
+    break;
+  }
+
+  if (value < s->min) value = s->min;
+  if (value > s->max) value = s->max;
+
+  return value;
+}
+
+struct am_ompt_profile_data* am_ompt_profile_create_thread_data() {
+  struct am_ompt_profile_data* pd;
+
+  if (!am_ompt_profile_enabled) return NULL;
+
+  if (!(pd = calloc(1, sizeof(*pd)))) {
+    fprintf(stderr, "Afterompt: Could not allocate profiling data.\n");
+    goto out_err;
+  }
+
+  if (!(pd->table = malloc(sizeof(*pd->table)))) {
+    fprintf(stderr, "Afterompt: Could not allocate profile table.\n");
+    goto out_err_free;
+  }
+
+  if (am_ompt_profile_table_init(pd->table,
+                                 AM_OMPT_DEFAULT_PROFILE_TABLE_SIZE)) {
+    fprintf(stderr, "Afterompt: Could not allocate profile table entries.\n");
+    goto out_err_free_table;
+  }
+
+  /* No acquisition is pending */
+  pd->acquire_tsc = AM_TIMESTAMP_T_MAX;
+
+  pthread_mutex_lock(&am_ompt_profile_lock);
+  pd->table->next = am_ompt_profile_tables;
+  am_ompt_profile_tables = pd->table;
+  pthread_mutex_unlock(&am_ompt_profile_lock);
+
+  return pd;
+
+out_err_free_table:
+  free(pd->table);
+out_err_free:
+  free(pd);
+out_err:
+  return NULL;
+}
+
+void am_ompt_profile_destroy_thread_data(struct am_ompt_profile_data* pd) {
+  free(pd);
+}
+
+void am_ompt_profile_record(struct am_ompt_profile_data* pd,
+                            enum am_ompt_profile_kind kind,
+                            uint64_t codeptr_ra, uint64_t duration) {
+  struct am_ompt_profile_key key = {codeptr_ra, kind};
+  struct am_ompt_profile_stats* s;
+
+  if (!(s = am_ompt_profile_table_get(pd->table, key))) return;
+
+  s->count++;
+  s->total += duration;
+  s->hist[am_ompt_profile_bucket(duration)]++;
+
+  if (duration < s->min) s->min = duration;
+  if (duration > s->max) s->max = duration;
+}
+
+void am_ompt_profile_acquire(struct am_ompt_profile_data* pd,
+                             uint64_t wait_id, const void* codeptr_ra,
+                             am_timestamp_t tsc) {
+  pd->acquire_wait_id = wait_id;
+  pd->acquire_codeptr_ra = (uint64_t)codeptr_ra;
+  pd->acquire_tsc = tsc;
+}
+
+void am_ompt_profile_acquired(struct am_ompt_profile_data* pd,
+                              uint64_t wait_id, am_timestamp_t tsc) {
+  /* Acquisition without a matching acquire, e.g. started while paused */
+  if (pd->acquire_wait_id != wait_id || pd->acquire_tsc > tsc) return;
+
+  am_ompt_profile_record(pd, AM_OMPT_PROFILE_LOCK_WAIT, pd->acquire_codeptr_ra,
+                         tsc - pd->acquire_tsc);
+
+  /* Mark the pending acquisition as consumed */
+  pd->acquire_tsc = AM_TIMESTAMP_T_MAX;
+}
+
+void am_ompt_profile_schedule(struct am_ompt_profile_data* pd,
+                              uint64_t prior_task_id, int prior_completed,
+                              uint64_t next_task_id, uint64_t codeptr_ra,
+                              am_timestamp_t tsc) {
+  struct am_ompt_profile_task* t = &pd->task;
+
+  if (t->id && t->id == prior_task_id) {
+    t->elapsed += tsc > t->tsc ? tsc - t->tsc : 0;
+
+    if (prior_completed) {
+      am_ompt_profile_record(pd, AM_OMPT_PROFILE_TASK, t->codeptr_ra,
+                             t->elapsed);
+    } else {
+      /* Tasks that are never resumed on this thread are replaced by newer
+         ones */
+      if (pd->num_suspended == AM_OMPT_PROFILE_MAX_SUSPENDED_TASKS) {
+        memmove(&pd->suspended[0], &pd->suspended[1],
+                (pd->num_suspended - 1) * sizeof(pd->suspended[0]));
+        pd->num_suspended--;
+      }
+
+      pd->suspended[pd->num_suspended++] = *t;
+    }
+  }
+
+  t->id = 0;
+
+  if (!next_task_id) return;
+
+  /* Tasks are usually resumed in reverse order of suspension */
+  for (uint32_t i = pd->num_suspended; i > 0; i--) {
+    if (pd->suspended[i - 1].id != next_task_id) continue;
+
+    *t = pd->suspended[i - 1];
+    memmove(&pd->suspended[i - 1], &pd->suspended[i],
+            (pd->num_suspended - i) * sizeof(pd->suspended[0]));
+    pd->num_suspended--;
+    t->tsc = tsc;
+
+    return;
+  }
+
+  t->id = next_task_id;
+  t->codeptr_ra = codeptr_ra;
+  t->tsc = tsc;
+  t->elapsed = 0;
+}
+
+/*
+  Write the location of a code address as the file name of the object
+  containing it and the offset in that object, so that locations remain
+  comparable across runs with different load addresses
+*/
+static void am_ompt_profile_location(uint64_t codeptr_ra, char* buf,
+                                     size_t size) {
+  const char* name;
+  Dl_info info;
+
+  if (!codeptr_ra) {
+    snprintf(buf, size, "unknown");
+    return;
+  }
+
+  if (!dladdr((void*)codeptr_ra, &info) || !info.dli_fname ||
+      !info.dli_fname[0]) {
+    snprintf(buf, size, "%#lx", codeptr_ra);
+    return;
+  }
+
+  name = strrchr(info.dli_fname, '/');
+  name = name ? name + 1 : info.dli_fname;
+
+  snprintf(buf, size, "%s+%#lx", name, codeptr_ra - (uint64_t)info.dli_fbase);
+
+  /* Locations are separated by whitespace in the profile */
+  for (char* c = buf; *c; c++) {
+    if (*c == ' ' || *c == '\t') *c = '_';
+  }
+}
+
+/* Merged entry with its location */
+struct am_ompt_profile_entry {
+  struct am_ompt_profile_stats* stats;
+  char location[AM_OMPT_PROFILE_MAX_LOCATION];
+  uint64_t quantiles[AM_OMPT_PROFILE_NUM_QUANTILES];
+};
+
+static int am_ompt_profile_compare(const void* a, const void* b) {
+  const struct am_ompt_profile_stats* sa =
+      ((const struct am_ompt_profile_entry*)a)->stats;
+  const struct am_ompt_profile_stats* sb =
+      ((const struct am_ompt_profile_entry*)b)->stats;
+
+  if (sa->kind != sb->kind) return sa->kind < sb->kind ? -1 : 1;
+
+  return (sa->total < sb->total) - (sa->total > sb->total);
+}
+
+/*
+  Compare the profile against the baseline and report the constructs whose
+  compared quantiles grew beyond the threshold. Returns the number of
+  regressions or -1 if the baseline cannot be read or has a malformed line.
+*/
+static int am_ompt_profile_compare_baseline(
+    struct am_ompt_profile_entry* entries, size_t n) {
+  uint64_t base[AM_OMPT_PROFILE_NUM_QUANTILES];
+  char location[AM_OMPT_PROFILE_MAX_LOCATION];
+  uint64_t count, total, min, max;
+  struct am_ompt_profile_entry* e;
+  unsigned int q;
+  char kind[32];
+  char line[512];
+  int regressions = 0;
+  FILE* fp;
+
+  if (!(fp = fopen(am_ompt_profile_baseline, "r"))) {
+    fprintf(stderr, "Afterompt: Could not open baseline profile \"%s\".\n",
+            am_ompt_profile_baseline);
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), fp)) {
+    if (line[0] == '#' || line[0] == '\n') continue;
+
+    if (sscanf(line, "%31s %255s %lu %lu %lu %lu %lu %lu %lu", kind, location,
+               &count, &total, &min, &base[0], &base[1], &base[2],
+               &max) != 9) {
+      fprintf(stderr, "Afterompt: Malformed line in baseline profile: %s",
+              line);
+      regressions = -1;
+      break;
+    }
+
+    e = NULL;
+
+    for (size_t i = 0; i < n && !e; i++) {
+      if (!strcmp(entries[i].location, location) &&
+          !strcmp(am_ompt_profile_kind_names[entries[i].stats->kind], kind))
+        e = &entries[i];
+    }
+
+    if (!e || count < am_ompt_profile_min_count ||
+        e->stats->count < am_ompt_profile_min_count)
+      continue;
+
+    for (size_t i = 0; i < sizeof(am_ompt_profile_compared) /
+                               sizeof(am_ompt_profile_compared[0]);
+         i++) {
+      q = am_ompt_profile_compared[i];
+
+      if (!base[q] || e->quantiles[q] * 100 <=
+                          base[q] * (100 + am_ompt_profile_threshold))
+        continue;
+
+      fprintf(stderr,
+              "Afterompt: Regression of %s at %s: p%u %lu -> %lu "
+              "(+%lu%%)\n",
+              kind, location, am_ompt_profile_quantiles[q], base[q],
+              e->quantiles[q], (e->quantiles[q] - base[q]) * 100 / base[q]);
+
+      regressions++;
+      break;
+    }
+  }
+
+  fclose(fp);
+
+  return regressions;
+}
+
+int am_ompt_profile_report() {
+  struct am_ompt_profile_entry* entries = NULL;
+  struct am_ompt_profile_table merged;
+  struct am_ompt_profile_stats *s, *m;
+  int regressions = 0, ret = 0;
+  size_t n = 0;
+  FILE* fp;
+
+  if (!am_ompt_profile_enabled) return 0;
+
+  if (am_ompt_profile_table_init(&merged, AM_OMPT_DEFAULT_PROFILE_TABLE_SIZE)) {
+    fprintf(stderr, "Afterompt: Could not allocate merged profile table.\n");
+    return 0;
+  }
+
+  pthread_mutex_lock(&am_ompt_profile_lock);
+
+  for (struct am_ompt_profile_table* t = am_ompt_profile_tables; t;
+       t = t->next) {
+    for (size_t i = 0; i < t->capacity; i++) {
+      s = &t->entries[i];
+
+      if (!s->count) continue;
+
+      if (!(m = am_ompt_profile_table_get(&merged,
+                                          am_ompt_profile_table_key(s)))) {
+        fprintf(stderr, "Afterompt: Could not merge profile tables.\n");
+        goto out_unlock;
+      }
+
+      m->count += s->count;
+      m->total += s->total;
+
+      if (s->min < m->min) m->min = s->min;
+      if (s->max > m->max) m->max = s->max;
+
+      for (unsigned int b = 0; b < AM_OMPT_PROFILE_BUCKETS; b++)
+        m->hist[b] += s->hist[b];
+    }
+  }
+
+  if (!(entries = calloc(merged.size ? merged.size : 1, sizeof(*entries)))) {
+    fprintf(stderr, "Afterompt: Could not allocate profile entries.\n");
+    goto out_unlock;
+  }
+
+  for (size_t i = 0; i < merged.capacity; i++) {
+    if (!merged.entries[i].count) continue;
+
+    entries[n].stats = &merged.entries[i];
+    am_ompt_profile_location(merged.entries[i].codeptr_ra,
+                             entries[n].location, sizeof(entries[n].location));
+
+    for (unsigned int q = 0; q < AM_OMPT_PROFILE_NUM_QUANTILES; q++) {
+      entries[n].quantiles[q] = am_ompt_profile_quantile(
+          &merged.entries[i], am_ompt_profile_quantiles[q]);
+    }
+
+    n++;
+  }
+
+  qsort(entries, n, sizeof(*entries), am_ompt_profile_compare);
+
+  if (!(fp = fopen(am_ompt_profile_file, "w"))) {
+    fprintf(stderr, "Afterompt: Could not open profile \"%s\".\n",
+            am_ompt_profile_file);
+    goto out_unlock;
+  }
+
+  fprintf(fp,
+          "# AfterOMPT construct profile, durations in trace timestamp "
+          "units\n"
+          "# kind location count total min p50 p90 p99 max\n");
+
+  for (size_t i = 0; i < n; i++) {
+    s = entries[i].stats;
+
+    fprintf(fp, "%s %s %lu %lu %lu %lu %lu %lu %lu\n",
+            am_ompt_profile_kind_names[s->kind], entries[i].location,
+            s->count, s->total, s->min, entries[i].quantiles[0],
+            entries[i].quantiles[1], entries[i].quantiles[2], s->max);
+  }
+
+  fclose(fp);
+
+  if (am_ompt_profile_baseline)
+    regressions = am_ompt_profile_compare_baseline(entries, n);
+
+  if (regressions < 0) {
+    fprintf(stderr, "Afterompt: Could not compare against \"%s\".\n",
+            am_ompt_profile_baseline);
+    ret = am_ompt_profile_baseline_exit_status;
+  } else if (regressions > 0) {
+    fprintf(stderr,
+            "Afterompt: %d constructs regressed by more than %u%% against "
+            "\"%s\".\n",
+            regressions, am_ompt_profile_threshold, am_ompt_profile_baseline);
+    ret = am_ompt_profile_exit_status;
+  }
+
+out_unlock:
+  pthread_mutex_unlock(&am_ompt_profile_lock);
+  free(entries);
+  free(merged.entries);
+
+  return ret;
+}
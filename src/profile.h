@@ -0,0 +1,163 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef AM_OMPT_PROFILE_H
+#define AM_OMPT_PROFILE_H
+
+#include <stdint.h>
+
+#include <aftermath/trace/timestamp.h>
+
+/* Sub-buckets per power of two of the duration histograms */
+#define AM_OMPT_PROFILE_SUB_BUCKET_BITS 4
+#define AM_OMPT_PROFILE_SUB_BUCKETS (1 << AM_OMPT_PROFILE_SUB_BUCKET_BITS)
+
+/* Number of buckets of the duration histograms. Durations of up to 2^43
+   timestamp units are distinguished, longer ones share the last bucket. */
+#define AM_OMPT_PROFILE_BUCKETS (40 * AM_OMPT_PROFILE_SUB_BUCKETS)
+
+/* Maximum number of suspended explicit tasks tracked per thread */
+#define AM_OMPT_PROFILE_MAX_SUSPENDED_TASKS 16
+
+/* Maximum length of a location in a profile, e.g. "libfoo.so+0x1a2b" */
+#define AM_OMPT_PROFILE_MAX_LOCATION 256
+
+#define AM_OMPT_DEFAULT_PROFILE_TABLE_SIZE 16
+#define AM_OMPT_DEFAULT_PROFILE_THRESHOLD 20
+#define AM_OMPT_DEFAULT_PROFILE_MIN_COUNT 10
+#define AM_OMPT_DEFAULT_PROFILE_EXIT_STATUS 3
+#define AM_OMPT_DEFAULT_PROFILE_BASELINE_EXIT_STATUS 4
+
+/* Kinds of constructs in the profile */
+enum am_ompt_profile_kind {
+  AM_OMPT_PROFILE_PARALLEL = 0,
+  AM_OMPT_PROFILE_WORK,
+  AM_OMPT_PROFILE_TASK,
+  AM_OMPT_PROFILE_SYNC_WAIT,
+  AM_OMPT_PROFILE_LOCK_WAIT,
+  AM_OMPT_NUM_PROFILE_KINDS
+};
+
+/* Durations of a single kind of construct at a single code location */
+struct am_ompt_profile_stats {
+  uint64_t codeptr_ra;
+  int32_t kind;
+  /* Zero for empty hash table entries */
+  uint64_t count;
+  uint64_t total;
+  uint64_t min;
+  uint64_t max;
+  uint64_t hist[AM_OMPT_PROFILE_BUCKETS];
+};
+
+/* Open addressing hash table of construct durations */
+struct am_ompt_profile_table {
+  struct am_ompt_profile_stats* entries;
+  size_t capacity;
+  size_t size;
+  /* Link in the list of all tables, merged at finalize */
+  struct am_ompt_profile_table* next;
+};
+
+/* Explicit task executed by a thread */
+struct am_ompt_profile_task {
+  /* Zero if no explicit task is executed */
+  uint64_t id;
+  uint64_t codeptr_ra;
+  am_timestamp_t tsc;
+  /* Execution time before the last suspension */
+  uint64_t elapsed;
+};
+
+/* Per-thread profiling state */
+struct am_ompt_profile_data {
+  struct am_ompt_profile_table* table;
+
+  /* Lock acquisition the thread is currently waiting for */
+  uint64_t acquire_wait_id;
+  uint64_t acquire_codeptr_ra;
+  am_timestamp_t acquire_tsc;
+
+  struct am_ompt_profile_task task;
+  struct am_ompt_profile_task suspended[AM_OMPT_PROFILE_MAX_SUSPENDED_TASKS];
+  uint32_t num_suspended;
+};
+
+/* Set if construct profiling is enabled */
+extern int am_ompt_profile_enabled;
+
+/*
+  Read profiling settings from the environment. Profiling is enabled if
+  AFTEROMPT_PROFILE names the profile file.
+*/
+int am_ompt_profile_init();
+
+/*
+  Allocate the profiling state for a new thread. Returns NULL if profiling
+  is disabled. The hash table is kept after the thread finishes, so it can be
+  merged at finalize.
+*/
+struct am_ompt_profile_data* am_ompt_profile_create_thread_data();
+
+/*
+  Free the per-thread profiling state, except for its hash table.
+*/
+void am_ompt_profile_destroy_thread_data(struct am_ompt_profile_data* pd);
+
+/*
+  Record a construct of the given kind at codeptr_ra that took duration
+  timestamp units.
+*/
+void am_ompt_profile_record(struct am_ompt_profile_data* pd,
+                            enum am_ompt_profile_kind kind,
+                            uint64_t codeptr_ra, uint64_t duration);
+
+/*
+  Record the beginning of a wait for a lock.
+*/
+void am_ompt_profile_acquire(struct am_ompt_profile_data* pd,
+                             uint64_t wait_id, const void* codeptr_ra,
+                             am_timestamp_t tsc);
+
+/*
+  Record the end of a wait for a lock.
+*/
+void am_ompt_profile_acquired(struct am_ompt_profile_data* pd,
+                              uint64_t wait_id, am_timestamp_t tsc);
+
+/*
+  Record a task scheduling point. The prior task is suspended or, if it
+  completed, its execution time is recorded. The next task resumes if it was
+  suspended on this thread before, otherwise it starts and is attributed to
+  codeptr_ra, the location of its creation if known.
+*/
+void am_ompt_profile_schedule(struct am_ompt_profile_data* pd,
+                              uint64_t prior_task_id, int prior_completed,
+                              uint64_t next_task_id, uint64_t codeptr_ra,
+                              am_timestamp_t tsc);
+
+/*
+  Merge the tables of all threads, write the profile and compare it against
+  the baseline profile, if any. Returns the exit status for regressions if a
+  construct regressed beyond the threshold, the exit status for baseline
+  errors if the baseline cannot be read or has a malformed line, and zero
+  otherwise.
+*/
+int am_ompt_profile_report();
+
+#endif
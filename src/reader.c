@@ -0,0 +1,525 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "reader.h"
+
+/* Layout of a frame type identified by its name */
+struct am_ompt_reader_known_type {
+  const char* name;
+  struct am_ompt_reader_type type;
+};
+
+static const struct am_ompt_reader_known_type am_ompt_reader_known_types[] = {
+    {"am::core::frame_type_id", {AM_OMPT_LAYOUT_STRING, 4, 0, -1}},
+    {"am::core::hierarchy_description", {AM_OMPT_LAYOUT_STRING, 4, 0, -1}},
+    {"am::core::hierarchy_node", {AM_OMPT_LAYOUT_STRING, 12, 0, -1}},
+    {"am::core::event_collection", {AM_OMPT_LAYOUT_STRING, 4, 0, -1}},
+    {"am::core::event_mapping", {AM_OMPT_LAYOUT_FIXED, 28, 0, -1}},
+    {"am::core::counter_description", {AM_OMPT_LAYOUT_STRING, 4, 0, -1}},
+    {"am::core::counter_event",
+     {AM_OMPT_LAYOUT_FIXED, 24, 1, AM_OMPT_EVENT_COUNTER}},
+    {"am::core::state_description", {AM_OMPT_LAYOUT_STRING, 4, 0, -1}},
+    {"am::core::state_event", {AM_OMPT_LAYOUT_FIXED, 24, 1, -1}},
+#define AM_OMPT_KNOWN_TYPE(name, NAME, kind)                 \
+  {"am::ompt::" #name,                                       \
+   {AM_OMPT_LAYOUT_FIXED, AM_OMPT_EVENT_SIZE(name, kind), 1, \
+    AM_OMPT_EVENT_##NAME}},
+    AM_OMPT_EVENTS(AM_OMPT_KNOWN_TYPE)
+#undef AM_OMPT_KNOWN_TYPE
+};
+
+#define AM_OMPT_NUM_KNOWN_TYPES                                                \
+  (sizeof(am_ompt_reader_known_types) / sizeof(am_ompt_reader_known_types[0]))
+
+const char* am_ompt_event_names[AM_OMPT_NUM_EVENTS + 1] = {
+#define AM_OMPT_EVENT_NAME(name, NAME, kind) #name,
+    AM_OMPT_EVENTS(AM_OMPT_EVENT_NAME)
+#undef AM_OMPT_EVENT_NAME
+    "counter"};
+
+#define AM_OMPT_IS_INTERVAL_INTERVAL 1
+#define AM_OMPT_IS_INTERVAL_POINT 0
+
+const int am_ompt_event_is_interval[AM_OMPT_NUM_EVENTS + 1] = {
+#define AM_OMPT_EVENT_IS_INTERVAL(name, NAME, kind) AM_OMPT_IS_INTERVAL_##kind,
+    AM_OMPT_EVENTS(AM_OMPT_EVENT_IS_INTERVAL)
+#undef AM_OMPT_EVENT_IS_INTERVAL
+    0};
+
+static inline uint32_t am_ompt_read_u32(const uint8_t* p) {
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+
+  return v;
+}
+
+static int am_ompt_reader_fail(struct am_ompt_reader* r, size_t offset,
+                               const char* msg, uint32_t arg) {
+  r->error_offset = offset;
+  snprintf(r->error, sizeof(r->error), msg, arg);
+
+  return 1;
+}
+
+/* Declare a frame type from a frame type id frame */
+static int am_ompt_reader_declare(struct am_ompt_reader* r, uint32_t id,
+                                  const char* name, uint32_t len) {
+  struct am_ompt_reader_type* types;
+
+  if (id > AM_OMPT_READER_MAX_TYPE_ID) return 1;
+
+  if (id >= r->num_types) {
+    if (!(types = realloc(r->types, (id + 1) * sizeof(*types)))) return 1;
+
+    memset(&types[r->num_types], 0, (id + 1 - r->num_types) * sizeof(*types));
+
+    r->types = types;
+    r->num_types = id + 1;
+  }
+
+  for (size_t i = 0; i < AM_OMPT_NUM_KNOWN_TYPES; i++) {
+    const char* known = am_ompt_reader_known_types[i].name;
+
+    if (strlen(known) == len && !memcmp(known, name, len)) {
+      r->types[id] = am_ompt_reader_known_types[i].type;
+
+      if (!strcmp(known, "am::core::event_collection"))
+        r->collection_type_id = id;
+
+      return 0;
+    }
+  }
+
+  r->types[id].layout = AM_OMPT_LAYOUT_UNKNOWN;
+
+  return 0;
+}
+
+static struct am_ompt_reader_collection* am_ompt_reader_get_collection(
+    struct am_ompt_reader* r, uint32_t id) {
+  struct am_ompt_reader_collection* c;
+
+  for (size_t i = 0; i < r->num_collections; i++) {
+    if (r->collections[i].id == id) return &r->collections[i];
+  }
+
+  if (r->num_collections == r->max_collections) {
+    size_t max = r->max_collections ? 2 * r->max_collections : 64;
+
+    if (!(c = realloc(r->collections, max * sizeof(*c)))) return NULL;
+
+    r->collections = c;
+    r->max_collections = max;
+  }
+
+  c = &r->collections[r->num_collections++];
+  memset(c, 0, sizeof(*c));
+  c->id = id;
+
+  return c;
+}
+
+/* Extend the last range of a collection or start a new one */
+static int am_ompt_reader_add_frame(struct am_ompt_reader_collection* c,
+                                    size_t start, size_t end) {
+  struct am_ompt_reader_range* ranges;
+
+  c->num_frames++;
+
+  if (c->num_ranges && c->ranges[c->num_ranges - 1].end == start) {
+    c->ranges[c->num_ranges - 1].end = end;
+    return 0;
+  }
+
+  if (c->num_ranges == c->max_ranges) {
+    size_t max = c->max_ranges ? 2 * c->max_ranges : 16;
+
+    if (!(ranges = realloc(c->ranges, max * sizeof(*ranges)))) return 1;
+
+    c->ranges = ranges;
+    c->max_ranges = max;
+  }
+
+  c->ranges[c->num_ranges].start = start;
+  c->ranges[c->num_ranges].end = end;
+  c->num_ranges++;
+
+  return 0;
+}
+
+/* Walk all frames once, only reading type ids, collection ids and the frames
+   that declare types and collections. */
+static int am_ompt_reader_scan(struct am_ompt_reader* r) {
+  const uint8_t* data = r->data;
+  size_t off = 2 * sizeof(uint32_t);
+  struct am_ompt_reader_collection* last = NULL;
+  uint32_t frame_type_id_id;
+
+  if (r->frames_end - off < sizeof(uint32_t)) return 0;
+
+  /* Types are declared before their first use, so the first frame declares a
+     type and carries the type id of frame type id frames. */
+  frame_type_id_id = am_ompt_read_u32(&data[off]);
+
+  if (am_ompt_reader_declare(r, frame_type_id_id, "am::core::frame_type_id",
+                             strlen("am::core::frame_type_id")))
+    return am_ompt_reader_fail(r, off, "Invalid frame type id %u.",
+                               frame_type_id_id);
+
+  while (off < r->frames_end) {
+    const struct am_ompt_reader_type* t;
+    uint32_t id;
+    size_t p, size;
+
+    if (r->frames_end - off < sizeof(uint32_t))
+      return am_ompt_reader_fail(r, off, "Truncated frame type id.", 0);
+
+    id = am_ompt_read_u32(&data[off]);
+    p = off + sizeof(uint32_t);
+
+    if (id >= r->num_types || r->types[id].layout == AM_OMPT_LAYOUT_UNKNOWN)
+      return am_ompt_reader_fail(r, off, "Unknown frame type %u.", id);
+
+    t = &r->types[id];
+    size = t->size;
+
+    if (t->layout == AM_OMPT_LAYOUT_STRING) {
+      if (r->frames_end - p < size + sizeof(uint32_t))
+        return am_ompt_reader_fail(r, off, "Truncated frame of type %u.", id);
+
+      size += sizeof(uint32_t) + am_ompt_read_u32(&data[p + t->size]);
+    }
+
+    if (r->frames_end - p < size)
+      return am_ompt_reader_fail(r, off, "Truncated frame of type %u.", id);
+
+    if (id == frame_type_id_id) {
+      if (am_ompt_reader_declare(r, am_ompt_read_u32(&data[p]),
+                                 (const char*)&data[p + 8],
+                                 am_ompt_read_u32(&data[p + 4])))
+        return am_ompt_reader_fail(r, off, "Invalid frame type id %u.",
+                                   am_ompt_read_u32(&data[p]));
+    } else if (t->per_collection) {
+      uint32_t cid = am_ompt_read_u32(&data[p]);
+
+      if ((!last || last->id != cid) &&
+          !(last = am_ompt_reader_get_collection(r, cid)))
+        return am_ompt_reader_fail(r, off, "Out of memory.", 0);
+
+      if (am_ompt_reader_add_frame(last, off, p + size))
+        return am_ompt_reader_fail(r, off, "Out of memory.", 0);
+    } else if (id == r->collection_type_id) {
+      struct am_ompt_reader_collection* c;
+      uint32_t len = am_ompt_read_u32(&data[p + 4]);
+
+      if (!(c = am_ompt_reader_get_collection(r, am_ompt_read_u32(&data[p]))))
+        return am_ompt_reader_fail(r, off, "Out of memory.", 0);
+
+      free(c->name);
+
+      if ((c->name = malloc(len + 1))) {
+        memcpy(c->name, &data[p + 8], len);
+        c->name[len] = '\0';
+      }
+    }
+
+    off = p + size;
+    r->num_frames++;
+  }
+
+  return 0;
+}
+
+static inline uint64_t am_ompt_read_u64(const uint8_t* p) {
+  uint64_t v;
+
+  memcpy(&v, p, sizeof(v));
+
+  return v;
+}
+
+/* Find the indexes from the end of the trace, each preceded by the next */
+static void am_ompt_reader_find_index(struct am_ompt_reader* r) {
+  const uint8_t* footer;
+  size_t end = r->size;
+  uint64_t start, num;
+  uint32_t size, magic;
+
+  while (end >= 2 * sizeof(uint32_t) + AM_OMPT_INDEX_FOOTER_SIZE) {
+    footer = &r->data[end - AM_OMPT_INDEX_FOOTER_SIZE];
+    start = am_ompt_read_u64(footer);
+    num = am_ompt_read_u64(&footer[sizeof(uint64_t)]);
+    size = am_ompt_read_u32(&footer[2 * sizeof(uint64_t)]);
+    magic = am_ompt_read_u32(&footer[2 * sizeof(uint64_t) + sizeof(uint32_t)]);
+
+    if (start < 2 * sizeof(uint32_t) ||
+        start > end - AM_OMPT_INDEX_FOOTER_SIZE || !size ||
+        (end - AM_OMPT_INDEX_FOOTER_SIZE - start) / size != num ||
+        (end - AM_OMPT_INDEX_FOOTER_SIZE - start) % size)
+      return;
+
+    if (magic == AM_OMPT_INDEX_MAGIC && size == AM_OMPT_INDEX_ENTRY_SIZE &&
+        !r->index) {
+      r->index = &r->data[start];
+      r->num_index_entries = num;
+    } else if (magic == AM_OMPT_SEEK_INDEX_MAGIC &&
+               size == AM_OMPT_SEEK_INDEX_ENTRY_SIZE && !r->seek) {
+      r->seek = &r->data[start];
+      r->num_seek_entries = num;
+    } else {
+      return;
+    }
+
+    r->frames_end = start;
+    end = start;
+  }
+}
+
+int am_ompt_reader_open(struct am_ompt_reader* r, const char* path) {
+  struct stat st;
+  void* data;
+
+  memset(r, 0, sizeof(*r));
+  r->collection_type_id = UINT32_MAX;
+
+  if ((r->fd = open(path, O_RDONLY)) == -1) {
+    fprintf(stderr, "Could not open trace \"%s\".\n", path);
+    goto out_err;
+  }
+
+  if (fstat(r->fd, &st)) {
+    fprintf(stderr, "Could not stat trace \"%s\".\n", path);
+    goto out_err_close;
+  }
+
+  if ((size_t)st.st_size < 2 * sizeof(uint32_t)) {
+    fprintf(stderr, "Trace \"%s\" is too short.\n", path);
+    goto out_err_close;
+  }
+
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, r->fd, 0);
+
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "Could not map trace \"%s\".\n", path);
+    goto out_err_close;
+  }
+
+  r->data = data;
+  r->size = st.st_size;
+
+  if (am_ompt_read_u32(r->data) != AM_OMPT_READER_MAGIC) {
+    fprintf(stderr, "File \"%s\" is not an Aftermath trace.\n", path);
+    goto out_err_unmap;
+  }
+
+  r->version = am_ompt_read_u32(&r->data[sizeof(uint32_t)]);
+  r->frames_end = r->size;
+
+  am_ompt_reader_find_index(r);
+
+  madvise(data, r->size, MADV_WILLNEED);
+
+  am_ompt_reader_scan(r);
+
+  return 0;
+
+out_err_unmap:
+  munmap(data, r->size);
+out_err_close:
+  close(r->fd);
+out_err:
+  return 1;
+}
+
+void am_ompt_reader_close(struct am_ompt_reader* r) {
+  for (size_t i = 0; i < r->num_collections; i++) {
+    free(r->collections[i].name);
+    free(r->collections[i].ranges);
+  }
+
+  free(r->collections);
+  free(r->types);
+  munmap((void*)r->data, r->size);
+  close(r->fd);
+}
+
+/* Read a little-endian field and advance the frame pointer. Traces are only
+   written on little-endian machines, so a copy is sufficient. */
+#define AM_OMPT_READ(dst) (memcpy(&(dst), p, sizeof(dst)), p += sizeof(dst))
+
+#define AM_OMPT_READ_PREFIX_INTERVAL \
+  AM_OMPT_READ(e->start);            \
+  AM_OMPT_READ(e->end);
+
+#define AM_OMPT_READ_PREFIX_POINT \
+  AM_OMPT_READ(e->start);         \
+  e->end = e->start;
+
+#define AM_OMPT_READ_FIELD(type, name) AM_OMPT_READ(f->name);
+
+static void am_ompt_reader_decode(int type, const uint8_t* p,
+                                  struct am_ompt_event* e) {
+  e->type = type;
+
+  AM_OMPT_READ(e->collection_id);
+
+  switch (type) {
+#define AM_OMPT_DECODE_CASE(name, NAME, kind) \
+  case AM_OMPT_EVENT_##NAME: {                \
+    __typeof__(e->name)* f = &e->name;        \
+                                              \
+    (void)f;                                  \
+    AM_OMPT_READ_PREFIX_##kind                \
+    AM_OMPT_FIELDS_##name(AM_OMPT_READ_FIELD) \
+    break;                                    \
+  }
+    AM_OMPT_EVENTS(AM_OMPT_DECODE_CASE)
+#undef AM_OMPT_DECODE_CASE
+    case AM_OMPT_EVENT_COUNTER:
+      AM_OMPT_READ(e->counter.counter_id);
+      AM_OMPT_READ_PREFIX_POINT
+      AM_OMPT_READ(e->counter.value);
+      break;
+  }
+}
+
+int am_ompt_reader_next(const struct am_ompt_reader* r, size_t* offset,
+                        size_t end, struct am_ompt_event* e) {
+  size_t off = *offset;
+
+  /* Ranges only contain frames of fixed size that were checked by the scan */
+  while (off < end) {
+    const struct am_ompt_reader_type* t =
+        &r->types[am_ompt_read_u32(&r->data[off])];
+    const uint8_t* p = &r->data[off + sizeof(uint32_t)];
+
+    off += sizeof(uint32_t) + t->size;
+
+    if (t->event >= 0) {
+      am_ompt_reader_decode(t->event, p, e);
+      *offset = off;
+      return 1;
+    }
+  }
+
+  *offset = off;
+
+  return 0;
+}
+
+void am_ompt_reader_index_entry(const struct am_ompt_reader* r, uint64_t i,
+                                struct am_ompt_index_entry* entry) {
+  const uint8_t* p = &r->index[i * AM_OMPT_INDEX_ENTRY_SIZE];
+
+  entry->time = am_ompt_read_u64(p);
+  entry->collection_id = am_ompt_read_u32(&p[sizeof(uint64_t)]);
+  entry->offset = am_ompt_read_u64(&p[sizeof(uint64_t) + sizeof(uint32_t)]);
+}
+
+void am_ompt_reader_seek_entry(const struct am_ompt_reader* r, uint64_t i,
+                               struct am_ompt_seek_entry* entry) {
+  const uint8_t* p = &r->seek[i * AM_OMPT_SEEK_INDEX_ENTRY_SIZE];
+
+  entry->time = am_ompt_read_u64(p);
+  entry->offset = am_ompt_read_u64(&p[sizeof(uint64_t)]);
+  entry->collection_id = am_ompt_read_u32(&p[2 * sizeof(uint64_t)]);
+  entry->depth = am_ompt_read_u32(&p[2 * sizeof(uint64_t) + sizeof(uint32_t)]);
+}
+
+int am_ompt_reader_seek(const struct am_ompt_reader* r,
+                        const struct am_ompt_reader_collection* c,
+                        uint64_t time, size_t* range, size_t* offset,
+                        uint32_t* depth) {
+  struct am_ompt_seek_entry entry;
+  uint64_t lo = 0, hi = r->num_seek_entries;
+
+  *range = 0;
+  *offset = c->num_ranges ? c->ranges[0].start : 0;
+  *depth = 0;
+
+  /* Last entry of the collection with a time before the given time, no
+     frame before it was recorded later */
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+
+    am_ompt_reader_seek_entry(r, mid, &entry);
+
+    if (entry.collection_id < c->id ||
+        (entry.collection_id == c->id && entry.time < time))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (!lo) return 0;
+
+  am_ompt_reader_seek_entry(r, lo - 1, &entry);
+
+  if (entry.collection_id != c->id) return 0;
+
+  for (size_t i = 0; i < c->num_ranges; i++) {
+    if (entry.offset >= c->ranges[i].start && entry.offset < c->ranges[i].end) {
+      *range = i;
+      *offset = entry.offset;
+      *depth = entry.depth;
+
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int am_ompt_reader_index_event(const struct am_ompt_reader* r, uint64_t i,
+                               struct am_ompt_event* e) {
+  struct am_ompt_index_entry entry;
+  const struct am_ompt_reader_type* t;
+  uint32_t id;
+
+  am_ompt_reader_index_entry(r, i, &entry);
+
+  /* Frames before an error in the trace were not checked by the scan */
+  if (entry.offset < 2 * sizeof(uint32_t) ||
+      (r->error_offset && entry.offset >= r->error_offset) ||
+      r->frames_end - entry.offset < sizeof(uint32_t))
+    return 0;
+
+  id = am_ompt_read_u32(&r->data[entry.offset]);
+
+  if (id >= r->num_types) return 0;
+
+  t = &r->types[id];
+
+  if (t->event < 0 || t->layout != AM_OMPT_LAYOUT_FIXED ||
+      r->frames_end - entry.offset - sizeof(uint32_t) < t->size)
+    return 0;
+
+  am_ompt_reader_decode(t->event, &r->data[entry.offset + sizeof(uint32_t)],
+                        e);
+
+  return 1;
+}
@@ -0,0 +1,185 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef AM_OMPT_READER_H
+#define AM_OMPT_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "events.h"
+
+/* Magic number at the start of Aftermath traces */
+#define AM_OMPT_READER_MAGIC 0x5654534f
+
+/* Highest frame type id accepted by the reader */
+#define AM_OMPT_READER_MAX_TYPE_ID 0xffff
+
+/* Counter events are decoded along with the Afterompt events */
+#define AM_OMPT_EVENT_COUNTER AM_OMPT_NUM_EVENTS
+
+/* Layout of a frame after its type id */
+enum am_ompt_reader_layout {
+  /* Type id was not declared in the trace or has an unknown name */
+  AM_OMPT_LAYOUT_UNKNOWN = 0,
+  /* Fixed number of bytes */
+  AM_OMPT_LAYOUT_FIXED,
+  /* Fixed number of bytes followed by a string */
+  AM_OMPT_LAYOUT_STRING
+};
+
+/* Frame type declared by a frame type id frame */
+struct am_ompt_reader_type {
+  enum am_ompt_reader_layout layout;
+  /* Size without the type id and the string */
+  uint32_t size;
+  /* Set if the frame starts with the id of an event collection */
+  int per_collection;
+  /* Event type, or -1 if frames are not decoded as events */
+  int event;
+};
+
+/* Contiguous range of frames of a single event collection */
+struct am_ompt_reader_range {
+  size_t start;
+  size_t end;
+};
+
+struct am_ompt_reader_collection {
+  uint32_t id;
+  /* Name from the event collection frame, NULL if there was none */
+  char* name;
+  uint64_t num_frames;
+  struct am_ompt_reader_range* ranges;
+  size_t num_ranges;
+  size_t max_ranges;
+};
+
+/* Trace mapped into memory with the frames split by event collection */
+struct am_ompt_reader {
+  int fd;
+  const uint8_t* data;
+  size_t size;
+  uint32_t version;
+  uint64_t num_frames;
+  /* Frame types indexed by their id */
+  struct am_ompt_reader_type* types;
+  uint32_t num_types;
+  /* Type id of event collection frames */
+  uint32_t collection_type_id;
+  /* End of the frames, before the indexes if there are any */
+  size_t frames_end;
+  /* Entries of the time index, NULL if the trace has none */
+  const uint8_t* index;
+  uint64_t num_index_entries;
+  /* Entries of the seek index, NULL if the trace has none */
+  const uint8_t* seek;
+  uint64_t num_seek_entries;
+  struct am_ompt_reader_collection* collections;
+  size_t num_collections;
+  size_t max_collections;
+  /* Offset at which scanning stopped because of a malformed frame, zero if
+     the whole trace was scanned */
+  size_t error_offset;
+  char error[128];
+};
+
+#define AM_OMPT_EVENT_FIELD_DECL(type, name) type name;
+
+/* Event decoded from the trace. Point events have equal start and end. */
+struct am_ompt_event {
+  int type;
+  uint32_t collection_id;
+  uint64_t start;
+  uint64_t end;
+  union {
+#define AM_OMPT_EVENT_UNION(name, NAME, kind)       \
+  struct {                                          \
+    AM_OMPT_FIELDS_##name(AM_OMPT_EVENT_FIELD_DECL) \
+  } name;
+    AM_OMPT_EVENTS(AM_OMPT_EVENT_UNION)
+#undef AM_OMPT_EVENT_UNION
+    struct {
+      uint32_t counter_id;
+      int64_t value;
+    } counter;
+  };
+};
+
+extern const char* am_ompt_event_names[AM_OMPT_NUM_EVENTS + 1];
+
+/* Non-zero for interval events */
+extern const int am_ompt_event_is_interval[AM_OMPT_NUM_EVENTS + 1];
+
+/* Map a trace into memory and split its frames by event collection. Errors in
+   the frames are recorded in the reader, so only the frames up to the error
+   are available. Returns 0 on success. */
+int am_ompt_reader_open(struct am_ompt_reader* r, const char* path);
+
+void am_ompt_reader_close(struct am_ompt_reader* r);
+
+/* Entry of the time index */
+struct am_ompt_index_entry {
+  uint64_t time;
+  uint32_t collection_id;
+  uint64_t offset;
+};
+
+/* Read entry i of the time index */
+void am_ompt_reader_index_entry(const struct am_ompt_reader* r, uint64_t i,
+                                struct am_ompt_index_entry* entry);
+
+/* Decode the event of entry i of the time index. Iterating over all entries
+   visits the events of all collections in order of their recording time with
+   a single pass over the index. Returns 0 if the entry does not refer to an
+   event frame. */
+int am_ompt_reader_index_event(const struct am_ompt_reader* r, uint64_t i,
+                               struct am_ompt_event* e);
+
+/* Entry of the seek index */
+struct am_ompt_seek_entry {
+  uint64_t time;
+  uint64_t offset;
+  uint32_t collection_id;
+  /* Number of states open at the time, whose intervals follow the frame */
+  uint32_t depth;
+};
+
+/* Read entry i of the seek index */
+void am_ompt_reader_seek_entry(const struct am_ompt_reader* r, uint64_t i,
+                               struct am_ompt_seek_entry* entry);
+
+/* Find where to start reading the events of a collection to see all events
+   recorded at or after the given time. On return, the events from *offset to
+   the end of range *range of the collection and its following ranges include
+   all such events. *depth is the number of states open where reading starts,
+   whose intervals are among the events that follow.
+   Returns 1 if the seek index was used, 0 if reading has to start at the
+   beginning of the collection. */
+int am_ompt_reader_seek(const struct am_ompt_reader* r,
+                        const struct am_ompt_reader_collection* c,
+                        uint64_t time, size_t* range, size_t* offset,
+                        uint32_t* depth);
+
+/* Decode the next event or counter event of the range starting at *offset and
+   advance the offset. Returns 1 if an event was decoded, 0 at the end of the
+   range. Safe to call concurrently for different ranges. */
+int am_ompt_reader_next(const struct am_ompt_reader* r, size_t* offset,
+                        size_t end, struct am_ompt_event* e);
+
+#endif
@@ -0,0 +1,286 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "control.h"
+#include "sampling.h"
+#include "trace.h"
+#include "writer.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+int am_ompt_sampling_enabled;
+
+/* Samples per second of thread CPU time */
+static double am_ompt_sampling_frequency;
+
+static int am_ompt_sampling_signal = AM_OMPT_DEFAULT_SAMPLING_SIGNAL;
+
+/* Capacity of the sample ring of each thread, a power of two */
+static uint32_t am_ompt_sampling_buffer = AM_OMPT_DEFAULT_SAMPLING_BUFFER;
+
+/* Runtime entry point for the OpenMP state of a thread, may be NULL */
+static ompt_get_state_t am_ompt_get_state;
+
+/* Sampler of the calling thread. It is first accessed when the sampler is
+   created, so that the signal handler never allocates thread-local
+   storage. */
+static __thread struct am_ompt_sampler* am_ompt_sampler;
+
+/* Program counter of the interrupted code */
+static inline uint64_t am_ompt_sampling_pc(void* ucontext) {
+  ucontext_t* uc = ucontext;
+
+#if defined(__x86_64__)
+  return uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+  return uc->uc_mcontext.pc;
+#elif defined(__powerpc64__)
+  return uc->uc_mcontext.regs->nip;
+#else
+  (void)uc;
+  return 0;
+#endif
+}
+
+/*
+  Record the interrupted program counter together with the innermost state
+  on the state stack of the thread. Only stores to the ring of the thread,
+  which is async-signal-safe.
+*/
+static void am_ompt_sampling_handler(int signum, siginfo_t* info,
+                                     void* ucontext) {
+  struct am_ompt_sampler* s = am_ompt_sampler;
+
+  if (!s || !am_ompt_tracing_enabled()) return;
+
+  uint32_t head = s->head;
+
+  if (head - s->tail > s->mask) {
+    s->dropped++;
+    return;
+  }
+
+  struct am_ompt_thread_data* td = s->td;
+  struct am_ompt_sample* sample = &s->ring[head & s->mask];
+  uint32_t top = td->state_stack.top;
+  ompt_wait_id_t wait_id;
+
+  sample->tsc = am_ompt_now();
+  sample->pc = am_ompt_sampling_pc(ucontext);
+  sample->kind = -1;
+  sample->omp_state = am_ompt_get_state ? am_ompt_get_state(&wait_id) : -1;
+  sample->task_id = td->task_id;
+  sample->codeptr_ra = 0;
+
+  if (top > 0) {
+    struct am_ompt_stack_item* item = &td->state_stack.stack[top - 1];
+
+    sample->kind = item->kind;
+
+    if (item->kind == AM_OMPT_STATE_LOOP)
+      sample->codeptr_ra = item->data.loop_info.codeptr_ra;
+  }
+
+  __atomic_store_n(&s->head, head + 1, __ATOMIC_RELEASE);
+}
+
+int am_ompt_sampling_init(ompt_function_lookup_t lookup) {
+  struct sigaction sa;
+  const char* value;
+  uint32_t size = 1;
+
+  if ((value = getenv("AFTEROMPT_SAMPLING_FREQUENCY")))
+    sscanf(value, "%lf", &am_ompt_sampling_frequency);
+
+  if ((value = getenv("AFTEROMPT_SAMPLING_SIGNAL")))
+    sscanf(value, "%d", &am_ompt_sampling_signal);
+
+  if ((value = getenv("AFTEROMPT_SAMPLING_BUFFER")))
+    sscanf(value, "%u", &am_ompt_sampling_buffer);
+
+  if (am_ompt_sampling_frequency <= 0 || !am_ompt_sampling_buffer) return 0;
+
+  while (size < am_ompt_sampling_buffer) size *= 2;
+
+  am_ompt_sampling_buffer = size;
+  am_ompt_get_state = (ompt_get_state_t)lookup("ompt_get_state");
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = am_ompt_sampling_handler;
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+
+  if (sigaction(am_ompt_sampling_signal, &sa, NULL)) {
+    fprintf(stderr,
+            "Afterompt: Could not install handler for sampling signal %d.\n",
+            am_ompt_sampling_signal);
+    return 1;
+  }
+
+  am_ompt_sampling_enabled = 1;
+
+  return 0;
+}
+
+struct am_ompt_sampler* am_ompt_sampling_create(
+    struct am_ompt_thread_data* td) {
+  struct am_ompt_sampler* s;
+  struct sigevent sev;
+  struct itimerspec its;
+  clockid_t clock;
+  double period = 1.0 / am_ompt_sampling_frequency;
+
+  if (!(s = malloc(sizeof(*s)))) {
+    fprintf(stderr, "Afterompt: Could not allocate sampler.\n");
+    goto out_err;
+  }
+
+  if (!(s->ring = malloc(am_ompt_sampling_buffer * sizeof(*s->ring)))) {
+    fprintf(stderr, "Afterompt: Could not allocate sample buffer.\n");
+    goto out_err_free;
+  }
+
+  s->td = td;
+  s->mask = am_ompt_sampling_buffer - 1;
+  s->head = 0;
+  s->tail = 0;
+  s->dropped = 0;
+
+  if (pthread_getcpuclockid(pthread_self(), &clock)) {
+    fprintf(stderr, "Afterompt: Could not get thread CPU clock.\n");
+    goto out_err_free_ring;
+  }
+
+  memset(&sev, 0, sizeof(sev));
+  sev.sigev_notify = SIGEV_THREAD_ID;
+  sev.sigev_signo = am_ompt_sampling_signal;
+  sev.sigev_notify_thread_id = syscall(SYS_gettid);
+
+  if (timer_create(clock, &sev, &s->timer)) {
+    fprintf(stderr, "Afterompt: Could not create sampling timer.\n");
+    goto out_err_free_ring;
+  }
+
+  am_ompt_sampler = s;
+
+  its.it_interval.tv_sec = (time_t)period;
+  its.it_interval.tv_nsec = (long)((period - (time_t)period) * 1e9);
+
+  /* Periods below the timer resolution would disarm the timer */
+  if (!its.it_interval.tv_sec && !its.it_interval.tv_nsec)
+    its.it_interval.tv_nsec = 1;
+
+  its.it_value = its.it_interval;
+
+  if (timer_settime(s->timer, 0, &its, NULL)) {
+    fprintf(stderr, "Afterompt: Could not start sampling timer.\n");
+    goto out_err_delete;
+  }
+
+  return s;
+
+out_err_delete:
+  am_ompt_sampler = NULL;
+  timer_delete(s->timer);
+out_err_free_ring:
+  free(s->ring);
+out_err_free:
+  free(s);
+out_err:
+  return NULL;
+}
+
+void am_ompt_sampling_destroy(struct am_ompt_sampler* s) {
+  if (!s) return;
+
+  /* Signals still pending after the timer is deleted find no sampler */
+  am_ompt_sampler = NULL;
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+  timer_delete(s->timer);
+
+  if (s->dropped) {
+    fprintf(stderr,
+            "Afterompt: %lu samples were dropped, consider increasing "
+            "AFTEROMPT_SAMPLING_BUFFER.\n",
+            s->dropped);
+  }
+
+  free(s->ring);
+  free(s);
+}
+
+int am_ompt_sampling_drain_slow(struct am_ompt_sampler* s,
+                                struct am_buffered_event_collection* c) {
+  uint32_t head = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE);
+
+  while (s->tail != head) {
+    struct am_ompt_sample* p = &s->ring[s->tail & s->mask];
+
+    if (am_ompt_write_sample(&c->data, c->id, p->tsc, p->pc, p->kind,
+                             p->omp_state, p->task_id, p->codeptr_ra))
+      return 1;
+
+    /* Frees the slot for the signal handler */
+    __atomic_store_n(&s->tail, s->tail + 1, __ATOMIC_RELEASE);
+  }
+
+  return 0;
+}
+
+int am_ompt_sampling_write_maps(const char* trace_file) {
+  char path[4096];
+  char buf[4096];
+  FILE *in, *out;
+  size_t n;
+
+  snprintf(path, sizeof(path), "%s.maps", trace_file);
+
+  if (!(in = fopen("/proc/self/maps", "r"))) goto out_err;
+
+  if (!(out = fopen(path, "w"))) goto out_err_close_in;
+
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+    if (fwrite(buf, 1, n, out) != n) goto out_err_close_out;
+  }
+
+  if (fclose(out)) goto out_err_close_in;
+
+  fclose(in);
+
+  return 0;
+
+out_err_close_out:
+  fclose(out);
+out_err_close_in:
+  fclose(in);
+out_err:
+  return 1;
+}
@@ -0,0 +1,106 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef AM_OMPT_SAMPLING_H
+#define AM_OMPT_SAMPLING_H
+
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <ompt.h>
+
+#include <aftermath/trace/buffered_event_collection.h>
+#include <aftermath/trace/timestamp.h>
+
+#define AM_OMPT_DEFAULT_SAMPLING_SIGNAL SIGPROF
+#define AM_OMPT_DEFAULT_SAMPLING_BUFFER 1024
+
+struct am_ompt_thread_data;
+
+/* Sample taken by the signal handler, written to the trace later */
+struct am_ompt_sample {
+  am_timestamp_t tsc;
+  uint64_t pc;
+  int32_t kind;
+  int32_t omp_state;
+  uint64_t task_id;
+  uint64_t codeptr_ra;
+};
+
+/*
+  Per-thread sampling state. Samples are stored in a ring by the signal
+  handler and moved to the event collection by the thread itself, so that
+  the handler never touches an event buffer the thread may be writing to.
+*/
+struct am_ompt_sampler {
+  timer_t timer;
+  struct am_ompt_thread_data* td;
+  struct am_ompt_sample* ring;
+  uint32_t mask;
+  /* Written by the signal handler only */
+  uint32_t head;
+  uint64_t dropped;
+  /* Written by the thread only */
+  uint32_t tail;
+};
+
+/* Set if sampling is enabled */
+extern int am_ompt_sampling_enabled;
+
+/*
+  Read the sampling settings from the environment and install the signal
+  handler. Sampling is enabled if AFTEROMPT_SAMPLING_FREQUENCY is set. The
+  lookup function is used to find ompt_get_state, which is optional.
+*/
+int am_ompt_sampling_init(ompt_function_lookup_t lookup);
+
+/*
+  Start sampling the calling thread, which td belongs to. Returns NULL on
+  error.
+*/
+struct am_ompt_sampler* am_ompt_sampling_create(struct am_ompt_thread_data* td);
+
+/*
+  Stop sampling and free the sampler. Has to be called on the sampled
+  thread.
+*/
+void am_ompt_sampling_destroy(struct am_ompt_sampler* s);
+
+/*
+  Copy the memory mappings of the process to <trace_file>.maps, so that
+  sampled program counters can be resolved after the run. Returns 0 on
+  success.
+*/
+int am_ompt_sampling_write_maps(const char* trace_file);
+
+/*
+  Write the pending samples to the event collection. Returns 0 on success.
+*/
+int am_ompt_sampling_drain_slow(struct am_ompt_sampler* s,
+                                struct am_buffered_event_collection* c);
+
+/* Write pending samples, if any. Returns 0 on success. */
+static inline int am_ompt_sampling_drain(
+    struct am_ompt_sampler* s, struct am_buffered_event_collection* c) {
+  if (__atomic_load_n(&s->head, __ATOMIC_ACQUIRE) == s->tail) return 0;
+
+  return am_ompt_sampling_drain_slow(s, c);
+}
+
+#endif
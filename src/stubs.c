@@ -0,0 +1,33 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+  No-op stubs of the annotation API for libafterompt-annotate. Applications
+  link against them unconditionally, and the definitions of libafterompt
+  take precedence when it is preloaded.
+*/
+
+#include "afterompt-annotate.h"
+
+__attribute__((weak)) uint32_t afterompt_label(const char* name) { return 0; }
+
+__attribute__((weak)) void afterompt_phase_begin(uint32_t label) {}
+
+__attribute__((weak)) void afterompt_phase_end(void) {}
+
+__attribute__((weak)) void afterompt_counter(uint32_t label, int64_t value) {}
@@ -0,0 +1,119 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef AM_OMPT_TABLE_H
+#define AM_OMPT_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+  Hash of a key for open addressing tables. Further bits that tell apart
+  entries with the same key, such as the kind of a construct, are mixed in
+  with extra.
+*/
+static inline uint64_t am_ompt_hash(uint64_t key, uint64_t extra) {
+  uint64_t h = (key * 0x9e3779b97f4a7c15ULL) ^ extra;
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+
+  return h;
+}
+
+/* Non-zero if another entry would raise the load factor of a table above one
+   half, beyond which probe sequences grow long */
+static inline int am_ompt_table_full(size_t size, size_t capacity) {
+  return 2 * (size + 1) > capacity;
+}
+
+/*
+  Defines the functions of a growing open addressing hash table with linear
+  probing. The table type has the fields entries, capacity (a power of two)
+  and size. The following functions have to be defined beforehand:
+
+    uint64_t <prefix>_hash(key_t key)
+    int <prefix>_used(const entry_t* e), non-zero for occupied entries
+    int <prefix>_match(const entry_t* e, key_t key)
+    key_t <prefix>_key(const entry_t* e)
+    void <prefix>_fill(entry_t* e, key_t key), initializes a new entry
+
+  The defined functions are:
+
+    entry_t* <prefix>_slot(table_t* t, key_t key)
+      Find the entry for a key in a table with free entries left.
+
+    int <prefix>_grow(table_t* t)
+      Double the capacity of the table. Returns 0 on success.
+
+    entry_t* <prefix>_get(table_t* t, key_t key)
+      Returns the entry for a key, inserting a filled one if it does not
+      exist yet. Returns NULL if the table cannot grow.
+*/
+#define AM_OMPT_TABLE_DEFINE(prefix, table_t, entry_t, key_t)                 \
+  static entry_t* prefix##_slot(table_t* t, key_t key) {                      \
+    size_t mask = t->capacity - 1;                                            \
+    size_t i = prefix##_hash(key) & mask;                                     \
+                                                                              \
+    while (prefix##_used(&t->entries[i]) &&                                   \
+           !prefix##_match(&t->entries[i], key))                              \
+      i = (i + 1) & mask;                                                     \
+                                                                              \
+    return &t->entries[i];                                                    \
+  }                                                                           \
+                                                                              \
+  static int prefix##_grow(table_t* t) {                                      \
+    entry_t* old = t->entries;                                                \
+    size_t old_capacity = t->capacity;                                        \
+                                                                              \
+    if (!(t->entries = calloc(2 * old_capacity, sizeof(*t->entries)))) {      \
+      t->entries = old;                                                       \
+      return 1;                                                               \
+    }                                                                         \
+                                                                              \
+    t->capacity = 2 * old_capacity;                                           \
+                                                                              \
+    for (size_t i = 0; i < old_capacity; i++) {                               \
+      if (prefix##_used(&old[i]))                                             \
+        *prefix##_slot(t, prefix##_key(&old[i])) = old[i];                    \
+    }                                                                         \
+                                                                              \
+    free(old);                                                                \
+                                                                              \
+    return 0;                                                                 \
+  }                                                                           \
+                                                                              \
+  static entry_t* prefix##_get(table_t* t, key_t key) {                       \
+    entry_t* e;                                                               \
+                                                                              \
+    if (am_ompt_table_full(t->size, t->capacity) && prefix##_grow(t))         \
+      return NULL;                                                            \
+                                                                              \
+    e = prefix##_slot(t, key);                                                \
+                                                                              \
+    if (!prefix##_used(e)) {                                                  \
+      prefix##_fill(e, key);                                                  \
+      t->size++;                                                              \
+    }                                                                         \
+                                                                              \
+    return e;                                                                 \
+  }
+
+#endif
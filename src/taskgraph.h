@@ -0,0 +1,90 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef AM_OMPT_TASKGRAPH_H
+#define AM_OMPT_TASKGRAPH_H
+
+#include <stdint.h>
+
+/*
+  Task graph extracted from a trace by afterompt-taskgraph and replayed by
+  afterompt-simulate. The file consists of a header, the tasks, the actions
+  of all tasks and the dependences, each as an array of the structures
+  below in native byte order. The structures have no padding.
+
+  Tasks are referred to by their index. Each task has a cost, its execution
+  time without the time it was suspended, and a list of actions ordered by
+  the execution time of the task at which they happen: the creation of a
+  child task and the suspension of the task until the children it created
+  so far completed. Tasks created by implicit tasks are children of a root
+  task per event collection, whose cost is the time from the first to the
+  last creation.
+*/
+#define AM_OMPT_TASKGRAPH_MAGIC 0x47544f41
+#define AM_OMPT_TASKGRAPH_VERSION 1
+
+/* Index of a task that does not exist, e.g. the parent of a root */
+#define AM_OMPT_TASKGRAPH_NONE UINT32_MAX
+
+struct am_ompt_taskgraph_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_tasks;
+  uint32_t num_actions;
+  uint32_t num_dependences;
+  /* Number of event collections that executed or created tasks */
+  uint32_t num_threads;
+  /* Time from the first creation to the last completion of a task */
+  uint64_t span;
+};
+
+/* Set for the root tasks standing for the implicit tasks */
+#define AM_OMPT_TASKGRAPH_ROOT 1
+
+struct am_ompt_taskgraph_task {
+  /* Id of the task in the trace, zero for roots */
+  uint64_t id;
+  uint64_t codeptr_ra;
+  uint64_t cost;
+  uint32_t first_action;
+  uint32_t num_actions;
+  uint32_t parent;
+  uint32_t flags;
+};
+
+enum am_ompt_taskgraph_action_kind {
+  /* Creation of the child task arg */
+  AM_OMPT_TASKGRAPH_CREATE = 0,
+  /* Suspension until all children created before have completed */
+  AM_OMPT_TASKGRAPH_WAIT
+};
+
+struct am_ompt_taskgraph_action {
+  /* Execution time of the task at which the action happens */
+  uint64_t offset;
+  uint32_t kind;
+  uint32_t arg;
+};
+
+/* The sink task cannot start before the source task has completed */
+struct am_ompt_taskgraph_dependence {
+  uint32_t src;
+  uint32_t sink;
+};
+
+#endif
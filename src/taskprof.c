@@ -0,0 +1,516 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "table.h"
+#include "taskprof.h"
+
+int am_ompt_taskprof_enabled;
+
+/* Name of the report file */
+static const char* am_ompt_taskprof_file;
+
+/* Number of task constructs listed in the report */
+static size_t am_ompt_taskprof_top = AM_OMPT_DEFAULT_TASK_PROFILE_TOP;
+
+/* Number of creations per thread that can wait for execution, a power of
+   two */
+static size_t am_ompt_taskprof_window = AM_OMPT_DEFAULT_TASK_PROFILE_WINDOW;
+
+/* State of all threads, protected by am_ompt_taskprof_lock */
+static struct am_ompt_task_data* am_ompt_taskprof_threads;
+static pthread_mutex_t am_ompt_taskprof_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Threads by tid, open addressing. Entries are only ever added, so they can
+   be looked up without the lock. */
+static struct am_ompt_task_data*
+    am_ompt_taskprof_by_tid[AM_OMPT_TASK_MAX_THREADS];
+
+/* NUMA node of each core */
+static int* am_ompt_taskprof_node_of_core;
+static int am_ompt_taskprof_num_cores;
+static int am_ompt_taskprof_num_nodes;
+
+/* Distance class between each pair of nodes. Class zero is the same core. */
+static uint8_t* am_ompt_taskprof_classes;
+
+/* Node distance of each class as reported by the kernel */
+static int am_ompt_taskprof_class_distance[AM_OMPT_TASK_MAX_DISTANCES];
+static int am_ompt_taskprof_num_classes = 1;
+
+/* Read the NUMA distances of a node. Returns the number of distances. */
+static int am_ompt_taskprof_read_distances(int node, int* distances, int max) {
+  char path[128];
+  FILE* fp;
+  int n = 0;
+
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/distance",
+           node);
+
+  if (!(fp = fopen(path, "r"))) return 0;
+
+  while (n < max && fscanf(fp, "%d", &distances[n]) == 1) n++;
+
+  fclose(fp);
+
+  return n;
+}
+
+/* Assign the cores in a cpulist, e.g. "0-3,8-11", to a node */
+static int am_ompt_taskprof_read_cpulist(int node) {
+  char path[128];
+  FILE* fp;
+  int first, last;
+
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+           node);
+
+  if (!(fp = fopen(path, "r"))) return 1;
+
+  while (fscanf(fp, "%d", &first) == 1) {
+    last = first;
+
+    if (fscanf(fp, "-%d", &last) != 1) last = first;
+
+    for (int core = first; core <= last; core++) {
+      if (core >= 0 && core < am_ompt_taskprof_num_cores)
+        am_ompt_taskprof_node_of_core[core] = node;
+    }
+
+    if (fgetc(fp) != ',') break;
+  }
+
+  fclose(fp);
+
+  return 0;
+}
+
+/* Map cores to nodes and classify node distances. Without NUMA information
+   all cores are considered to be on the same node. */
+static int am_ompt_taskprof_read_topology() {
+  int distances[AM_OMPT_TASK_MAX_NODES];
+
+  am_ompt_taskprof_num_cores = sysconf(_SC_NPROCESSORS_CONF);
+
+  if (am_ompt_taskprof_num_cores < 1) am_ompt_taskprof_num_cores = 1;
+
+  if (!(am_ompt_taskprof_node_of_core =
+            calloc(am_ompt_taskprof_num_cores, sizeof(int))))
+    return 1;
+
+  while (am_ompt_taskprof_num_nodes < AM_OMPT_TASK_MAX_NODES &&
+         !am_ompt_taskprof_read_cpulist(am_ompt_taskprof_num_nodes))
+    am_ompt_taskprof_num_nodes++;
+
+  if (!am_ompt_taskprof_num_nodes) am_ompt_taskprof_num_nodes = 1;
+
+  if (!(am_ompt_taskprof_classes =
+            calloc(am_ompt_taskprof_num_nodes * am_ompt_taskprof_num_nodes,
+                   sizeof(uint8_t))))
+    return 1;
+
+  for (int i = 0; i < am_ompt_taskprof_num_nodes; i++) {
+    int n = am_ompt_taskprof_read_distances(i, distances,
+                                            AM_OMPT_TASK_MAX_NODES);
+
+    /* Distances equal to 10 are local, but are still a separate class from
+       the same core */
+    for (int j = 0; j < am_ompt_taskprof_num_nodes; j++) {
+      int d = j < n ? distances[j] : (i == j ? 10 : 20);
+      int c = 1;
+
+      while (c < am_ompt_taskprof_num_classes &&
+             am_ompt_taskprof_class_distance[c] != d)
+        c++;
+
+      if (c == am_ompt_taskprof_num_classes) {
+        /* Too many distinct distances, merge with the largest one */
+        if (c == AM_OMPT_TASK_MAX_DISTANCES)
+          c--;
+        else
+          am_ompt_taskprof_class_distance[am_ompt_taskprof_num_classes++] = d;
+      }
+
+      am_ompt_taskprof_classes[i * am_ompt_taskprof_num_nodes + j] = c;
+    }
+  }
+
+  return 0;
+}
+
+static inline int am_ompt_taskprof_node(int32_t core) {
+  if (core < 0 || core >= am_ompt_taskprof_num_cores) return 0;
+
+  return am_ompt_taskprof_node_of_core[core];
+}
+
+static inline int am_ompt_taskprof_class(int32_t from, int32_t to) {
+  if (from == to) return 0;
+
+  return am_ompt_taskprof_classes[am_ompt_taskprof_node(from) *
+                                      am_ompt_taskprof_num_nodes +
+                                  am_ompt_taskprof_node(to)];
+}
+
+int am_ompt_taskprof_init() {
+  const char* value;
+
+  if (!(am_ompt_taskprof_file = getenv("AFTEROMPT_TASK_PROFILE"))) return 0;
+
+  if ((value = getenv("AFTEROMPT_TASK_PROFILE_TOP")))
+    sscanf(value, "%zu", &am_ompt_taskprof_top);
+
+  if ((value = getenv("AFTEROMPT_TASK_PROFILE_WINDOW")))
+    sscanf(value, "%zu", &am_ompt_taskprof_window);
+
+  /* Round the window up to a power of two */
+  if (am_ompt_taskprof_window < 2) am_ompt_taskprof_window = 2;
+
+  am_ompt_taskprof_window =
+      1UL << (64 - __builtin_clzl(am_ompt_taskprof_window - 1));
+
+  if (am_ompt_taskprof_read_topology()) {
+    fprintf(stderr, "Afterompt: Could not read NUMA topology.\n");
+    return 1;
+  }
+
+  am_ompt_taskprof_enabled = 1;
+
+  return 0;
+}
+
+static int am_ompt_task_table_init(struct am_ompt_task_table* t,
+                                   size_t capacity) {
+  if (!(t->entries = calloc(capacity, sizeof(*t->entries)))) return 1;
+
+  t->capacity = capacity;
+  t->size = 0;
+
+  return 0;
+}
+
+/* Entries of the task table are keyed by the code location of the task */
+static inline uint64_t am_ompt_task_table_hash(uint64_t codeptr_ra) {
+  return am_ompt_hash(codeptr_ra, 0);
+}
+
+static inline int am_ompt_task_table_used(const struct am_ompt_task_stats* s) {
+  return s->count != 0;
+}
+
+static inline int am_ompt_task_table_match(const struct am_ompt_task_stats* s,
+                                           uint64_t codeptr_ra) {
+  return s->codeptr_ra == codeptr_ra;
+}
+
+static inline uint64_t am_ompt_task_table_key(
+    const struct am_ompt_task_stats* s) {
+  return s->codeptr_ra;
+}
+
+/* New entries have a count of zero until the caller records the task */
+static inline void am_ompt_task_table_fill(struct am_ompt_task_stats* s,
+                                           uint64_t codeptr_ra) {
+  memset(s, 0, sizeof(*s));
+  s->codeptr_ra = codeptr_ra;
+}
+
+AM_OMPT_TABLE_DEFINE(am_ompt_task_table, struct am_ompt_task_table,
+                     struct am_ompt_task_stats, uint64_t)
+
+static inline unsigned int am_ompt_taskprof_bucket(uint64_t duration) {
+  unsigned int b = duration ? 64 - __builtin_clzll(duration) : 0;
+
+  return b < AM_OMPT_TASK_HIST_BUCKETS ? b : AM_OMPT_TASK_HIST_BUCKETS - 1;
+}
+
+static struct am_ompt_task_data* am_ompt_taskprof_lookup(uint32_t tid) {
+  size_t mask = AM_OMPT_TASK_MAX_THREADS - 1;
+  size_t i = am_ompt_hash(tid, 0) & mask;
+  struct am_ompt_task_data* td;
+
+  while (
+      (td = __atomic_load_n(&am_ompt_taskprof_by_tid[i], __ATOMIC_ACQUIRE))) {
+    if (td->tid == tid) return td;
+
+    i = (i + 1) & mask;
+  }
+
+  return NULL;
+}
+
+struct am_ompt_task_data* am_ompt_taskprof_create_thread_data(uint32_t tid) {
+  size_t mask = AM_OMPT_TASK_MAX_THREADS - 1;
+  struct am_ompt_task_data* td;
+  size_t i, probes = 0;
+
+  if (!(td = calloc(1, sizeof(*td)))) {
+    fprintf(stderr, "Afterompt: Could not allocate task profiling data.\n");
+    goto out_err;
+  }
+
+  td->tid = tid;
+
+  if (am_ompt_task_table_init(&td->table, AM_OMPT_DEFAULT_TASK_TABLE_SIZE)) {
+    fprintf(stderr, "Afterompt: Could not allocate task table.\n");
+    goto out_err_free;
+  }
+
+  if (!(td->window = calloc(am_ompt_taskprof_window, sizeof(*td->window)))) {
+    fprintf(stderr, "Afterompt: Could not allocate task window.\n");
+    goto out_err_free_table;
+  }
+
+  pthread_mutex_lock(&am_ompt_taskprof_lock);
+
+  /* Thread ids can be reused, in which case the newest thread wins */
+  for (i = am_ompt_hash(tid, 0) & mask;
+       am_ompt_taskprof_by_tid[i] && am_ompt_taskprof_by_tid[i]->tid != tid;
+       i = (i + 1) & mask) {
+    if (++probes == AM_OMPT_TASK_MAX_THREADS) {
+      pthread_mutex_unlock(&am_ompt_taskprof_lock);
+      fprintf(stderr, "Afterompt: Too many threads for task profiling.\n");
+      goto out_err_free_window;
+    }
+  }
+
+  __atomic_store_n(&am_ompt_taskprof_by_tid[i], td, __ATOMIC_RELEASE);
+
+  td->next = am_ompt_taskprof_threads;
+  am_ompt_taskprof_threads = td;
+
+  pthread_mutex_unlock(&am_ompt_taskprof_lock);
+
+  return td;
+
+out_err_free_window:
+  free(td->window);
+out_err_free_table:
+  free(td->table.entries);
+out_err_free:
+  free(td);
+out_err:
+  return NULL;
+}
+
+void am_ompt_taskprof_created(struct am_ompt_task_data* td, uint64_t task_id,
+                              const void* codeptr_ra, int32_t core,
+                              am_timestamp_t tsc) {
+  struct am_ompt_task_slot* s =
+      &td->window[task_id & (am_ompt_taskprof_window - 1)];
+
+  /* Invalidate the slot before its fields change, so that a concurrent
+     reader cannot claim a mix of the old and new creation */
+  if (__atomic_exchange_n(&s->id, 0, __ATOMIC_RELAXED)) td->lost++;
+
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  __atomic_store_n(&s->tsc, tsc, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->codeptr_ra, (uint64_t)codeptr_ra, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->core, core, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->id, task_id, __ATOMIC_RELEASE);
+}
+
+uint64_t am_ompt_taskprof_scheduled(struct am_ompt_task_data* td,
+                                    uint64_t task_id, int32_t core,
+                                    am_timestamp_t tsc) {
+  uint32_t creator_tid = task_id >> 32;
+  struct am_ompt_task_data* creator;
+  struct am_ompt_task_stats* s;
+  struct am_ompt_task_slot* slot;
+  am_timestamp_t created;
+  uint64_t codeptr_ra, latency, expected = task_id;
+  int32_t created_core;
+  int c;
+
+  if (creator_tid == td->tid)
+    creator = td;
+  else if (!(creator = am_ompt_taskprof_lookup(creator_tid)))
+    return 0;
+
+  slot = &creator->window[task_id & (am_ompt_taskprof_window - 1)];
+
+  if (__atomic_load_n(&slot->id, __ATOMIC_ACQUIRE) != task_id) return 0;
+
+  created = __atomic_load_n(&slot->tsc, __ATOMIC_RELAXED);
+  codeptr_ra = __atomic_load_n(&slot->codeptr_ra, __ATOMIC_RELAXED);
+  created_core = __atomic_load_n(&slot->core, __ATOMIC_RELAXED);
+
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+  /* Only the first execution claims the slot. A failure means the task was
+     already executed or the slot was reused. */
+  if (!__atomic_compare_exchange_n(&slot->id, &expected, 0, 0,
+                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    return 0;
+
+  if (!(s = am_ompt_task_table_get(&td->table, codeptr_ra)))
+    return codeptr_ra;
+
+  latency = tsc > created ? tsc - created : 0;
+  c = am_ompt_taskprof_class(created_core, core);
+
+  s->count++;
+  s->stolen += (creator != td);
+  s->latency_total += latency;
+  s->latency_hist[am_ompt_taskprof_bucket(latency)]++;
+  s->distance_count[c]++;
+  s->distance_latency[c] += latency;
+
+  if (latency > s->latency_max) s->latency_max = latency;
+
+  return codeptr_ra;
+}
+
+static int am_ompt_taskprof_compare(const void* a, const void* b) {
+  const struct am_ompt_task_stats* sa = a;
+  const struct am_ompt_task_stats* sb = b;
+
+  if (sa->count != sb->count) return sa->count < sb->count ? 1 : -1;
+
+  return (sa->latency_total < sb->latency_total) -
+         (sa->latency_total > sb->latency_total);
+}
+
+static void am_ompt_taskprof_print_hist(FILE* fp, const uint64_t* hist) {
+  fprintf(fp, "      latency:");
+
+  /* Bucket b holds durations in [2^(b-1), 2^b) */
+  for (unsigned int b = 0; b < AM_OMPT_TASK_HIST_BUCKETS; b++) {
+    if (hist[b]) fprintf(fp, " <2^%u:%lu", b, hist[b]);
+  }
+
+  fprintf(fp, "\n");
+}
+
+static void am_ompt_taskprof_print_distances(
+    FILE* fp, const struct am_ompt_task_stats* s) {
+  fprintf(fp, "      distance:");
+
+  for (int c = 0; c < am_ompt_taskprof_num_classes; c++) {
+    if (!s->distance_count[c]) continue;
+
+    if (c == 0)
+      fprintf(fp, " core");
+    else
+      fprintf(fp, " %d", am_ompt_taskprof_class_distance[c]);
+
+    fprintf(fp, ":%lu/%lu", s->distance_count[c],
+            s->distance_latency[c] / s->distance_count[c]);
+  }
+
+  fprintf(fp, "\n");
+}
+
+void am_ompt_taskprof_report() {
+  struct am_ompt_task_table merged;
+  struct am_ompt_task_stats *s, *m;
+  uint64_t tasks = 0, stolen = 0, lost = 0;
+  size_t n = 0;
+  FILE* fp;
+
+  if (!am_ompt_taskprof_enabled) return;
+
+  if (am_ompt_task_table_init(&merged, AM_OMPT_DEFAULT_TASK_TABLE_SIZE)) {
+    fprintf(stderr, "Afterompt: Could not allocate merged task table.\n");
+    return;
+  }
+
+  pthread_mutex_lock(&am_ompt_taskprof_lock);
+
+  for (struct am_ompt_task_data* td = am_ompt_taskprof_threads; td;
+       td = td->next) {
+    lost += td->lost;
+
+    for (size_t i = 0; i < td->table.capacity; i++) {
+      s = &td->table.entries[i];
+
+      if (!s->count) continue;
+
+      if (!(m = am_ompt_task_table_get(&merged, s->codeptr_ra))) {
+        fprintf(stderr, "Afterompt: Could not merge task tables.\n");
+        goto out_unlock;
+      }
+
+      m->count += s->count;
+      m->stolen += s->stolen;
+      m->latency_total += s->latency_total;
+
+      if (s->latency_max > m->latency_max) m->latency_max = s->latency_max;
+
+      for (unsigned int b = 0; b < AM_OMPT_TASK_HIST_BUCKETS; b++)
+        m->latency_hist[b] += s->latency_hist[b];
+
+      for (unsigned int c = 0; c < AM_OMPT_TASK_MAX_DISTANCES; c++) {
+        m->distance_count[c] += s->distance_count[c];
+        m->distance_latency[c] += s->distance_latency[c];
+      }
+    }
+  }
+
+  /* Compact the used entries to the front and sort them by task count */
+  for (size_t i = 0; i < merged.capacity; i++) {
+    if (merged.entries[i].count) {
+      tasks += merged.entries[i].count;
+      stolen += merged.entries[i].stolen;
+      merged.entries[n++] = merged.entries[i];
+    }
+  }
+
+  qsort(merged.entries, n, sizeof(*merged.entries), am_ompt_taskprof_compare);
+
+  if (!(fp = fopen(am_ompt_taskprof_file, "w"))) {
+    fprintf(stderr, "Afterompt: Could not open task profile \"%s\".\n",
+            am_ompt_taskprof_file);
+    goto out_unlock;
+  }
+
+  fprintf(fp,
+          "# AfterOMPT task profile, times in trace timestamp units\n"
+          "# %zu task constructs, showing the %zu with the most tasks\n"
+          "# %lu tasks, %lu stolen, %lu creations lost (increase "
+          "AFTEROMPT_TASK_PROFILE_WINDOW)\n"
+          "# %d NUMA nodes, distance as count/average latency per NUMA "
+          "distance\n",
+          n, n < am_ompt_taskprof_top ? n : am_ompt_taskprof_top, tasks,
+          stolen, lost, am_ompt_taskprof_num_nodes);
+  fprintf(fp, "%4s %18s %10s %10s %8s %14s %14s\n", "rank", "codeptr_ra",
+          "tasks", "stolen", "stolen%", "latency_avg", "latency_max");
+
+  for (size_t i = 0; i < n && i < am_ompt_taskprof_top; i++) {
+    s = &merged.entries[i];
+
+    fprintf(fp, "%4zu %#18lx %10lu %10lu %7.2f%% %14lu %14lu\n", i + 1,
+            s->codeptr_ra, s->count, s->stolen, 100.0 * s->stolen / s->count,
+            s->latency_total / s->count, s->latency_max);
+
+    am_ompt_taskprof_print_hist(fp, s->latency_hist);
+    am_ompt_taskprof_print_distances(fp, s);
+  }
+
+  fclose(fp);
+
+out_unlock:
+  pthread_mutex_unlock(&am_ompt_taskprof_lock);
+  free(merged.entries);
+}
@@ -0,0 +1,127 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef AM_OMPT_TASKPROF_H
+#define AM_OMPT_TASKPROF_H
+
+#include <stdint.h>
+
+#include <aftermath/trace/timestamp.h>
+
+/* Number of logarithmic buckets for latency histograms */
+#define AM_OMPT_TASK_HIST_BUCKETS 32
+
+/* Maximum number of distinct NUMA distances, including the same core */
+#define AM_OMPT_TASK_MAX_DISTANCES 8
+
+/* Maximum number of threads whose tasks can be matched */
+#define AM_OMPT_TASK_MAX_THREADS 4096
+
+/* Maximum number of NUMA nodes */
+#define AM_OMPT_TASK_MAX_NODES 256
+
+#define AM_OMPT_DEFAULT_TASK_TABLE_SIZE 64
+#define AM_OMPT_DEFAULT_TASK_PROFILE_TOP 10
+#define AM_OMPT_DEFAULT_TASK_PROFILE_WINDOW 16384
+
+/* Creation of a task that has not started to execute yet */
+struct am_ompt_task_slot {
+  /* Zero if the slot is free */
+  uint64_t id;
+  am_timestamp_t tsc;
+  uint64_t codeptr_ra;
+  int32_t core;
+};
+
+/* Statistics of the tasks created at a single code location */
+struct am_ompt_task_stats {
+  uint64_t codeptr_ra;
+  /* Zero for empty hash table entries */
+  uint64_t count;
+  uint64_t stolen;
+  uint64_t latency_total;
+  uint64_t latency_max;
+  uint64_t latency_hist[AM_OMPT_TASK_HIST_BUCKETS];
+  /* Tasks and their latency by distance between creating and executing
+     core, indexed by distance class */
+  uint64_t distance_count[AM_OMPT_TASK_MAX_DISTANCES];
+  uint64_t distance_latency[AM_OMPT_TASK_MAX_DISTANCES];
+};
+
+/* Open addressing hash table of task statistics */
+struct am_ompt_task_table {
+  struct am_ompt_task_stats* entries;
+  size_t capacity;
+  size_t size;
+};
+
+/*
+  Per-thread task profiling state. It is kept after the thread finishes, as
+  the tasks it created may still be executed by other threads, and merged at
+  finalize.
+*/
+struct am_ompt_task_data {
+  /* Creating thread as encoded in the upper half of task ids */
+  uint32_t tid;
+  struct am_ompt_task_table table;
+  /* Recent creations, indexed by the lower bits of the task id */
+  struct am_ompt_task_slot* window;
+  /* Creations overwritten before the task was executed */
+  uint64_t lost;
+  /* Link in the list of all threads */
+  struct am_ompt_task_data* next;
+};
+
+/* Set if task profiling is enabled */
+extern int am_ompt_taskprof_enabled;
+
+/*
+  Read task profiling settings from the environment and the NUMA topology
+  from sysfs. Profiling is enabled if AFTEROMPT_TASK_PROFILE names the report
+  file.
+*/
+int am_ompt_taskprof_init();
+
+/*
+  Allocate the task profiling state for a new thread. Returns NULL on error.
+*/
+struct am_ompt_task_data* am_ompt_taskprof_create_thread_data(uint32_t tid);
+
+/*
+  Record the creation of a task by the calling thread.
+*/
+void am_ompt_taskprof_created(struct am_ompt_task_data* td, uint64_t task_id,
+                              const void* codeptr_ra, int32_t core,
+                              am_timestamp_t tsc);
+
+/*
+  Record that a task was scheduled on the calling thread. Only the first
+  execution of a task is accounted. Returns the location at which the task
+  was created, or zero if its creation is unknown or it executed before.
+*/
+uint64_t am_ompt_taskprof_scheduled(struct am_ompt_task_data* td,
+                                    uint64_t task_id, int32_t core,
+                                    am_timestamp_t tsc);
+
+/*
+  Merge the tables of all threads and write the report of the task
+  constructs with the most tasks.
+*/
+void am_ompt_taskprof_report();
+
+#endif
@@ -0,0 +1,134 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <aftermath/trace/tsc.h>
+
+#include "telemetry.h"
+#include "trace.h"
+
+int am_ompt_telemetry_enabled;
+
+/* Name of the shared memory segment */
+static const char* am_ompt_telemetry_name;
+
+static struct am_ompt_telemetry_header* am_ompt_telemetry_header;
+static struct am_ompt_telemetry_slot* am_ompt_telemetry_slots;
+
+int am_ompt_telemetry_init() {
+  const char* value;
+  uint32_t num_slots = AM_OMPT_DEFAULT_TELEMETRY_SLOTS;
+  size_t size;
+  void* addr;
+  int fd;
+
+  if (!(am_ompt_telemetry_name = getenv("AFTEROMPT_TELEMETRY"))) return 0;
+
+  if ((value = getenv("AFTEROMPT_TELEMETRY_SLOTS")))
+    sscanf(value, "%u", &num_slots);
+
+  size = sizeof(struct am_ompt_telemetry_header) +
+         num_slots * sizeof(struct am_ompt_telemetry_slot);
+
+  if ((fd = shm_open(am_ompt_telemetry_name, O_CREAT | O_RDWR | O_TRUNC,
+                     0644)) == -1) {
+    fprintf(stderr,
+            "Afterompt: Could not create telemetry segment \"%s\".\n",
+            am_ompt_telemetry_name);
+    goto out_err;
+  }
+
+  if (ftruncate(fd, size)) {
+    fprintf(stderr, "Afterompt: Could not resize telemetry segment.\n");
+    goto out_err_unlink;
+  }
+
+  if ((addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) ==
+      MAP_FAILED) {
+    fprintf(stderr, "Afterompt: Could not map telemetry segment.\n");
+    goto out_err_unlink;
+  }
+
+  close(fd);
+
+  am_ompt_telemetry_header = addr;
+  am_ompt_telemetry_slots =
+      (struct am_ompt_telemetry_slot*)(am_ompt_telemetry_header + 1);
+
+  am_ompt_telemetry_header->num_slots = num_slots;
+  am_ompt_telemetry_header->used_slots = 0;
+  am_ompt_telemetry_header->tsc_offset = am_timestamp_now() - am_ompt_now();
+  am_ompt_telemetry_header->finished = 0;
+  am_ompt_telemetry_header->version = AM_OMPT_TELEMETRY_VERSION;
+
+  /* The magic is written last, so readers never see a partial header */
+  __atomic_store_n(&am_ompt_telemetry_header->magic, AM_OMPT_TELEMETRY_MAGIC,
+                   __ATOMIC_RELEASE);
+
+  am_ompt_telemetry_enabled = 1;
+
+  return 0;
+
+out_err_unlink:
+  close(fd);
+  shm_unlink(am_ompt_telemetry_name);
+out_err:
+  return 1;
+}
+
+struct am_ompt_telemetry_slot* am_ompt_telemetry_attach_thread(uint32_t tid) {
+  struct am_ompt_telemetry_slot* slot;
+  uint32_t idx;
+
+  if (!am_ompt_telemetry_enabled) return NULL;
+
+  idx = __atomic_fetch_add(&am_ompt_telemetry_header->used_slots, 1,
+                           __ATOMIC_RELAXED);
+
+  if (idx >= am_ompt_telemetry_header->num_slots) {
+    fprintf(stderr,
+            "Afterompt: No telemetry slot left for thread %u. Please "
+            "increase AFTEROMPT_TELEMETRY_SLOTS.\n",
+            tid);
+    return NULL;
+  }
+
+  slot = &am_ompt_telemetry_slots[idx];
+
+  slot->tid = tid;
+  slot->since = am_ompt_now();
+  __atomic_store_n(&slot->state, AM_OMPT_TELEMETRY_IDLE, __ATOMIC_RELEASE);
+
+  return slot;
+}
+
+void am_ompt_telemetry_exit() {
+  if (!am_ompt_telemetry_enabled) return;
+
+  __atomic_store_n(&am_ompt_telemetry_header->finished, 1, __ATOMIC_RELEASE);
+
+  /* The segment stays mapped, since threads finishing after the tool may
+     still update their slots */
+  shm_unlink(am_ompt_telemetry_name);
+}
@@ -0,0 +1,112 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef AM_OMPT_TELEMETRY_H
+#define AM_OMPT_TELEMETRY_H
+
+#include <stdint.h>
+
+/* Identifies a telemetry segment and its layout version */
+#define AM_OMPT_TELEMETRY_MAGIC 0x414f4d54
+#define AM_OMPT_TELEMETRY_VERSION 1
+
+#define AM_OMPT_TELEMETRY_CACHE_LINE 64
+#define AM_OMPT_DEFAULT_TELEMETRY_SLOTS 256
+
+/* Coarse state of a thread as shown by the telemetry reader */
+enum am_ompt_telemetry_state {
+  AM_OMPT_TELEMETRY_IDLE = 0,
+  AM_OMPT_TELEMETRY_WORK,
+  AM_OMPT_TELEMETRY_BARRIER,
+  AM_OMPT_TELEMETRY_TASK,
+  AM_OMPT_TELEMETRY_LOCK,
+  AM_OMPT_TELEMETRY_NUM_STATES,
+  /* Thread has finished, the slot is not updated anymore */
+  AM_OMPT_TELEMETRY_EXITED = AM_OMPT_TELEMETRY_NUM_STATES
+};
+
+/*
+  Per-thread slot. Each slot is written by a single thread with relaxed
+  stores and read concurrently by the reader, so a snapshot may be
+  slightly inconsistent, but never blocks the traced thread. Slots are
+  aligned to cache lines to avoid false sharing between threads.
+*/
+struct am_ompt_telemetry_slot {
+  uint32_t tid;
+  uint32_t state;
+  /* Time the current state was entered */
+  uint64_t since;
+  /* Time spent in each state, not including the current one */
+  uint64_t time[AM_OMPT_TELEMETRY_NUM_STATES];
+} __attribute__((aligned(AM_OMPT_TELEMETRY_CACHE_LINE)));
+
+/* Header of the shared memory segment, followed by num_slots slots */
+struct am_ompt_telemetry_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_slots;
+  /* Number of slots handed out to threads so far */
+  uint32_t used_slots;
+  /* Difference between the raw timestamp and the timestamps in the slots */
+  uint64_t tsc_offset;
+  /* Set once the traced application has finished */
+  uint32_t finished;
+} __attribute__((aligned(AM_OMPT_TELEMETRY_CACHE_LINE)));
+
+/* Set if the telemetry segment has been created */
+extern int am_ompt_telemetry_enabled;
+
+/*
+  Switch the slot to a new state, charging the time since the last switch
+  to the previous state.
+*/
+static inline void am_ompt_telemetry_set_state(
+    struct am_ompt_telemetry_slot* slot, enum am_ompt_telemetry_state state,
+    uint64_t now) {
+  uint32_t prev = slot->state;
+
+  if (prev == (uint32_t)state) return;
+
+  if (prev < AM_OMPT_TELEMETRY_NUM_STATES) {
+    __atomic_store_n(&slot->time[prev], slot->time[prev] + (now - slot->since),
+                     __ATOMIC_RELAXED);
+  }
+
+  __atomic_store_n(&slot->since, now, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->state, state, __ATOMIC_RELAXED);
+}
+
+/*
+  Create the shared memory segment if AFTEROMPT_TELEMETRY is set. Has to be
+  called after the time reference is initialized.
+*/
+int am_ompt_telemetry_init();
+
+/*
+  Hand out a slot to a new thread. Returns NULL if telemetry is disabled or
+  all slots are in use.
+*/
+struct am_ompt_telemetry_slot* am_ompt_telemetry_attach_thread(uint32_t tid);
+
+/*
+  Mark the segment as finished and remove its name, so that it disappears
+  once the process and the last reader detach.
+*/
+void am_ompt_telemetry_exit();
+
+#endif
@@ -26,33 +26,147 @@
 #include <sched.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include <aftermath/trace/on_disk_structs.h>
 #include <aftermath/trace/on_disk_write_to_buffer.h>
 
+#include "columnar.h"
+#include "control.h"
 #include "trace.h"
-
-/* Maximum number of cores that can be traced */
-// TODO: Read number of cores from the system
-#define MAX_CORES 128
+#include "writer.h"
 
 /* Application trace */
 struct am_buffered_trace am_ompt_trace;
 
+/* Time reference */
+struct am_timestamp_reference am_ompt_tsref;
+
 /* Name of the trace file */
 static const char* am_ompt_trace_file;
 
 /* Protected by trace_lock */
 static am_hierarchy_node_id_t curr_hierarchy_node_id = 2;
 
-/* Size of event collection write buffers */
+/* Address space reserved for each event collection buffer, a multiple of
+   the segment size */
 static size_t am_ompt_cbuf_size;
 
+/* Event collection buffers grow by segments of this size */
+static size_t am_ompt_segment_size;
+
+/* Segments that can still be taken if memory is limited */
+static int am_ompt_memory_limited;
+static size_t am_ompt_free_segments;
+
+/* Events discarded because the memory limit was reached */
+static uint64_t am_ompt_dropped_events;
+
+/* Set if a time index is appended to the trace on exit */
+static int am_ompt_time_index;
+
+/* Frames and time units between the entries of the seek index appended to
+   the trace on exit, no seek index is written if both are zero */
+static uint64_t am_ompt_seek_index_events;
+static uint64_t am_ompt_seek_index_interval;
+
+/* Set if the events are also written in columns next to the trace on exit */
+static int am_ompt_columnar;
+
+/* Largest frame written to an event collection */
+#define AM_OMPT_MAX_FRAME_SIZE 128
+
+/* Target of events that are dropped */
+static __thread uint8_t am_ompt_discard[AM_OMPT_MAX_FRAME_SIZE];
+
 /* Lock for trace-wide operations */
 static pthread_spinlock_t am_ompt_trace_lock;
 
-/* Mapping from the core number to the event collection id */
-static uint64_t event_collection_id_by_core[MAX_CORES];
+/* Event collection running on a core during an interval */
+struct am_ompt_mapping {
+  am_event_collection_id_t collection_id;
+  int32_t core;
+  am_timestamp_t start;
+  am_timestamp_t end;
+};
+
+/* Mappings of finished threads, protected by trace_lock */
+static struct am_ompt_mapping* am_ompt_mappings;
+static size_t am_ompt_num_mappings;
+static size_t am_ompt_max_mappings;
+
+/* Threads that have not finished yet, protected by trace_lock */
+static struct am_ompt_thread_data* am_ompt_live_threads;
+
+/* Take segments from the pool without locking */
+static int am_ompt_take_segments(size_t n) {
+  size_t avail;
+
+  if (!am_ompt_memory_limited) return 0;
+
+  avail = __atomic_load_n(&am_ompt_free_segments, __ATOMIC_RELAXED);
+
+  do {
+    if (avail < n) return 1;
+  } while (!__atomic_compare_exchange_n(&am_ompt_free_segments, &avail,
+                                        avail - n, 1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED));
+
+  return 0;
+}
+
+/*
+  Called when the current segment of an event collection buffer is full.
+  The buffer is mapped with its maximum size, so taking segments just extends
+  the usable part and the collection stays contiguous. Pages are only backed
+  by memory once they are written to. If the memory limit is reached the
+  event is written to a scratch area and dropped.
+*/
+uint8_t* am_ompt_reserve_slow(struct am_write_buffer* b, size_t size) {
+  size_t n = (b->used + size - b->size + am_ompt_segment_size - 1) /
+             am_ompt_segment_size;
+  size_t new_size = b->size + n * am_ompt_segment_size;
+  uint8_t* p;
+
+  if (new_size > am_ompt_cbuf_size || am_ompt_take_segments(n)) {
+    if (size > AM_OMPT_MAX_FRAME_SIZE) return NULL;
+
+    __atomic_add_fetch(&am_ompt_dropped_events, 1, __ATOMIC_RELAXED);
+
+    return am_ompt_discard;
+  }
+
+  b->size = new_size;
+
+  p = &b->data[b->used];
+  b->used += size;
+
+  return p;
+}
+
+/* Replace the buffer allocated by Aftermath with a mapping that is filled by
+   segments. No segment is taken until the first event is written. */
+static int am_ompt_map_collection_buffer(struct am_write_buffer* b) {
+  void* data = mmap(NULL, am_ompt_cbuf_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  if (data == MAP_FAILED) return 1;
+
+  free(b->data);
+
+  b->data = data;
+  b->size = 0;
+  b->used = 0;
+
+  return 0;
+}
+
+static void am_ompt_unmap_collection_buffer(struct am_write_buffer* b) {
+  munmap(b->data, am_ompt_cbuf_size);
+
+  /* Aftermath frees the buffer when the collection is destroyed */
+  b->data = NULL;
+}
 
 /* Create a new event collection and attach it to the trace */
 static struct am_buffered_event_collection* am_ompt_create_event_collection(
@@ -77,18 +191,23 @@ static struct am_buffered_event_collection* am_ompt_create_event_collection(
     goto out_err;
   }
 
-  if (am_buffered_event_collection_init(c, id, am_ompt_cbuf_size)) {
+  if (am_buffered_event_collection_init(c, id, sizeof(uint64_t))) {
     fprintf(stderr,
             "Afterompt: Could not initialize event "
             "collection.\n");
     goto out_err_free_c;
   }
 
+  if (am_ompt_map_collection_buffer(&c->data)) {
+    fprintf(stderr, "Afterompt: Could not map event collection buffer.\n");
+    goto out_err_destroy;
+  }
+
   /* Use pthread lock rather than critical section to avoid
      triggering callbacks before thread data is initialized */
   if (pthread_spin_lock(&am_ompt_trace_lock)) {
     fprintf(stderr, "Afterompt: Could not acquire lock. \n");
-    goto out_err_destroy;
+    goto out_err_unmap;
   }
 
   if (am_buffered_trace_add_collection(&am_ompt_trace, c)) {
@@ -108,7 +227,7 @@ static struct am_buffered_event_collection* am_ompt_create_event_collection(
 
   if (pthread_spin_unlock(&am_ompt_trace_lock)) {
     fprintf(stderr, "Afterompt: Could not release the lock. \n");
-    goto out_err_destroy;
+    goto out_err_unmap;
   }
 
   return c;
@@ -117,6 +236,8 @@ out_err_unlock:
   if (pthread_spin_unlock(&am_ompt_trace_lock)) {
     fprintf(stderr, "Afterompt: Could not release the lock. \n");
   }
+out_err_unmap:
+  am_ompt_unmap_collection_buffer(&c->data);
 out_err_destroy:
   am_buffered_event_collection_destroy(c);
 out_err_free_c:
@@ -125,9 +246,22 @@ out_err:
   return NULL;
 }
 
-struct am_ompt_thread_data* am_ompt_create_thread_data(pthread_t tid) {
+struct am_ompt_thread_data* am_ompt_create_thread_data(pthread_t tid,
+                                                       int traced) {
   struct am_ompt_thread_data* data;
 
+  if (!traced) {
+    if (!(data = calloc(1, sizeof(*data)))) {
+      fprintf(stderr, "Afterompt: Could not allocate memory for thread data\n");
+      return NULL;
+    }
+
+    data->tid = tid;
+    data->untraced = 1;
+
+    return data;
+  }
+
   if ((data = malloc(sizeof(*data))) == NULL) {
     fprintf(stderr, "Afterompt: Could not allocate memory for thread data\n");
     goto out_err;
@@ -150,9 +284,99 @@ struct am_ompt_thread_data* am_ompt_create_thread_data(pthread_t tid) {
 
   data->tid = tid;
   data->unique_counter = 0;
+  data->core = am_ompt_getcpu();
+  data->num_placements = 1;
+  data->max_placements = AM_OMPT_DEFAULT_MAX_PLACEMENTS;
+
+  if (!(data->placements =
+            malloc(sizeof(*data->placements) * data->max_placements))) {
+    fprintf(stderr, "Afterompt: Could not allocate memory for placements\n");
+    goto out_err_destroy;
+  }
+
+  data->placements[0].start = am_ompt_now();
+  data->placements[0].core = data->core;
+  data->telemetry = am_ompt_telemetry_attach_thread(tid);
+  data->in_explicit_task = 0;
+  data->prev = NULL;
+  data->locks = NULL;
+  data->tasks = NULL;
+  data->governor = NULL;
+  data->tool_time = 0;
+  data->sampler = NULL;
+  data->task_id = 0;
+  data->profile = NULL;
+  data->occupancy = NULL;
+  data->filtered = 0;
+  data->untraced = 0;
+  data->phases.depth = 0;
+
+  if (am_ompt_lockprof_enabled &&
+      !(data->locks = am_ompt_lockprof_create_thread_data())) {
+    fprintf(stderr, "Afterompt: Could not create lock profiling data\n");
+    goto out_err_destroy_placements;
+  }
+
+  /* The task profiling state is owned by the task profiler, as tasks created
+     by this thread may outlive it */
+  if (am_ompt_taskprof_enabled &&
+      !(data->tasks = am_ompt_taskprof_create_thread_data((uint32_t)tid))) {
+    fprintf(stderr, "Afterompt: Could not create task profiling data\n");
+    goto out_err_destroy_locks;
+  }
+
+  if (am_ompt_governor_enabled &&
+      !(data->governor = am_ompt_governor_create(data->placements[0].start))) {
+    fprintf(stderr, "Afterompt: Could not create governor data\n");
+    goto out_err_destroy_locks;
+  }
+
+  if (am_ompt_sampling_enabled &&
+      !(data->sampler = am_ompt_sampling_create(data))) {
+    fprintf(stderr, "Afterompt: Could not create sampler\n");
+    goto out_err_destroy_governor;
+  }
+
+  if (am_ompt_profile_enabled &&
+      !(data->profile = am_ompt_profile_create_thread_data())) {
+    fprintf(stderr, "Afterompt: Could not create profiling data\n");
+    goto out_err_destroy_sampler;
+  }
+
+  if (am_ompt_occupancy_enabled &&
+      !(data->occupancy =
+            am_ompt_occupancy_create(data->placements[0].start))) {
+    fprintf(stderr, "Afterompt: Could not create occupancy data\n");
+    goto out_err_destroy_profile;
+  }
+
+  if (pthread_spin_lock(&am_ompt_trace_lock)) {
+    fprintf(stderr, "Afterompt: Could not acquire lock. \n");
+    goto out_err_destroy_occupancy;
+  }
+
+  data->next = am_ompt_live_threads;
+
+  if (am_ompt_live_threads) am_ompt_live_threads->prev = data;
+
+  am_ompt_live_threads = data;
+
+  pthread_spin_unlock(&am_ompt_trace_lock);
 
   return data;
 
+out_err_destroy_occupancy:
+  am_ompt_occupancy_destroy(data->occupancy);
+out_err_destroy_profile:
+  am_ompt_profile_destroy_thread_data(data->profile);
+out_err_destroy_sampler:
+  am_ompt_sampling_destroy(data->sampler);
+out_err_destroy_governor:
+  am_ompt_governor_destroy(data->governor);
+out_err_destroy_locks:
+  am_ompt_lockprof_destroy_thread_data(data->locks);
+out_err_destroy_placements:
+  free(data->placements);
 out_err_destroy:
   free(data->state_stack.stack);
 out_err_free:
@@ -161,71 +385,177 @@ out_err:
   return NULL;
 }
 
+int am_ompt_current_core() { return sched_getcpu(); }
+
+int am_ompt_migrate_thread(struct am_ompt_thread_data* td, int core,
+                           am_timestamp_t tsc) {
+  struct am_buffered_event_collection* c = td->event_collection;
+  struct am_ompt_placement* placements;
+
+  if (td->num_placements == td->max_placements) {
+    if (!(placements = realloc(td->placements, 2 * td->max_placements *
+                                                   sizeof(*placements)))) {
+      return 1;
+    }
+
+    td->placements = placements;
+    td->max_placements *= 2;
+  }
+
+  td->placements[td->num_placements].start = tsc;
+  td->placements[td->num_placements].core = core;
+  td->num_placements++;
+  td->core = core;
+
+  return am_ompt_write_counter(&c->data, c->id, AM_OMPT_CORE_COUNTER_ID, tsc,
+                               core);
+}
+
+/*
+  Append the placements of a thread to a list of mappings. The last
+  placement ends at the given time.
+*/
+static int am_ompt_append_mappings(struct am_ompt_mapping** mappings,
+                                   size_t* num, size_t* max,
+                                   const struct am_ompt_thread_data* td,
+                                   am_timestamp_t end) {
+  struct am_ompt_mapping* m;
+
+  if (*num + td->num_placements > *max) {
+    size_t new_max = 2 * (*num + td->num_placements);
+
+    if (!(m = realloc(*mappings, new_max * sizeof(*m)))) return 1;
+
+    *mappings = m;
+    *max = new_max;
+  }
+
+  for (size_t i = 0; i < td->num_placements; i++) {
+    m = &(*mappings)[(*num)++];
+
+    m->collection_id = td->event_collection->id;
+    m->core = td->placements[i].core;
+    m->start = td->placements[i].start;
+    m->end = (i + 1 < td->num_placements) ? td->placements[i + 1].start : end;
+  }
+
+  return 0;
+}
+
 void am_ompt_destroy_thread_data(struct am_ompt_thread_data* thread_data) {
-  int core_number = sched_getcpu();
+  am_timestamp_t end = am_ompt_now();
+
+  if (!thread_data->event_collection) {
+    free(thread_data);
+    return;
+  }
+
+  if (pthread_spin_lock(&am_ompt_trace_lock)) {
+    fprintf(stderr, "Afterompt: Could not acquire lock. \n");
+    exit(1);
+  }
 
-  if (core_number >= MAX_CORES) {
+  /* The collection is mapped to each core the thread was seen on, from the
+     time it was first seen there until it moved on. */
+  if (am_ompt_append_mappings(&am_ompt_mappings, &am_ompt_num_mappings,
+                              &am_ompt_max_mappings, thread_data, end)) {
     fprintf(stderr,
-            "Afterompt: Event collection for core %d will be discarded. Please "
-            "increase MAX_CORES to fix this problem!\n",
-            core_number);
+            "Afterompt: Could not save mappings, event collection %u "
+            "will be discarded.\n",
+            thread_data->event_collection->id);
   }
 
-  /* We assume that the core finishing the thread has done all the work on
-     that thread. It is true with 1-1 mapping between cores and threads.
-     The initial thread may move between cores, before OpenMP pins it, but
-     in that period no OpenMP work in executed. */
-  event_collection_id_by_core[core_number] = thread_data->event_collection->id;
+  if (thread_data->prev)
+    thread_data->prev->next = thread_data->next;
+  else
+    am_ompt_live_threads = thread_data->next;
+
+  if (thread_data->next) thread_data->next->prev = thread_data->prev;
+
+  pthread_spin_unlock(&am_ompt_trace_lock);
 
+  am_ompt_lockprof_destroy_thread_data(thread_data->locks);
+  am_ompt_governor_destroy(thread_data->governor);
+  am_ompt_sampling_destroy(thread_data->sampler);
+  am_ompt_profile_destroy_thread_data(thread_data->profile);
+  am_ompt_occupancy_destroy(thread_data->occupancy);
+  free(thread_data->placements);
   free(thread_data->state_stack.stack);
   free(thread_data);
 
   // TODO: Event collection is not free, so it can be dumped on exit.
 }
 
-/* Write default ID of each state to the trace */
+/* Frame type names of Afterompt events, indexed by event type */
+static const char* am_ompt_event_type_names[AM_OMPT_NUM_EVENTS] = {
+#define AM_OMPT_EVENT_TYPE_NAME(name, NAME, kind) "am::ompt::" #name,
+    AM_OMPT_EVENTS(AM_OMPT_EVENT_TYPE_NAME)
+#undef AM_OMPT_EVENT_TYPE_NAME
+};
+
+/* Event types of optional features, which are not known to Aftermath */
+#define AM_OMPT_EVENT_BIT(NAME) (UINT64_C(1) << AM_OMPT_EVENT_##NAME)
+#define AM_OMPT_OPTIONAL_EVENT_TYPES                               \
+  (AM_OMPT_EVENT_BIT(GOVERNOR) | AM_OMPT_EVENT_BIT(TOOL_TIME) |    \
+   AM_OMPT_EVENT_BIT(SAMPLE) | AM_OMPT_EVENT_BIT(OCCUPANCY) |      \
+   AM_OMPT_EVENT_BIT(PHASE))
+
+uint64_t am_ompt_used_event_types;
+
+/* Register the compile-time type id of an Afterompt event */
+static int am_ompt_register_event_type(int type) {
+  struct am_dsk_frame_type_id ft;
+
+  ft.id = AM_OMPT_TYPE_ID_BASE + type;
+  ft.type_name.str = (char*)am_ompt_event_type_names[type];
+  ft.type_name.len = strlen(ft.type_name.str);
+
+  return am_dsk_frame_type_id_write_to_buffer_defid(&am_ompt_trace.data, &ft);
+}
+
+/* Register the event types of optional features used so far. Called right
+   before the trace buffer is dumped, which precedes the event collections in
+   the trace file. */
+static int am_ompt_register_used_types() {
+  uint64_t used = __atomic_load_n(&am_ompt_used_event_types, __ATOMIC_ACQUIRE);
+
+  for (int i = 0; i < AM_OMPT_NUM_EVENTS; i++) {
+    if ((used & (UINT64_C(1) << i)) && am_ompt_register_event_type(i))
+      return 1;
+  }
+
+  return 0;
+}
+
 static int am_ompt_register_types() {
   if (am_dsk_hierarchy_description_write_default_id_to_buffer(
           &am_ompt_trace.data) ||
       am_dsk_hierarchy_node_write_default_id_to_buffer(&am_ompt_trace.data) ||
       am_dsk_event_collection_write_default_id_to_buffer(&am_ompt_trace.data) ||
       am_dsk_event_mapping_write_default_id_to_buffer(&am_ompt_trace.data) ||
-      am_dsk_ompt_thread_write_default_id_to_buffer(&am_ompt_trace.data) ||
-      am_dsk_ompt_parallel_write_default_id_to_buffer(&am_ompt_trace.data) ||
-      am_dsk_ompt_implicit_task_write_default_id_to_buffer(
-          &am_ompt_trace.data) ||
-      am_dsk_ompt_task_create_write_default_id_to_buffer(
-          &am_ompt_trace.data) ||
-      am_dsk_ompt_task_schedule_write_default_id_to_buffer(
-          &am_ompt_trace.data) ||
-      am_dsk_ompt_sync_region_wait_write_default_id_to_buffer(
-          &am_ompt_trace.data) ||
-      am_dsk_ompt_mutex_released_write_default_id_to_buffer(
-          &am_ompt_trace.data) ||
-      am_dsk_ompt_dependences_write_default_id_to_buffer(
-          &am_ompt_trace.data) ||
-      am_dsk_ompt_task_dependence_write_default_id_to_buffer(
-          &am_ompt_trace.data) ||
-      am_dsk_ompt_work_write_default_id_to_buffer(&am_ompt_trace.data) ||
-      am_dsk_ompt_master_write_default_id_to_buffer(&am_ompt_trace.data) ||
-      am_dsk_ompt_sync_region_write_default_id_to_buffer(
-          &am_ompt_trace.data) ||
-      am_dsk_ompt_lock_init_write_default_id_to_buffer(&am_ompt_trace.data) ||
-      am_dsk_ompt_lock_destroy_write_default_id_to_buffer(
-          &am_ompt_trace.data) ||
-      am_dsk_ompt_mutex_acquire_write_default_id_to_buffer(
-          &am_ompt_trace.data) ||
-      am_dsk_ompt_mutex_acquired_write_default_id_to_buffer(
-          &am_ompt_trace.data) ||
-      am_dsk_ompt_nest_lock_write_default_id_to_buffer(&am_ompt_trace.data) ||
-      am_dsk_ompt_flush_write_default_id_to_buffer(&am_ompt_trace.data) ||
-      am_dsk_ompt_cancel_write_default_id_to_buffer(&am_ompt_trace.data) ||
-      am_dsk_ompt_loop_write_default_id_to_buffer(&am_ompt_trace.data) ||
-      am_dsk_ompt_loop_chunk_write_default_id_to_buffer(
+      am_dsk_counter_description_write_default_id_to_buffer(
           &am_ompt_trace.data)) {
     return 1;
   }
 
+  /* Counter events in event collections are written by Afterompt */
+  struct am_dsk_frame_type_id ct;
+
+  ct.id = AM_OMPT_TYPE_ID_COUNTER;
+  ct.type_name.str = (char*)"am::core::counter_event";
+  ct.type_name.len = strlen(ct.type_name.str);
+
+  if (am_dsk_frame_type_id_write_to_buffer_defid(&am_ompt_trace.data, &ct))
+    return 1;
+
+  /* Afterompt events are written with compile-time type ids, those of
+     optional features are registered once they are used */
+  for (int i = 0; i < AM_OMPT_NUM_EVENTS; i++) {
+    if (!(AM_OMPT_OPTIONAL_EVENT_TYPES & (UINT64_C(1) << i)) &&
+        am_ompt_register_event_type(i))
+      return 1;
+  }
+
   return 0;
 }
 
@@ -247,6 +577,37 @@ int am_ompt_init_trace() {
     am_ompt_cbuf_size = AM_OMPT_DEFAULT_EVENT_COLLECTION_BUFFER_SIZE;
   }
 
+  if (!(size = getenv("AFTEROMPT_SEGMENT_SIZE")) ||
+      sscanf(size, "%zu", &am_ompt_segment_size) != 1 ||
+      am_ompt_segment_size < AM_OMPT_MAX_FRAME_SIZE) {
+    am_ompt_segment_size = AM_OMPT_DEFAULT_SEGMENT_SIZE;
+  }
+
+  am_ompt_cbuf_size = (am_ompt_cbuf_size + am_ompt_segment_size - 1) /
+                      am_ompt_segment_size * am_ompt_segment_size;
+
+  /* Memory for all event collections, in segments */
+  if ((size = getenv("AFTEROMPT_MEMORY_LIMIT"))) {
+    size_t limit;
+
+    if (sscanf(size, "%zu", &limit) == 1) {
+      am_ompt_memory_limited = 1;
+      am_ompt_free_segments = limit / am_ompt_segment_size;
+    }
+  }
+
+  if ((size = getenv("AFTEROMPT_TIME_INDEX")))
+    sscanf(size, "%d", &am_ompt_time_index);
+
+  if ((size = getenv("AFTEROMPT_SEEK_INDEX")))
+    sscanf(size, "%lu", &am_ompt_seek_index_events);
+
+  if ((size = getenv("AFTEROMPT_SEEK_INDEX_INTERVAL")))
+    sscanf(size, "%lu", &am_ompt_seek_index_interval);
+
+  if ((size = getenv("AFTEROMPT_COLUMNAR")))
+    sscanf(size, "%d", &am_ompt_columnar);
+
   /* Filename of the trace file */
   if (!(am_ompt_trace_file = getenv("AFTERMATH_TRACE_FILE"))) {
     fprintf(stderr, "Afterompt: No trace file specified.\n");
@@ -275,6 +636,18 @@ int am_ompt_init_trace() {
     goto out_err_trace;
   }
 
+  struct am_dsk_counter_description dsk_cd;
+
+  dsk_cd.counter_id = AM_OMPT_CORE_COUNTER_ID;
+  dsk_cd.name.str = "Core";
+  dsk_cd.name.len = strlen(dsk_cd.name.str);
+
+  if (am_dsk_counter_description_write_to_buffer_defid(&am_ompt_trace.data,
+                                                       &dsk_cd)) {
+    fprintf(stderr, "Afterompt: Could not write counter description.\n");
+    goto out_err_trace;
+  }
+
   if (pthread_spin_init(&am_ompt_trace_lock, 0)) {
     fprintf(stderr, "Afterompt: Could not create spin lock.\n");
     goto out_err_trace;
@@ -288,63 +661,154 @@ out_err:
   return 1;
 }
 
-/* Writes an entry for each event collection to the trace buffer */
-static int am_ompt_trace_mappings() {
-  struct am_dsk_event_mapping dsk_em;
-  /* Keep it before the loop to be able to do the goto error handling */
-  struct am_simple_hierarchy_node* hn;
+static int am_ompt_compare_mappings(const void* a, const void* b) {
+  const struct am_ompt_mapping* ma = a;
+  const struct am_ompt_mapping* mb = b;
 
-  for (size_t i = 0; i < MAX_CORES; i++) {
-    /* We assume unused elements are zero. It is true, because the array is
-       initialized as static. */
-    if (event_collection_id_by_core[i] == 0) continue;
+  if (ma->core != mb->core) return ma->core < mb->core ? -1 : 1;
 
-    struct am_dsk_hierarchy_node dsk_hn;
-    char name_buf[64];
+  return (ma->start > mb->start) - (ma->start < mb->start);
+}
 
-    snprintf(name_buf, sizeof(name_buf), "Core %zu", i);
+/*
+  Writes a hierarchy node for a lane of a core. If add_node is zero, only the
+  on-disk frame is written and the in-memory hierarchy is left untouched.
+*/
+static int am_ompt_trace_core_node(int32_t core, size_t lane,
+                                   am_hierarchy_node_id_t id, int add_node) {
+  struct am_dsk_hierarchy_node dsk_hn;
+  struct am_simple_hierarchy_node* hn;
+  char name_buf[64];
 
-    dsk_hn.parent_id = 1;
-    dsk_hn.name.str = name_buf;
-    dsk_hn.name.len = strlen(name_buf);
+  /* Additional lanes are only needed if several threads share a core */
+  if (lane == 0)
+    snprintf(name_buf, sizeof(name_buf), "Core %d", core);
+  else
+    snprintf(name_buf, sizeof(name_buf), "Core %d.%zu", core, lane);
 
-    if (!(hn = malloc(sizeof(*hn)))) {
-      fprintf(stderr,
-              "Afterompt: Failed to allocate an on-disk hierarchy node!\n");
+  dsk_hn.parent_id = 1;
+  dsk_hn.name.str = name_buf;
+  dsk_hn.name.len = strlen(name_buf);
+  dsk_hn.hierarchy_id = am_ompt_trace.hierarchies[0]->id;
+  dsk_hn.id = id;
 
-      goto err_out;
+  if (!add_node) {
+    if (am_dsk_hierarchy_node_write_to_buffer_defid(&am_ompt_trace.data,
+                                                     &dsk_hn)) {
+      fprintf(stderr, "Afterompt: Could not write hierarchy node!\n");
+      return 1;
     }
 
-    if (!(hn->name = strdup(name_buf))) {
-      fprintf(stderr,
-              "Afterompt: Failed to allocate an on-disk hierarchy node!\n");
+    return 0;
+  }
+
+  if (!(hn = malloc(sizeof(*hn)))) {
+    fprintf(stderr,
+            "Afterompt: Failed to allocate an on-disk hierarchy node!\n");
+
+    goto err_out;
+  }
+
+  if (!(hn->name = strdup(name_buf))) {
+    fprintf(stderr,
+            "Afterompt: Failed to allocate an on-disk hierarchy node!\n");
 
-      goto err_out_free_hn;
+    goto err_out_free_hn;
+  }
+
+  hn->first_child = NULL;
+  hn->id = id;
+
+  am_simple_hierarchy_node_add_child(am_ompt_trace.hierarchies[0]->root, hn);
+
+  if (am_dsk_hierarchy_node_write_to_buffer_defid(&am_ompt_trace.data,
+                                                   &dsk_hn)) {
+    am_simple_hierarchy_node_remove_first_child(
+        am_ompt_trace.hierarchies[0]->root);
+
+    fprintf(stderr, "Afterompt: Could not write hierarchy node!\n");
+
+    goto err_out_free_name;
+  }
+
+  return 0;
+
+err_out_free_name:
+  free(hn->name);
+err_out_free_hn:
+  free(hn);
+err_out:
+  return 1;
+}
+
+/*
+  Writes a hierarchy node for each core and a time-ranged event mapping for
+  each interval an event collection ran on a core. If several collections
+  share a core at the same time, e.g. with oversubscription, they are
+  assigned to separate lanes of that core, so no collection is dropped. If
+  add_nodes is zero, only the on-disk frames are written and the in-memory
+  hierarchy is left untouched. Sorts the mappings.
+*/
+static int am_ompt_trace_mappings(struct am_ompt_mapping* mappings,
+                                  size_t num_mappings, int add_nodes) {
+  struct am_dsk_event_mapping dsk_em;
+  /* End of the last interval and node of each lane of the current core */
+  am_timestamp_t* lane_ends = NULL;
+  am_hierarchy_node_id_t* lane_nodes = NULL;
+  size_t num_lanes = 0;
+  size_t max_lanes = 0;
+  am_hierarchy_node_id_t next_node_id = curr_hierarchy_node_id;
+  int ret = 1;
+
+  qsort(mappings, num_mappings, sizeof(*mappings), am_ompt_compare_mappings);
+
+  for (size_t i = 0; i < num_mappings; i++) {
+    struct am_ompt_mapping* m = &mappings[i];
+    size_t lane;
+
+    if (i == 0 || m->core != mappings[i - 1].core) num_lanes = 0;
+
+    for (lane = 0; lane < num_lanes; lane++) {
+      if (lane_ends[lane] <= m->start) break;
     }
 
-    hn->first_child = NULL;
-    hn->id = i + 2;
+    if (lane == num_lanes) {
+      if (num_lanes == max_lanes) {
+        am_timestamp_t* ends;
+        am_hierarchy_node_id_t* nodes = NULL;
 
-    dsk_hn.hierarchy_id = am_ompt_trace.hierarchies[0]->id;
-    dsk_hn.id = hn->id;
+        max_lanes = max_lanes ? 2 * max_lanes : 4;
 
-    am_simple_hierarchy_node_add_child(am_ompt_trace.hierarchies[0]->root, hn);
+        /* Keep the old arrays on failure, so that they are freed */
+        if ((ends = realloc(lane_ends, max_lanes * sizeof(*ends)))) {
+          lane_ends = ends;
 
-    if (am_dsk_hierarchy_node_write_to_buffer_defid(&am_ompt_trace.data,
-                                                     &dsk_hn)) {
-      am_simple_hierarchy_node_remove_first_child(
-          am_ompt_trace.hierarchies[0]->root);
+          if ((nodes = realloc(lane_nodes, max_lanes * sizeof(*nodes))))
+            lane_nodes = nodes;
+        }
 
-      fprintf(stderr, "Afterompt: Could not write hierarchy node!\n");
+        if (!ends || !nodes) {
+          fprintf(stderr, "Afterompt: Could not allocate core lanes!\n");
+          goto out;
+        }
+      }
+
+      lane_nodes[num_lanes] = next_node_id++;
+
+      if (am_ompt_trace_core_node(m->core, num_lanes, lane_nodes[num_lanes],
+                                  add_nodes))
+        goto out;
 
-      goto err_out_free_hn;
+      num_lanes++;
     }
 
-    dsk_em.collection_id = event_collection_id_by_core[i];
+    lane_ends[lane] = m->end;
+
+    dsk_em.collection_id = m->collection_id;
     dsk_em.hierarchy_id = 0;
-    dsk_em.node_id = i + 2;
-    dsk_em.interval.start = 0;
-    dsk_em.interval.end = AM_TIMESTAMP_T_MAX;
+    dsk_em.node_id = lane_nodes[lane];
+    dsk_em.interval.start = m->start;
+    dsk_em.interval.end = m->end;
 
     if (am_dsk_event_mapping_write_to_buffer_defid(&am_ompt_trace.data,
                                                    &dsk_em)) {
@@ -352,34 +816,626 @@ static int am_ompt_trace_mappings() {
               "Afterompt: Could not write event "
               "mapping for event collection %u"
               " .\n",
-              am_ompt_trace.collections[i]->id);
+              m->collection_id);
+
+      goto out;
+    }
+  }
+
+  if (add_nodes) curr_hierarchy_node_id = next_node_id;
+
+  ret = 0;
+
+out:
+  free(lane_ends);
+  free(lane_nodes);
+
+  return ret;
+}
+
+/*
+  Returns the mappings of finished threads together with the mappings of
+  threads that are still running, which are mapped up to the end of the
+  trace. Has to be called with the trace lock held.
+*/
+static struct am_ompt_mapping* am_ompt_collect_mappings(size_t* num) {
+  struct am_ompt_mapping* mappings;
+  size_t max = am_ompt_num_mappings + 1;
+
+  if (!(mappings = malloc(max * sizeof(*mappings)))) return NULL;
+
+  memcpy(mappings, am_ompt_mappings,
+         am_ompt_num_mappings * sizeof(*mappings));
+  *num = am_ompt_num_mappings;
+
+  for (struct am_ompt_thread_data* td = am_ompt_live_threads; td;
+       td = td->next) {
+    if (am_ompt_append_mappings(&mappings, num, &max, td,
+                                AM_TIMESTAMP_T_MAX)) {
+      free(mappings);
+      return NULL;
+    }
+  }
+
+  return mappings;
+}
+
+int am_ompt_flush_trace() {
+  struct am_ompt_mapping* mappings;
+  size_t num_mappings;
+  size_t used;
+  int ret = 0;
+
+  if (pthread_spin_lock(&am_ompt_trace_lock)) {
+    fprintf(stderr, "Afterompt: Could not acquire lock. \n");
+    return 1;
+  }
+
+  if (!(mappings = am_ompt_collect_mappings(&num_mappings))) {
+    fprintf(stderr, "Afterompt: Could not collect event mappings.\n");
+    ret = 1;
+    goto out_unlock;
+  }
+
+  /* Event types, labels and mappings of the snapshot are discarded after
+     the dump, so they are written again with the final labels and core
+     assignment on exit */
+  used = am_ompt_trace.data.used;
+
+  if (am_ompt_register_used_types()) {
+    fprintf(stderr, "Afterompt: Could not register event types.\n");
+    ret = 1;
+  } else if (am_ompt_annotate_write_labels(&am_ompt_trace.data)) {
+    fprintf(stderr, "Afterompt: Could not write labels.\n");
+    ret = 1;
+  } else if (am_ompt_trace_mappings(mappings, num_mappings, 0)) {
+    fprintf(stderr, "Afterompt: Could not trace event mappings.\n");
+    ret = 1;
+  } else if (am_buffered_trace_dump(&am_ompt_trace, am_ompt_trace_file)) {
+    fprintf(stderr,
+            "Afterompt: Could not write trace file "
+            "\"%s\".\n",
+            am_ompt_trace_file);
+    ret = 1;
+  }
+
+  am_ompt_trace.data.used = used;
+
+  free(mappings);
+
+out_unlock:
+  pthread_spin_unlock(&am_ompt_trace_lock);
+
+  return ret;
+}
+
+/* Frame size and offset of the recording time of each event type */
+static const uint32_t am_ompt_frame_sizes[AM_OMPT_NUM_EVENTS] = {
+#define AM_OMPT_FRAME_SIZE(name, NAME, kind) \
+  sizeof(uint32_t) + AM_OMPT_EVENT_SIZE(name, kind),
+    AM_OMPT_EVENTS(AM_OMPT_FRAME_SIZE)
+#undef AM_OMPT_FRAME_SIZE
+};
+
+static const uint32_t am_ompt_frame_time_offsets[AM_OMPT_NUM_EVENTS] = {
+#define AM_OMPT_FRAME_TIME_OFFSET(name, NAME, kind) AM_OMPT_TIME_OFFSET_##kind,
+    AM_OMPT_EVENTS(AM_OMPT_FRAME_TIME_OFFSET)
+#undef AM_OMPT_FRAME_TIME_OFFSET
+};
+
+/* Recording time and buffer position of a frame for the time index */
+struct am_ompt_index_point {
+  am_timestamp_t tsc;
+  size_t pos;
+};
+
+/* Position in the buffer of an event collection while the index is built */
+struct am_ompt_index_cursor {
+  const uint8_t* data;
+  size_t used;
+  size_t pos;
+  /* File offset of the buffer */
+  uint64_t offset;
+  uint32_t id;
+  /* Recording time of the frame at pos */
+  am_timestamp_t tsc;
+  /* Frames of the buffer in order of time and the next one to be indexed */
+  struct am_ompt_index_point* points;
+  size_t num_points;
+  size_t next;
+};
+
+/*
+  Read the recording time of the frame at the cursor. Event collections only
+  contain Afterompt events and the counter events of core migrations, so any
+  other type id is a counter event. Returns 0 at the end of the buffer.
+*/
+static int am_ompt_index_peek(struct am_ompt_index_cursor* c) {
+  uint32_t type_id, size, time_offset;
+
+  if (c->used - c->pos < sizeof(type_id)) return 0;
+
+  memcpy(&type_id, &c->data[c->pos], sizeof(type_id));
+
+  if (type_id >= AM_OMPT_TYPE_ID_BASE &&
+      type_id < AM_OMPT_TYPE_ID_BASE + AM_OMPT_NUM_EVENTS) {
+    size = am_ompt_frame_sizes[type_id - AM_OMPT_TYPE_ID_BASE];
+    time_offset = am_ompt_frame_time_offsets[type_id - AM_OMPT_TYPE_ID_BASE];
+  } else {
+    size = AM_OMPT_COUNTER_FRAME_SIZE;
+    time_offset = AM_OMPT_COUNTER_TIME_OFFSET;
+  }
+
+  if (c->used - c->pos < size) return 0;
+
+  memcpy(&c->tsc, &c->data[c->pos + time_offset], sizeof(c->tsc));
+
+  return 1;
+}
+
+/* Size of the frame at the cursor, which has to be complete */
+static uint32_t am_ompt_index_frame_size(const struct am_ompt_index_cursor* c) {
+  uint32_t type_id;
 
-      goto err_out_free_hn;
+  memcpy(&type_id, &c->data[c->pos], sizeof(type_id));
+
+  if (type_id >= AM_OMPT_TYPE_ID_BASE &&
+      type_id < AM_OMPT_TYPE_ID_BASE + AM_OMPT_NUM_EVENTS)
+    return am_ompt_frame_sizes[type_id - AM_OMPT_TYPE_ID_BASE];
+
+  return AM_OMPT_COUNTER_FRAME_SIZE;
+}
+
+static void am_ompt_index_sift_down(struct am_ompt_index_cursor** heap,
+                                    size_t n, size_t i) {
+  for (;;) {
+    size_t min = i;
+    size_t l = 2 * i + 1;
+    size_t r = l + 1;
+
+    if (l < n && heap[l]->tsc < heap[min]->tsc) min = l;
+    if (r < n && heap[r]->tsc < heap[min]->tsc) min = r;
+
+    if (min == i) return;
+
+    struct am_ompt_index_cursor* tmp = heap[i];
+    heap[i] = heap[min];
+    heap[min] = tmp;
+    i = min;
+  }
+}
+
+static int am_ompt_cmp_index_point(const void* a, const void* b) {
+  const struct am_ompt_index_point* x = a;
+  const struct am_ompt_index_point* y = b;
+
+  if (x->tsc != y->tsc) return (x->tsc > y->tsc) - (x->tsc < y->tsc);
+
+  return (x->pos > y->pos) - (x->pos < y->pos);
+}
+
+/*
+  Collect the frames of the buffer of a cursor in order of their recording
+  time. Frames are mostly written when they are recorded, but mutex
+  acquisitions deferred until the lock is acquired and interval ends moved
+  back by the compensated tool time are written after later frames. Frames
+  recorded at the same time keep the order in which they were written.
+*/
+static int am_ompt_index_sort(struct am_ompt_index_cursor* c) {
+  size_t num = 0, max = 0;
+  int sorted = 1;
+
+  c->points = NULL;
+
+  for (c->pos = 0; am_ompt_index_peek(c);
+       c->pos += am_ompt_index_frame_size(c)) {
+    if (num == max) {
+      struct am_ompt_index_point* tmp;
+
+      max = max ? 2 * max : 1024;
+
+      if (!(tmp = realloc(c->points, max * sizeof(*tmp)))) goto out_err;
+
+      c->points = tmp;
     }
+
+    if (num && c->tsc < c->points[num - 1].tsc) sorted = 0;
+
+    c->points[num].tsc = c->tsc;
+    c->points[num].pos = c->pos;
+    num++;
   }
 
+  if (!sorted)
+    qsort(c->points, num, sizeof(*c->points), am_ompt_cmp_index_point);
+
+  c->num_points = num;
+  c->next = 0;
+
   return 0;
 
-err_out_free_hn:
-  free(hn);
-err_out:
+out_err:
+  free(c->points);
+  c->points = NULL;
+  return 1;
+}
+
+/*
+  Append the time index to the dumped trace. The frames of each event
+  collection are sorted by their recording time and the collections are
+  merged with a heap, so that the entries are in order of time.
+*/
+static int am_ompt_write_time_index(FILE* fp,
+                                    struct am_ompt_index_cursor* cursors,
+                                    size_t num) {
+  struct am_ompt_index_cursor** heap;
+  size_t n = 0, sorted = 0;
+  uint8_t entry[AM_OMPT_INDEX_ENTRY_SIZE];
+  uint64_t num_entries = 0, offset;
+  uint32_t entry_size = AM_OMPT_INDEX_ENTRY_SIZE;
+  uint32_t magic = AM_OMPT_INDEX_MAGIC;
+  long start;
+
+  if ((start = ftell(fp)) < 0) goto out_err;
+
+  if (!(heap = malloc((num ? num : 1) * sizeof(*heap)))) goto out_err;
+
+  for (; sorted < num; sorted++) {
+    struct am_ompt_index_cursor* c = &cursors[sorted];
+
+    if (am_ompt_index_sort(c)) goto out_err_free;
+
+    if (c->num_points) {
+      c->tsc = c->points[0].tsc;
+      heap[n++] = c;
+    }
+  }
+
+  for (size_t i = n / 2; i-- > 0;) am_ompt_index_sift_down(heap, n, i);
+
+  while (n) {
+    struct am_ompt_index_cursor* c = heap[0];
+    uint64_t frame = c->offset + c->points[c->next].pos;
+
+    memcpy(&entry[0], &c->tsc, sizeof(uint64_t));
+    memcpy(&entry[sizeof(uint64_t)], &c->id, sizeof(uint32_t));
+    memcpy(&entry[sizeof(uint64_t) + sizeof(uint32_t)], &frame,
+           sizeof(uint64_t));
+
+    if (fwrite(entry, sizeof(entry), 1, fp) != 1) goto out_err_free;
+
+    num_entries++;
+
+    if (++c->next < c->num_points)
+      c->tsc = c->points[c->next].tsc;
+    else
+      heap[0] = heap[--n];
+
+    am_ompt_index_sift_down(heap, n, 0);
+  }
+
+  offset = start;
+
+  if (fwrite(&offset, sizeof(offset), 1, fp) != 1 ||
+      fwrite(&num_entries, sizeof(num_entries), 1, fp) != 1 ||
+      fwrite(&entry_size, sizeof(entry_size), 1, fp) != 1 ||
+      fwrite(&magic, sizeof(magic), 1, fp) != 1)
+    goto out_err_free;
+
+  for (size_t i = 0; i < sorted; i++) free(cursors[i].points);
+
+  free(heap);
+
+  return 0;
+
+out_err_free:
+  for (size_t i = 0; i < sorted; i++) free(cursors[i].points);
+
+  free(heap);
+out_err:
+  return 1;
+}
+
+/* Entry of the seek index of an event collection while it is built */
+struct am_ompt_seek_point {
+  am_timestamp_t tsc;
+  uint64_t offset;
+  /* Difference of the depth to the previous entry */
+  int64_t depth;
+};
+
+/* Index of the first entry with a time of at least tsc */
+static size_t am_ompt_seek_lower_bound(const struct am_ompt_seek_point* e,
+                                       size_t num, am_timestamp_t tsc) {
+  size_t lo = 0, hi = num;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+
+    if (e[mid].tsc < tsc)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+/*
+  Write the seek index entries of a single event collection. An entry is
+  taken at the first frame, after every am_ompt_seek_index_events frames and
+  once am_ompt_seek_index_interval time units passed since the last entry.
+  The time of an entry is the latest recording time of the frames up to it,
+  so no earlier frame was recorded after it. Its depth is the number of
+  intervals written at or after it that started at or before its time, i.e.
+  the states open at that point. Intervals nest and are written when they
+  end, so each interval adds one to the depth of the entries from its start
+  up to its frame, which is accumulated as differences.
+*/
+static int am_ompt_write_seek_entries(FILE* fp, struct am_ompt_index_cursor* c,
+                                      uint64_t* num_entries) {
+  struct am_ompt_seek_point *entries = NULL, *tmp;
+  size_t num = 0, max = 0;
+  uint64_t frames = 0, last_frames = 0;
+  am_timestamp_t tsc = 0;
+  int64_t carry = 0, depth = 0;
+  uint8_t entry[AM_OMPT_SEEK_INDEX_ENTRY_SIZE];
+
+  for (c->pos = 0; am_ompt_index_peek(c);
+       c->pos += am_ompt_index_frame_size(c)) {
+    uint32_t type_id;
+
+    if (c->tsc > tsc) tsc = c->tsc;
+
+    if (!num ||
+        (am_ompt_seek_index_events &&
+         frames - last_frames >= am_ompt_seek_index_events) ||
+        (am_ompt_seek_index_interval &&
+         tsc - entries[num - 1].tsc >= am_ompt_seek_index_interval)) {
+      if (num == max) {
+        max = max ? 2 * max : 64;
+
+        if (!(tmp = realloc(entries, max * sizeof(*entries)))) goto out_err;
+
+        entries = tmp;
+      }
+
+      entries[num].tsc = tsc;
+      entries[num].offset = c->offset + c->pos;
+      entries[num].depth = carry;
+      carry = 0;
+      num++;
+      last_frames = frames;
+    }
+
+    memcpy(&type_id, &c->data[c->pos], sizeof(type_id));
+
+    if (type_id >= AM_OMPT_TYPE_ID_BASE &&
+        type_id < AM_OMPT_TYPE_ID_BASE + AM_OMPT_NUM_EVENTS &&
+        am_ompt_frame_time_offsets[type_id - AM_OMPT_TYPE_ID_BASE] ==
+            AM_OMPT_TIME_OFFSET_INTERVAL) {
+      am_timestamp_t start;
+
+      memcpy(&start, &c->data[c->pos + AM_OMPT_TIME_OFFSET_POINT],
+             sizeof(start));
+
+      size_t i = am_ompt_seek_lower_bound(entries, num, start);
+
+      if (i < num) {
+        entries[i].depth++;
+        carry--;
+      }
+    }
+
+    frames++;
+  }
+
+  for (size_t i = 0; i < num; i++) {
+    depth += entries[i].depth;
+
+    uint32_t d = depth;
+
+    memcpy(&entry[0], &entries[i].tsc, sizeof(uint64_t));
+    memcpy(&entry[sizeof(uint64_t)], &entries[i].offset, sizeof(uint64_t));
+    memcpy(&entry[2 * sizeof(uint64_t)], &c->id, sizeof(uint32_t));
+    memcpy(&entry[2 * sizeof(uint64_t) + sizeof(uint32_t)], &d,
+           sizeof(uint32_t));
+
+    if (fwrite(entry, sizeof(entry), 1, fp) != 1) goto out_err;
+  }
+
+  *num_entries += num;
+  free(entries);
+
+  return 0;
+
+out_err:
+  free(entries);
+  return 1;
+}
+
+static int am_ompt_cmp_cursor_id(const void* a, const void* b) {
+  const struct am_ompt_index_cursor* x = a;
+  const struct am_ompt_index_cursor* y = b;
+
+  return (x->id > y->id) - (x->id < y->id);
+}
+
+/*
+  Append the seek index to the dumped trace, with the entries of each event
+  collection in order of their time and the collections in order of their
+  ids, so that readers find an entry with a binary search.
+*/
+static int am_ompt_write_seek_index(FILE* fp,
+                                    struct am_ompt_index_cursor* cursors,
+                                    size_t num) {
+  uint64_t num_entries = 0, offset;
+  uint32_t entry_size = AM_OMPT_SEEK_INDEX_ENTRY_SIZE;
+  uint32_t magic = AM_OMPT_SEEK_INDEX_MAGIC;
+  long start;
+
+  if ((start = ftell(fp)) < 0) return 1;
+
+  qsort(cursors, num, sizeof(*cursors), am_ompt_cmp_cursor_id);
+
+  for (size_t i = 0; i < num; i++) {
+    if (am_ompt_write_seek_entries(fp, &cursors[i], &num_entries)) return 1;
+  }
+
+  offset = start;
+
+  if (fwrite(&offset, sizeof(offset), 1, fp) != 1 ||
+      fwrite(&num_entries, sizeof(num_entries), 1, fp) != 1 ||
+      fwrite(&entry_size, sizeof(entry_size), 1, fp) != 1 ||
+      fwrite(&magic, sizeof(magic), 1, fp) != 1)
+    return 1;
+
+  return 0;
+}
+
+/*
+  Append the enabled indexes to the dumped trace. The collections are the
+  last part of the dump, so the file offset of each buffer follows from the
+  size of the file.
+*/
+static int am_ompt_write_indexes() {
+  struct am_ompt_index_cursor* cursors;
+  size_t num = am_ompt_trace.num_collections;
+  uint64_t offset;
+  FILE* fp;
+  long end;
+
+  if (!am_ompt_time_index && !am_ompt_seek_index_events &&
+      !am_ompt_seek_index_interval)
+    return 0;
+
+  if (!(cursors = calloc(num ? num : 1, sizeof(*cursors)))) goto out_err;
+
+  if (!(fp = fopen(am_ompt_trace_file, "r+b"))) goto out_err_free;
+
+  if (fseek(fp, 0, SEEK_END) || (end = ftell(fp)) < 0) goto out_err_close;
+
+  offset = end;
+
+  for (size_t i = num; i-- > 0;) {
+    struct am_buffered_event_collection* c = am_ompt_trace.collections[i];
+
+    offset -= c->data.used;
+
+    cursors[i].data = c->data.data;
+    cursors[i].used = c->data.used;
+    cursors[i].offset = offset;
+    cursors[i].id = c->id;
+  }
+
+  if (am_ompt_time_index && am_ompt_write_time_index(fp, cursors, num))
+    goto out_err_close;
+
+  if ((am_ompt_seek_index_events || am_ompt_seek_index_interval) &&
+      am_ompt_write_seek_index(fp, cursors, num))
+    goto out_err_close;
+
+  if (fclose(fp)) goto out_err_free;
+
+  free(cursors);
+
+  return 0;
+
+out_err_close:
+  fclose(fp);
+out_err_free:
+  free(cursors);
+out_err:
   return 1;
 }
 
 void am_ompt_exit_trace() {
-  if (am_ompt_trace_mappings()) {
+  struct am_ompt_mapping* mappings;
+  size_t num_mappings;
+  am_timestamp_t now = am_ompt_now();
+
+  /* Callbacks of a runtime still dispatching them return early from now on */
+  am_ompt_end_tracing();
+
+  if (pthread_spin_lock(&am_ompt_trace_lock)) {
+    fprintf(stderr, "Afterompt: Could not acquire lock. \n");
+    exit(1);
+  }
+
+  /* Summarize the events that threads still alive have aggregated. They are
+     quiescent, so their data is not modified while it is written. */
+  for (struct am_ompt_thread_data* td = am_ompt_live_threads; td;
+       td = td->next) {
+    if (td->governor &&
+        am_ompt_governor_flush(td->governor, td->event_collection, now)) {
+      fprintf(stderr, "Afterompt: Could not write governor summary.\n");
+    }
+
+    if (td->sampler &&
+        am_ompt_sampling_drain(td->sampler, td->event_collection)) {
+      fprintf(stderr, "Afterompt: Could not write samples.\n");
+    }
+
+    if (td->occupancy &&
+        am_ompt_occupancy_flush(td->occupancy, td->event_collection, now)) {
+      fprintf(stderr, "Afterompt: Could not write occupancy bins.\n");
+    }
+  }
+
+  pthread_spin_unlock(&am_ompt_trace_lock);
+
+  if (am_ompt_sampling_enabled &&
+      am_ompt_sampling_write_maps(am_ompt_trace_file)) {
+    fprintf(stderr, "Afterompt: Could not write memory mappings.\n");
+  }
+
+  if (!(mappings = am_ompt_collect_mappings(&num_mappings)) ||
+      am_ompt_trace_mappings(mappings, num_mappings, 1)) {
     fprintf(stderr, "Afterompt: Could not trace event mappings.\n");
   }
 
+  free(mappings);
+  free(am_ompt_mappings);
+
+  if (am_ompt_register_used_types())
+    fprintf(stderr, "Afterompt: Could not register event types.\n");
+
+  if (am_ompt_annotate_write_labels(&am_ompt_trace.data))
+    fprintf(stderr, "Afterompt: Could not write labels.\n");
+
   if (am_buffered_trace_dump(&am_ompt_trace, am_ompt_trace_file)) {
     fprintf(stderr,
             "Afterompt: Could not write trace file "
             "\"%s\".\n",
             am_ompt_trace_file);
+  } else if (am_ompt_write_indexes()) {
+    fprintf(stderr, "Afterompt: Could not write indexes to \"%s\".\n",
+            am_ompt_trace_file);
+  }
+
+  if (am_ompt_columnar &&
+      am_ompt_columnar_write(am_ompt_trace_file, am_ompt_trace.collections,
+                             am_ompt_trace.num_collections)) {
+    fprintf(stderr, "Afterompt: Could not write columns of \"%s\".\n",
+            am_ompt_trace_file);
   }
 
+  if (am_ompt_dropped_events) {
+    fprintf(stderr,
+            "Afterompt: Memory limit reached, %lu events were dropped.\n"
+            "           Consider increasing AFTEROMPT_MEMORY_LIMIT\n",
+            am_ompt_dropped_events);
+  }
+
+  for (size_t i = 0; i < am_ompt_trace.num_collections; i++)
+    am_ompt_unmap_collection_buffer(&am_ompt_trace.collections[i]->data);
+
   am_buffered_trace_destroy(&am_ompt_trace);
   pthread_spin_destroy(&am_ompt_trace_lock);
 }
 
+uint64_t am_ompt_dropped_event_count() {
+  return __atomic_load_n(&am_ompt_dropped_events, __ATOMIC_RELAXED);
+}
+
 #pragma clang diagnostic pop
@@ -19,19 +19,51 @@
 #ifndef AM_OMPT_TRACE_H
 #define AM_OMPT_TRACE_H
 
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
 #include <aftermath/trace/buffered_event_collection.h>
 #include <aftermath/trace/buffered_trace.h>
 #include <aftermath/trace/timestamp.h>
 
+#include "annotate.h"
+#include "events.h"
+#include "governor.h"
+#include "lockprof.h"
+#include "occupancy.h"
+#include "profile.h"
+#include "sampling.h"
+#include "taskprof.h"
+#include "telemetry.h"
+
 #define AM_OMPT_DEFAULT_TRACE_BUFFER_SIZE (2 << 20)
 #define AM_OMPT_DEFAULT_EVENT_COLLECTION_BUFFER_SIZE (2 << 24)
+#define AM_OMPT_DEFAULT_SEGMENT_SIZE (256 << 10)
 #define AM_OMPT_DEFAULT_MAX_STATE_STACK_ENTRIES 64
+#define AM_OMPT_DEFAULT_MAX_PLACEMENTS 4
+
+/* Counter with the core a thread runs on, written on each migration */
+#define AM_OMPT_CORE_COUNTER_ID 0
 
 /* Application trace */
 extern struct am_buffered_trace am_ompt_trace;
 
+/* Time reference */
+extern struct am_timestamp_reference am_ompt_tsref;
+
+/* Core a thread runs on from a point in time */
+struct am_ompt_placement {
+  am_timestamp_t start;
+  int32_t core;
+};
+
 /* Struct for loop specific info */
 struct am_ompt_loop_info {
+  uint64_t instance_id;
   int flags;
   int64_t lower_bound;
   int64_t upper_bound;
@@ -49,9 +81,26 @@ union am_ompt_stack_item_data {
   struct am_ompt_loop_info loop_info;
 };
 
+/* Kind of the state pushed on the state stack */
+enum am_ompt_state_kind {
+  AM_OMPT_STATE_THREAD = 0,
+  AM_OMPT_STATE_PARALLEL,
+  AM_OMPT_STATE_IMPLICIT_TASK,
+  AM_OMPT_STATE_SYNC_REGION_WAIT,
+  AM_OMPT_STATE_WORK,
+  AM_OMPT_STATE_MASTER,
+  AM_OMPT_STATE_SYNC_REGION,
+  AM_OMPT_STATE_NEST_LOCK,
+  AM_OMPT_STATE_LOOP,
+  AM_OMPT_NUM_STATE_KINDS
+};
+
 /* Single stack element for tracing states containing intervals */
 struct am_ompt_stack_item {
   am_timestamp_t tsc;
+  /* Tool time of the thread when the state was pushed */
+  am_timestamp_t tool_time;
+  enum am_ompt_state_kind kind;
   union am_ompt_stack_item_data data;
 };
 
@@ -63,12 +112,149 @@ struct am_ompt_stack {
 
 /* Struct containing tracing information for a single thread */
 struct am_ompt_thread_data {
+  /* NULL if the thread is not traced */
   struct am_buffered_event_collection* event_collection;
   struct am_ompt_stack state_stack;
   pthread_t tid;
   uint32_t unique_counter;
+  /* Core the thread was last seen on */
+  int core;
+  /* Cores the thread ran on, in order of time */
+  struct am_ompt_placement* placements;
+  size_t num_placements;
+  size_t max_placements;
+  /* Live telemetry slot, NULL if telemetry is disabled */
+  struct am_ompt_telemetry_slot* telemetry;
+  /* Set while an explicit task is executed, only tracked for telemetry and
+     occupancy */
+  int in_explicit_task;
+  /* Lock profiling state, NULL if lock profiling is disabled */
+  struct am_ompt_lock_data* locks;
+  /* Task profiling state, NULL if task profiling is disabled */
+  struct am_ompt_task_data* tasks;
+  /* Overhead governor state, NULL if the governor is disabled */
+  struct am_ompt_governor* governor;
+  /* Calibrated time spent in callbacks, zero if compensation is disabled */
+  am_timestamp_t tool_time;
+  /* Sampling state, NULL if sampling is disabled */
+  struct am_ompt_sampler* sampler;
+  /* Explicit task currently executed, only tracked for sampling */
+  uint64_t task_id;
+  /* Construct profiling state, NULL if profiling is disabled */
+  struct am_ompt_profile_data* profile;
+  /* Occupancy bins, NULL if occupancy is disabled */
+  struct am_ompt_occupancy* occupancy;
+  /* Scopes opened in filtered-out code, zero while events are traced */
+  uint32_t filtered;
+  /* Set if the thread is not selected by AFTEROMPT_THREADS */
+  int untraced;
+  /* Phases begun with the annotation API */
+  struct am_ompt_phases phases;
+  /* Links in the list of live threads, protected by the trace lock */
+  struct am_ompt_thread_data* prev;
+  struct am_ompt_thread_data* next;
 };
 
+/*
+  Returns the current timestamp normalized to the reference. If the result
+  would be negative, the process is aborted.
+*/
+static inline am_timestamp_t am_ompt_now(void) {
+  am_timestamp_t now;
+
+  if (am_timestamp_reference_now(&am_ompt_tsref, &now)) {
+    fprintf(
+        stderr,
+        "Afterompt: Local timestamp normalized to reference is negative.\n");
+    // TODO: Dying may be too radical.
+    exit(1);
+  }
+
+  return now;
+}
+
+/*
+  Returns the core the calling thread runs on using sched_getcpu().
+*/
+int am_ompt_current_core();
+
+/*
+  Returns the core the calling thread runs on. On x86 it is read from the
+  auxiliary value of rdtscp, which Linux sets to the number of the core
+  (lower 12 bits) and is much cheaper than a system call.
+*/
+static inline int am_ompt_getcpu(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int aux;
+
+  __rdtscp(&aux);
+
+  return aux & 0xfff;
+#else
+  return am_ompt_current_core();
+#endif
+}
+
+/*
+  Get a new id for a task or loop created by the thread, made of the lower
+  half of its thread id and a counter. The counter skips its maximum, so that
+  no id equals AM_OMPT_FILTERED_TASK. Once it wraps around ids repeat, which
+  is reported.
+*/
+static inline uint64_t am_ompt_new_id(struct am_ompt_thread_data* td) {
+  if (__builtin_expect(td->unique_counter == UINT32_MAX, 0)) {
+    fprintf(stderr,
+            "Afterompt: Task and loop ids of thread %u wrapped around, ids "
+            "are not unique anymore.\n",
+            (uint32_t)td->tid);
+    td->unique_counter = 0;
+  }
+
+  return (td->tid << 32) | (td->unique_counter++);
+}
+
+/*
+  Record that the thread has moved to another core at the given time and
+  write a migration event to its event collection.
+*/
+int am_ompt_migrate_thread(struct am_ompt_thread_data* td, int core,
+                           am_timestamp_t tsc);
+
+/*
+  Check if the thread has moved to another core since the last sample. It
+  is called at the beginning of intervals, so that mappings of event
+  collections to cores follow the migrations of threads.
+*/
+static inline void am_ompt_sample_core(struct am_ompt_thread_data* td,
+                                       am_timestamp_t tsc) {
+  int core = am_ompt_getcpu();
+
+  if (__builtin_expect(core != td->core, 0)) {
+    if (am_ompt_migrate_thread(td, core, tsc)) {
+      fprintf(stderr, "Afterompt: Could not record thread migration.\n");
+      // TODO: Dying may be too radical.
+      exit(1);
+    }
+  }
+}
+
+/* Event types of optional features that have been used, as bits indexed by
+   enum am_ompt_event_type */
+extern uint64_t am_ompt_used_event_types;
+
+/*
+  Mark an event type of an optional feature as used. The frame types of
+  optional features are only registered in traces in which they are used,
+  when the trace is written, so traces without them can be read by Aftermath.
+  The type has to be marked before its first event is written.
+*/
+static inline void am_ompt_use_event_type(enum am_ompt_event_type type) {
+  uint64_t bit = UINT64_C(1) << type;
+
+  if (!(__atomic_load_n(&am_ompt_used_event_types, __ATOMIC_RELAXED) & bit))
+    __atomic_fetch_or(&am_ompt_used_event_types, bit, __ATOMIC_RELEASE);
+}
+
 /*
   Initialize new trace. The function has to be called before any
   other tracing related function is called.
@@ -77,18 +263,38 @@ int am_ompt_init_trace();
 
 /*
   Initialize an event collection and state stack for a specific
-  thread and add add them to the trace.
+  thread and add add them to the trace. Threads that are not traced only get
+  a minimal thread data object without event collection, which is marked as
+  untraced, so their callbacks return early.
 */
-struct am_ompt_thread_data* am_ompt_create_thread_data(pthread_t tid);
+struct am_ompt_thread_data* am_ompt_create_thread_data(pthread_t tid,
+                                                       int traced);
 
 /*
-  Free the core data and destroy the state stack.
+  Free the core data and destroy the state stack. The cores the thread ran
+  on are kept, so its event collection can be mapped on exit.
 */
 void am_ompt_destroy_thread_data(struct am_ompt_thread_data* thread_data);
 
 /*
-  Save trace to the file and clean up all structures.
+  Write a snapshot of everything traced so far to the trace file. Threads
+  that are still running are mapped to their cores up to the end of the
+  trace.
+  The trace is left untouched, so tracing can continue afterwards. Event
+  collections are read while the snapshot is taken, so it should be called
+  from a sequential part of the application.
+*/
+int am_ompt_flush_trace();
+
+/*
+  Save trace to the file and clean up all structures. The governor, sample
+  and occupancy data of threads that have not ended is written on their
+  behalf, so no thread may be in a callback any more. This holds when the
+  tool is finalized, since the runtime dispatches no further callbacks.
 */
 void am_ompt_exit_trace();
 
+/* Number of events dropped because the memory limit was reached */
+uint64_t am_ompt_dropped_event_count();
+
 #endif
@@ -0,0 +1,133 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef AM_OMPT_WRITER_H
+#define AM_OMPT_WRITER_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <aftermath/trace/on_disk_structs.h>
+#include <aftermath/trace/write_buffer.h>
+
+#include "events.h"
+
+/* Type ids of Afterompt events start above the default ids of Aftermath */
+#define AM_OMPT_TYPE_ID_BASE 0x1000
+
+enum am_ompt_type_id {
+#define AM_OMPT_TYPE_ID_ENUM(name, NAME, kind)                          \
+  AM_OMPT_TYPE_ID_##NAME = AM_OMPT_TYPE_ID_BASE + AM_OMPT_EVENT_##NAME,
+  AM_OMPT_EVENTS(AM_OMPT_TYPE_ID_ENUM)
+#undef AM_OMPT_TYPE_ID_ENUM
+};
+
+/* Type id of the Aftermath counter events written to event collections,
+   registered for am::core::counter_event */
+#define AM_OMPT_TYPE_ID_COUNTER (AM_OMPT_TYPE_ID_BASE - 1)
+
+uint8_t* am_ompt_reserve_slow(struct am_write_buffer* b, size_t size);
+
+/*
+  Reserves space for a frame with a single bounds check. Only if the buffer is
+  full it is grown by am_ompt_reserve_slow. Returns NULL if no space could be
+  reserved.
+*/
+static inline __attribute__((always_inline)) uint8_t* am_ompt_reserve(
+    struct am_write_buffer* b, size_t size) {
+  if (__builtin_expect(b->size - b->used >= size, 1)) {
+    uint8_t* p = &b->data[b->used];
+
+    b->used += size;
+
+    return p;
+  }
+
+  return am_ompt_reserve_slow(b, size);
+}
+
+/* Store a little-endian value in the frame and advance the frame pointer */
+#define AM_OMPT_STORE(type, value) \
+  {                                \
+    type v = (value);              \
+                                   \
+    memcpy(p, &v, sizeof(v));      \
+    p += sizeof(v);                \
+  }
+
+#define AM_OMPT_WRITER_PARAMS_INTERVAL , struct am_dsk_interval interval
+#define AM_OMPT_WRITER_PARAMS_POINT , uint64_t tsc
+
+#define AM_OMPT_WRITER_STORE_INTERVAL     \
+  AM_OMPT_STORE(uint64_t, interval.start) \
+  AM_OMPT_STORE(uint64_t, interval.end)
+
+#define AM_OMPT_WRITER_STORE_POINT AM_OMPT_STORE(uint64_t, tsc)
+
+#define AM_OMPT_WRITER_PARAM(type, name) , type name
+
+/*
+  Writers am_ompt_write_<name>(buffer, collection_id, interval or tsc,
+  fields...) for all events. Each writer reserves the exact frame size and
+  stores the fields directly. Returns 0 on success.
+*/
+#define AM_OMPT_WRITER(name, NAME, kind)                                       \
+  static inline __attribute__((always_inline)) int am_ompt_write_##name(       \
+      struct am_write_buffer* b,                                               \
+      uint32_t collection_id AM_OMPT_WRITER_PARAMS_##kind                      \
+          AM_OMPT_FIELDS_##name(AM_OMPT_WRITER_PARAM)) {                       \
+    uint8_t* p =                                                               \
+        am_ompt_reserve(b, sizeof(uint32_t) + AM_OMPT_EVENT_SIZE(name, kind)); \
+                                                                               \
+    if (!p) return 1;                                                          \
+                                                                               \
+    AM_OMPT_STORE(uint32_t, AM_OMPT_TYPE_ID_##NAME)                            \
+    AM_OMPT_STORE(uint32_t, collection_id)                                     \
+    AM_OMPT_WRITER_STORE_##kind                                                \
+    AM_OMPT_FIELDS_##name(AM_OMPT_STORE)                                       \
+                                                                               \
+    return 0;                                                                  \
+  }
+
+AM_OMPT_EVENTS(AM_OMPT_WRITER)
+
+#undef AM_OMPT_WRITER
+
+/*
+  Writes a counter event in the format of Aftermath. Unlike the writers of
+  Aftermath it grows the buffer of the collection if needed, so it is used
+  for all counter events in event collections. Returns 0 on success.
+*/
+static inline int am_ompt_write_counter(struct am_write_buffer* b,
+                                        uint32_t collection_id,
+                                        uint32_t counter_id, uint64_t tsc,
+                                        int64_t value) {
+  uint8_t* p = am_ompt_reserve(b, AM_OMPT_COUNTER_FRAME_SIZE);
+
+  if (!p) return 1;
+
+  AM_OMPT_STORE(uint32_t, AM_OMPT_TYPE_ID_COUNTER)
+  AM_OMPT_STORE(uint32_t, collection_id)
+  AM_OMPT_STORE(uint32_t, counter_id)
+  AM_OMPT_STORE(uint64_t, tsc)
+  AM_OMPT_STORE(int64_t, value)
+
+  return 0;
+}
+
+#endif
@@ -0,0 +1,697 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+  Benchmark harness that acts as a fake OMPT runtime. It starts the tool
+  through ompt_start_tool, captures the callbacks registered with
+  ompt_set_callback and drives them directly from a number of pthreads
+  with scripted event streams. This measures the cost of the tracing hot
+  path without the noise of a real OpenMP runtime.
+
+  Usage: afterompt-bench [threads] [iterations]
+
+  The trace is written to AFTERMATH_TRACE_FILE, or afterompt-bench.ost if
+  the variable is not set. Unless AFTERMATH_EVENT_COLLECTION_BUFFER_SIZE is
+  set, the collection buffers are sized to hold all scripted events.
+
+  The dumped trace is read back and checked: intervals have to nest, every
+  scheduled task has to be created and each event type has to occur as often
+  as scripted. The check assumes that every event is traced, so settings
+  that aggregate, filter, skip or pause events have to be unset. The exit
+  status is non-zero if events were dropped or the trace fails the check.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "afterompt.h"
+#include "reader.h"
+#include "trace.h"
+
+#define AM_BENCH_DEFAULT_THREADS 4
+#define AM_BENCH_DEFAULT_ITERATIONS 10000
+#define AM_BENCH_MAX_CALLBACKS 64
+
+/* Callbacks registered by the tool, indexed by ompt_callbacks_t */
+static ompt_callback_t am_bench_callbacks[AM_BENCH_MAX_CALLBACKS];
+
+static size_t am_bench_iterations = AM_BENCH_DEFAULT_ITERATIONS;
+
+/* Shared lock for the lock ping-pong scenario */
+static pthread_mutex_t am_bench_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Released once all threads have started, so scenarios run concurrently */
+static pthread_barrier_t am_bench_barrier;
+
+/* Captured callback of the given event, cast to the given signature */
+#define CB_AS(name, type) \
+  ((ompt_callback_##type##_t)am_bench_callbacks[ompt_callback_##name])
+
+#define CB(name) CB_AS(name, name)
+
+static ompt_set_result_t am_bench_set_callback(ompt_callbacks_t event,
+                                               ompt_callback_t callback) {
+  if (event >= AM_BENCH_MAX_CALLBACKS) return ompt_set_never;
+
+  am_bench_callbacks[event] = callback;
+
+  return ompt_set_always;
+}
+
+static ompt_interface_fn_t am_bench_lookup(const char* name) {
+  if (!strcmp(name, "ompt_set_callback"))
+    return (ompt_interface_fn_t)am_bench_set_callback;
+
+  return NULL;
+}
+
+static inline uint64_t am_bench_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Event collection of the calling thread */
+static struct am_buffered_event_collection* am_bench_own_collection(void) {
+  am_event_collection_id_t id = pthread_self();
+
+  for (size_t i = 0; i < am_ompt_trace.num_collections; i++) {
+    if (am_ompt_trace.collections[i]->id == id)
+      return am_ompt_trace.collections[i];
+  }
+
+  return NULL;
+}
+
+/* Result of a single benchmark on a single thread */
+struct am_bench_result {
+  uint64_t ns;
+  uint64_t callbacks;
+  uint64_t events;
+  uint64_t bytes;
+};
+
+/* Benchmarked operation, invoking one or more callbacks */
+struct am_bench_op {
+  const char* name;
+  /* Callback that has to be registered for the operation to be run */
+  ompt_callbacks_t required;
+  /* Callbacks invoked and events of each type written by a single
+     operation */
+  unsigned int callbacks;
+  unsigned int events[AM_OMPT_NUM_EVENTS];
+  void (*run)(size_t i);
+};
+
+/* Frame size of each event type, including the type id */
+static const size_t am_bench_event_sizes[AM_OMPT_NUM_EVENTS] = {
+#define AM_BENCH_EVENT_SIZE(name, NAME, kind) \
+  [AM_OMPT_EVENT_##NAME] = sizeof(uint32_t) + AM_OMPT_EVENT_SIZE(name, kind),
+    AM_OMPT_EVENTS(AM_BENCH_EVENT_SIZE)
+#undef AM_BENCH_EVENT_SIZE
+};
+
+static ompt_data_t am_bench_parallel_data;
+static ompt_data_t am_bench_task_data;
+
+static void am_bench_op_parallel(size_t i) {
+  CB(parallel_begin)(&am_bench_task_data, NULL, &am_bench_parallel_data, 4,
+                     ompt_parallel_team, NULL);
+  CB(parallel_end)(&am_bench_parallel_data, &am_bench_task_data,
+                   ompt_parallel_team, NULL);
+}
+
+static void am_bench_op_implicit_task(size_t i) {
+  CB(implicit_task)(ompt_scope_begin, &am_bench_parallel_data,
+                    &am_bench_task_data, 4, 0, ompt_task_implicit);
+  CB(implicit_task)(ompt_scope_end, &am_bench_parallel_data,
+                    &am_bench_task_data, 4, 0, ompt_task_implicit);
+}
+
+static void am_bench_op_work(size_t i) {
+  CB(work)(ompt_work_loop, ompt_scope_begin, &am_bench_parallel_data,
+           &am_bench_task_data, 100, NULL);
+  CB(work)(ompt_work_loop, ompt_scope_end, &am_bench_parallel_data,
+           &am_bench_task_data, 100, NULL);
+}
+
+static void am_bench_op_master(size_t i) {
+  CB(master)(ompt_scope_begin, &am_bench_parallel_data, &am_bench_task_data,
+             NULL);
+  CB(master)(ompt_scope_end, &am_bench_parallel_data, &am_bench_task_data,
+             NULL);
+}
+
+static void am_bench_op_sync_region(size_t i) {
+  CB(sync_region)(ompt_sync_region_barrier, ompt_scope_begin,
+                  &am_bench_parallel_data, &am_bench_task_data, NULL);
+  CB(sync_region)(ompt_sync_region_barrier, ompt_scope_end,
+                  &am_bench_parallel_data, &am_bench_task_data, NULL);
+}
+
+static void am_bench_op_sync_region_wait(size_t i) {
+  ompt_callback_sync_region_t wait = CB_AS(sync_region_wait, sync_region);
+
+  wait(ompt_sync_region_barrier, ompt_scope_begin, &am_bench_parallel_data,
+       &am_bench_task_data, NULL);
+  wait(ompt_sync_region_barrier, ompt_scope_end, &am_bench_parallel_data,
+       &am_bench_task_data, NULL);
+}
+
+static void am_bench_op_nest_lock(size_t i) {
+  CB(nest_lock)(ompt_scope_begin, 1, NULL);
+  CB(nest_lock)(ompt_scope_end, 1, NULL);
+}
+
+static void am_bench_op_task_create(size_t i) {
+  ompt_data_t new_task = {0};
+
+  CB(task_create)(&am_bench_task_data, NULL, &new_task, ompt_task_explicit,
+                  0, NULL);
+}
+
+/* Tasks are created first, so that every scheduled task is in the trace */
+static void am_bench_op_task_schedule(size_t i) {
+  ompt_data_t task = {0};
+
+  CB(task_create)(&am_bench_task_data, NULL, &task, ompt_task_explicit, 0,
+                  NULL);
+  CB(task_schedule)(&am_bench_task_data, ompt_task_switch, &task);
+}
+
+static void am_bench_op_task_dependence(size_t i) {
+  ompt_data_t src = {.value = i};
+  ompt_data_t sink = {.value = i + 1};
+
+  CB(task_dependence)(&src, &sink);
+}
+
+static void am_bench_op_dependences(size_t i) {
+  CB(dependences)(&am_bench_task_data, NULL, 0);
+}
+
+static void am_bench_op_mutex(size_t i) {
+  CB(mutex_acquire)(ompt_mutex_lock, 0, 0, i & 0xff, NULL);
+  CB_AS(mutex_acquired, mutex)(ompt_mutex_lock, i & 0xff, NULL);
+  CB_AS(mutex_released, mutex)(ompt_mutex_lock, i & 0xff, NULL);
+}
+
+static void am_bench_op_lock_init_destroy(size_t i) {
+  CB_AS(lock_init, mutex_acquire)(ompt_mutex_lock, 0, 0, i, NULL);
+  CB_AS(lock_destroy, mutex)(ompt_mutex_lock, i, NULL);
+}
+
+static void am_bench_op_flush(size_t i) { CB(flush)(NULL, NULL); }
+
+static void am_bench_op_cancel(size_t i) {
+  CB(cancel)(&am_bench_task_data, ompt_cancel_parallel, NULL);
+}
+
+/* Nested regions as executed by one thread of a team */
+static void am_bench_scenario_nested(size_t i) {
+  ompt_callback_sync_region_t wait = CB_AS(sync_region_wait, sync_region);
+
+  CB(parallel_begin)(&am_bench_task_data, NULL, &am_bench_parallel_data, 4,
+                     ompt_parallel_team, NULL);
+  CB(implicit_task)(ompt_scope_begin, &am_bench_parallel_data,
+                    &am_bench_task_data, 4, 0, ompt_task_implicit);
+  CB(work)(ompt_work_loop, ompt_scope_begin, &am_bench_parallel_data,
+           &am_bench_task_data, 100, NULL);
+  CB(work)(ompt_work_loop, ompt_scope_end, &am_bench_parallel_data,
+           &am_bench_task_data, 100, NULL);
+  CB(sync_region)(ompt_sync_region_barrier, ompt_scope_begin,
+                  &am_bench_parallel_data, &am_bench_task_data, NULL);
+  wait(ompt_sync_region_barrier, ompt_scope_begin, &am_bench_parallel_data,
+       &am_bench_task_data, NULL);
+  wait(ompt_sync_region_barrier, ompt_scope_end, &am_bench_parallel_data,
+       &am_bench_task_data, NULL);
+  CB(sync_region)(ompt_sync_region_barrier, ompt_scope_end,
+                  &am_bench_parallel_data, &am_bench_task_data, NULL);
+  CB(master)(ompt_scope_begin, &am_bench_parallel_data, &am_bench_task_data,
+             NULL);
+  CB(master)(ompt_scope_end, &am_bench_parallel_data, &am_bench_task_data,
+             NULL);
+  CB(implicit_task)(ompt_scope_end, &am_bench_parallel_data,
+                    &am_bench_task_data, 4, 0, ompt_task_implicit);
+  CB(parallel_end)(&am_bench_parallel_data, &am_bench_task_data,
+                   ompt_parallel_team, NULL);
+}
+
+/* Creation of a batch of tasks, followed by their execution */
+#define AM_BENCH_TASK_BATCH 16
+
+static void am_bench_scenario_task_storm(size_t i) {
+  ompt_data_t tasks[AM_BENCH_TASK_BATCH];
+
+  memset(tasks, 0, sizeof(tasks));
+
+  for (int t = 0; t < AM_BENCH_TASK_BATCH; t++) {
+    CB(task_create)(&am_bench_task_data, NULL, &tasks[t], ompt_task_explicit,
+                    0, NULL);
+  }
+
+  for (int t = 0; t < AM_BENCH_TASK_BATCH; t++) {
+    CB(task_schedule)(&am_bench_task_data, ompt_task_switch, &tasks[t]);
+    CB(task_schedule)(&tasks[t], ompt_task_complete, &am_bench_task_data);
+  }
+}
+
+/* Contended lock passed between all threads */
+static void am_bench_scenario_lock_ping_pong(size_t i) {
+  CB(mutex_acquire)(ompt_mutex_lock, 0, 0, 1, NULL);
+  pthread_mutex_lock(&am_bench_mutex);
+  CB_AS(mutex_acquired, mutex)(ompt_mutex_lock, 1, NULL);
+  pthread_mutex_unlock(&am_bench_mutex);
+  CB_AS(mutex_released, mutex)(ompt_mutex_lock, 1, NULL);
+}
+
+static const struct am_bench_op am_bench_ops[] = {
+    {"parallel", ompt_callback_parallel_begin, 2,
+     {[AM_OMPT_EVENT_PARALLEL] = 1}, am_bench_op_parallel},
+    {"implicit_task", ompt_callback_implicit_task, 2,
+     {[AM_OMPT_EVENT_IMPLICIT_TASK] = 1}, am_bench_op_implicit_task},
+    {"work", ompt_callback_work, 2, {[AM_OMPT_EVENT_WORK] = 1},
+     am_bench_op_work},
+    {"master", ompt_callback_master, 2, {[AM_OMPT_EVENT_MASTER] = 1},
+     am_bench_op_master},
+    {"sync_region", ompt_callback_sync_region, 2,
+     {[AM_OMPT_EVENT_SYNC_REGION] = 1}, am_bench_op_sync_region},
+    {"sync_region_wait", ompt_callback_sync_region_wait, 2,
+     {[AM_OMPT_EVENT_SYNC_REGION_WAIT] = 1}, am_bench_op_sync_region_wait},
+    {"nest_lock", ompt_callback_nest_lock, 2, {[AM_OMPT_EVENT_NEST_LOCK] = 1},
+     am_bench_op_nest_lock},
+    {"task_create", ompt_callback_task_create, 1,
+     {[AM_OMPT_EVENT_TASK_CREATE] = 1}, am_bench_op_task_create},
+    {"task_schedule", ompt_callback_task_schedule, 2,
+     {[AM_OMPT_EVENT_TASK_CREATE] = 1, [AM_OMPT_EVENT_TASK_SCHEDULE] = 1},
+     am_bench_op_task_schedule},
+    {"task_dependence", ompt_callback_task_dependence, 1,
+     {[AM_OMPT_EVENT_TASK_DEPENDENCE] = 1}, am_bench_op_task_dependence},
+    {"dependences", ompt_callback_dependences, 1,
+     {[AM_OMPT_EVENT_DEPENDENCES] = 1}, am_bench_op_dependences},
+    {"mutex", ompt_callback_mutex_acquire, 3,
+     {[AM_OMPT_EVENT_MUTEX_ACQUIRE] = 1, [AM_OMPT_EVENT_MUTEX_ACQUIRED] = 1,
+      [AM_OMPT_EVENT_MUTEX_RELEASED] = 1},
+     am_bench_op_mutex},
+    {"lock_init_destroy", ompt_callback_lock_init, 2,
+     {[AM_OMPT_EVENT_LOCK_INIT] = 1, [AM_OMPT_EVENT_LOCK_DESTROY] = 1},
+     am_bench_op_lock_init_destroy},
+    {"flush", ompt_callback_flush, 1, {[AM_OMPT_EVENT_FLUSH] = 1},
+     am_bench_op_flush},
+    {"cancel", ompt_callback_cancel, 1, {[AM_OMPT_EVENT_CANCEL] = 1},
+     am_bench_op_cancel},
+    {"scenario:nested_regions", ompt_callback_parallel_begin, 12,
+     {[AM_OMPT_EVENT_PARALLEL] = 1, [AM_OMPT_EVENT_IMPLICIT_TASK] = 1,
+      [AM_OMPT_EVENT_WORK] = 1, [AM_OMPT_EVENT_SYNC_REGION] = 1,
+      [AM_OMPT_EVENT_SYNC_REGION_WAIT] = 1, [AM_OMPT_EVENT_MASTER] = 1},
+     am_bench_scenario_nested},
+    {"scenario:task_storm", ompt_callback_task_create,
+     3 * AM_BENCH_TASK_BATCH,
+     {[AM_OMPT_EVENT_TASK_CREATE] = AM_BENCH_TASK_BATCH,
+      [AM_OMPT_EVENT_TASK_SCHEDULE] = 2 * AM_BENCH_TASK_BATCH},
+     am_bench_scenario_task_storm},
+    {"scenario:lock_ping_pong", ompt_callback_mutex_acquire, 3,
+     {[AM_OMPT_EVENT_MUTEX_ACQUIRE] = 1, [AM_OMPT_EVENT_MUTEX_ACQUIRED] = 1,
+      [AM_OMPT_EVENT_MUTEX_RELEASED] = 1},
+     am_bench_scenario_lock_ping_pong}};
+
+#define AM_BENCH_NUM_OPS (sizeof(am_bench_ops) / sizeof(am_bench_ops[0]))
+
+/* Events of all types written by a single operation */
+static unsigned int am_bench_op_events(const struct am_bench_op* o) {
+  unsigned int events = 0;
+
+  for (int t = 0; t < AM_OMPT_NUM_EVENTS; t++) events += o->events[t];
+
+  return events;
+}
+
+/* Per-thread results, indexed by thread and operation */
+static struct am_bench_result* am_bench_results;
+
+/* Collection bytes written by each thread, checked against the dump */
+static uint64_t* am_bench_thread_bytes;
+
+static void* am_bench_thread(void* arg) {
+  size_t idx = (size_t)arg;
+  struct am_bench_result* results = &am_bench_results[idx * AM_BENCH_NUM_OPS];
+  struct am_buffered_event_collection* c;
+  ompt_data_t thread_data = {0};
+
+  CB(thread_begin)(ompt_thread_worker, &thread_data);
+
+  if (!(c = am_bench_own_collection())) {
+    fprintf(stderr, "Thread %zu: Could not find own event collection.\n",
+            idx);
+    exit(1);
+  }
+
+  for (size_t op = 0; op < AM_BENCH_NUM_OPS; op++) {
+    const struct am_bench_op* o = &am_bench_ops[op];
+    size_t used = c->data.used;
+    uint64_t start;
+
+    if (!am_bench_callbacks[o->required]) continue;
+
+    pthread_barrier_wait(&am_bench_barrier);
+
+    start = am_bench_ns();
+
+    for (size_t i = 0; i < am_bench_iterations; i++) o->run(i);
+
+    results[op].ns = am_bench_ns() - start;
+    results[op].callbacks = o->callbacks * am_bench_iterations;
+    results[op].events = am_bench_op_events(o) * am_bench_iterations;
+    results[op].bytes = c->data.used - used;
+  }
+
+  am_bench_thread_bytes[idx] = c->data.used;
+
+  CB(thread_end)(&thread_data);
+
+  return NULL;
+}
+
+/* Collection buffer size for the scripted events of a thread, leaving room
+   for the thread, counter and tool time events */
+static size_t am_bench_buffer_size(void) {
+  size_t bytes = 0;
+
+  for (size_t op = 0; op < AM_BENCH_NUM_OPS; op++) {
+    for (int t = 0; t < AM_OMPT_NUM_EVENTS; t++)
+      bytes += am_bench_ops[op].events[t] * am_bench_event_sizes[t];
+  }
+
+  return 2 * bytes * am_bench_iterations + (1 << 20);
+}
+
+static int am_bench_push(uint64_t** values, size_t* num, size_t* max,
+                         uint64_t value) {
+  if (*num == *max) {
+    size_t new_max = *max ? 2 * *max : 1024;
+    uint64_t* v = realloc(*values, new_max * sizeof(*v));
+
+    if (!v) return 1;
+
+    *values = v;
+    *max = new_max;
+  }
+
+  (*values)[(*num)++] = value;
+
+  return 0;
+}
+
+static int am_bench_cmp(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+
+  return (x > y) - (x < y);
+}
+
+/* Interval of a collection enclosing the intervals read so far */
+struct am_bench_open {
+  uint64_t start;
+  uint64_t end;
+};
+
+/* Read the dumped trace back and check that intervals nest, that every
+   scheduled task was created and that each event type occurs as often as
+   scripted. Returns the number of errors. */
+static int am_bench_check_trace(const char* path, size_t num_threads) {
+  struct am_ompt_reader r;
+  struct am_ompt_event e;
+  uint64_t count[AM_OMPT_NUM_EVENTS + 1] = {0};
+  uint64_t expected[AM_OMPT_NUM_EVENTS] = {0};
+  int scripted[AM_OMPT_NUM_EVENTS] = {0};
+  uint64_t *created = NULL, *scheduled = NULL;
+  size_t num_created = 0, max_created = 0;
+  size_t num_scheduled = 0, max_scheduled = 0;
+  struct am_bench_open* stack = NULL;
+  size_t max_depth = 0;
+  uint64_t overlapping = 0, not_created = 0;
+  int errors = 0;
+
+  if (am_ompt_reader_open(&r, path)) return 1;
+
+  if (r.error_offset) {
+    fprintf(stderr, "Trace is malformed at offset %zu: %s\n", r.error_offset,
+            r.error);
+    errors++;
+  }
+
+  for (size_t i = 0; i < r.num_collections; i++) {
+    struct am_ompt_reader_collection* rc = &r.collections[i];
+    size_t depth = 0;
+
+    for (size_t j = 0; j < rc->num_ranges; j++) {
+      size_t off = rc->ranges[j].start;
+
+      while (am_ompt_reader_next(&r, &off, rc->ranges[j].end, &e)) {
+        count[e.type]++;
+
+        /* Intervals are written when they end, so an interval encloses the
+           open intervals that start after it */
+        if (am_ompt_event_is_interval[e.type]) {
+          if (e.start > e.end) overlapping++;
+
+          while (depth && stack[depth - 1].start >= e.start) {
+            if (stack[--depth].end > e.end) overlapping++;
+          }
+
+          if (depth && stack[depth - 1].end > e.start) overlapping++;
+
+          if (depth == max_depth) {
+            size_t max = max_depth ? 2 * max_depth : 64;
+            struct am_bench_open* o = realloc(stack, max * sizeof(*o));
+
+            if (!o) goto out_err;
+
+            stack = o;
+            max_depth = max;
+          }
+
+          stack[depth].start = e.start;
+          stack[depth].end = e.end;
+          depth++;
+        }
+
+        if (e.type == AM_OMPT_EVENT_TASK_CREATE &&
+            am_bench_push(&created, &num_created, &max_created,
+                          e.task_create.new_task_id))
+          goto out_err;
+
+        /* The implicit task has no id */
+        if (e.type == AM_OMPT_EVENT_TASK_SCHEDULE &&
+            e.task_schedule.next_task_id &&
+            am_bench_push(&scheduled, &num_scheduled, &max_scheduled,
+                          e.task_schedule.next_task_id))
+          goto out_err;
+      }
+    }
+  }
+
+  qsort(created, num_created, sizeof(uint64_t), am_bench_cmp);
+
+  for (size_t i = 0; i < num_scheduled; i++) {
+    if (!bsearch(&scheduled[i], created, num_created, sizeof(uint64_t),
+                 am_bench_cmp))
+      not_created++;
+  }
+
+  if (overlapping) {
+    fprintf(stderr, "%lu intervals do not nest.\n", overlapping);
+    errors++;
+  }
+
+  if (not_created) {
+    fprintf(stderr, "%lu scheduled tasks were not created.\n", not_created);
+    errors++;
+  }
+
+  /* Event types of operations whose callbacks are not registered must not
+     occur at all */
+  expected[AM_OMPT_EVENT_THREAD] = num_threads;
+  scripted[AM_OMPT_EVENT_THREAD] = 1;
+
+  for (size_t op = 0; op < AM_BENCH_NUM_OPS; op++) {
+    const struct am_bench_op* o = &am_bench_ops[op];
+    int registered = (am_bench_callbacks[o->required] != NULL);
+
+    for (int t = 0; t < AM_OMPT_NUM_EVENTS; t++) {
+      if (!o->events[t]) continue;
+
+      scripted[t] = 1;
+
+      if (registered)
+        expected[t] += (uint64_t)o->events[t] * am_bench_iterations *
+                       num_threads;
+    }
+  }
+
+  for (int t = 0; t < AM_OMPT_NUM_EVENTS; t++) {
+    if (scripted[t] && count[t] != expected[t]) {
+      fprintf(stderr, "Trace has %lu %s events, %lu were scripted.\n",
+              count[t], am_ompt_event_names[t], expected[t]);
+      errors++;
+    }
+  }
+
+  free(stack);
+  free(scheduled);
+  free(created);
+  am_ompt_reader_close(&r);
+
+  return errors;
+
+out_err:
+  fprintf(stderr, "Could not allocate memory.\n");
+  free(stack);
+  free(scheduled);
+  free(created);
+  am_ompt_reader_close(&r);
+
+  return errors + 1;
+}
+
+int main(int argc, char** argv) {
+  ompt_start_tool_result_t* tool;
+  ompt_data_t tool_data = {0};
+  size_t num_threads = AM_BENCH_DEFAULT_THREADS;
+  pthread_t* threads;
+  uint64_t total_bytes = 0;
+  const char* trace_file;
+  struct stat st;
+  int ret = 0;
+
+  if (argc > 1) sscanf(argv[1], "%zu", &num_threads);
+  if (argc > 2) sscanf(argv[2], "%zu", &am_bench_iterations);
+
+  if (!getenv("AFTERMATH_TRACE_FILE"))
+    setenv("AFTERMATH_TRACE_FILE", "afterompt-bench.ost", 1);
+
+  /* Events beyond the collection buffers would be dropped */
+  if (!getenv("AFTERMATH_EVENT_COLLECTION_BUFFER_SIZE")) {
+    size_t size = am_bench_buffer_size();
+    char value[32];
+
+    if (size > AM_OMPT_DEFAULT_EVENT_COLLECTION_BUFFER_SIZE) {
+      snprintf(value, sizeof(value), "%zu", size);
+      setenv("AFTERMATH_EVENT_COLLECTION_BUFFER_SIZE", value, 1);
+    }
+  }
+
+  trace_file = getenv("AFTERMATH_TRACE_FILE");
+
+  if (!(tool = ompt_start_tool(201811, "afterompt-bench"))) {
+    fprintf(stderr, "Tool did not start.\n");
+    return 1;
+  }
+
+  if (!tool->initialize(am_bench_lookup, 0, &tool_data)) {
+    fprintf(stderr, "Tool failed to initialize.\n");
+    return 1;
+  }
+
+  if (!am_bench_callbacks[ompt_callback_thread_begin] ||
+      !am_bench_callbacks[ompt_callback_thread_end]) {
+    fprintf(stderr, "Tool did not register thread callbacks.\n");
+    return 1;
+  }
+
+  threads = malloc(num_threads * sizeof(*threads));
+  am_bench_results = calloc(num_threads * AM_BENCH_NUM_OPS,
+                            sizeof(*am_bench_results));
+  am_bench_thread_bytes = calloc(num_threads, sizeof(*am_bench_thread_bytes));
+
+  if (!threads || !am_bench_results || !am_bench_thread_bytes) {
+    fprintf(stderr, "Could not allocate memory.\n");
+    return 1;
+  }
+
+  pthread_barrier_init(&am_bench_barrier, NULL, num_threads);
+
+  for (size_t t = 0; t < num_threads; t++) {
+    if (pthread_create(&threads[t], NULL, am_bench_thread, (void*)t)) {
+      fprintf(stderr, "Could not create thread %zu.\n", t);
+      return 1;
+    }
+  }
+
+  for (size_t t = 0; t < num_threads; t++) pthread_join(threads[t], NULL);
+
+  printf("%-26s %12s %12s %12s %14s\n", "operation", "callbacks",
+         "ns/callback", "bytes/event", "Mevents/s/thr");
+
+  for (size_t op = 0; op < AM_BENCH_NUM_OPS; op++) {
+    struct am_bench_result sum = {0, 0, 0, 0};
+
+    if (!am_bench_callbacks[am_bench_ops[op].required]) {
+      printf("%-26s %12s\n", am_bench_ops[op].name, "not registered");
+      continue;
+    }
+
+    for (size_t t = 0; t < num_threads; t++) {
+      struct am_bench_result* r = &am_bench_results[t * AM_BENCH_NUM_OPS + op];
+
+      sum.ns += r->ns;
+      sum.callbacks += r->callbacks;
+      sum.events += r->events;
+      sum.bytes += r->bytes;
+    }
+
+    printf("%-26s %12lu %12.1f %12.1f %14.2f\n", am_bench_ops[op].name,
+           sum.callbacks, (double)sum.ns / sum.callbacks,
+           (double)sum.bytes / sum.events, 1e3 * sum.events / sum.ns);
+  }
+
+  for (size_t t = 0; t < num_threads; t++)
+    total_bytes += am_bench_thread_bytes[t];
+
+  tool->finalize(&tool_data);
+
+  if (am_ompt_dropped_event_count()) {
+    fprintf(stderr, "%lu events were dropped.\n",
+            am_ompt_dropped_event_count());
+    ret = 1;
+  }
+
+  /* The dump has to contain at least the events of all benchmark threads */
+  if (stat(trace_file, &st) || (uint64_t)st.st_size < total_bytes) {
+    fprintf(stderr, "Trace \"%s\" is missing events: %lu bytes expected.\n",
+            trace_file, total_bytes);
+    ret = 1;
+  } else if (am_bench_check_trace(trace_file, num_threads)) {
+    fprintf(stderr, "Trace \"%s\" does not match the scripted events.\n",
+            trace_file);
+    ret = 1;
+  }
+
+  pthread_barrier_destroy(&am_bench_barrier);
+  free(am_bench_thread_bytes);
+  free(am_bench_results);
+  free(threads);
+
+  return ret;
+}
@@ -0,0 +1,920 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+  Predicts the makespan of the traced loops under other schedule clauses and
+  recommends the clause with the lowest prediction for each of the loops
+  that took the most time.
+
+  The chunk events of each thread give the time each chunk took, from its
+  start to the start of the next chunk or the end of the loop on that
+  thread, and the iterations it covered (bounds are inclusive). Spreading
+  the time of each chunk evenly over its iterations yields a cost profile
+  over the iteration space of the loop instance; iterations without a chunk
+  get the average cost. The loops of the threads of a team are matched to
+  one instance by their code location, their bounds and overlapping times.
+
+  Each instance is then replayed with schedule(static), schedule(static, c),
+  schedule(dynamic, c) and schedule(guided, c) for chunk sizes c in powers of
+  two, on each number of threads. Dynamic and guided schedules pay the
+  dispatch overhead for every chunk, static ones do not. Guided chunks are
+  the remaining iterations divided by the number of threads, but at least c.
+  Predictions are averaged over up to AM_OMPT_LOOPSCHED_MAX_INSTANCES
+  instances of each loop, spread over the run.
+
+  Usage: afterompt-loopsched <trace> [threads,...] [dispatch overhead]
+                             [loops]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reader.h"
+
+/* Maximal number of instances of a loop that are simulated */
+#define AM_OMPT_LOOPSCHED_MAX_INSTANCES 16
+
+/* Chunk sizes leading to more chunks are not simulated */
+#define AM_OMPT_LOOPSCHED_MAX_CHUNKS (1 << 20)
+
+/* Maximal number of thread counts */
+#define AM_OMPT_LOOPSCHED_MAX_SWEEP 64
+
+/* Default dispatch overhead in timestamp units, about the cost of an atomic
+   operation on a contended cache line */
+#define AM_OMPT_LOOPSCHED_DEFAULT_OVERHEAD 500
+
+#define AM_OMPT_LOOPSCHED_DEFAULT_LOOPS 10
+
+enum am_ompt_loopsched_kind {
+  AM_OMPT_LOOPSCHED_STATIC = 0,
+  AM_OMPT_LOOPSCHED_DYNAMIC,
+  AM_OMPT_LOOPSCHED_GUIDED,
+  AM_OMPT_LOOPSCHED_NUM_KINDS
+};
+
+static const char* am_ompt_loopsched_kind_names[AM_OMPT_LOOPSCHED_NUM_KINDS] =
+    {"static", "dynamic", "guided"};
+
+/* Chunk started by a thread */
+struct am_ompt_loopsched_chunk {
+  uint64_t time;
+  int64_t lower;
+  int64_t upper;
+};
+
+/* Time spent on a range of iterations, from first to end (exclusive) */
+struct am_ompt_loopsched_segment {
+  uint64_t first;
+  uint64_t end;
+  uint64_t cost;
+};
+
+/* Part of a loop instance executed by one thread */
+struct am_ompt_loopsched_part {
+  uint64_t codeptr_ra;
+  int64_t lower;
+  int64_t upper;
+  int64_t increment;
+  uint64_t start;
+  uint64_t end;
+  size_t first_segment;
+  size_t num_segments;
+};
+
+/* Loop instance executed by a team of threads */
+struct am_ompt_loopsched_instance {
+  /* Parts of the instance in the sorted parts */
+  size_t first_part;
+  size_t num_parts;
+  uint64_t iterations;
+  uint64_t makespan;
+};
+
+/* Instances of the loop at one code location */
+struct am_ompt_loopsched_loop {
+  uint64_t codeptr_ra;
+  size_t first_instance;
+  size_t num_instances;
+  uint64_t total;
+  /* Largest number of threads that executed an instance */
+  uint32_t threads;
+};
+
+/* Cost profile of an instance: iterations from bounds[i] to bounds[i + 1]
+   cost rates[i] each and prefix[i] is the cost of the iterations before
+   bounds[i] */
+struct am_ompt_loopsched_profile {
+  uint64_t* bounds;
+  double* rates;
+  double* prefix;
+  size_t num;
+  size_t max;
+};
+
+/* Schedule clause and its predicted makespan */
+struct am_ompt_loopsched_result {
+  enum am_ompt_loopsched_kind kind;
+  /* Zero for schedule(static) without chunk size */
+  uint64_t chunk;
+  double makespan;
+};
+
+/* Chunks of a loop that is running on a thread */
+struct am_ompt_loopsched_open {
+  uint64_t instance_id;
+  struct am_ompt_loopsched_chunk* chunks;
+  size_t num;
+  size_t max;
+};
+
+static struct am_ompt_reader am_ompt_loopsched_reader;
+
+static uint64_t am_ompt_loopsched_overhead =
+    AM_OMPT_LOOPSCHED_DEFAULT_OVERHEAD;
+
+static struct am_ompt_loopsched_part* am_ompt_loopsched_parts;
+static size_t am_ompt_loopsched_num_parts;
+static size_t am_ompt_loopsched_max_parts;
+
+static struct am_ompt_loopsched_segment* am_ompt_loopsched_segments;
+static size_t am_ompt_loopsched_num_segments;
+static size_t am_ompt_loopsched_max_segments;
+
+static struct am_ompt_loopsched_instance* am_ompt_loopsched_instances;
+static size_t am_ompt_loopsched_num_instances;
+
+static struct am_ompt_loopsched_loop* am_ompt_loopsched_loops;
+static size_t am_ompt_loopsched_num_loops;
+
+/* Make room for one more element in a growing array */
+static int am_ompt_loopsched_reserve(void** array, size_t* max, size_t num,
+                                     size_t size) {
+  void* grown;
+  size_t n = *max ? 2 * *max : 64;
+
+  if (num < *max) return 0;
+
+  if (!(grown = realloc(*array, n * size))) return 1;
+
+  *array = grown;
+  *max = n;
+
+  return 0;
+}
+
+static inline uint64_t am_ompt_loopsched_abs(int64_t v) {
+  return v < 0 ? -(uint64_t)v : (uint64_t)v;
+}
+
+/* Number of iterations from lower to upper, both inclusive */
+static inline uint64_t am_ompt_loopsched_count(int64_t lower, int64_t upper,
+                                               int64_t increment) {
+  if ((increment >= 0 && upper < lower) || (increment < 0 && upper > lower))
+    return 0;
+
+  return am_ompt_loopsched_abs(upper - lower) /
+             am_ompt_loopsched_abs(increment ? increment : 1) +
+         1;
+}
+
+/*
+  Turn the chunks of a loop on a thread into a part with the time spent on
+  each chunk, which ends where the next one starts or with the loop
+*/
+static int am_ompt_loopsched_add_part(struct am_ompt_loopsched_open* o,
+                                      const struct am_ompt_event* e) {
+  struct am_ompt_loopsched_part* p;
+  struct am_ompt_loopsched_segment* s;
+  int64_t inc = e->loop.increment ? e->loop.increment : 1;
+  uint64_t end, first;
+
+  if (!o->num) return 0;
+
+  if (am_ompt_loopsched_reserve((void**)&am_ompt_loopsched_parts,
+                                &am_ompt_loopsched_max_parts,
+                                am_ompt_loopsched_num_parts,
+                                sizeof(*am_ompt_loopsched_parts)))
+    return 1;
+
+  p = &am_ompt_loopsched_parts[am_ompt_loopsched_num_parts++];
+  p->codeptr_ra = e->loop.codeptr_ra;
+  p->lower = e->loop.lower_bound;
+  p->upper = e->loop.upper_bound;
+  p->increment = inc;
+  p->start = e->start;
+  p->end = e->end;
+  p->first_segment = am_ompt_loopsched_num_segments;
+  p->num_segments = 0;
+
+  for (size_t i = 0; i < o->num; i++) {
+    end = i + 1 < o->num ? o->chunks[i + 1].time : e->end;
+
+    /* Chunks outside of the bounds of the loop are left out */
+    if (!am_ompt_loopsched_count(p->lower, o->chunks[i].lower, inc) ||
+        !am_ompt_loopsched_count(o->chunks[i].lower, o->chunks[i].upper,
+                                 inc) ||
+        !am_ompt_loopsched_count(o->chunks[i].upper, p->upper, inc))
+      continue;
+
+    if (am_ompt_loopsched_reserve((void**)&am_ompt_loopsched_segments,
+                                  &am_ompt_loopsched_max_segments,
+                                  am_ompt_loopsched_num_segments,
+                                  sizeof(*am_ompt_loopsched_segments)))
+      return 1;
+
+    first = am_ompt_loopsched_count(p->lower, o->chunks[i].lower, inc) - 1;
+
+    s = &am_ompt_loopsched_segments[am_ompt_loopsched_num_segments++];
+    s->first = first;
+    s->end = first + am_ompt_loopsched_count(o->chunks[i].lower,
+                                             o->chunks[i].upper, inc);
+    s->cost = end > o->chunks[i].time ? end - o->chunks[i].time : 0;
+    p->num_segments++;
+  }
+
+  return 0;
+}
+
+/* Collect the parts of the loops executed by a collection */
+static int am_ompt_loopsched_collect(size_t c) {
+  struct am_ompt_reader_collection* rc =
+      &am_ompt_loopsched_reader.collections[c];
+  struct am_ompt_loopsched_open* open = NULL;
+  struct am_ompt_loopsched_open* o;
+  size_t num_open = 0, max_open = 0, l;
+  struct am_ompt_event e;
+  int ret = 1;
+
+  for (size_t i = 0; i < rc->num_ranges; i++) {
+    size_t off = rc->ranges[i].start;
+
+    while (am_ompt_reader_next(&am_ompt_loopsched_reader, &off,
+                               rc->ranges[i].end, &e)) {
+      if (e.type == AM_OMPT_EVENT_LOOP_CHUNK) {
+        /* Markers closing loops carry no iterations */
+        if (e.loop_chunk.is_last) continue;
+
+        for (l = 0; l < num_open; l++) {
+          if (open[l].instance_id == e.loop_chunk.instance_id) break;
+        }
+
+        if (l == num_open) {
+          if (am_ompt_loopsched_reserve((void**)&open, &max_open, num_open,
+                                        sizeof(*open)))
+            goto out;
+
+          memset(&open[num_open], 0, sizeof(*open));
+          open[num_open++].instance_id = e.loop_chunk.instance_id;
+        }
+
+        o = &open[l];
+
+        if (am_ompt_loopsched_reserve((void**)&o->chunks, &o->max, o->num,
+                                      sizeof(*o->chunks)))
+          goto out;
+
+        o->chunks[o->num].time = e.start;
+        o->chunks[o->num].lower = e.loop_chunk.lower_bound;
+        o->chunks[o->num].upper = e.loop_chunk.upper_bound;
+        o->num++;
+      } else if (e.type == AM_OMPT_EVENT_LOOP) {
+        for (l = 0; l < num_open; l++) {
+          if (open[l].instance_id == e.loop.instance_id) break;
+        }
+
+        if (l == num_open) continue;
+
+        if (am_ompt_loopsched_add_part(&open[l], &e)) goto out;
+
+        free(open[l].chunks);
+        open[l] = open[--num_open];
+      }
+    }
+  }
+
+  ret = 0;
+
+out:
+  for (l = 0; l < num_open; l++) free(open[l].chunks);
+
+  free(open);
+
+  return ret;
+}
+
+static int am_ompt_loopsched_cmp_part(const void* a, const void* b) {
+  const struct am_ompt_loopsched_part* pa = a;
+  const struct am_ompt_loopsched_part* pb = b;
+
+  if (pa->codeptr_ra != pb->codeptr_ra)
+    return pa->codeptr_ra < pb->codeptr_ra ? -1 : 1;
+
+  if (pa->lower != pb->lower) return pa->lower < pb->lower ? -1 : 1;
+
+  if (pa->upper != pb->upper) return pa->upper < pb->upper ? -1 : 1;
+
+  if (pa->increment != pb->increment)
+    return pa->increment < pb->increment ? -1 : 1;
+
+  return (pa->start > pb->start) - (pa->start < pb->start);
+}
+
+static int am_ompt_loopsched_cmp_loop(const void* a, const void* b) {
+  const struct am_ompt_loopsched_loop* la = a;
+  const struct am_ompt_loopsched_loop* lb = b;
+
+  return (la->total < lb->total) - (la->total > lb->total);
+}
+
+/*
+  Group the parts of the threads into instances, which overlap in time and
+  have the same code location and bounds, and the instances into loops
+*/
+static int am_ompt_loopsched_group() {
+  struct am_ompt_loopsched_part *p, *q;
+  struct am_ompt_loopsched_instance* in;
+  struct am_ompt_loopsched_loop* loop;
+  size_t n = am_ompt_loopsched_num_parts;
+  uint64_t start, end;
+
+  qsort(am_ompt_loopsched_parts, n, sizeof(*am_ompt_loopsched_parts),
+        am_ompt_loopsched_cmp_part);
+
+  /* At most one instance and loop per part */
+  am_ompt_loopsched_instances =
+      malloc((n ? n : 1) * sizeof(*am_ompt_loopsched_instances));
+  am_ompt_loopsched_loops =
+      malloc((n ? n : 1) * sizeof(*am_ompt_loopsched_loops));
+
+  if (!am_ompt_loopsched_instances || !am_ompt_loopsched_loops) return 1;
+
+  for (size_t i = 0; i < n;) {
+    p = &am_ompt_loopsched_parts[i];
+    in = &am_ompt_loopsched_instances[am_ompt_loopsched_num_instances++];
+    in->first_part = i;
+    in->iterations = am_ompt_loopsched_count(p->lower, p->upper, p->increment);
+    start = p->start;
+    end = p->end;
+
+    for (i++; i < n; i++) {
+      q = &am_ompt_loopsched_parts[i];
+
+      if (q->codeptr_ra != p->codeptr_ra || q->lower != p->lower ||
+          q->upper != p->upper || q->increment != p->increment ||
+          q->start >= end)
+        break;
+
+      if (q->end > end) end = q->end;
+    }
+
+    in->num_parts = i - in->first_part;
+    in->makespan = end - start;
+
+    if (!am_ompt_loopsched_num_loops ||
+        am_ompt_loopsched_loops[am_ompt_loopsched_num_loops - 1].codeptr_ra !=
+            p->codeptr_ra) {
+      loop = &am_ompt_loopsched_loops[am_ompt_loopsched_num_loops++];
+      loop->codeptr_ra = p->codeptr_ra;
+      loop->first_instance = am_ompt_loopsched_num_instances - 1;
+      loop->num_instances = 0;
+      loop->total = 0;
+      loop->threads = 0;
+    }
+
+    loop = &am_ompt_loopsched_loops[am_ompt_loopsched_num_loops - 1];
+    loop->num_instances++;
+    loop->total += in->makespan;
+
+    if (in->num_parts > loop->threads) loop->threads = in->num_parts;
+  }
+
+  return 0;
+}
+
+static int am_ompt_loopsched_cmp_segment(const void* a, const void* b) {
+  const struct am_ompt_loopsched_segment* sa = a;
+  const struct am_ompt_loopsched_segment* sb = b;
+
+  return (sa->first > sb->first) - (sa->first < sb->first);
+}
+
+static int am_ompt_loopsched_profile_add(struct am_ompt_loopsched_profile* pr,
+                                         uint64_t bound, double rate) {
+  size_t n = pr->max ? 2 * pr->max : 64;
+  uint64_t* bounds;
+  double *rates, *prefix;
+
+  if (pr->num + 1 >= pr->max) {
+    if (!(bounds = realloc(pr->bounds, n * sizeof(*bounds)))) return 1;
+
+    pr->bounds = bounds;
+
+    if (!(rates = realloc(pr->rates, n * sizeof(*rates)))) return 1;
+
+    pr->rates = rates;
+
+    if (!(prefix = realloc(pr->prefix, n * sizeof(*prefix)))) return 1;
+
+    pr->prefix = prefix;
+    pr->max = n;
+  }
+
+  pr->bounds[pr->num] = bound;
+  pr->rates[pr->num] = rate;
+  pr->prefix[pr->num] =
+      pr->num ? pr->prefix[pr->num - 1] +
+                    (bound - pr->bounds[pr->num - 1]) * pr->rates[pr->num - 1]
+              : 0;
+  pr->num++;
+
+  return 0;
+}
+
+/*
+  Build the cost profile of an instance from the segments of its parts.
+  Returns -1 if the instance has no timed iterations.
+*/
+static int am_ompt_loopsched_profile_build(
+    struct am_ompt_loopsched_profile* pr,
+    const struct am_ompt_loopsched_instance* in) {
+  struct am_ompt_loopsched_segment* segs = NULL;
+  struct am_ompt_loopsched_part* p;
+  size_t n = 0, k = 0;
+  uint64_t covered = 0, cost = 0, pos = 0, first;
+  double average;
+  int ret = 1;
+
+  pr->num = 0;
+
+  for (size_t i = 0; i < in->num_parts; i++)
+    n += am_ompt_loopsched_parts[in->first_part + i].num_segments;
+
+  if (!n || !in->iterations) return -1;
+
+  if (!(segs = malloc(n * sizeof(*segs)))) return 1;
+
+  for (size_t i = 0; i < in->num_parts; i++) {
+    p = &am_ompt_loopsched_parts[in->first_part + i];
+    memcpy(&segs[k], &am_ompt_loopsched_segments[p->first_segment],
+           p->num_segments * sizeof(*segs));
+    k += p->num_segments;
+  }
+
+  qsort(segs, n, sizeof(*segs), am_ompt_loopsched_cmp_segment);
+
+  for (size_t i = 0; i < n; i++) {
+    covered += segs[i].end - segs[i].first;
+    cost += segs[i].cost;
+  }
+
+  average = (double)cost / covered;
+
+  /* Iterations covered twice keep the first chunk, iterations not covered
+     get the average cost */
+  for (size_t i = 0; i < n && pos < in->iterations; i++) {
+    if (segs[i].end <= pos) continue;
+
+    first = segs[i].first > pos ? segs[i].first : pos;
+
+    if (first > pos && am_ompt_loopsched_profile_add(pr, pos, average))
+      goto out;
+
+    if (am_ompt_loopsched_profile_add(
+            pr, first,
+            (double)segs[i].cost / (segs[i].end - segs[i].first)))
+      goto out;
+
+    pos = segs[i].end < in->iterations ? segs[i].end : in->iterations;
+  }
+
+  if (pos < in->iterations && am_ompt_loopsched_profile_add(pr, pos, average))
+    goto out;
+
+  if (am_ompt_loopsched_profile_add(pr, in->iterations, 0)) goto out;
+
+  ret = 0;
+
+out:
+  free(segs);
+
+  return ret;
+}
+
+/* Cost of the iterations before i */
+static double am_ompt_loopsched_prefix(
+    const struct am_ompt_loopsched_profile* pr, uint64_t i) {
+  size_t lo = 0, hi = pr->num - 1, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi + 1) / 2;
+
+    if (pr->bounds[mid] <= i)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+
+  return pr->prefix[lo] + (i - pr->bounds[lo]) * pr->rates[lo];
+}
+
+/* Cost of the iterations from first to end (exclusive) */
+static inline double am_ompt_loopsched_cost(
+    const struct am_ompt_loopsched_profile* pr, uint64_t first, uint64_t end) {
+  return am_ompt_loopsched_prefix(pr, end) -
+         am_ompt_loopsched_prefix(pr, first);
+}
+
+/* Take the earliest free time from a binary min-heap */
+static double am_ompt_loopsched_heap_pop(double* heap, size_t n) {
+  double top = heap[0], v = heap[n - 1];
+  size_t i = 0, c;
+
+  n--;
+
+  while ((c = 2 * i + 1) < n) {
+    if (c + 1 < n && heap[c + 1] < heap[c]) c++;
+
+    if (heap[c] >= v) break;
+
+    heap[i] = heap[c];
+    i = c;
+  }
+
+  heap[i] = v;
+
+  return top;
+}
+
+static void am_ompt_loopsched_heap_push(double* heap, size_t n, double v) {
+  size_t i = n, p;
+
+  while (i && heap[p = (i - 1) / 2] > v) {
+    heap[i] = heap[p];
+    i = p;
+  }
+
+  heap[i] = v;
+}
+
+/* Predicted makespan of a schedule on a number of threads, heap and busy
+   hold one entry per thread */
+static double am_ompt_loopsched_simulate(
+    const struct am_ompt_loopsched_profile* pr, uint64_t n,
+    enum am_ompt_loopsched_kind kind, uint64_t chunk, uint32_t threads,
+    double* heap, double* busy) {
+  double makespan = 0, t;
+  uint64_t first = 0, size;
+
+  if (kind == AM_OMPT_LOOPSCHED_STATIC) {
+    if (!chunk) {
+      /* One block per thread, the first n % threads get one more */
+      for (uint32_t i = 0; i < threads; i++) {
+        size = n / threads + (i < n % threads);
+        t = am_ompt_loopsched_cost(pr, first, first + size);
+        first += size;
+
+        if (t > makespan) makespan = t;
+      }
+
+      return makespan;
+    }
+
+    for (uint32_t i = 0; i < threads; i++) busy[i] = 0;
+
+    for (uint64_t c = 0; first < n; c++, first += size) {
+      size = n - first < chunk ? n - first : chunk;
+      busy[c % threads] += am_ompt_loopsched_cost(pr, first, first + size);
+    }
+
+    for (uint32_t i = 0; i < threads; i++) {
+      if (busy[i] > makespan) makespan = busy[i];
+    }
+
+    return makespan;
+  }
+
+  for (uint32_t i = 0; i < threads; i++) heap[i] = 0;
+
+  while (first < n) {
+    size = chunk;
+
+    if (kind == AM_OMPT_LOOPSCHED_GUIDED &&
+        (n - first + threads - 1) / threads > size)
+      size = (n - first + threads - 1) / threads;
+
+    if (size > n - first) size = n - first;
+
+    t = am_ompt_loopsched_heap_pop(heap, threads) +
+        am_ompt_loopsched_overhead +
+        am_ompt_loopsched_cost(pr, first, first + size);
+    am_ompt_loopsched_heap_push(heap, threads - 1, t);
+    first += size;
+
+    if (t > makespan) makespan = t;
+  }
+
+  return makespan;
+}
+
+/* Number of chunk sizes simulated for n iterations on a number of threads:
+   powers of two up to an even share of the iterations */
+static size_t am_ompt_loopsched_num_chunks(uint64_t n, uint32_t threads) {
+  uint64_t share = (n + threads - 1) / threads;
+  size_t k = 0;
+
+  for (uint64_t c = 1; c <= share; c *= 2) k++;
+
+  return k;
+}
+
+/*
+  Simulate the sampled instances of a loop on a number of threads and print
+  the predictions for schedule(static) and the best clause
+*/
+static int am_ompt_loopsched_predict(
+    const size_t* sample, size_t num_sample,
+    struct am_ompt_loopsched_profile* profiles, uint32_t threads) {
+  struct am_ompt_loopsched_result* results = NULL;
+  struct am_ompt_loopsched_result *best, *baseline;
+  const struct am_ompt_loopsched_instance* in;
+  size_t num_results = 0, max_results = 0, k;
+  double *heap = NULL, *busy = NULL, recorded = 0;
+  uint64_t chunk, n;
+  size_t num_recorded = 0;
+  char clause[64];
+  int ret = 1;
+
+  if (!(heap = malloc(threads * sizeof(*heap))) ||
+      !(busy = malloc(threads * sizeof(*busy))))
+    goto out;
+
+  for (size_t s = 0; s < num_sample; s++) {
+    in = &am_ompt_loopsched_instances[sample[s]];
+    n = in->iterations;
+
+    if (in->num_parts == threads) {
+      recorded += in->makespan;
+      num_recorded++;
+    }
+
+    /* Results are accumulated for the chunk sizes of the first instance,
+       which match those of the others unless the bounds change */
+    if (!s) {
+      k = am_ompt_loopsched_num_chunks(n, threads);
+      max_results = 1 + AM_OMPT_LOOPSCHED_NUM_KINDS * k;
+
+      if (!(results = calloc(max_results, sizeof(*results)))) goto out;
+
+      results[num_results++].kind = AM_OMPT_LOOPSCHED_STATIC;
+
+      for (int kind = 0; kind < AM_OMPT_LOOPSCHED_NUM_KINDS; kind++) {
+        chunk = 1;
+
+        for (size_t i = 0; i < k; i++, chunk *= 2) {
+          if ((n + chunk - 1) / chunk > AM_OMPT_LOOPSCHED_MAX_CHUNKS) continue;
+
+          results[num_results].kind = kind;
+          results[num_results++].chunk = chunk;
+        }
+      }
+    }
+
+    for (size_t i = 0; i < num_results; i++) {
+      results[i].makespan += am_ompt_loopsched_simulate(
+          &profiles[s], n, results[i].kind, results[i].chunk, threads, heap,
+          busy);
+    }
+  }
+
+  baseline = best = &results[0];
+
+  for (size_t i = 1; i < num_results; i++) {
+    if (results[i].makespan < best->makespan) best = &results[i];
+  }
+
+  if (best->chunk)
+    snprintf(clause, sizeof(clause), "schedule(%s, %lu)",
+             am_ompt_loopsched_kind_names[best->kind], best->chunk);
+  else
+    snprintf(clause, sizeof(clause), "schedule(%s)",
+             am_ompt_loopsched_kind_names[best->kind]);
+
+  if (num_recorded)
+    printf("  %8u %14.0f", threads, recorded / num_recorded);
+  else
+    printf("  %8u %14s", threads, "-");
+
+  printf(" %14.0f  %-26s %14.0f %6.1f%%\n", baseline->makespan / num_sample,
+         clause, best->makespan / num_sample,
+         baseline->makespan
+             ? 100.0 * (baseline->makespan - best->makespan) /
+                   baseline->makespan
+             : 0.0);
+
+  ret = 0;
+
+out:
+  free(results);
+  free(busy);
+  free(heap);
+
+  return ret;
+}
+
+/* Default sweep: powers of two up to twice the recorded number of threads,
+   including the recorded number itself */
+static size_t am_ompt_loopsched_default_sweep(uint32_t threads,
+                                              uint32_t* sweep) {
+  size_t n = 0;
+
+  if (!threads) threads = 1;
+
+  for (uint32_t p = 1; p < 2 * threads && n < AM_OMPT_LOOPSCHED_MAX_SWEEP - 2;
+       p *= 2) {
+    if (p > threads && sweep[n - 1] < threads) sweep[n++] = threads;
+
+    sweep[n++] = p;
+  }
+
+  if (sweep[n - 1] < threads) sweep[n++] = threads;
+
+  sweep[n++] = 2 * threads;
+
+  return n;
+}
+
+/* Print the predictions for one loop */
+static int am_ompt_loopsched_report(const struct am_ompt_loopsched_loop* loop,
+                                    const uint32_t* sweep, size_t num_sweep) {
+  struct am_ompt_loopsched_profile profiles[AM_OMPT_LOOPSCHED_MAX_INSTANCES];
+  size_t sample[AM_OMPT_LOOPSCHED_MAX_INSTANCES];
+  size_t num_sample = 0, num_profiles = 0, idx;
+  size_t step = loop->num_instances / AM_OMPT_LOOPSCHED_MAX_INSTANCES + 1;
+  uint64_t iterations = 0;
+  int ret = 1, err;
+
+  memset(profiles, 0, sizeof(profiles));
+
+  for (size_t i = 0; i < loop->num_instances &&
+                     num_sample < AM_OMPT_LOOPSCHED_MAX_INSTANCES;
+       i += step) {
+    idx = loop->first_instance + i;
+    err = am_ompt_loopsched_profile_build(&profiles[num_profiles],
+                                          &am_ompt_loopsched_instances[idx]);
+
+    if (err > 0) goto out;
+
+    /* Keep the allocations of profiles that could not be built */
+    if (err) continue;
+
+    sample[num_sample++] = idx;
+    iterations += am_ompt_loopsched_instances[idx].iterations;
+    num_profiles++;
+  }
+
+  printf("Loop %#lx: %zu instances, total time %lu on up to %u threads\n",
+         loop->codeptr_ra, loop->num_instances, loop->total, loop->threads);
+
+  if (!num_sample) {
+    printf("  No chunks recorded\n\n");
+    ret = 0;
+    goto out;
+  }
+
+  printf("  %lu iterations per instance, %zu instances simulated\n",
+         iterations / num_sample, num_sample);
+  printf("  %8s %14s %14s  %-26s %14s %7s\n", "threads", "recorded",
+         "static", "best clause", "predicted", "gain");
+
+  for (size_t i = 0; i < num_sweep; i++) {
+    if (am_ompt_loopsched_predict(sample, num_sample, profiles, sweep[i]))
+      goto out;
+  }
+
+  printf("\n");
+  ret = 0;
+
+out:
+  for (size_t i = 0; i <= num_profiles && i < AM_OMPT_LOOPSCHED_MAX_INSTANCES;
+       i++) {
+    free(profiles[i].bounds);
+    free(profiles[i].rates);
+    free(profiles[i].prefix);
+  }
+
+  return ret;
+}
+
+int main(int argc, char** argv) {
+  uint32_t sweep[AM_OMPT_LOOPSCHED_MAX_SWEEP];
+  size_t num_sweep = 0, num_loops = AM_OMPT_LOOPSCHED_DEFAULT_LOOPS;
+  uint32_t threads = 0;
+  int ret = 2, len;
+  char* arg;
+
+  if (argc < 2) {
+    fprintf(stderr,
+            "Usage: %s <trace> [threads,...] [dispatch overhead] [loops]\n",
+            argv[0]);
+    return 2;
+  }
+
+  if (argc > 2) {
+    for (arg = argv[2]; *arg && num_sweep < AM_OMPT_LOOPSCHED_MAX_SWEEP;
+         arg += len) {
+      if (sscanf(arg, "%u%n", &sweep[num_sweep], &len) != 1 ||
+          !sweep[num_sweep]) {
+        fprintf(stderr, "Invalid number of threads \"%s\".\n", argv[2]);
+        return 2;
+      }
+
+      num_sweep++;
+
+      if (arg[len] == ',') len++;
+    }
+  }
+
+  if (argc > 3 && sscanf(argv[3], "%lu", &am_ompt_loopsched_overhead) != 1) {
+    fprintf(stderr, "Invalid dispatch overhead \"%s\".\n", argv[3]);
+    return 2;
+  }
+
+  if (argc > 4 && sscanf(argv[4], "%zu", &num_loops) != 1) {
+    fprintf(stderr, "Invalid number of loops \"%s\".\n", argv[4]);
+    return 2;
+  }
+
+  if (am_ompt_reader_open(&am_ompt_loopsched_reader, argv[1])) return 2;
+
+  if (am_ompt_loopsched_reader.error_offset) {
+    fprintf(stderr, "Trace is malformed at offset %zu: %s\n",
+            am_ompt_loopsched_reader.error_offset,
+            am_ompt_loopsched_reader.error);
+    fprintf(stderr, "Analyzing the loops before the error.\n");
+  }
+
+  ret = 1;
+
+  for (size_t c = 0; c < am_ompt_loopsched_reader.num_collections; c++) {
+    if (am_ompt_loopsched_collect(c)) goto out_err_mem;
+  }
+
+  if (am_ompt_loopsched_group()) goto out_err_mem;
+
+  qsort(am_ompt_loopsched_loops, am_ompt_loopsched_num_loops,
+        sizeof(*am_ompt_loopsched_loops), am_ompt_loopsched_cmp_loop);
+
+  for (size_t l = 0; l < am_ompt_loopsched_num_loops; l++) {
+    if (am_ompt_loopsched_loops[l].threads > threads)
+      threads = am_ompt_loopsched_loops[l].threads;
+  }
+
+  if (!num_sweep)
+    num_sweep = am_ompt_loopsched_default_sweep(threads, sweep);
+
+  if (!am_ompt_loopsched_num_loops) {
+    printf("No loop chunks recorded\n");
+    ret = 0;
+    goto out;
+  }
+
+  printf("%zu loops with chunks, dispatch overhead %lu\n\n",
+         am_ompt_loopsched_num_loops, am_ompt_loopsched_overhead);
+
+  for (size_t l = 0; l < am_ompt_loopsched_num_loops && l < num_loops; l++) {
+    if (am_ompt_loopsched_report(&am_ompt_loopsched_loops[l], sweep,
+                                 num_sweep))
+      goto out_err_mem;
+  }
+
+  ret = 0;
+  goto out;
+
+out_err_mem:
+  fprintf(stderr, "Could not allocate memory.\n");
+out:
+  free(am_ompt_loopsched_loops);
+  free(am_ompt_loopsched_instances);
+  free(am_ompt_loopsched_segments);
+  free(am_ompt_loopsched_parts);
+  am_ompt_reader_close(&am_ompt_loopsched_reader);
+
+  return ret;
+}
@@ -0,0 +1,916 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+  Converts an Afterompt trace to the protobuf trace format of Perfetto, which
+  can be opened in ui.perfetto.dev and chrome://tracing.
+
+  Each event collection becomes a thread track. Interval events become
+  slices, point events instants and core migrations a counter track of the
+  thread. Explicit tasks are shown as slices from the schedule that starts
+  them to the one that completes them, connected by flows to their creation
+  and to the tasks they depend on. Event names are interned, so each packet
+  only carries small ids.
+
+  The collections are merged by time, or read in the order of the time index
+  if the trace has one, and streamed to the output with memory that does not
+  depend on the number of events. Only the dependences that
+  are waiting for their source task to complete are kept, in a table of fixed
+  size.
+
+  Usage: afterompt-perfetto <trace> <output> [timestamp units per ns]
+                            [max pending dependences]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reader.h"
+#include "table.h"
+
+/* Maximal size of an encoded message */
+#define AM_OMPT_PB_MAX_SIZE 8192
+
+/* Maximal number of flows attached to a single event */
+#define AM_OMPT_PERFETTO_MAX_FLOWS 64
+
+/* Maximal number of nested tasks tracked per thread */
+#define AM_OMPT_PERFETTO_MAX_TASK_DEPTH 64
+
+#define AM_OMPT_PERFETTO_DEFAULT_MAX_DEPENDENCES (1 << 16)
+
+/* Field numbers of the Perfetto trace protos */
+enum am_ompt_pb_field {
+  AM_OMPT_PB_TRACE_PACKET = 1,
+  AM_OMPT_PB_PACKET_TIMESTAMP = 8,
+  AM_OMPT_PB_PACKET_SEQUENCE_ID = 10,
+  AM_OMPT_PB_PACKET_TRACK_EVENT = 11,
+  AM_OMPT_PB_PACKET_INTERNED_DATA = 12,
+  AM_OMPT_PB_PACKET_SEQUENCE_FLAGS = 13,
+  AM_OMPT_PB_PACKET_TRACK_DESCRIPTOR = 60,
+  AM_OMPT_PB_EVENT_DEBUG_ANNOTATIONS = 4,
+  AM_OMPT_PB_EVENT_TYPE = 9,
+  AM_OMPT_PB_EVENT_NAME_IID = 10,
+  AM_OMPT_PB_EVENT_TRACK_UUID = 11,
+  AM_OMPT_PB_EVENT_COUNTER_VALUE = 30,
+  AM_OMPT_PB_EVENT_FLOW_IDS = 47,
+  AM_OMPT_PB_EVENT_TERMINATING_FLOW_IDS = 48,
+  AM_OMPT_PB_INTERNED_EVENT_NAMES = 2,
+  AM_OMPT_PB_INTERNED_ANNOTATION_NAMES = 3,
+  AM_OMPT_PB_INTERNED_IID = 1,
+  AM_OMPT_PB_INTERNED_NAME = 2,
+  AM_OMPT_PB_ANNOTATION_NAME_IID = 1,
+  AM_OMPT_PB_ANNOTATION_UINT_VALUE = 3,
+  AM_OMPT_PB_ANNOTATION_INT_VALUE = 4,
+  AM_OMPT_PB_TRACK_UUID = 1,
+  AM_OMPT_PB_TRACK_NAME = 2,
+  AM_OMPT_PB_TRACK_PROCESS = 3,
+  AM_OMPT_PB_TRACK_THREAD = 4,
+  AM_OMPT_PB_TRACK_PARENT_UUID = 5,
+  AM_OMPT_PB_TRACK_COUNTER = 8,
+  AM_OMPT_PB_PROCESS_PID = 1,
+  AM_OMPT_PB_PROCESS_NAME = 6,
+  AM_OMPT_PB_THREAD_PID = 1,
+  AM_OMPT_PB_THREAD_TID = 2,
+  AM_OMPT_PB_THREAD_NAME = 5
+};
+
+enum am_ompt_pb_event_type {
+  AM_OMPT_PB_SLICE_BEGIN = 1,
+  AM_OMPT_PB_SLICE_END = 2,
+  AM_OMPT_PB_INSTANT = 3,
+  AM_OMPT_PB_COUNTER = 4
+};
+
+#define AM_OMPT_PB_SEQ_INCREMENTAL_STATE_CLEARED 1
+#define AM_OMPT_PB_SEQ_NEEDS_INCREMENTAL_STATE 2
+
+/* All packets are written as a single sequence sharing the interned names */
+#define AM_OMPT_PERFETTO_SEQUENCE_ID 1
+#define AM_OMPT_PERFETTO_PID 1
+#define AM_OMPT_PERFETTO_PROCESS_UUID 1
+
+/* Values of ompt_task_status_t */
+#define AM_OMPT_TASK_COMPLETE 1
+#define AM_OMPT_TASK_CANCEL 3
+#define AM_OMPT_TASK_DETACH 4
+#define AM_OMPT_TASK_LATE_FULFILL 6
+
+/* Names of ompt_sync_region_t and ompt_work_t, indexed by their values */
+static const char* am_ompt_perfetto_sync_names[] = {
+    NULL,         "barrier",   "barrier_implicit", "barrier_explicit",
+    "barrier_implementation",  "taskwait",         "taskgroup",
+    "reduction",  "barrier_implicit_workshare",    "barrier_implicit_parallel",
+    "barrier_teams"};
+
+static const char* am_ompt_perfetto_work_names[] = {
+    NULL,        "loop",      "sections",   "single_executor", "single_other",
+    "workshare", "distribute", "taskloop", "scope"};
+
+#define AM_OMPT_PERFETTO_NUM_SYNC_NAMES \
+  (sizeof(am_ompt_perfetto_sync_names) / sizeof(am_ompt_perfetto_sync_names[0]))
+#define AM_OMPT_PERFETTO_NUM_WORK_NAMES \
+  (sizeof(am_ompt_perfetto_work_names) / sizeof(am_ompt_perfetto_work_names[0]))
+
+/* Interned event names: the event types including counters, explicit tasks,
+   sync regions and waits by kind and work regions by type */
+#define AM_OMPT_PERFETTO_IID_EVENT(type) (1 + (type))
+#define AM_OMPT_PERFETTO_IID_TASK \
+  AM_OMPT_PERFETTO_IID_EVENT(AM_OMPT_NUM_EVENTS + 1)
+#define AM_OMPT_PERFETTO_IID_SYNC(kind) (AM_OMPT_PERFETTO_IID_TASK + 1 + (kind))
+#define AM_OMPT_PERFETTO_IID_WAIT(kind) \
+  (AM_OMPT_PERFETTO_IID_SYNC(AM_OMPT_PERFETTO_NUM_SYNC_NAMES) + (kind))
+#define AM_OMPT_PERFETTO_IID_WORK(kind) \
+  (AM_OMPT_PERFETTO_IID_WAIT(AM_OMPT_PERFETTO_NUM_SYNC_NAMES) + (kind))
+#define AM_OMPT_PERFETTO_NUM_IIDS \
+  AM_OMPT_PERFETTO_IID_WORK(AM_OMPT_PERFETTO_NUM_WORK_NAMES)
+
+/* Interned names of debug annotations */
+enum am_ompt_perfetto_annotation {
+  AM_OMPT_PERFETTO_ARG_TASK = 1,
+  AM_OMPT_PERFETTO_ARG_COUNT,
+  AM_OMPT_PERFETTO_ARG_LOWER_BOUND,
+  AM_OMPT_PERFETTO_ARG_UPPER_BOUND,
+  AM_OMPT_PERFETTO_ARG_CODEPTR_RA,
+  AM_OMPT_PERFETTO_ARG_WAIT_ID,
+  AM_OMPT_PERFETTO_NUM_ARGS
+};
+
+static const char* am_ompt_perfetto_arg_names[AM_OMPT_PERFETTO_NUM_ARGS] = {
+    NULL,          "task",       "count",  "lower_bound",
+    "upper_bound", "codeptr_ra", "wait_id"};
+
+/* Protobuf message under construction */
+struct am_ompt_pb {
+  uint8_t data[AM_OMPT_PB_MAX_SIZE];
+  size_t len;
+  /* Set if the message did not fit */
+  int overflow;
+};
+
+/* Read position in an event collection and the next event */
+struct am_ompt_perfetto_cursor {
+  struct am_ompt_reader_collection* rc;
+  size_t range;
+  size_t offset;
+  struct am_ompt_event e;
+  uint64_t track;
+  /* Explicit tasks started on the thread, innermost last */
+  uint64_t tasks[AM_OMPT_PERFETTO_MAX_TASK_DEPTH];
+  size_t num_tasks;
+};
+
+/* Dependence that waits for its source to complete (pending) or for its sink
+   to start (released) */
+enum am_ompt_perfetto_dep_state {
+  AM_OMPT_PERFETTO_DEP_EMPTY = 0,
+  AM_OMPT_PERFETTO_DEP_PENDING,
+  AM_OMPT_PERFETTO_DEP_RELEASED
+};
+
+/* Entry of the dependence table, keyed by the source task while pending and
+   by the sink task once released */
+struct am_ompt_perfetto_dep {
+  int state;
+  uint64_t key;
+  uint64_t other;
+};
+
+static struct am_ompt_reader am_ompt_perfetto_reader;
+static FILE* am_ompt_perfetto_out;
+static double am_ompt_perfetto_units_per_ns = 1.0;
+
+static struct am_ompt_perfetto_dep* am_ompt_perfetto_deps;
+static size_t am_ompt_perfetto_max_deps =
+    AM_OMPT_PERFETTO_DEFAULT_MAX_DEPENDENCES;
+static size_t am_ompt_perfetto_num_deps;
+static uint64_t am_ompt_perfetto_dropped_deps;
+
+static void am_ompt_pb_raw(struct am_ompt_pb* pb, uint64_t v) {
+  do {
+    if (pb->len == AM_OMPT_PB_MAX_SIZE) {
+      pb->overflow = 1;
+      return;
+    }
+
+    pb->data[pb->len++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+    v >>= 7;
+  } while (v);
+}
+
+static void am_ompt_pb_varint(struct am_ompt_pb* pb, uint32_t field,
+                              uint64_t v) {
+  am_ompt_pb_raw(pb, (uint64_t)field << 3);
+  am_ompt_pb_raw(pb, v);
+}
+
+static void am_ompt_pb_fixed64(struct am_ompt_pb* pb, uint32_t field,
+                               uint64_t v) {
+  am_ompt_pb_raw(pb, ((uint64_t)field << 3) | 1);
+
+  for (int i = 0; i < 8; i++) {
+    if (pb->len == AM_OMPT_PB_MAX_SIZE) {
+      pb->overflow = 1;
+      return;
+    }
+
+    pb->data[pb->len++] = v >> (8 * i);
+  }
+}
+
+static void am_ompt_pb_bytes(struct am_ompt_pb* pb, uint32_t field,
+                             const void* data, size_t len) {
+  am_ompt_pb_raw(pb, ((uint64_t)field << 3) | 2);
+  am_ompt_pb_raw(pb, len);
+
+  if (AM_OMPT_PB_MAX_SIZE - pb->len < len) {
+    pb->overflow = 1;
+    return;
+  }
+
+  memcpy(&pb->data[pb->len], data, len);
+  pb->len += len;
+}
+
+static void am_ompt_pb_string(struct am_ompt_pb* pb, uint32_t field,
+                              const char* s) {
+  am_ompt_pb_bytes(pb, field, s, strlen(s));
+}
+
+static void am_ompt_pb_message(struct am_ompt_pb* pb, uint32_t field,
+                               const struct am_ompt_pb* m) {
+  pb->overflow |= m->overflow;
+  am_ompt_pb_bytes(pb, field, m->data, m->len);
+}
+
+/* Append a trace packet to the output */
+static int am_ompt_perfetto_packet(const struct am_ompt_pb* packet) {
+  struct am_ompt_pb header = {.len = 0, .overflow = 0};
+
+  if (packet->overflow) {
+    fprintf(stderr, "Packet exceeds %d bytes.\n", AM_OMPT_PB_MAX_SIZE);
+    return 1;
+  }
+
+  am_ompt_pb_raw(&header, (AM_OMPT_PB_TRACE_PACKET << 3) | 2);
+  am_ompt_pb_raw(&header, packet->len);
+
+  return fwrite(header.data, 1, header.len, am_ompt_perfetto_out) !=
+             header.len ||
+         fwrite(packet->data, 1, packet->len, am_ompt_perfetto_out) !=
+             packet->len;
+}
+
+static void am_ompt_perfetto_interned(struct am_ompt_pb* pb, uint32_t field,
+                                      uint64_t iid, const char* name) {
+  struct am_ompt_pb entry = {.len = 0, .overflow = 0};
+
+  am_ompt_pb_varint(&entry, AM_OMPT_PB_INTERNED_IID, iid);
+  am_ompt_pb_string(&entry, AM_OMPT_PB_INTERNED_NAME, name);
+  am_ompt_pb_message(pb, field, &entry);
+}
+
+/* Write the packet that starts the sequence with all interned names */
+static int am_ompt_perfetto_write_names() {
+  static struct am_ompt_pb packet, interned;
+  char name[64];
+
+  for (size_t t = 0; t <= AM_OMPT_NUM_EVENTS; t++) {
+    am_ompt_perfetto_interned(&interned, AM_OMPT_PB_INTERNED_EVENT_NAMES,
+                              AM_OMPT_PERFETTO_IID_EVENT(t),
+                              am_ompt_event_names[t]);
+  }
+
+  am_ompt_perfetto_interned(&interned, AM_OMPT_PB_INTERNED_EVENT_NAMES,
+                            AM_OMPT_PERFETTO_IID_TASK, "task");
+
+  for (size_t k = 1; k < AM_OMPT_PERFETTO_NUM_SYNC_NAMES; k++) {
+    am_ompt_perfetto_interned(&interned, AM_OMPT_PB_INTERNED_EVENT_NAMES,
+                              AM_OMPT_PERFETTO_IID_SYNC(k),
+                              am_ompt_perfetto_sync_names[k]);
+
+    snprintf(name, sizeof(name), "wait_%s", am_ompt_perfetto_sync_names[k]);
+    am_ompt_perfetto_interned(&interned, AM_OMPT_PB_INTERNED_EVENT_NAMES,
+                              AM_OMPT_PERFETTO_IID_WAIT(k), name);
+  }
+
+  for (size_t k = 1; k < AM_OMPT_PERFETTO_NUM_WORK_NAMES; k++) {
+    am_ompt_perfetto_interned(&interned, AM_OMPT_PB_INTERNED_EVENT_NAMES,
+                              AM_OMPT_PERFETTO_IID_WORK(k),
+                              am_ompt_perfetto_work_names[k]);
+  }
+
+  for (int a = 1; a < AM_OMPT_PERFETTO_NUM_ARGS; a++) {
+    am_ompt_perfetto_interned(&interned, AM_OMPT_PB_INTERNED_ANNOTATION_NAMES,
+                              a, am_ompt_perfetto_arg_names[a]);
+  }
+
+  am_ompt_pb_varint(&packet, AM_OMPT_PB_PACKET_SEQUENCE_ID,
+                    AM_OMPT_PERFETTO_SEQUENCE_ID);
+  am_ompt_pb_varint(&packet, AM_OMPT_PB_PACKET_SEQUENCE_FLAGS,
+                    AM_OMPT_PB_SEQ_INCREMENTAL_STATE_CLEARED);
+  am_ompt_pb_message(&packet, AM_OMPT_PB_PACKET_INTERNED_DATA, &interned);
+
+  return am_ompt_perfetto_packet(&packet);
+}
+
+/* Write the descriptors of the process and of the thread and counter tracks
+   of each event collection */
+static int am_ompt_perfetto_write_tracks(struct am_ompt_perfetto_cursor* cs,
+                                         size_t n) {
+  struct am_ompt_pb packet, track, desc;
+  char name[64];
+
+  packet.len = track.len = desc.len = 0;
+  packet.overflow = track.overflow = desc.overflow = 0;
+
+  am_ompt_pb_varint(&desc, AM_OMPT_PB_PROCESS_PID, AM_OMPT_PERFETTO_PID);
+  am_ompt_pb_string(&desc, AM_OMPT_PB_PROCESS_NAME, "afterompt");
+  am_ompt_pb_varint(&track, AM_OMPT_PB_TRACK_UUID,
+                    AM_OMPT_PERFETTO_PROCESS_UUID);
+  am_ompt_pb_message(&track, AM_OMPT_PB_TRACK_PROCESS, &desc);
+  am_ompt_pb_message(&packet, AM_OMPT_PB_PACKET_TRACK_DESCRIPTOR, &track);
+
+  if (am_ompt_perfetto_packet(&packet)) return 1;
+
+  for (size_t i = 0; i < n; i++) {
+    struct am_ompt_reader_collection* rc = cs[i].rc;
+
+    if (rc->name)
+      snprintf(name, sizeof(name), "%s", rc->name);
+    else
+      snprintf(name, sizeof(name), "collection %u", rc->id);
+
+    packet.len = track.len = desc.len = 0;
+
+    am_ompt_pb_varint(&desc, AM_OMPT_PB_THREAD_PID, AM_OMPT_PERFETTO_PID);
+    am_ompt_pb_varint(&desc, AM_OMPT_PB_THREAD_TID, i + 1);
+    am_ompt_pb_string(&desc, AM_OMPT_PB_THREAD_NAME, name);
+    am_ompt_pb_varint(&track, AM_OMPT_PB_TRACK_UUID, cs[i].track);
+    am_ompt_pb_message(&track, AM_OMPT_PB_TRACK_THREAD, &desc);
+    am_ompt_pb_message(&packet, AM_OMPT_PB_PACKET_TRACK_DESCRIPTOR, &track);
+
+    if (am_ompt_perfetto_packet(&packet)) return 1;
+
+    /* Core migrations are shown on a counter track of the thread */
+    packet.len = track.len = 0;
+
+    am_ompt_pb_varint(&track, AM_OMPT_PB_TRACK_UUID, cs[i].track + 1);
+    am_ompt_pb_varint(&track, AM_OMPT_PB_TRACK_PARENT_UUID, cs[i].track);
+    am_ompt_pb_string(&track, AM_OMPT_PB_TRACK_NAME, "core");
+    am_ompt_pb_bytes(&track, AM_OMPT_PB_TRACK_COUNTER, NULL, 0);
+    am_ompt_pb_message(&packet, AM_OMPT_PB_PACKET_TRACK_DESCRIPTOR, &track);
+
+    if (am_ompt_perfetto_packet(&packet)) return 1;
+  }
+
+  return 0;
+}
+
+static void am_ompt_perfetto_arg(struct am_ompt_pb* event,
+                                 enum am_ompt_perfetto_annotation arg,
+                                 int64_t value, int is_signed) {
+  struct am_ompt_pb a = {.len = 0, .overflow = 0};
+
+  am_ompt_pb_varint(&a, AM_OMPT_PB_ANNOTATION_NAME_IID, arg);
+  am_ompt_pb_varint(&a,
+                    is_signed ? AM_OMPT_PB_ANNOTATION_INT_VALUE
+                              : AM_OMPT_PB_ANNOTATION_UINT_VALUE,
+                    value);
+  am_ompt_pb_message(event, AM_OMPT_PB_EVENT_DEBUG_ANNOTATIONS, &a);
+}
+
+/* Start a track event. Further fields can be added before it is written with
+   am_ompt_perfetto_end_event. */
+static void am_ompt_perfetto_begin_event(struct am_ompt_pb* event,
+                                         enum am_ompt_pb_event_type type,
+                                         uint64_t track, uint64_t name_iid) {
+  event->len = 0;
+  event->overflow = 0;
+
+  am_ompt_pb_varint(event, AM_OMPT_PB_EVENT_TYPE, type);
+  am_ompt_pb_varint(event, AM_OMPT_PB_EVENT_TRACK_UUID, track);
+
+  if (name_iid) am_ompt_pb_varint(event, AM_OMPT_PB_EVENT_NAME_IID, name_iid);
+}
+
+static int am_ompt_perfetto_end_event(const struct am_ompt_pb* event,
+                                      uint64_t tsc) {
+  static struct am_ompt_pb packet;
+
+  packet.len = 0;
+  packet.overflow = 0;
+
+  am_ompt_pb_varint(&packet, AM_OMPT_PB_PACKET_TIMESTAMP,
+                    tsc / am_ompt_perfetto_units_per_ns);
+  am_ompt_pb_varint(&packet, AM_OMPT_PB_PACKET_SEQUENCE_ID,
+                    AM_OMPT_PERFETTO_SEQUENCE_ID);
+  am_ompt_pb_varint(&packet, AM_OMPT_PB_PACKET_SEQUENCE_FLAGS,
+                    AM_OMPT_PB_SEQ_NEEDS_INCREMENTAL_STATE);
+  am_ompt_pb_message(&packet, AM_OMPT_PB_PACKET_TRACK_EVENT, event);
+
+  return am_ompt_perfetto_packet(&packet);
+}
+
+/* Flow of the dependence between two tasks, distinct from the flow ids of
+   tasks, which are the task ids */
+static inline uint64_t am_ompt_perfetto_dep_flow(uint64_t src, uint64_t sink) {
+  return am_ompt_hash(src ^ am_ompt_hash(sink, 0), 0) | 1ULL << 63;
+}
+
+static inline size_t am_ompt_perfetto_dep_home(int state, uint64_t key) {
+  return am_ompt_hash(key ^ ((uint64_t)state << 62), 0) &
+         (am_ompt_perfetto_max_deps - 1);
+}
+
+static void am_ompt_perfetto_dep_insert(int state, uint64_t key,
+                                        uint64_t other) {
+  size_t mask = am_ompt_perfetto_max_deps - 1;
+  size_t i = am_ompt_perfetto_dep_home(state, key);
+
+  /* The table does not grow, further dependences are dropped */
+  if (am_ompt_table_full(am_ompt_perfetto_num_deps,
+                         am_ompt_perfetto_max_deps)) {
+    am_ompt_perfetto_dropped_deps++;
+    return;
+  }
+
+  while (am_ompt_perfetto_deps[i].state) i = (i + 1) & mask;
+
+  am_ompt_perfetto_deps[i].state = state;
+  am_ompt_perfetto_deps[i].key = key;
+  am_ompt_perfetto_deps[i].other = other;
+  am_ompt_perfetto_num_deps++;
+}
+
+/* Remove an entry and shift the following entries of the probe sequence
+   back, so that lookups never need tombstones */
+static void am_ompt_perfetto_dep_remove(size_t i) {
+  size_t mask = am_ompt_perfetto_max_deps - 1;
+  size_t j = i;
+
+  for (;;) {
+    j = (j + 1) & mask;
+
+    if (!am_ompt_perfetto_deps[j].state) break;
+
+    size_t k = am_ompt_perfetto_dep_home(am_ompt_perfetto_deps[j].state,
+                                         am_ompt_perfetto_deps[j].key);
+
+    /* Entry j stays if its home lies cyclically in (i, j] */
+    if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
+
+    am_ompt_perfetto_deps[i] = am_ompt_perfetto_deps[j];
+    i = j;
+  }
+
+  am_ompt_perfetto_deps[i].state = AM_OMPT_PERFETTO_DEP_EMPTY;
+  am_ompt_perfetto_num_deps--;
+}
+
+/* Remove up to max entries with the given state and key and return their
+   other tasks */
+static size_t am_ompt_perfetto_dep_take(int state, uint64_t key,
+                                        uint64_t* others, size_t max) {
+  size_t mask = am_ompt_perfetto_max_deps - 1;
+  size_t n = 0;
+  size_t i = am_ompt_perfetto_dep_home(state, key);
+
+  while (n < max && am_ompt_perfetto_deps[i].state) {
+    if (am_ompt_perfetto_deps[i].state == state &&
+        am_ompt_perfetto_deps[i].key == key) {
+      others[n++] = am_ompt_perfetto_deps[i].other;
+      /* A following entry may have moved into slot i */
+      am_ompt_perfetto_dep_remove(i);
+    } else {
+      i = (i + 1) & mask;
+    }
+  }
+
+  return n;
+}
+
+static int am_ompt_perfetto_is_on_stack(struct am_ompt_perfetto_cursor* c,
+                                        uint64_t task) {
+  for (size_t i = 0; i < c->num_tasks; i++) {
+    if (c->tasks[i] == task) return 1;
+  }
+
+  return 0;
+}
+
+/* A schedule ends the execution of the prior task on the thread and starts
+   or resumes the next one */
+static int am_ompt_perfetto_schedule(struct am_ompt_perfetto_cursor* c,
+                                     const struct am_ompt_event* e) {
+  static struct am_ompt_pb event;
+  uint64_t prior = e->task_schedule.prior_task_id;
+  uint64_t next = e->task_schedule.next_task_id;
+  int32_t status = e->task_schedule.prior_task_status;
+  uint64_t others[AM_OMPT_PERFETTO_MAX_FLOWS];
+  size_t n = 0;
+
+  /* Dependent tasks are released when their source completes */
+  if (prior && (status == AM_OMPT_TASK_COMPLETE ||
+                status == AM_OMPT_TASK_CANCEL ||
+                status == AM_OMPT_TASK_LATE_FULFILL)) {
+    n = am_ompt_perfetto_dep_take(AM_OMPT_PERFETTO_DEP_PENDING, prior, others,
+                                  AM_OMPT_PERFETTO_MAX_FLOWS);
+
+    for (size_t i = 0; i < n; i++) {
+      am_ompt_perfetto_dep_insert(AM_OMPT_PERFETTO_DEP_RELEASED, others[i],
+                                  prior);
+    }
+  }
+
+  if (prior && c->num_tasks && c->tasks[c->num_tasks - 1] == prior &&
+      (status == AM_OMPT_TASK_COMPLETE || status == AM_OMPT_TASK_CANCEL ||
+       status == AM_OMPT_TASK_DETACH)) {
+    c->num_tasks--;
+    am_ompt_perfetto_begin_event(&event, AM_OMPT_PB_SLICE_END, c->track, 0);
+  } else if (n) {
+    /* The flows need an event on the thread that released them */
+    am_ompt_perfetto_begin_event(&event, AM_OMPT_PB_INSTANT, c->track,
+                                 AM_OMPT_PERFETTO_IID_EVENT(e->type));
+  } else {
+    event.len = 0;
+  }
+
+  if (event.len) {
+    for (size_t i = 0; i < n; i++) {
+      am_ompt_pb_fixed64(&event, AM_OMPT_PB_EVENT_FLOW_IDS,
+                         am_ompt_perfetto_dep_flow(prior, others[i]));
+    }
+
+    if (am_ompt_perfetto_end_event(&event, e->start)) return 1;
+  }
+
+  /* Resumed tasks are still open */
+  if (!next || am_ompt_perfetto_is_on_stack(c, next)) return 0;
+
+  if (c->num_tasks == AM_OMPT_PERFETTO_MAX_TASK_DEPTH) return 0;
+
+  c->tasks[c->num_tasks++] = next;
+
+  am_ompt_perfetto_begin_event(&event, AM_OMPT_PB_SLICE_BEGIN, c->track,
+                               AM_OMPT_PERFETTO_IID_TASK);
+  am_ompt_perfetto_arg(&event, AM_OMPT_PERFETTO_ARG_TASK, next, 0);
+  am_ompt_pb_fixed64(&event, AM_OMPT_PB_EVENT_FLOW_IDS, next);
+
+  n = am_ompt_perfetto_dep_take(AM_OMPT_PERFETTO_DEP_RELEASED, next, others,
+                                AM_OMPT_PERFETTO_MAX_FLOWS);
+
+  for (size_t i = 0; i < n; i++) {
+    am_ompt_pb_fixed64(&event, AM_OMPT_PB_EVENT_TERMINATING_FLOW_IDS,
+                       am_ompt_perfetto_dep_flow(others[i], next));
+  }
+
+  return am_ompt_perfetto_end_event(&event, e->start);
+}
+
+/* Name of an event, by kind for sync regions and work */
+static uint64_t am_ompt_perfetto_name(const struct am_ompt_event* e) {
+  switch (e->type) {
+    case AM_OMPT_EVENT_SYNC_REGION:
+      if (e->sync_region.kind > 0 &&
+          e->sync_region.kind < (int32_t)AM_OMPT_PERFETTO_NUM_SYNC_NAMES)
+        return AM_OMPT_PERFETTO_IID_SYNC(e->sync_region.kind);
+      break;
+    case AM_OMPT_EVENT_SYNC_REGION_WAIT:
+      if (e->sync_region_wait.kind > 0 &&
+          e->sync_region_wait.kind < (int32_t)AM_OMPT_PERFETTO_NUM_SYNC_NAMES)
+        return AM_OMPT_PERFETTO_IID_WAIT(e->sync_region_wait.kind);
+      break;
+    case AM_OMPT_EVENT_WORK:
+      if (e->work.wstype > 0 &&
+          e->work.wstype < (int32_t)AM_OMPT_PERFETTO_NUM_WORK_NAMES)
+        return AM_OMPT_PERFETTO_IID_WORK(e->work.wstype);
+      break;
+  }
+
+  return AM_OMPT_PERFETTO_IID_EVENT(e->type);
+}
+
+/* Arguments shown with an event */
+static void am_ompt_perfetto_args(struct am_ompt_pb* event,
+                                  const struct am_ompt_event* e) {
+  switch (e->type) {
+    case AM_OMPT_EVENT_TASK_CREATE:
+      am_ompt_perfetto_arg(event, AM_OMPT_PERFETTO_ARG_TASK,
+                           e->task_create.new_task_id, 0);
+      am_ompt_perfetto_arg(event, AM_OMPT_PERFETTO_ARG_CODEPTR_RA,
+                           e->task_create.codeptr_ra, 0);
+      break;
+    case AM_OMPT_EVENT_WORK:
+      am_ompt_perfetto_arg(event, AM_OMPT_PERFETTO_ARG_COUNT, e->work.count,
+                           0);
+      break;
+    case AM_OMPT_EVENT_LOOP:
+      am_ompt_perfetto_arg(event, AM_OMPT_PERFETTO_ARG_LOWER_BOUND,
+                           e->loop.lower_bound, 1);
+      am_ompt_perfetto_arg(event, AM_OMPT_PERFETTO_ARG_UPPER_BOUND,
+                           e->loop.upper_bound, 1);
+      am_ompt_perfetto_arg(event, AM_OMPT_PERFETTO_ARG_CODEPTR_RA,
+                           e->loop.codeptr_ra, 0);
+      break;
+    case AM_OMPT_EVENT_LOOP_CHUNK:
+      am_ompt_perfetto_arg(event, AM_OMPT_PERFETTO_ARG_LOWER_BOUND,
+                           e->loop_chunk.lower_bound, 1);
+      am_ompt_perfetto_arg(event, AM_OMPT_PERFETTO_ARG_UPPER_BOUND,
+                           e->loop_chunk.upper_bound, 1);
+      break;
+    case AM_OMPT_EVENT_MUTEX_RELEASED:
+      am_ompt_perfetto_arg(event, AM_OMPT_PERFETTO_ARG_WAIT_ID,
+                           e->mutex_released.wait_id, 0);
+      break;
+    case AM_OMPT_EVENT_MUTEX_ACQUIRE:
+      am_ompt_perfetto_arg(event, AM_OMPT_PERFETTO_ARG_WAIT_ID,
+                           e->mutex_acquire.wait_id, 0);
+      break;
+    case AM_OMPT_EVENT_MUTEX_ACQUIRED:
+      am_ompt_perfetto_arg(event, AM_OMPT_PERFETTO_ARG_WAIT_ID,
+                           e->mutex_acquired.wait_id, 0);
+      break;
+    case AM_OMPT_EVENT_NEST_LOCK:
+      am_ompt_perfetto_arg(event, AM_OMPT_PERFETTO_ARG_WAIT_ID,
+                           e->nest_lock.wait_id, 0);
+      break;
+    case AM_OMPT_EVENT_GOVERNOR:
+      am_ompt_perfetto_arg(event, AM_OMPT_PERFETTO_ARG_CODEPTR_RA,
+                           e->governor.codeptr_ra, 0);
+      am_ompt_perfetto_arg(event, AM_OMPT_PERFETTO_ARG_COUNT,
+                           e->governor.count, 0);
+      break;
+  }
+}
+
+static int am_ompt_perfetto_event(struct am_ompt_perfetto_cursor* c,
+                                  const struct am_ompt_event* e) {
+  static struct am_ompt_pb event;
+
+  switch (e->type) {
+    case AM_OMPT_EVENT_TASK_SCHEDULE:
+      return am_ompt_perfetto_schedule(c, e);
+    case AM_OMPT_EVENT_TASK_DEPENDENCE:
+      am_ompt_perfetto_dep_insert(AM_OMPT_PERFETTO_DEP_PENDING,
+                                  e->task_dependence.src_task_id,
+                                  e->task_dependence.sink_task_id);
+      return 0;
+    case AM_OMPT_EVENT_TOOL_TIME:
+      /* Only meaningful for exclusive times, see afterompt-stats */
+      return 0;
+    case AM_OMPT_EVENT_OCCUPANCY:
+      /* Bins summarize the slices of the same thread */
+      return 0;
+    case AM_OMPT_EVENT_COUNTER:
+      /* Only core migrations have a track, not annotation counters */
+      if (e->counter.counter_id) return 0;
+
+      am_ompt_perfetto_begin_event(&event, AM_OMPT_PB_COUNTER, c->track + 1,
+                                   0);
+      am_ompt_pb_varint(&event, AM_OMPT_PB_EVENT_COUNTER_VALUE,
+                        e->counter.value);
+      return am_ompt_perfetto_end_event(&event, e->start);
+  }
+
+  if (am_ompt_event_is_interval[e->type]) {
+    am_ompt_perfetto_begin_event(&event, AM_OMPT_PB_SLICE_BEGIN, c->track,
+                                 am_ompt_perfetto_name(e));
+    am_ompt_perfetto_args(&event, e);
+
+    if (am_ompt_perfetto_end_event(&event, e->start)) return 1;
+
+    am_ompt_perfetto_begin_event(&event, AM_OMPT_PB_SLICE_END, c->track, 0);
+
+    return am_ompt_perfetto_end_event(&event, e->end);
+  }
+
+  am_ompt_perfetto_begin_event(&event, AM_OMPT_PB_INSTANT, c->track,
+                               am_ompt_perfetto_name(e));
+  am_ompt_perfetto_args(&event, e);
+
+  /* Creations start the flow through the execution of the task */
+  if (e->type == AM_OMPT_EVENT_TASK_CREATE) {
+    am_ompt_pb_fixed64(&event, AM_OMPT_PB_EVENT_FLOW_IDS,
+                       e->task_create.new_task_id);
+  }
+
+  return am_ompt_perfetto_end_event(&event, e->start);
+}
+
+/* Decode the next event of a collection. Returns 0 at its end. */
+static int am_ompt_perfetto_advance(struct am_ompt_perfetto_cursor* c) {
+  while (c->range < c->rc->num_ranges) {
+    if (am_ompt_reader_next(&am_ompt_perfetto_reader, &c->offset,
+                            c->rc->ranges[c->range].end, &c->e))
+      return 1;
+
+    if (++c->range < c->rc->num_ranges)
+      c->offset = c->rc->ranges[c->range].start;
+  }
+
+  return 0;
+}
+
+/* Events are written when they end, so collections are merged by end */
+static inline int am_ompt_perfetto_before(struct am_ompt_perfetto_cursor* a,
+                                          struct am_ompt_perfetto_cursor* b) {
+  return a->e.end < b->e.end;
+}
+
+static void am_ompt_perfetto_sift_down(struct am_ompt_perfetto_cursor** heap,
+                                       size_t n, size_t i) {
+  for (;;) {
+    size_t min = i;
+    size_t l = 2 * i + 1;
+    size_t r = l + 1;
+
+    if (l < n && am_ompt_perfetto_before(heap[l], heap[min])) min = l;
+    if (r < n && am_ompt_perfetto_before(heap[r], heap[min])) min = r;
+
+    if (min == i) return;
+
+    struct am_ompt_perfetto_cursor* tmp = heap[i];
+    heap[i] = heap[min];
+    heap[min] = tmp;
+    i = min;
+  }
+}
+
+/* Write the events of all collections in the order of their end */
+static int am_ompt_perfetto_merge(struct am_ompt_perfetto_cursor* cs,
+                                  size_t num) {
+  struct am_ompt_perfetto_cursor** heap;
+  size_t n = 0;
+  int ret = 0;
+
+  if (!(heap = malloc((num ? num : 1) * sizeof(*heap)))) {
+    fprintf(stderr, "Could not allocate memory.\n");
+    return 1;
+  }
+
+  for (size_t i = 0; i < num; i++) {
+    cs[i].offset = cs[i].rc->num_ranges ? cs[i].rc->ranges[0].start : 0;
+
+    if (am_ompt_perfetto_advance(&cs[i])) heap[n++] = &cs[i];
+  }
+
+  for (size_t i = n / 2; i-- > 0;) am_ompt_perfetto_sift_down(heap, n, i);
+
+  while (n) {
+    struct am_ompt_perfetto_cursor* c = heap[0];
+
+    if (am_ompt_perfetto_event(c, &c->e)) {
+      ret = 1;
+      break;
+    }
+
+    if (!am_ompt_perfetto_advance(c)) heap[0] = heap[--n];
+
+    am_ompt_perfetto_sift_down(heap, n, 0);
+  }
+
+  free(heap);
+
+  return ret;
+}
+
+static int am_ompt_perfetto_cmp_cursor(const void* a, const void* b) {
+  uint32_t x = ((const struct am_ompt_perfetto_cursor*)a)->rc->id;
+  uint32_t y = ((const struct am_ompt_perfetto_cursor*)b)->rc->id;
+
+  return (x > y) - (x < y);
+}
+
+/* Write the events in the order of the time index. Cursors are sorted by
+   collection id. */
+static int am_ompt_perfetto_replay_index(struct am_ompt_perfetto_cursor* cs,
+                                         size_t num) {
+  struct am_ompt_reader* r = &am_ompt_perfetto_reader;
+  struct am_ompt_reader_collection key_rc;
+  struct am_ompt_perfetto_cursor key = {.rc = &key_rc};
+  struct am_ompt_perfetto_cursor* c;
+  struct am_ompt_event e;
+
+  for (uint64_t i = 0; i < r->num_index_entries; i++) {
+    if (!am_ompt_reader_index_event(r, i, &e)) continue;
+
+    key_rc.id = e.collection_id;
+
+    if (!(c = bsearch(&key, cs, num, sizeof(*cs), am_ompt_perfetto_cmp_cursor)))
+      continue;
+
+    if (am_ompt_perfetto_event(c, &e)) return 1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  struct am_ompt_reader* r = &am_ompt_perfetto_reader;
+  struct am_ompt_perfetto_cursor* cs = NULL;
+  size_t max_deps;
+
+  if (argc < 3) {
+    fprintf(stderr,
+            "Usage: %s <trace> <output> [timestamp units per ns] "
+            "[max pending dependences]\n",
+            argv[0]);
+    return 2;
+  }
+
+  if (argc > 3 &&
+      (sscanf(argv[3], "%lf", &am_ompt_perfetto_units_per_ns) != 1 ||
+       am_ompt_perfetto_units_per_ns <= 0)) {
+    fprintf(stderr, "Invalid number of timestamp units per ns.\n");
+    return 2;
+  }
+
+  if (argc > 4) sscanf(argv[4], "%zu", &am_ompt_perfetto_max_deps);
+
+  /* Twice the number of dependences, rounded up to a power of two */
+  for (max_deps = 2; max_deps < 2 * am_ompt_perfetto_max_deps; max_deps *= 2)
+    ;
+  am_ompt_perfetto_max_deps = max_deps;
+
+  if (am_ompt_reader_open(r, argv[1])) return 2;
+
+  if (r->error_offset) {
+    fprintf(stderr, "Trace is malformed at offset %zu: %s\n", r->error_offset,
+            r->error);
+    fprintf(stderr, "Converting the events before the error.\n");
+  }
+
+  cs = calloc(r->num_collections ? r->num_collections : 1, sizeof(*cs));
+  am_ompt_perfetto_deps =
+      calloc(am_ompt_perfetto_max_deps, sizeof(*am_ompt_perfetto_deps));
+
+  if (!cs || !am_ompt_perfetto_deps) {
+    fprintf(stderr, "Could not allocate memory.\n");
+    goto out_err;
+  }
+
+  /* Thread tracks have even uuids, counter tracks the following odd ones */
+  for (size_t i = 0; i < r->num_collections; i++) {
+    cs[i].rc = &r->collections[i];
+    cs[i].track = ((uint64_t)cs[i].rc->id << 2) | 2;
+  }
+
+  qsort(cs, r->num_collections, sizeof(*cs), am_ompt_perfetto_cmp_cursor);
+
+  if (!(am_ompt_perfetto_out = fopen(argv[2], "wb"))) {
+    fprintf(stderr, "Could not open \"%s\".\n", argv[2]);
+    goto out_err;
+  }
+
+  if (am_ompt_perfetto_write_names() ||
+      am_ompt_perfetto_write_tracks(cs, r->num_collections) ||
+      (r->index ? am_ompt_perfetto_replay_index(cs, r->num_collections)
+                : am_ompt_perfetto_merge(cs, r->num_collections))) {
+    fprintf(stderr, "Could not write \"%s\".\n", argv[2]);
+    goto out_err_close;
+  }
+
+  if (fclose(am_ompt_perfetto_out)) {
+    fprintf(stderr, "Could not write \"%s\".\n", argv[2]);
+    goto out_err;
+  }
+
+  if (am_ompt_perfetto_dropped_deps) {
+    fprintf(stderr,
+            "%lu dependences were not shown, consider increasing the number "
+            "of pending dependences.\n",
+            am_ompt_perfetto_dropped_deps);
+  }
+
+  free(am_ompt_perfetto_deps);
+  free(cs);
+  am_ompt_reader_close(r);
+
+  return 0;
+
+out_err_close:
+  fclose(am_ompt_perfetto_out);
+out_err:
+  free(am_ompt_perfetto_deps);
+  free(cs);
+  am_ompt_reader_close(r);
+
+  return 2;
+}
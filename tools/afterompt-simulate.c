@@ -0,0 +1,659 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+  Replays a task graph written by afterompt-taskgraph on a number of virtual
+  workers to predict the makespan of the tasks at other thread counts.
+
+  Each task runs for its recorded cost, split at its actions. A creation
+  makes the child ready, unless it waits for a dependence, and costs the
+  creating task the given creation overhead. A suspension blocks the task
+  until the children it created have completed. Workers schedule the ready
+  tasks with one of the policies below:
+
+  work-first     The creating worker runs a new child right away and leaves
+                 the rest of the parent in its deque. Idle workers steal the
+                 oldest entry of the deques in round-robin order.
+  breadth-first  Ready tasks are queued in a single FIFO queue shared by all
+                 workers.
+  locality       New, released and resumed tasks are pushed to the deque of
+                 the worker that made them ready, which runs the newest one
+                 first. Idle workers steal from the nearest worker first.
+
+  Tasks are not tied to the worker that started them and stealing has no
+  cost, so predictions are lower bounds for the scheduling overheads.
+
+  Usage: afterompt-simulate <task graph> [policy|all] [workers,...]
+                            [creation overhead]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "taskgraph.h"
+
+enum am_ompt_sim_policy {
+  AM_OMPT_SIM_WORK_FIRST = 0,
+  AM_OMPT_SIM_BREADTH_FIRST,
+  AM_OMPT_SIM_LOCALITY,
+  AM_OMPT_SIM_NUM_POLICIES
+};
+
+static const char* am_ompt_sim_policy_names[AM_OMPT_SIM_NUM_POLICIES] = {
+    "work-first", "breadth-first", "locality"};
+
+/* Maximal number of worker counts in a sweep */
+#define AM_OMPT_SIM_MAX_SWEEP 64
+
+/* Task graph as read from the file */
+static struct am_ompt_taskgraph_header am_ompt_sim_header;
+static struct am_ompt_taskgraph_task* am_ompt_sim_tasks;
+static struct am_ompt_taskgraph_action* am_ompt_sim_actions;
+static struct am_ompt_taskgraph_dependence* am_ompt_sim_deps;
+
+/* Sinks of the dependences of each task, from am_ompt_sim_succ_start[i] to
+   am_ompt_sim_succ_start[i + 1] */
+static uint32_t* am_ompt_sim_succ_start;
+static uint32_t* am_ompt_sim_succ;
+
+/* Number of dependences of each task */
+static uint32_t* am_ompt_sim_num_deps;
+
+static uint64_t am_ompt_sim_create_cost;
+
+/* State of a task during a simulation */
+struct am_ompt_sim_task {
+  /* Next action and execution time reached so far */
+  uint32_t next_action;
+  uint64_t done;
+  /* Children created and not completed yet */
+  uint32_t pending;
+  /* Dependences whose source has not completed yet */
+  uint32_t unmet;
+  uint8_t created;
+  uint8_t blocked;
+};
+
+/* Double-ended queue of ready tasks in a ring buffer */
+struct am_ompt_sim_deque {
+  uint32_t* tasks;
+  size_t capacity;
+  size_t head;
+  size_t size;
+};
+
+struct am_ompt_sim_worker {
+  /* Task executed, AM_OMPT_TASKGRAPH_NONE if idle */
+  uint32_t task;
+  uint64_t busy;
+  struct am_ompt_sim_deque deque;
+};
+
+/* End of the segment a worker executes */
+struct am_ompt_sim_event {
+  uint64_t time;
+  uint32_t worker;
+};
+
+/* Simulation state */
+struct am_ompt_sim {
+  enum am_ompt_sim_policy policy;
+  uint32_t num_workers;
+  struct am_ompt_sim_task* tasks;
+  struct am_ompt_sim_worker* workers;
+  /* Queue shared by all workers for breadth-first scheduling */
+  struct am_ompt_sim_deque queue;
+  /* Workers executing a segment, ordered by its end */
+  struct am_ompt_sim_event* heap;
+  size_t heap_size;
+  /* Number of ready tasks in all queues */
+  size_t num_ready;
+  uint64_t now;
+  uint32_t completed;
+  /* Worker for which the next round-robin steal starts */
+  uint32_t steal_start;
+};
+
+static int am_ompt_sim_push_back(struct am_ompt_sim_deque* d, uint32_t task) {
+  uint32_t* grown;
+  size_t n;
+
+  if (d->size == d->capacity) {
+    n = d->capacity ? 2 * d->capacity : 64;
+
+    if (!(grown = malloc(n * sizeof(*grown)))) return 1;
+
+    for (size_t i = 0; i < d->size; i++)
+      grown[i] = d->tasks[(d->head + i) % d->capacity];
+
+    free(d->tasks);
+    d->tasks = grown;
+    d->capacity = n;
+    d->head = 0;
+  }
+
+  d->tasks[(d->head + d->size++) % d->capacity] = task;
+
+  return 0;
+}
+
+static uint32_t am_ompt_sim_pop_back(struct am_ompt_sim_deque* d) {
+  return d->tasks[(d->head + --d->size) % d->capacity];
+}
+
+static uint32_t am_ompt_sim_pop_front(struct am_ompt_sim_deque* d) {
+  uint32_t task = d->tasks[d->head];
+
+  d->head = (d->head + 1) % d->capacity;
+  d->size--;
+
+  return task;
+}
+
+static inline int am_ompt_sim_before(const struct am_ompt_sim_event* a,
+                                     const struct am_ompt_sim_event* b) {
+  return a->time < b->time || (a->time == b->time && a->worker < b->worker);
+}
+
+static void am_ompt_sim_heap_push(struct am_ompt_sim* s, uint64_t time,
+                                  uint32_t worker) {
+  struct am_ompt_sim_event e = {time, worker};
+  size_t i = s->heap_size++;
+
+  while (i && am_ompt_sim_before(&e, &s->heap[(i - 1) / 2])) {
+    s->heap[i] = s->heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+
+  s->heap[i] = e;
+}
+
+static struct am_ompt_sim_event am_ompt_sim_heap_pop(struct am_ompt_sim* s) {
+  struct am_ompt_sim_event top = s->heap[0];
+  struct am_ompt_sim_event last = s->heap[--s->heap_size];
+  size_t i = 0, child;
+
+  while ((child = 2 * i + 1) < s->heap_size) {
+    if (child + 1 < s->heap_size &&
+        am_ompt_sim_before(&s->heap[child + 1], &s->heap[child]))
+      child++;
+
+    if (!am_ompt_sim_before(&s->heap[child], &last)) break;
+
+    s->heap[i] = s->heap[child];
+    i = child;
+  }
+
+  s->heap[i] = last;
+
+  return top;
+}
+
+/* Start or continue a task on a worker until its next action or its end */
+static void am_ompt_sim_run(struct am_ompt_sim* s, uint32_t w, uint32_t task) {
+  const struct am_ompt_taskgraph_task* t = &am_ompt_sim_tasks[task];
+  struct am_ompt_sim_task* st = &s->tasks[task];
+  const struct am_ompt_taskgraph_action* a = NULL;
+  uint64_t until = t->cost, length;
+
+  if (st->next_action < t->num_actions) {
+    a = &am_ompt_sim_actions[t->first_action + st->next_action];
+    until = a->offset;
+  }
+
+  length = until > st->done ? until - st->done : 0;
+  st->done += length;
+
+  if (a && a->kind == AM_OMPT_TASKGRAPH_CREATE)
+    length += am_ompt_sim_create_cost;
+
+  s->workers[w].task = task;
+  s->workers[w].busy += length;
+  am_ompt_sim_heap_push(s, s->now + length, w);
+}
+
+/* Queue a task that became ready on a worker */
+static int am_ompt_sim_ready(struct am_ompt_sim* s, uint32_t w, uint32_t task) {
+  s->num_ready++;
+
+  if (s->policy == AM_OMPT_SIM_BREADTH_FIRST)
+    return am_ompt_sim_push_back(&s->queue, task);
+
+  return am_ompt_sim_push_back(&s->workers[w].deque, task);
+}
+
+/* Take the next ready task for an idle worker, AM_OMPT_TASKGRAPH_NONE if
+   there is none */
+static uint32_t am_ompt_sim_take(struct am_ompt_sim* s, uint32_t w) {
+  struct am_ompt_sim_deque* d;
+  uint32_t v;
+
+  if (!s->num_ready) return AM_OMPT_TASKGRAPH_NONE;
+
+  if (s->policy == AM_OMPT_SIM_BREADTH_FIRST) {
+    s->num_ready--;
+    return am_ompt_sim_pop_front(&s->queue);
+  }
+
+  if (s->workers[w].deque.size) {
+    s->num_ready--;
+    return am_ompt_sim_pop_back(&s->workers[w].deque);
+  }
+
+  for (uint32_t i = 1; i < s->num_workers + 1; i++) {
+    if (s->policy == AM_OMPT_SIM_LOCALITY) {
+      /* Alternate between the neighbours at increasing distance */
+      uint32_t dist = (i + 1) / 2;
+
+      if (dist >= s->num_workers) break;
+
+      v = (i & 1) ? (w + dist) % s->num_workers
+                  : (w + s->num_workers - dist) % s->num_workers;
+    } else {
+      v = (s->steal_start + i) % s->num_workers;
+    }
+
+    d = &s->workers[v].deque;
+
+    if (!d->size) continue;
+
+    if (s->policy == AM_OMPT_SIM_WORK_FIRST) s->steal_start = v;
+
+    s->num_ready--;
+    return am_ompt_sim_pop_front(d);
+  }
+
+  return AM_OMPT_TASKGRAPH_NONE;
+}
+
+/* A task completed on a worker: release its parent and dependent tasks */
+static int am_ompt_sim_complete(struct am_ompt_sim* s, uint32_t w,
+                                uint32_t task) {
+  uint32_t parent = am_ompt_sim_tasks[task].parent;
+  struct am_ompt_sim_task* sp;
+  uint32_t sink;
+
+  s->completed++;
+
+  if (parent != AM_OMPT_TASKGRAPH_NONE) {
+    sp = &s->tasks[parent];
+
+    if (!--sp->pending && sp->blocked) {
+      sp->blocked = 0;
+
+      if (am_ompt_sim_ready(s, w, parent)) return 1;
+    }
+  }
+
+  for (uint32_t i = am_ompt_sim_succ_start[task];
+       i < am_ompt_sim_succ_start[task + 1]; i++) {
+    sink = am_ompt_sim_succ[i];
+
+    if (!--s->tasks[sink].unmet && s->tasks[sink].created &&
+        am_ompt_sim_ready(s, w, sink))
+      return 1;
+  }
+
+  return 0;
+}
+
+/*
+  Handle the end of a segment on a worker. Returns the task the worker
+  continues with, AM_OMPT_TASKGRAPH_NONE if it has to look for another one,
+  or UINT32_MAX - 1 on error.
+*/
+static uint32_t am_ompt_sim_step(struct am_ompt_sim* s, uint32_t w) {
+  uint32_t task = s->workers[w].task, child;
+  const struct am_ompt_taskgraph_task* t = &am_ompt_sim_tasks[task];
+  struct am_ompt_sim_task* st = &s->tasks[task];
+  const struct am_ompt_taskgraph_action* a;
+
+  if (st->next_action == t->num_actions) {
+    if (am_ompt_sim_complete(s, w, task)) return UINT32_MAX - 1;
+
+    return AM_OMPT_TASKGRAPH_NONE;
+  }
+
+  a = &am_ompt_sim_actions[t->first_action + st->next_action++];
+
+  if (a->kind == AM_OMPT_TASKGRAPH_WAIT) {
+    if (!st->pending) return task;
+
+    st->blocked = 1;
+    return AM_OMPT_TASKGRAPH_NONE;
+  }
+
+  child = a->arg;
+  st->pending++;
+  s->tasks[child].created = 1;
+
+  if (s->tasks[child].unmet) return task;
+
+  /* The parent continues where any worker can steal it */
+  if (s->policy == AM_OMPT_SIM_WORK_FIRST) {
+    if (am_ompt_sim_ready(s, w, task)) return UINT32_MAX - 1;
+
+    return child;
+  }
+
+  if (am_ompt_sim_ready(s, w, child)) return UINT32_MAX - 1;
+
+  return task;
+}
+
+static void am_ompt_sim_free(struct am_ompt_sim* s) {
+  if (s->workers) {
+    for (uint32_t w = 0; w < s->num_workers; w++)
+      free(s->workers[w].deque.tasks);
+  }
+
+  free(s->queue.tasks);
+  free(s->heap);
+  free(s->workers);
+  free(s->tasks);
+}
+
+/*
+  Simulate the task graph on a number of workers. Returns the makespan and
+  the total idle time of the workers, or 1 on error.
+*/
+static int am_ompt_sim_simulate(enum am_ompt_sim_policy policy,
+                                uint32_t num_workers, uint64_t* makespan,
+                                uint64_t* idle) {
+  uint32_t n = am_ompt_sim_header.num_tasks, next, w;
+  struct am_ompt_sim s = {0};
+  struct am_ompt_sim_event e;
+  uint64_t busy = 0;
+
+  s.policy = policy;
+  s.num_workers = num_workers;
+
+  s.tasks = calloc(n ? n : 1, sizeof(*s.tasks));
+  s.workers = calloc(num_workers, sizeof(*s.workers));
+  s.heap = malloc(num_workers * sizeof(*s.heap));
+
+  if (!s.tasks || !s.workers || !s.heap) goto out_err;
+
+  for (w = 0; w < num_workers; w++) s.workers[w].task = AM_OMPT_TASKGRAPH_NONE;
+
+  /* Roots are spread over the workers */
+  for (uint32_t i = 0, r = 0; i < n; i++) {
+    s.tasks[i].unmet = am_ompt_sim_num_deps[i];
+
+    if (am_ompt_sim_tasks[i].parent != AM_OMPT_TASKGRAPH_NONE) continue;
+
+    s.tasks[i].created = 1;
+
+    if (!s.tasks[i].unmet && am_ompt_sim_ready(&s, r++ % num_workers, i))
+      goto out_err;
+  }
+
+  do {
+    /* Idle workers pick up ready tasks */
+    for (w = 0; w < num_workers && s.num_ready; w++) {
+      if (s.workers[w].task != AM_OMPT_TASKGRAPH_NONE) continue;
+
+      if ((next = am_ompt_sim_take(&s, w)) != AM_OMPT_TASKGRAPH_NONE)
+        am_ompt_sim_run(&s, w, next);
+    }
+
+    if (!s.heap_size) break;
+
+    e = am_ompt_sim_heap_pop(&s);
+    s.now = e.time;
+
+    if ((next = am_ompt_sim_step(&s, e.worker)) == UINT32_MAX - 1)
+      goto out_err;
+
+    s.workers[e.worker].task = AM_OMPT_TASKGRAPH_NONE;
+
+    if (next != AM_OMPT_TASKGRAPH_NONE ||
+        (next = am_ompt_sim_take(&s, e.worker)) != AM_OMPT_TASKGRAPH_NONE)
+      am_ompt_sim_run(&s, e.worker, next);
+  } while (1);
+
+  if (s.completed != n) {
+    fprintf(stderr, "%u of %u tasks could not run with %s on %u workers.\n",
+            n - s.completed, n, am_ompt_sim_policy_names[policy],
+            num_workers);
+  }
+
+  for (w = 0; w < num_workers; w++) busy += s.workers[w].busy;
+
+  *makespan = s.now;
+  *idle = (uint64_t)num_workers * s.now - busy;
+
+  am_ompt_sim_free(&s);
+
+  return 0;
+
+out_err:
+  fprintf(stderr, "Could not allocate memory.\n");
+  am_ompt_sim_free(&s);
+
+  return 1;
+}
+
+/* Read the task graph and index the dependences by their source */
+static int am_ompt_sim_load(const char* path) {
+  struct am_ompt_taskgraph_header* h = &am_ompt_sim_header;
+  uint32_t n;
+  FILE* fp;
+
+  if (!(fp = fopen(path, "rb"))) {
+    fprintf(stderr, "Could not open \"%s\".\n", path);
+    return 1;
+  }
+
+  if (fread(h, sizeof(*h), 1, fp) != 1 || h->magic != AM_OMPT_TASKGRAPH_MAGIC ||
+      h->version != AM_OMPT_TASKGRAPH_VERSION) {
+    fprintf(stderr, "\"%s\" is not a task graph.\n", path);
+    goto out_err_close;
+  }
+
+  n = h->num_tasks;
+  am_ompt_sim_tasks = malloc((n ? n : 1) * sizeof(*am_ompt_sim_tasks));
+  am_ompt_sim_actions = malloc((h->num_actions ? h->num_actions : 1) *
+                               sizeof(*am_ompt_sim_actions));
+  am_ompt_sim_deps = malloc((h->num_dependences ? h->num_dependences : 1) *
+                            sizeof(*am_ompt_sim_deps));
+  am_ompt_sim_succ = malloc((h->num_dependences ? h->num_dependences : 1) *
+                            sizeof(*am_ompt_sim_succ));
+  am_ompt_sim_succ_start = calloc(n + 1, sizeof(*am_ompt_sim_succ_start));
+  am_ompt_sim_num_deps = calloc(n ? n : 1, sizeof(*am_ompt_sim_num_deps));
+
+  if (!am_ompt_sim_tasks || !am_ompt_sim_actions || !am_ompt_sim_deps ||
+      !am_ompt_sim_succ || !am_ompt_sim_succ_start || !am_ompt_sim_num_deps) {
+    fprintf(stderr, "Could not allocate memory.\n");
+    goto out_err_close;
+  }
+
+  if (fread(am_ompt_sim_tasks, sizeof(*am_ompt_sim_tasks), n, fp) != n ||
+      fread(am_ompt_sim_actions, sizeof(*am_ompt_sim_actions), h->num_actions,
+            fp) != h->num_actions ||
+      fread(am_ompt_sim_deps, sizeof(*am_ompt_sim_deps), h->num_dependences,
+            fp) != h->num_dependences) {
+    fprintf(stderr, "\"%s\" is truncated.\n", path);
+    goto out_err_close;
+  }
+
+  fclose(fp);
+
+  /* Check references, so the simulation can follow them blindly */
+  for (uint32_t i = 0; i < n; i++) {
+    const struct am_ompt_taskgraph_task* t = &am_ompt_sim_tasks[i];
+
+    if ((t->parent != AM_OMPT_TASKGRAPH_NONE && t->parent >= n) ||
+        t->first_action > h->num_actions ||
+        t->num_actions > h->num_actions - t->first_action)
+      goto out_err_invalid;
+
+    for (uint32_t j = 0; j < t->num_actions; j++) {
+      const struct am_ompt_taskgraph_action* a =
+          &am_ompt_sim_actions[t->first_action + j];
+
+      if (a->kind == AM_OMPT_TASKGRAPH_CREATE &&
+          (a->arg >= n || am_ompt_sim_tasks[a->arg].parent != i))
+        goto out_err_invalid;
+    }
+  }
+
+  for (uint32_t i = 0; i < h->num_dependences; i++) {
+    if (am_ompt_sim_deps[i].src >= n || am_ompt_sim_deps[i].sink >= n)
+      goto out_err_invalid;
+
+    am_ompt_sim_succ_start[am_ompt_sim_deps[i].src + 1]++;
+    am_ompt_sim_num_deps[am_ompt_sim_deps[i].sink]++;
+  }
+
+  for (uint32_t i = 0; i < n; i++)
+    am_ompt_sim_succ_start[i + 1] += am_ompt_sim_succ_start[i];
+
+  /* Fill in the sinks, temporarily advancing the start of each source */
+  for (uint32_t i = 0; i < h->num_dependences; i++)
+    am_ompt_sim_succ[am_ompt_sim_succ_start[am_ompt_sim_deps[i].src]++] =
+        am_ompt_sim_deps[i].sink;
+
+  for (uint32_t i = n; i > 0; i--)
+    am_ompt_sim_succ_start[i] = am_ompt_sim_succ_start[i - 1];
+
+  am_ompt_sim_succ_start[0] = 0;
+
+  return 0;
+
+out_err_invalid:
+  fprintf(stderr, "\"%s\" refers to tasks or actions that do not exist.\n",
+          path);
+  return 1;
+
+out_err_close:
+  fclose(fp);
+  return 1;
+}
+
+/* Default sweep: powers of two up to twice the recorded number of threads,
+   including the recorded number itself */
+static size_t am_ompt_sim_default_sweep(uint32_t* workers) {
+  uint32_t threads = am_ompt_sim_header.num_threads;
+  size_t n = 0;
+
+  if (!threads) threads = 1;
+
+  for (uint32_t p = 1; p < 2 * threads && n < AM_OMPT_SIM_MAX_SWEEP - 2;
+       p *= 2) {
+    if (p > threads && workers[n - 1] < threads) workers[n++] = threads;
+
+    workers[n++] = p;
+  }
+
+  if (workers[n - 1] < threads) workers[n++] = threads;
+
+  workers[n++] = 2 * threads;
+
+  return n;
+}
+
+int main(int argc, char** argv) {
+  uint32_t workers[AM_OMPT_SIM_MAX_SWEEP];
+  int policies[AM_OMPT_SIM_NUM_POLICIES] = {1, 1, 1};
+  uint64_t work = 0, makespan, idle;
+  size_t num_workers = 0;
+  uint32_t roots = 0;
+  int ret = 2, len;
+  char* arg;
+
+  if (argc < 2) {
+    fprintf(stderr,
+            "Usage: %s <task graph> [policy|all] [workers,...] "
+            "[creation overhead]\n",
+            argv[0]);
+    return 2;
+  }
+
+  if (argc > 2 && strcmp(argv[2], "all")) {
+    for (int p = 0; p < AM_OMPT_SIM_NUM_POLICIES; p++)
+      policies[p] = !strcmp(argv[2], am_ompt_sim_policy_names[p]);
+
+    if (!policies[0] && !policies[1] && !policies[2]) {
+      fprintf(stderr, "Unknown policy \"%s\".\n", argv[2]);
+      return 2;
+    }
+  }
+
+  if (argc > 3) {
+    for (arg = argv[3]; *arg && num_workers < AM_OMPT_SIM_MAX_SWEEP;
+         arg += len) {
+      if (sscanf(arg, "%u%n", &workers[num_workers], &len) != 1 ||
+          !workers[num_workers]) {
+        fprintf(stderr, "Invalid number of workers \"%s\".\n", argv[3]);
+        return 2;
+      }
+
+      num_workers++;
+
+      if (arg[len] == ',') len++;
+    }
+  }
+
+  if (argc > 4 && sscanf(argv[4], "%lu", &am_ompt_sim_create_cost) != 1) {
+    fprintf(stderr, "Invalid creation overhead \"%s\".\n", argv[4]);
+    return 2;
+  }
+
+  if (am_ompt_sim_load(argv[1])) goto out;
+
+  if (!num_workers) num_workers = am_ompt_sim_default_sweep(workers);
+
+  for (uint32_t i = 0; i < am_ompt_sim_header.num_tasks; i++) {
+    work += am_ompt_sim_tasks[i].cost;
+    roots += (am_ompt_sim_tasks[i].flags & AM_OMPT_TASKGRAPH_ROOT) != 0;
+  }
+
+  printf("%u tasks created by %u implicit tasks, %u dependences\n",
+         am_ompt_sim_header.num_tasks - roots, roots,
+         am_ompt_sim_header.num_dependences);
+  printf("Recorded on %u threads: span %lu, total work %lu\n\n",
+         am_ompt_sim_header.num_threads, am_ompt_sim_header.span, work);
+  printf("%-14s %8s %16s %8s %7s\n", "policy", "workers", "makespan",
+         "speedup", "idle%");
+
+  for (int p = 0; p < AM_OMPT_SIM_NUM_POLICIES; p++) {
+    if (!policies[p]) continue;
+
+    for (size_t i = 0; i < num_workers; i++) {
+      if (am_ompt_sim_simulate(p, workers[i], &makespan, &idle)) goto out;
+
+      printf("%-14s %8u %16lu %8.2f %6.1f%%\n", am_ompt_sim_policy_names[p],
+             workers[i], makespan, makespan ? (double)work / makespan : 0.0,
+             makespan ? 100.0 * idle / ((double)workers[i] * makespan) : 0.0);
+    }
+  }
+
+  ret = 0;
+
+out:
+  free(am_ompt_sim_num_deps);
+  free(am_ompt_sim_succ_start);
+  free(am_ompt_sim_succ);
+  free(am_ompt_sim_deps);
+  free(am_ompt_sim_actions);
+  free(am_ompt_sim_tasks);
+
+  return ret;
+}
@@ -0,0 +1,694 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+  Validates an Afterompt trace and prints summary statistics without loading
+  it in Aftermath. The trace is mapped into memory, split by event collection
+  in a single pass and the collections are then processed in parallel.
+
+  If the trace has samples, lists the program counters sampled most often
+  together with the kind of state the threads were in.
+
+  Checks per collection that intervals are well-formed and nest, and that
+  every loop with chunks is closed by the marker written at the end of the
+  loop. Checks across collections that every scheduled task was created.
+  If the trace has a time index, checks that it refers to every event once
+  and that its times never decrease.
+  If it has a seek index, checks that its entries refer to events of their
+  collections in order.
+
+  Usage: afterompt-stats <trace> [threads]
+
+  The exit status is non-zero if the trace is malformed.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "reader.h"
+
+enum am_ompt_stats_error {
+  AM_OMPT_STATS_INVALID_INTERVAL = 0,
+  AM_OMPT_STATS_OVERLAPPING_INTERVAL,
+  AM_OMPT_STATS_UNCLOSED_LOOP,
+  AM_OMPT_STATS_MARKER_WITHOUT_LOOP,
+  AM_OMPT_STATS_TASK_NOT_CREATED,
+  AM_OMPT_STATS_NUM_ERRORS
+};
+
+static const char* am_ompt_stats_error_names[AM_OMPT_STATS_NUM_ERRORS] = {
+    "interval ends before it starts",
+    "interval overlaps another interval",
+    "loop chunks without closing marker",
+    "loop marker without loop",
+    "scheduled task was not created"};
+
+/* What the value recorded for the first occurrence of an error is */
+static const char* am_ompt_stats_error_values[AM_OMPT_STATS_NUM_ERRORS] = {
+    "at", "at", "at", "at", "task"};
+
+/* Number of program counters listed in the hot spots */
+#define AM_OMPT_STATS_HOT_SPOTS 20
+
+/* Names of the state kinds recorded in samples, in the order of
+   enum am_ompt_state_kind in trace.h */
+static const char* am_ompt_stats_state_names[] = {
+    "thread", "parallel",    "implicit_task", "sync_region_wait", "work",
+    "master", "sync_region", "nest_lock",     "loop"};
+
+#define AM_OMPT_STATS_NUM_STATES \
+  (sizeof(am_ompt_stats_state_names) / sizeof(am_ompt_stats_state_names[0]))
+
+/* Sampled program counter in a kind of state, and number of samples */
+struct am_ompt_stats_sample {
+  uint64_t pc;
+  int64_t kind;
+  uint64_t count;
+};
+
+/* Growable array of 64-bit values */
+struct am_ompt_stats_array {
+  uint64_t* values;
+  size_t num;
+  size_t max;
+};
+
+/* Interval that may still turn out to have enclosing intervals */
+struct am_ompt_stats_open {
+  uint64_t start;
+  uint64_t end;
+};
+
+struct am_ompt_stats_collection {
+  struct am_ompt_reader_collection* rc;
+  uint64_t count[AM_OMPT_NUM_EVENTS + 1];
+  /* Exclusive time of interval events, i.e. without nested intervals and
+     without the tool time recorded for them */
+  uint64_t time[AM_OMPT_NUM_EVENTS];
+  /* Tool time subtracted from the exclusive time of interval events */
+  uint64_t tool_time[AM_OMPT_NUM_EVENTS];
+  /* Type and exclusive time of the last interval, which tool time events
+     written right after it refer to */
+  int last_interval;
+  uint64_t last_exclusive;
+  uint64_t first;
+  uint64_t last;
+  uint64_t errors[AM_OMPT_STATS_NUM_ERRORS];
+  /* Timestamp or task id of the first occurrence of each error */
+  uint64_t error_value[AM_OMPT_STATS_NUM_ERRORS];
+  /* Ids of created tasks and loops, and ids of scheduled tasks */
+  struct am_ompt_stats_array created;
+  struct am_ompt_stats_array scheduled;
+  /* Program counter and state kind of each sample */
+  struct am_ompt_stats_array samples;
+  int failed;
+};
+
+static struct am_ompt_reader am_ompt_stats_reader;
+static struct am_ompt_stats_collection* am_ompt_stats_collections;
+static size_t am_ompt_stats_next;
+
+static int am_ompt_stats_push(struct am_ompt_stats_array* a, uint64_t v) {
+  if (a->num == a->max) {
+    size_t max = a->max ? 2 * a->max : 256;
+    uint64_t* values = realloc(a->values, max * sizeof(*values));
+
+    if (!values) return 1;
+
+    a->values = values;
+    a->max = max;
+  }
+
+  a->values[a->num++] = v;
+
+  return 0;
+}
+
+static int am_ompt_stats_cmp(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+
+  return (x > y) - (x < y);
+}
+
+static void am_ompt_stats_error(struct am_ompt_stats_collection* s,
+                                enum am_ompt_stats_error error,
+                                uint64_t value) {
+  if (!s->errors[error]++) s->error_value[error] = value;
+}
+
+/* Intervals are written when they end, so a new interval encloses all open
+   intervals that start after it and has to start after the others end. */
+static int am_ompt_stats_interval(struct am_ompt_stats_collection* s,
+                                  struct am_ompt_stats_open** stack,
+                                  size_t* depth, size_t* max_depth,
+                                  const struct am_ompt_event* e) {
+  uint64_t nested = 0;
+
+  if (e->start > e->end) {
+    am_ompt_stats_error(s, AM_OMPT_STATS_INVALID_INTERVAL, e->end);
+    return 0;
+  }
+
+  while (*depth && (*stack)[*depth - 1].start >= e->start) {
+    struct am_ompt_stats_open* o = &(*stack)[--*depth];
+
+    if (o->end > e->end)
+      am_ompt_stats_error(s, AM_OMPT_STATS_OVERLAPPING_INTERVAL, e->start);
+    else
+      nested += o->end - o->start;
+  }
+
+  if (*depth && (*stack)[*depth - 1].end > e->start)
+    am_ompt_stats_error(s, AM_OMPT_STATS_OVERLAPPING_INTERVAL, e->start);
+
+  if (*depth == *max_depth) {
+    size_t max = *max_depth ? 2 * *max_depth : 64;
+    struct am_ompt_stats_open* o = realloc(*stack, max * sizeof(*o));
+
+    if (!o) return 1;
+
+    *stack = o;
+    *max_depth = max;
+  }
+
+  (*stack)[*depth].start = e->start;
+  (*stack)[*depth].end = e->end;
+  (*depth)++;
+
+  s->last_interval = e->type;
+  s->last_exclusive = 0;
+
+  if (nested <= e->end - e->start) {
+    s->last_exclusive = e->end - e->start - nested;
+    s->time[e->type] += s->last_exclusive;
+  }
+
+  return 0;
+}
+
+/* Subtract the tool time of an interval from its exclusive time */
+static void am_ompt_stats_tool_time(struct am_ompt_stats_collection* s,
+                                    const struct am_ompt_event* e) {
+  uint32_t id = e->tool_time.type_id;
+  uint64_t d = e->tool_time.duration;
+
+  if (s->last_interval < 0 || id >= am_ompt_stats_reader.num_types ||
+      am_ompt_stats_reader.types[id].event != s->last_interval)
+    return;
+
+  if (d > s->last_exclusive) d = s->last_exclusive;
+
+  s->time[s->last_interval] -= d;
+  s->tool_time[s->last_interval] += d;
+  s->last_exclusive -= d;
+}
+
+static int am_ompt_stats_process(struct am_ompt_stats_collection* s) {
+  struct am_ompt_reader_collection* rc = s->rc;
+  struct am_ompt_stats_open* stack = NULL;
+  size_t depth = 0, max_depth = 0;
+  /* Loops with chunks that were not closed yet */
+  struct am_ompt_stats_array loops = {NULL, 0, 0};
+  /* Instance id of the last loop event, closed by the next marker */
+  uint64_t last_loop = 0;
+  int have_loop = 0;
+  struct am_ompt_event e;
+
+  s->first = UINT64_MAX;
+  s->last_interval = -1;
+
+  for (size_t i = 0; i < rc->num_ranges; i++) {
+    size_t off = rc->ranges[i].start;
+
+    while (am_ompt_reader_next(&am_ompt_stats_reader, &off, rc->ranges[i].end,
+                               &e)) {
+      s->count[e.type]++;
+
+      if (e.start < s->first) s->first = e.start;
+      if (e.end > s->last) s->last = e.end;
+
+      if (am_ompt_event_is_interval[e.type]) {
+        if (am_ompt_stats_interval(s, &stack, &depth, &max_depth, &e))
+          goto out_err;
+      }
+
+      if (e.type == AM_OMPT_EVENT_TOOL_TIME) {
+        am_ompt_stats_tool_time(s, &e);
+        continue;
+      }
+
+      /* Samples are written between a loop and its marker as well */
+      if (e.type == AM_OMPT_EVENT_SAMPLE) {
+        if (am_ompt_stats_push(&s->samples, e.sample.pc) ||
+            am_ompt_stats_push(&s->samples, (int64_t)e.sample.kind))
+          goto out_err;
+        continue;
+      }
+
+      switch (e.type) {
+        case AM_OMPT_EVENT_TASK_CREATE:
+          if (am_ompt_stats_push(&s->created, e.task_create.new_task_id))
+            goto out_err;
+          break;
+        case AM_OMPT_EVENT_TASK_SCHEDULE:
+          if (e.task_schedule.next_task_id &&
+              am_ompt_stats_push(&s->scheduled, e.task_schedule.next_task_id))
+            goto out_err;
+          break;
+        case AM_OMPT_EVENT_LOOP:
+          /* Loops use the id of the implicit task, which may be scheduled */
+          if (am_ompt_stats_push(&s->created, e.loop.instance_id))
+            goto out_err;
+
+          last_loop = e.loop.instance_id;
+          have_loop = 1;
+          continue;
+        case AM_OMPT_EVENT_LOOP_CHUNK:
+          if (e.loop_chunk.is_last) {
+            if (!have_loop || last_loop != e.loop_chunk.instance_id) {
+              am_ompt_stats_error(s, AM_OMPT_STATS_MARKER_WITHOUT_LOOP,
+                                  e.start);
+            }
+
+            for (size_t l = 0; l < loops.num; l++) {
+              if (loops.values[l] == e.loop_chunk.instance_id)
+                loops.values[l] = loops.values[--loops.num];
+            }
+          } else {
+            size_t l = 0;
+
+            while (l < loops.num && loops.values[l] != e.loop_chunk.instance_id)
+              l++;
+
+            if (l == loops.num &&
+                am_ompt_stats_push(&loops, e.loop_chunk.instance_id))
+              goto out_err;
+          }
+          break;
+      }
+
+      have_loop = 0;
+    }
+  }
+
+  for (size_t l = 0; l < loops.num; l++)
+    am_ompt_stats_error(s, AM_OMPT_STATS_UNCLOSED_LOOP, s->last);
+
+  free(loops.values);
+  free(stack);
+
+  return 0;
+
+out_err:
+  free(loops.values);
+  free(stack);
+
+  return 1;
+}
+
+static void* am_ompt_stats_worker(void* arg) {
+  size_t i;
+
+  while ((i = __atomic_fetch_add(&am_ompt_stats_next, 1, __ATOMIC_RELAXED)) <
+         am_ompt_stats_reader.num_collections) {
+    if (am_ompt_stats_process(&am_ompt_stats_collections[i])) {
+      fprintf(stderr, "Out of memory while processing collection %u.\n",
+              am_ompt_stats_collections[i].rc->id);
+      am_ompt_stats_collections[i].failed = 1;
+    }
+  }
+
+  return NULL;
+}
+
+/* Check the scheduled tasks of all collections against the created ones */
+static int am_ompt_stats_check_tasks(size_t n) {
+  struct am_ompt_stats_array created = {NULL, 0, 0};
+
+  for (size_t i = 0; i < n; i++) {
+    struct am_ompt_stats_array* a = &am_ompt_stats_collections[i].created;
+
+    for (size_t j = 0; j < a->num; j++) {
+      if (am_ompt_stats_push(&created, a->values[j])) {
+        free(created.values);
+        return 1;
+      }
+    }
+  }
+
+  qsort(created.values, created.num, sizeof(uint64_t), am_ompt_stats_cmp);
+
+  for (size_t i = 0; i < n; i++) {
+    struct am_ompt_stats_collection* s = &am_ompt_stats_collections[i];
+
+    for (size_t j = 0; j < s->scheduled.num; j++) {
+      if (!bsearch(&s->scheduled.values[j], created.values, created.num,
+                   sizeof(uint64_t), am_ompt_stats_cmp)) {
+        am_ompt_stats_error(s, AM_OMPT_STATS_TASK_NOT_CREATED,
+                            s->scheduled.values[j]);
+      }
+    }
+  }
+
+  free(created.values);
+
+  return 0;
+}
+
+static void am_ompt_stats_print(size_t n) {
+  uint64_t count[AM_OMPT_NUM_EVENTS + 1] = {0};
+  uint64_t errors[AM_OMPT_STATS_NUM_ERRORS] = {0};
+  uint64_t total = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    struct am_ompt_stats_collection* s = &am_ompt_stats_collections[i];
+    uint64_t span = s->last > s->first ? s->last - s->first : 0;
+    uint64_t events = 0;
+
+    for (int t = 0; t <= AM_OMPT_NUM_EVENTS; t++) {
+      count[t] += s->count[t];
+      events += s->count[t];
+    }
+
+    total += events;
+
+    printf("Collection %u (%s): %lu events, %lu core migrations, %lu cycles\n",
+           s->rc->id, s->rc->name ? s->rc->name : "unnamed", events,
+           s->count[AM_OMPT_EVENT_COUNTER], span);
+
+    for (int t = 0; t < AM_OMPT_NUM_EVENTS; t++) {
+      if (!s->time[t] && !s->tool_time[t]) continue;
+
+      printf("  %-20s %14lu cycles %6.2f%%", am_ompt_event_names[t],
+             s->time[t], span ? 100.0 * s->time[t] / span : 0.0);
+
+      if (s->tool_time[t])
+        printf(" (%lu cycles of tool time removed)", s->tool_time[t]);
+
+      printf("\n");
+    }
+  }
+
+  printf("\nEvents\n");
+
+  for (int t = 0; t <= AM_OMPT_NUM_EVENTS; t++) {
+    if (count[t]) printf("  %-20s %14lu\n", am_ompt_event_names[t], count[t]);
+  }
+
+  printf("  %-20s %14lu\n", "total", total);
+
+  for (size_t i = 0; i < n; i++) {
+    for (int k = 0; k < AM_OMPT_STATS_NUM_ERRORS; k++)
+      errors[k] += am_ompt_stats_collections[i].errors[k];
+  }
+
+  printf("\nValidation\n");
+
+  for (int k = 0; k < AM_OMPT_STATS_NUM_ERRORS; k++) {
+    printf("  %-40s %10lu\n", am_ompt_stats_error_names[k], errors[k]);
+
+    for (size_t i = 0; i < n && errors[k]; i++) {
+      struct am_ompt_stats_collection* s = &am_ompt_stats_collections[i];
+
+      if (s->errors[k]) {
+        printf("    collection %u: %lu, first %s %lu\n", s->rc->id,
+               s->errors[k], am_ompt_stats_error_values[k], s->error_value[k]);
+      }
+    }
+  }
+}
+
+/* Check that the time index refers to each event of the trace. Returns the
+   number of invalid entries. */
+static int am_ompt_stats_cmp_sample(const void* a, const void* b) {
+  const struct am_ompt_stats_sample* x = a;
+  const struct am_ompt_stats_sample* y = b;
+
+  if (x->pc != y->pc) return (x->pc > y->pc) - (x->pc < y->pc);
+
+  return (x->kind > y->kind) - (x->kind < y->kind);
+}
+
+static int am_ompt_stats_cmp_sample_count(const void* a, const void* b) {
+  const struct am_ompt_stats_sample* x = a;
+  const struct am_ompt_stats_sample* y = b;
+
+  return (x->count < y->count) - (x->count > y->count);
+}
+
+/* Print the program counters sampled most often in each kind of state */
+static int am_ompt_stats_print_samples(size_t n) {
+  struct am_ompt_stats_sample* samples;
+  size_t num = 0, runs = 0;
+
+  for (size_t i = 0; i < n; i++)
+    num += am_ompt_stats_collections[i].samples.num / 2;
+
+  if (!num) return 0;
+
+  if (!(samples = malloc(num * sizeof(*samples)))) return 1;
+
+  num = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    struct am_ompt_stats_array* a = &am_ompt_stats_collections[i].samples;
+
+    for (size_t j = 0; j + 1 < a->num; j += 2) {
+      samples[num].pc = a->values[j];
+      samples[num].kind = (int64_t)a->values[j + 1];
+      samples[num].count = 1;
+      num++;
+    }
+  }
+
+  qsort(samples, num, sizeof(*samples), am_ompt_stats_cmp_sample);
+
+  /* Merge equal samples into the first of them */
+  for (size_t i = 0; i < num; i++) {
+    if (runs && samples[runs - 1].pc == samples[i].pc &&
+        samples[runs - 1].kind == samples[i].kind)
+      samples[runs - 1].count++;
+    else
+      samples[runs++] = samples[i];
+  }
+
+  qsort(samples, runs, sizeof(*samples), am_ompt_stats_cmp_sample_count);
+
+  printf("\nHot spots (%lu samples)\n", num);
+
+  for (size_t i = 0; i < runs && i < AM_OMPT_STATS_HOT_SPOTS; i++) {
+    int64_t kind = samples[i].kind;
+
+    printf("  0x%016lx %-20s %10lu %6.2f%%\n", samples[i].pc,
+           (kind >= 0 && kind < (int64_t)AM_OMPT_STATS_NUM_STATES)
+               ? am_ompt_stats_state_names[kind]
+               : "none",
+           samples[i].count, 100.0 * samples[i].count / num);
+  }
+
+  free(samples);
+
+  return 0;
+}
+
+static uint64_t am_ompt_stats_check_index(uint64_t num_events) {
+  struct am_ompt_reader* r = &am_ompt_stats_reader;
+  struct am_ompt_index_entry entry;
+  struct am_ompt_event e;
+  uint64_t invalid = 0, unordered = 0, last = 0;
+
+  for (uint64_t i = 0; i < r->num_index_entries; i++) {
+    am_ompt_reader_index_entry(r, i, &entry);
+
+    if (!am_ompt_reader_index_event(r, i, &e) ||
+        e.collection_id != entry.collection_id || e.end != entry.time) {
+      invalid++;
+      continue;
+    }
+
+    if (entry.time < last) unordered++;
+
+    last = entry.time;
+  }
+
+  printf("\nTime index\n");
+  printf("  %-40s %10lu\n", "entries", r->num_index_entries);
+  printf("  %-40s %10lu\n", "entries out of time order", unordered);
+  printf("  %-40s %10lu\n", "entries not referring to an event", invalid);
+
+  if (r->num_index_entries != num_events) {
+    printf("  Index has %lu entries for %lu events\n", r->num_index_entries,
+           num_events);
+    invalid++;
+  }
+
+  return invalid + unordered;
+}
+
+static uint64_t am_ompt_stats_check_seek(void) {
+  struct am_ompt_reader* r = &am_ompt_stats_reader;
+  struct am_ompt_seek_entry entry, last = {0, 0, 0, 0};
+  struct am_ompt_event e;
+  uint64_t invalid = 0, unordered = 0;
+
+  for (uint64_t i = 0; i < r->num_seek_entries; i++) {
+    struct am_ompt_reader_collection* c = NULL;
+    int found = 0;
+
+    am_ompt_reader_seek_entry(r, i, &entry);
+
+    if (i && (entry.collection_id < last.collection_id ||
+              (entry.collection_id == last.collection_id &&
+               entry.time < last.time)))
+      unordered++;
+
+    last = entry;
+
+    for (size_t j = 0; j < r->num_collections && !c; j++) {
+      if (r->collections[j].id == entry.collection_id) c = &r->collections[j];
+    }
+
+    for (size_t j = 0; c && j < c->num_ranges && !found; j++) {
+      size_t off = entry.offset;
+
+      if (off >= c->ranges[j].start && off < c->ranges[j].end)
+        found = am_ompt_reader_next(r, &off, c->ranges[j].end, &e);
+    }
+
+    if (!found) invalid++;
+  }
+
+  printf("\nSeek index\n");
+  printf("  %-40s %10lu\n", "entries", r->num_seek_entries);
+  printf("  %-40s %10lu\n", "entries out of order", unordered);
+  printf("  %-40s %10lu\n", "entries not referring to an event", invalid);
+
+  return invalid + unordered;
+}
+
+int main(int argc, char** argv) {
+  struct am_ompt_reader* r = &am_ompt_stats_reader;
+  long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  pthread_t* threads;
+  int ret = 0;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <trace> [threads]\n", argv[0]);
+    return 2;
+  }
+
+  if (argc > 2) sscanf(argv[2], "%ld", &num_threads);
+
+  if (am_ompt_reader_open(r, argv[1])) return 2;
+
+  printf("Trace %s: version %u, %zu bytes, %lu frames, %zu collections\n\n",
+         argv[1], r->version, r->size, r->num_frames, r->num_collections);
+
+  if (num_threads < 1) num_threads = 1;
+  if ((size_t)num_threads > r->num_collections)
+    num_threads = r->num_collections;
+
+  am_ompt_stats_collections =
+      calloc(r->num_collections, sizeof(*am_ompt_stats_collections));
+  threads = calloc(num_threads, sizeof(*threads));
+
+  if ((r->num_collections && !am_ompt_stats_collections) ||
+      (num_threads && !threads)) {
+    fprintf(stderr, "Could not allocate memory.\n");
+    goto out_err;
+  }
+
+  for (size_t i = 0; i < r->num_collections; i++)
+    am_ompt_stats_collections[i].rc = &r->collections[i];
+
+  for (long t = 0; t < num_threads; t++) {
+    if (pthread_create(&threads[t], NULL, am_ompt_stats_worker, NULL)) {
+      fprintf(stderr, "Could not create thread %ld.\n", t);
+      num_threads = t;
+      ret = 2;
+      break;
+    }
+  }
+
+  for (long t = 0; t < num_threads; t++) pthread_join(threads[t], NULL);
+
+  /* Collections not picked up by a failed thread */
+  if (ret) am_ompt_stats_worker(NULL);
+
+  for (size_t i = 0; i < r->num_collections; i++) {
+    if (am_ompt_stats_collections[i].failed) goto out_err;
+  }
+
+  if (am_ompt_stats_check_tasks(r->num_collections)) {
+    fprintf(stderr, "Could not allocate memory.\n");
+    goto out_err;
+  }
+
+  am_ompt_stats_print(r->num_collections);
+
+  if (am_ompt_stats_print_samples(r->num_collections)) {
+    fprintf(stderr, "Could not allocate memory.\n");
+    goto out_err;
+  }
+
+  if (r->index) {
+    uint64_t num_events = 0;
+
+    for (size_t i = 0; i < r->num_collections; i++) {
+      for (int t = 0; t <= AM_OMPT_NUM_EVENTS; t++)
+        num_events += am_ompt_stats_collections[i].count[t];
+    }
+
+    if (am_ompt_stats_check_index(num_events)) ret = 1;
+  }
+
+  if (r->seek && am_ompt_stats_check_seek()) ret = 1;
+
+  if (r->error_offset) {
+    printf("\nTrace is malformed at offset %zu: %s\n", r->error_offset,
+           r->error);
+    ret = 1;
+  }
+
+  for (size_t i = 0; i < r->num_collections; i++) {
+    for (int k = 0; k < AM_OMPT_STATS_NUM_ERRORS; k++) {
+      if (am_ompt_stats_collections[i].errors[k]) ret = 1;
+    }
+
+    free(am_ompt_stats_collections[i].created.values);
+    free(am_ompt_stats_collections[i].scheduled.values);
+    free(am_ompt_stats_collections[i].samples.values);
+  }
+
+  free(am_ompt_stats_collections);
+  free(threads);
+  am_ompt_reader_close(r);
+
+  return ret;
+
+out_err:
+  free(am_ompt_stats_collections);
+  free(threads);
+  am_ompt_reader_close(r);
+
+  return 2;
+}
@@ -0,0 +1,521 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+  Extracts the graph of the explicit tasks of an Afterompt trace for
+  afterompt-simulate, in the format described in taskgraph.h.
+
+  Tasks and the tasks that created them are taken from the task creation
+  events and dependences from the task dependence events. The task schedule
+  events of each thread give the execution time of each task, without the
+  time it was suspended, and the execution time at which it created each
+  child and was suspended. A suspension is assumed to wait for the children
+  created so far, as at a taskwait.
+
+  Usage: afterompt-taskgraph <trace> <output>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reader.h"
+#include "taskgraph.h"
+
+/* Values of ompt_task_status_t */
+#define AM_OMPT_TASK_COMPLETE 1
+#define AM_OMPT_TASK_CANCEL 3
+#define AM_OMPT_TASK_DETACH 4
+
+/* Task with the state needed while the graph is built */
+struct am_ompt_tg_task {
+  struct am_ompt_taskgraph_task t;
+  /* Id of the creating task, zero if it was an implicit task */
+  uint64_t parent_id;
+  /* Index of the creating event collection and time of the creation */
+  uint32_t creator;
+  uint64_t created;
+  /* Execution time so far */
+  uint64_t elapsed;
+};
+
+/* Action of a task and the order in which it was found */
+struct am_ompt_tg_action {
+  uint32_t task;
+  uint64_t seq;
+  struct am_ompt_taskgraph_action a;
+};
+
+/* Task creation by the implicit task of a collection */
+struct am_ompt_tg_root {
+  uint32_t task;
+  uint64_t first;
+  uint64_t last;
+};
+
+/* Entry of the table mapping task ids to indexes, empty if id is zero */
+struct am_ompt_tg_slot {
+  uint64_t id;
+  uint32_t index;
+};
+
+static struct am_ompt_reader am_ompt_tg_reader;
+
+static struct am_ompt_tg_task* am_ompt_tg_tasks;
+static size_t am_ompt_tg_num_tasks;
+static size_t am_ompt_tg_max_tasks;
+
+static struct am_ompt_tg_action* am_ompt_tg_actions;
+static size_t am_ompt_tg_num_actions;
+static size_t am_ompt_tg_max_actions;
+
+/* Source and sink ids of the dependences */
+static uint64_t* am_ompt_tg_dep_ids;
+static size_t am_ompt_tg_num_deps;
+static size_t am_ompt_tg_max_deps;
+
+static struct am_ompt_tg_slot* am_ompt_tg_slots;
+static size_t am_ompt_tg_num_slots;
+
+/* Root of each event collection, indexed like the reader's collections */
+static struct am_ompt_tg_root* am_ompt_tg_roots;
+
+/* First creation and last completion of a task */
+static uint64_t am_ompt_tg_first = UINT64_MAX;
+static uint64_t am_ompt_tg_last;
+
+/* Number of collections that created or executed explicit tasks */
+static uint32_t am_ompt_tg_num_threads;
+
+/* Make room for one more element in a growing array */
+static int am_ompt_tg_reserve(void** array, size_t* max, size_t num,
+                              size_t size) {
+  void* grown;
+  size_t n = *max ? 2 * *max : 1024;
+
+  if (num < *max) return 0;
+
+  if (!(grown = realloc(*array, n * size))) return 1;
+
+  *array = grown;
+  *max = n;
+
+  return 0;
+}
+
+static inline size_t am_ompt_tg_hash(uint64_t id) {
+  id ^= id >> 33;
+  id *= 0xff51afd7ed558ccdULL;
+  id ^= id >> 33;
+
+  return id & (am_ompt_tg_num_slots - 1);
+}
+
+static struct am_ompt_tg_slot* am_ompt_tg_slot(uint64_t id) {
+  size_t i = am_ompt_tg_hash(id);
+
+  while (am_ompt_tg_slots[i].id && am_ompt_tg_slots[i].id != id)
+    i = (i + 1) & (am_ompt_tg_num_slots - 1);
+
+  return &am_ompt_tg_slots[i];
+}
+
+/* Index of the task with the given id, AM_OMPT_TASKGRAPH_NONE if unknown */
+static uint32_t am_ompt_tg_lookup(uint64_t id) {
+  struct am_ompt_tg_slot* s;
+
+  if (!id || !am_ompt_tg_num_slots) return AM_OMPT_TASKGRAPH_NONE;
+
+  s = am_ompt_tg_slot(id);
+
+  return s->id ? s->index : AM_OMPT_TASKGRAPH_NONE;
+}
+
+/* Map a task id to an index, keeping the load factor below one half */
+static int am_ompt_tg_insert(uint64_t id, uint32_t index) {
+  struct am_ompt_tg_slot* old = am_ompt_tg_slots;
+  size_t old_num = am_ompt_tg_num_slots;
+  struct am_ompt_tg_slot* s;
+
+  if (2 * (index + 1) > am_ompt_tg_num_slots) {
+    am_ompt_tg_num_slots = old_num ? 2 * old_num : 1024;
+
+    if (!(am_ompt_tg_slots =
+              calloc(am_ompt_tg_num_slots, sizeof(*am_ompt_tg_slots)))) {
+      am_ompt_tg_slots = old;
+      am_ompt_tg_num_slots = old_num;
+      return 1;
+    }
+
+    for (size_t i = 0; i < old_num; i++) {
+      if (old[i].id) *am_ompt_tg_slot(old[i].id) = old[i];
+    }
+
+    free(old);
+  }
+
+  s = am_ompt_tg_slot(id);
+  s->id = id;
+  s->index = index;
+
+  return 0;
+}
+
+static struct am_ompt_tg_task* am_ompt_tg_add_task() {
+  struct am_ompt_tg_task* t;
+
+  if (am_ompt_tg_num_tasks == AM_OMPT_TASKGRAPH_NONE ||
+      am_ompt_tg_reserve((void**)&am_ompt_tg_tasks, &am_ompt_tg_max_tasks,
+                         am_ompt_tg_num_tasks, sizeof(*am_ompt_tg_tasks)))
+    return NULL;
+
+  t = &am_ompt_tg_tasks[am_ompt_tg_num_tasks++];
+  memset(t, 0, sizeof(*t));
+  t->t.parent = AM_OMPT_TASKGRAPH_NONE;
+
+  return t;
+}
+
+static int am_ompt_tg_add_action(uint32_t task, uint64_t offset,
+                                 uint32_t kind, uint32_t arg) {
+  struct am_ompt_tg_action* a;
+
+  if (am_ompt_tg_reserve((void**)&am_ompt_tg_actions, &am_ompt_tg_max_actions,
+                         am_ompt_tg_num_actions, sizeof(*am_ompt_tg_actions)))
+    return 1;
+
+  a = &am_ompt_tg_actions[am_ompt_tg_num_actions];
+  a->task = task;
+  a->seq = am_ompt_tg_num_actions++;
+  a->a.offset = offset;
+  a->a.kind = kind;
+  a->a.arg = arg;
+
+  return 0;
+}
+
+/* Collect the tasks and dependences of a collection */
+static int am_ompt_tg_collect(size_t c) {
+  struct am_ompt_reader_collection* rc = &am_ompt_tg_reader.collections[c];
+  struct am_ompt_tg_task* t;
+  struct am_ompt_event e;
+
+  for (size_t i = 0; i < rc->num_ranges; i++) {
+    size_t off = rc->ranges[i].start;
+
+    while (am_ompt_reader_next(&am_ompt_tg_reader, &off, rc->ranges[i].end,
+                               &e)) {
+      if (e.type == AM_OMPT_EVENT_TASK_CREATE) {
+        /* Tasks created twice, e.g. with reused ids, keep the first index */
+        if (am_ompt_tg_lookup(e.task_create.new_task_id) !=
+            AM_OMPT_TASKGRAPH_NONE)
+          continue;
+
+        if (!(t = am_ompt_tg_add_task()) ||
+            am_ompt_tg_insert(e.task_create.new_task_id,
+                              am_ompt_tg_num_tasks - 1))
+          return 1;
+
+        t->t.id = e.task_create.new_task_id;
+        t->t.codeptr_ra = e.task_create.codeptr_ra;
+        t->parent_id = e.task_create.current_task_id;
+        t->creator = c;
+        t->created = e.start;
+      } else if (e.type == AM_OMPT_EVENT_TASK_DEPENDENCE) {
+        if (am_ompt_tg_reserve((void**)&am_ompt_tg_dep_ids,
+                               &am_ompt_tg_max_deps, am_ompt_tg_num_deps,
+                               2 * sizeof(*am_ompt_tg_dep_ids)))
+          return 1;
+
+        am_ompt_tg_dep_ids[2 * am_ompt_tg_num_deps] =
+            e.task_dependence.src_task_id;
+        am_ompt_tg_dep_ids[2 * am_ompt_tg_num_deps + 1] =
+            e.task_dependence.sink_task_id;
+        am_ompt_tg_num_deps++;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/*
+  Attach each task to its creating task or to the root of the collection
+  that created it if it was created by an implicit task
+*/
+static int am_ompt_tg_link() {
+  struct am_ompt_tg_task* t;
+  struct am_ompt_tg_root* root;
+  size_t n = am_ompt_tg_num_tasks;
+
+  for (size_t i = 0; i < n; i++) {
+    t = &am_ompt_tg_tasks[i];
+
+    if (t->created < am_ompt_tg_first) am_ompt_tg_first = t->created;
+
+    if ((t->t.parent = am_ompt_tg_lookup(t->parent_id)) !=
+        AM_OMPT_TASKGRAPH_NONE)
+      continue;
+
+    root = &am_ompt_tg_roots[t->creator];
+
+    if (root->task == AM_OMPT_TASKGRAPH_NONE) {
+      if (!am_ompt_tg_add_task()) return 1;
+
+      /* The array may have moved */
+      t = &am_ompt_tg_tasks[i];
+      root->task = am_ompt_tg_num_tasks - 1;
+      am_ompt_tg_tasks[root->task].t.flags = AM_OMPT_TASKGRAPH_ROOT;
+      root->first = t->created;
+    }
+
+    t->t.parent = root->task;
+
+    if (t->created < root->first) root->first = t->created;
+    if (t->created > root->last) root->last = t->created;
+  }
+
+  for (size_t c = 0; c < am_ompt_tg_reader.num_collections; c++) {
+    root = &am_ompt_tg_roots[c];
+
+    if (root->task != AM_OMPT_TASKGRAPH_NONE)
+      am_ompt_tg_tasks[root->task].t.cost = root->last - root->first;
+  }
+
+  return 0;
+}
+
+/*
+  Follow the execution of the tasks on a collection and record the actions
+  of the tasks at their execution time
+*/
+static int am_ompt_tg_execute(size_t c) {
+  struct am_ompt_reader_collection* rc = &am_ompt_tg_reader.collections[c];
+  uint32_t current = AM_OMPT_TASKGRAPH_NONE, index, prior, next;
+  struct am_ompt_tg_task *t, *p;
+  uint64_t start = 0, offset;
+  struct am_ompt_event e;
+  int32_t status;
+  int active = 0;
+
+  for (size_t i = 0; i < rc->num_ranges; i++) {
+    size_t off = rc->ranges[i].start;
+
+    while (am_ompt_reader_next(&am_ompt_tg_reader, &off, rc->ranges[i].end,
+                               &e)) {
+      if (e.type == AM_OMPT_EVENT_TASK_CREATE) {
+        index = am_ompt_tg_lookup(e.task_create.new_task_id);
+        t = &am_ompt_tg_tasks[index];
+
+        /* Only the creation that was kept */
+        if (t->creator != c || t->created != e.start) continue;
+
+        active = 1;
+        p = &am_ompt_tg_tasks[t->t.parent];
+
+        if (p->t.flags & AM_OMPT_TASKGRAPH_ROOT)
+          offset = e.start - am_ompt_tg_roots[c].first;
+        else if (t->t.parent == current && e.start > start)
+          offset = p->elapsed + (e.start - start);
+        else
+          offset = p->elapsed;
+
+        if (am_ompt_tg_add_action(t->t.parent, offset,
+                                  AM_OMPT_TASKGRAPH_CREATE, index))
+          return 1;
+      } else if (e.type == AM_OMPT_EVENT_TASK_SCHEDULE) {
+        prior = am_ompt_tg_lookup(e.task_schedule.prior_task_id);
+        next = am_ompt_tg_lookup(e.task_schedule.next_task_id);
+        status = e.task_schedule.prior_task_status;
+
+        if (prior != AM_OMPT_TASKGRAPH_NONE && prior == current) {
+          p = &am_ompt_tg_tasks[prior];
+          p->elapsed += e.start > start ? e.start - start : 0;
+
+          if (status == AM_OMPT_TASK_COMPLETE ||
+              status == AM_OMPT_TASK_CANCEL ||
+              status == AM_OMPT_TASK_DETACH) {
+            if (e.start > am_ompt_tg_last) am_ompt_tg_last = e.start;
+          } else if (am_ompt_tg_add_action(prior, p->elapsed,
+                                           AM_OMPT_TASKGRAPH_WAIT, 0)) {
+            return 1;
+          }
+        }
+
+        active |= (next != AM_OMPT_TASKGRAPH_NONE);
+        current = next;
+        start = e.start;
+      }
+    }
+  }
+
+  am_ompt_tg_num_threads += active;
+
+  return 0;
+}
+
+static int am_ompt_tg_cmp_action(const void* a, const void* b) {
+  const struct am_ompt_tg_action* aa = a;
+  const struct am_ompt_tg_action* ab = b;
+
+  if (aa->task != ab->task) return aa->task < ab->task ? -1 : 1;
+
+  if (aa->a.offset != ab->a.offset) return aa->a.offset < ab->a.offset ? -1 : 1;
+
+  return (aa->seq > ab->seq) - (aa->seq < ab->seq);
+}
+
+static int am_ompt_tg_write(const char* path) {
+  struct am_ompt_taskgraph_header h = {0};
+  struct am_ompt_taskgraph_dependence d;
+  struct am_ompt_tg_task* t;
+  FILE* fp;
+
+  /* Lay out the actions of each task contiguously */
+  qsort(am_ompt_tg_actions, am_ompt_tg_num_actions,
+        sizeof(*am_ompt_tg_actions), am_ompt_tg_cmp_action);
+
+  for (size_t i = am_ompt_tg_num_actions; i > 0; i--) {
+    t = &am_ompt_tg_tasks[am_ompt_tg_actions[i - 1].task];
+    t->t.first_action = i - 1;
+    t->t.num_actions++;
+  }
+
+  if (!(fp = fopen(path, "wb"))) {
+    fprintf(stderr, "Could not open \"%s\".\n", path);
+    return 1;
+  }
+
+  h.magic = AM_OMPT_TASKGRAPH_MAGIC;
+  h.version = AM_OMPT_TASKGRAPH_VERSION;
+  h.num_tasks = am_ompt_tg_num_tasks;
+  h.num_actions = am_ompt_tg_num_actions;
+  h.num_threads = am_ompt_tg_num_threads;
+  h.span = am_ompt_tg_last > am_ompt_tg_first
+               ? am_ompt_tg_last - am_ompt_tg_first
+               : 0;
+
+  /* Dependences between tasks that are not in the trace are left out */
+  for (size_t i = 0; i < am_ompt_tg_num_deps; i++) {
+    if (am_ompt_tg_lookup(am_ompt_tg_dep_ids[2 * i]) !=
+            AM_OMPT_TASKGRAPH_NONE &&
+        am_ompt_tg_lookup(am_ompt_tg_dep_ids[2 * i + 1]) !=
+            AM_OMPT_TASKGRAPH_NONE)
+      h.num_dependences++;
+  }
+
+  if (fwrite(&h, sizeof(h), 1, fp) != 1) goto out_err;
+
+  for (size_t i = 0; i < am_ompt_tg_num_tasks; i++) {
+    t = &am_ompt_tg_tasks[i];
+
+    /* The cost of roots was set when they were linked */
+    if (!(t->t.flags & AM_OMPT_TASKGRAPH_ROOT)) t->t.cost = t->elapsed;
+
+    if (fwrite(&t->t, sizeof(t->t), 1, fp) != 1) goto out_err;
+  }
+
+  for (size_t i = 0; i < am_ompt_tg_num_actions; i++) {
+    if (fwrite(&am_ompt_tg_actions[i].a, sizeof(am_ompt_tg_actions[i].a), 1,
+               fp) != 1)
+      goto out_err;
+  }
+
+  for (size_t i = 0; i < am_ompt_tg_num_deps; i++) {
+    d.src = am_ompt_tg_lookup(am_ompt_tg_dep_ids[2 * i]);
+    d.sink = am_ompt_tg_lookup(am_ompt_tg_dep_ids[2 * i + 1]);
+
+    if (d.src == AM_OMPT_TASKGRAPH_NONE || d.sink == AM_OMPT_TASKGRAPH_NONE)
+      continue;
+
+    if (fwrite(&d, sizeof(d), 1, fp) != 1) goto out_err;
+  }
+
+  if (fclose(fp)) {
+    fprintf(stderr, "Could not write \"%s\".\n", path);
+    return 1;
+  }
+
+  printf("%u tasks, %u actions and %u dependences on %u threads\n",
+         h.num_tasks, h.num_actions, h.num_dependences, h.num_threads);
+
+  return 0;
+
+out_err:
+  fprintf(stderr, "Could not write \"%s\".\n", path);
+  fclose(fp);
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  struct am_ompt_reader* r = &am_ompt_tg_reader;
+  int ret = 2;
+
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s <trace> <output>\n", argv[0]);
+    return 2;
+  }
+
+  if (am_ompt_reader_open(r, argv[1])) return 2;
+
+  if (r->error_offset) {
+    fprintf(stderr, "Trace is malformed at offset %zu: %s\n", r->error_offset,
+            r->error);
+    fprintf(stderr, "Extracting the tasks before the error.\n");
+  }
+
+  if (!(am_ompt_tg_roots = calloc(r->num_collections ? r->num_collections : 1,
+                                  sizeof(*am_ompt_tg_roots)))) {
+    fprintf(stderr, "Could not allocate memory.\n");
+    goto out;
+  }
+
+  for (size_t c = 0; c < r->num_collections; c++)
+    am_ompt_tg_roots[c].task = AM_OMPT_TASKGRAPH_NONE;
+
+  for (size_t c = 0; c < r->num_collections; c++) {
+    if (am_ompt_tg_collect(c)) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      goto out;
+    }
+  }
+
+  if (am_ompt_tg_link()) {
+    fprintf(stderr, "Could not allocate memory.\n");
+    goto out;
+  }
+
+  for (size_t c = 0; c < r->num_collections; c++) {
+    if (am_ompt_tg_execute(c)) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      goto out;
+    }
+  }
+
+  if (!am_ompt_tg_write(argv[2])) ret = 0;
+
+out:
+  free(am_ompt_tg_roots);
+  free(am_ompt_tg_slots);
+  free(am_ompt_tg_dep_ids);
+  free(am_ompt_tg_actions);
+  free(am_ompt_tg_tasks);
+  am_ompt_reader_close(r);
+
+  return ret;
+}
@@ -0,0 +1,189 @@
+/**
+ * Copyright (C) 2018 Andi Drebes <andi@drebesium.org>
+ * Copyright (C) 2019 Igor Wodiany <igor.wodiany@manchester.ac.uk>
+ *
+ * Afterompt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+  Attaches to the telemetry segment of a running application traced with
+  AFTEROMPT_TELEMETRY set and prints the utilisation of each thread in
+  regular intervals.
+
+  Usage: afterompt-top <segment-name> [interval-seconds]
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <aftermath/trace/tsc.h>
+
+#include "telemetry.h"
+
+static const char* am_ompt_top_state_names[AM_OMPT_TELEMETRY_NUM_STATES + 1] =
+    {"idle", "work", "barrier", "task", "lock", "exited"};
+
+/* Time spent in each state by a thread up to a point in time */
+struct am_ompt_top_sample {
+  uint32_t tid;
+  uint32_t state;
+  uint64_t time[AM_OMPT_TELEMETRY_NUM_STATES];
+};
+
+/* Read all used slots, charging the current state up to now */
+static uint32_t am_ompt_top_read(const struct am_ompt_telemetry_header* hdr,
+                                 struct am_ompt_top_sample* samples) {
+  const struct am_ompt_telemetry_slot* slots =
+      (const struct am_ompt_telemetry_slot*)(hdr + 1);
+  uint32_t n = __atomic_load_n(&hdr->used_slots, __ATOMIC_ACQUIRE);
+  uint64_t now = am_timestamp_now() - hdr->tsc_offset;
+
+  if (n > hdr->num_slots) n = hdr->num_slots;
+
+  for (uint32_t i = 0; i < n; i++) {
+    const struct am_ompt_telemetry_slot* slot = &slots[i];
+    uint64_t since = __atomic_load_n(&slot->since, __ATOMIC_RELAXED);
+
+    samples[i].tid = slot->tid;
+    samples[i].state = __atomic_load_n(&slot->state, __ATOMIC_RELAXED);
+
+    for (int s = 0; s < AM_OMPT_TELEMETRY_NUM_STATES; s++)
+      samples[i].time[s] = __atomic_load_n(&slot->time[s], __ATOMIC_RELAXED);
+
+    if (samples[i].state < AM_OMPT_TELEMETRY_NUM_STATES && now > since)
+      samples[i].time[samples[i].state] += now - since;
+  }
+
+  return n;
+}
+
+static void am_ompt_top_print(const char* name, uint32_t n,
+                              const struct am_ompt_top_sample* prev,
+                              uint32_t nprev,
+                              const struct am_ompt_top_sample* curr) {
+  /* Clear screen and move the cursor home */
+  printf("\033[H\033[2J");
+  printf("AfterOMPT telemetry %s - %u threads\n\n", name, n);
+  printf("%4s %10s %-8s", "#", "TID", "STATE");
+
+  for (int s = 0; s < AM_OMPT_TELEMETRY_NUM_STATES; s++)
+    printf(" %7s%%", am_ompt_top_state_names[s]);
+
+  printf("\n");
+
+  for (uint32_t i = 0; i < n; i++) {
+    uint64_t delta[AM_OMPT_TELEMETRY_NUM_STATES];
+    uint64_t total = 0;
+    uint32_t state = curr[i].state;
+
+    if (state > AM_OMPT_TELEMETRY_NUM_STATES)
+      state = AM_OMPT_TELEMETRY_NUM_STATES;
+
+    for (int s = 0; s < AM_OMPT_TELEMETRY_NUM_STATES; s++) {
+      delta[s] = curr[i].time[s] - (i < nprev ? prev[i].time[s] : 0);
+      total += delta[s];
+    }
+
+    printf("%4u %10u %-8s", i, curr[i].tid, am_ompt_top_state_names[state]);
+
+    for (int s = 0; s < AM_OMPT_TELEMETRY_NUM_STATES; s++)
+      printf(" %7.1f%%", total ? 100.0 * delta[s] / total : 0.0);
+
+    printf("\n");
+  }
+
+  fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+  const struct am_ompt_telemetry_header* hdr;
+  struct am_ompt_top_sample *prev, *curr, *tmp;
+  uint32_t nprev = 0, n;
+  double interval = 1.0;
+  struct timespec ts;
+  struct stat st;
+  int fd;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <segment-name> [interval-seconds]\n", argv[0]);
+    return 1;
+  }
+
+  if (argc > 2) sscanf(argv[2], "%lf", &interval);
+
+  if ((fd = shm_open(argv[1], O_RDONLY, 0)) == -1) {
+    fprintf(stderr, "Could not open telemetry segment \"%s\".\n", argv[1]);
+    return 1;
+  }
+
+  if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*hdr)) {
+    fprintf(stderr, "Invalid telemetry segment \"%s\".\n", argv[1]);
+    return 1;
+  }
+
+  if ((hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) ==
+      MAP_FAILED) {
+    fprintf(stderr, "Could not map telemetry segment.\n");
+    return 1;
+  }
+
+  close(fd);
+
+  if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) !=
+          AM_OMPT_TELEMETRY_MAGIC ||
+      hdr->version != AM_OMPT_TELEMETRY_VERSION ||
+      sizeof(*hdr) + hdr->num_slots * sizeof(struct am_ompt_telemetry_slot) >
+          (size_t)st.st_size) {
+    fprintf(stderr, "Segment \"%s\" is not a telemetry segment.\n", argv[1]);
+    return 1;
+  }
+
+  prev = calloc(hdr->num_slots, sizeof(*prev));
+  curr = calloc(hdr->num_slots, sizeof(*curr));
+
+  if (!prev || !curr) {
+    fprintf(stderr, "Could not allocate memory for samples.\n");
+    return 1;
+  }
+
+  ts.tv_sec = (time_t)interval;
+  ts.tv_nsec = (long)((interval - ts.tv_sec) * 1e9);
+
+  nprev = am_ompt_top_read(hdr, prev);
+
+  while (!__atomic_load_n(&hdr->finished, __ATOMIC_ACQUIRE)) {
+    nanosleep(&ts, NULL);
+
+    n = am_ompt_top_read(hdr, curr);
+    am_ompt_top_print(argv[1], n, prev, nprev, curr);
+
+    tmp = prev;
+    prev = curr;
+    curr = tmp;
+    nprev = n;
+  }
+
+  printf("Application finished.\n");
+
+  free(prev);
+  free(curr);
+
+  return 0;
+}